@@ -98,6 +98,9 @@ GUMJS_DECLARE_FUNCTION (gumjs_interceptor_replace)
 static void gum_duk_replace_entry_free (GumDukReplaceEntry * entry);
 GUMJS_DECLARE_FUNCTION (gumjs_interceptor_revert)
 GUMJS_DECLARE_FUNCTION (gumjs_interceptor_flush)
+GUMJS_DECLARE_FUNCTION (gumjs_interceptor_set_profiling_enabled)
+GUMJS_DECLARE_FUNCTION (gumjs_interceptor_get_stats)
+GUMJS_DECLARE_FUNCTION (gumjs_interceptor_reset_stats)
 
 GUMJS_DECLARE_CONSTRUCTOR (gumjs_invocation_listener_construct)
 GUMJS_DECLARE_FUNCTION (gumjs_invocation_listener_detach)
@@ -171,6 +174,9 @@ static const duk_function_list_entry gumjs_interceptor_functions[] =
   { "_replace", gumjs_interceptor_replace, 2 },
   { "revert", gumjs_interceptor_revert, 1 },
   { "flush", gumjs_interceptor_flush, 0 },
+  { "setProfilingEnabled", gumjs_interceptor_set_profiling_enabled, 1 },
+  { "getStats", gumjs_interceptor_get_stats, 0 },
+  { "resetStats", gumjs_interceptor_reset_stats, 0 },
 
   { NULL, NULL, 0 }
 };
@@ -464,6 +470,11 @@ unable_to_attach:
         _gum_duk_throw (ctx, "already attached to this function");
       case GUM_ATTACH_POLICY_VIOLATION:
         _gum_duk_throw (ctx, "not permitted by code-signing policy");
+      case GUM_ATTACH_WRONG_TYPE:
+        _gum_duk_throw (ctx, "already replaced using the fast path");
+      case GUM_ATTACH_BUSY:
+        _gum_duk_throw (ctx,
+            "another thread is executing the function's prologue");
       default:
         g_assert_not_reached ();
     }
@@ -546,6 +557,9 @@ unable_to_replace:
         _gum_duk_throw (ctx, "already replaced this function");
       case GUM_REPLACE_POLICY_VIOLATION:
         _gum_duk_throw (ctx, "not permitted by code-signing policy");
+      case GUM_REPLACE_BUSY:
+        _gum_duk_throw (ctx,
+            "another thread is executing the function's prologue");
       default:
         g_assert_not_reached ();
     }
@@ -596,6 +610,77 @@ GUMJS_DEFINE_FUNCTION (gumjs_interceptor_flush)
   return 0;
 }
 
+GUMJS_DEFINE_FUNCTION (gumjs_interceptor_set_profiling_enabled)
+{
+  GumDukInterceptor * self;
+  gboolean enabled;
+
+  (void) ctx;
+
+  self = gumjs_module_from_args (args);
+
+  _gum_duk_args_parse (args, "t", &enabled);
+
+  gum_interceptor_set_profiling_enabled (self->interceptor, enabled);
+
+  return 0;
+}
+
+GUMJS_DEFINE_FUNCTION (gumjs_interceptor_get_stats)
+{
+  GumDukInterceptor * self;
+  GArray * stats;
+  guint i;
+
+  self = gumjs_module_from_args (args);
+
+  stats = gum_interceptor_get_stats (self->interceptor);
+
+  duk_push_array (ctx);
+
+  for (i = 0; i != stats->len; i++)
+  {
+    GumInterceptorHookStats * s =
+        &g_array_index (stats, GumInterceptorHookStats, i);
+
+    duk_push_object (ctx);
+
+    _gum_duk_push_native_pointer (ctx, s->function_address, args->core);
+    duk_put_prop_string (ctx, -2, "target");
+
+    duk_push_number (ctx, (double) s->invocations);
+    duk_put_prop_string (ctx, -2, "invocations");
+
+    duk_push_number (ctx, (double) s->bypassed_invocations);
+    duk_put_prop_string (ctx, -2, "bypassedInvocations");
+
+    duk_push_number (ctx, (double) s->listener_ticks);
+    duk_put_prop_string (ctx, -2, "listenerTicks");
+
+    duk_push_number (ctx, (double) s->trampoline_ticks);
+    duk_put_prop_string (ctx, -2, "trampolineTicks");
+
+    duk_put_prop_index (ctx, -2, i);
+  }
+
+  g_array_free (stats, TRUE);
+
+  return 1;
+}
+
+GUMJS_DEFINE_FUNCTION (gumjs_interceptor_reset_stats)
+{
+  GumDukInterceptor * self;
+
+  (void) ctx;
+
+  self = gumjs_module_from_args (args);
+
+  gum_interceptor_reset_stats (self->interceptor);
+
+  return 0;
+}
+
 GUMJS_DEFINE_CONSTRUCTOR (gumjs_invocation_listener_construct)
 {
   (void) ctx;
@@ -51,9 +51,10 @@ struct _GumMemoryPatchContext
 
 struct _GumMemoryScanContext
 {
-  GumMemoryRange range;
+  GArray * ranges;
   GumMatchPattern * pattern;
   GumDukHeapPtr on_match;
+  GumDukHeapPtr on_progress;
   GumDukHeapPtr on_error;
   GumDukHeapPtr on_complete;
 
@@ -128,10 +129,17 @@ GUMJS_DECLARE_FUNCTION (gumjs_memory_alloc_utf8_string)
 GUMJS_DECLARE_FUNCTION (gumjs_memory_alloc_utf16_string)
 
 GUMJS_DECLARE_FUNCTION (gumjs_memory_scan)
+GUMJS_DECLARE_FUNCTION (gumjs_memory_scan_ranges)
+static GArray * gum_duk_parse_ranges (duk_context * ctx, GumDukHeapPtr array,
+    GumDukCore * core);
+static void gum_memory_scan_context_schedule (GumMemoryScanContext * sc,
+    duk_context * ctx);
 static void gum_memory_scan_context_free (GumMemoryScanContext * ctx);
 static void gum_memory_scan_context_run (GumMemoryScanContext * self);
 static gboolean gum_memory_scan_context_emit_match (GumAddress address,
     gsize size, GumMemoryScanContext * self);
+static void gum_memory_scan_context_emit_progress (gsize bytes_scanned,
+    gsize bytes_total, GumMemoryScanContext * self);
 GUMJS_DECLARE_FUNCTION (gumjs_memory_scan_sync)
 static gboolean gum_append_match (GumAddress address, gsize size,
     GumDukCore * core);
@@ -175,6 +183,7 @@ static const duk_function_list_entry gumjs_memory_functions[] =
   { "allocUtf16String", gumjs_memory_alloc_utf16_string, 1 },
 
   { "scan", gumjs_memory_scan, 4 },
+  { "scanRanges", gumjs_memory_scan_ranges, 3 },
   { "scanSync", gumjs_memory_scan_sync, 3 },
 
   { NULL, NULL, 0 }
@@ -827,35 +836,127 @@ GUMJS_DEFINE_FUNCTION (gumjs_memory_alloc_utf16_string)
 
 GUMJS_DEFINE_FUNCTION (gumjs_memory_scan)
 {
-  GumDukCore * core = args->core;
   GumMemoryScanContext sc;
   gpointer address;
   gsize size;
   const gchar * match_str;
+  GumMemoryRange range;
 
   _gum_duk_args_parse (args, "pZsF{onMatch,onError?,onComplete}",
       &address, &size, &match_str, &sc.on_match, &sc.on_error, &sc.on_complete);
 
-  sc.range.base_address = GUM_ADDRESS (address);
-  sc.range.size = size;
   sc.pattern = gum_match_pattern_new_from_string (match_str);
-  sc.core = core;
+  if (sc.pattern == NULL)
+    _gum_duk_throw (ctx, "invalid match pattern");
+
+  range.base_address = GUM_ADDRESS (address);
+  range.size = size;
+
+  sc.ranges = g_array_sized_new (FALSE, FALSE, sizeof (GumMemoryRange), 1);
+  g_array_append_val (sc.ranges, range);
+  sc.on_progress = NULL;
+  sc.core = args->core;
+
+  gum_memory_scan_context_schedule (&sc, ctx);
+
+  return 0;
+}
+
+GUMJS_DEFINE_FUNCTION (gumjs_memory_scan_ranges)
+{
+  GumMemoryScanContext sc;
+  GumDukHeapPtr ranges;
+  const gchar * match_str;
+
+  _gum_duk_args_parse (args, "AsF{onMatch,onProgress?,onError?,onComplete}",
+      &ranges, &match_str, &sc.on_match, &sc.on_progress, &sc.on_error,
+      &sc.on_complete);
 
+  sc.ranges = gum_duk_parse_ranges (ctx, ranges, args->core);
+  if (sc.ranges == NULL)
+    _gum_duk_throw (ctx, "expected an array of ranges");
+
+  sc.pattern = gum_match_pattern_new_from_string (match_str);
   if (sc.pattern == NULL)
+  {
+    g_array_free (sc.ranges, TRUE);
     _gum_duk_throw (ctx, "invalid match pattern");
+  }
+
+  sc.core = args->core;
+
+  gum_memory_scan_context_schedule (&sc, ctx);
+
+  return 0;
+}
+
+static GArray *
+gum_duk_parse_ranges (duk_context * ctx,
+                      GumDukHeapPtr array,
+                      GumDukCore * core)
+{
+  GArray * ranges;
+  duk_size_t n, i;
+
+  duk_push_heapptr (ctx, array);
+  n = duk_get_length (ctx, -1);
+
+  ranges = g_array_sized_new (FALSE, FALSE, sizeof (GumMemoryRange), n);
+
+  for (i = 0; i != n; i++)
+  {
+    GumMemoryRange range;
+    gpointer base;
+    gsize size;
+    gboolean valid;
+
+    duk_get_prop_index (ctx, -1, (duk_uarridx_t) i);
+
+    duk_get_prop_string (ctx, -1, "base");
+    valid = _gum_duk_get_pointer (ctx, -1, core, &base);
+    duk_pop (ctx);
 
-  _gum_duk_protect (ctx, sc.on_match);
-  if (sc.on_error != NULL)
-    _gum_duk_protect (ctx, sc.on_error);
-  _gum_duk_protect (ctx, sc.on_complete);
+    duk_get_prop_string (ctx, -1, "size");
+    valid = valid && _gum_duk_get_size (ctx, -1, core, &size);
+    duk_pop (ctx);
+
+    duk_pop (ctx);
+
+    if (!valid)
+    {
+      duk_pop (ctx);
+      g_array_free (ranges, TRUE);
+      return NULL;
+    }
+
+    range.base_address = GUM_ADDRESS (base);
+    range.size = size;
+    g_array_append_val (ranges, range);
+  }
+
+  duk_pop (ctx);
+
+  return ranges;
+}
+
+static void
+gum_memory_scan_context_schedule (GumMemoryScanContext * sc,
+                                  duk_context * ctx)
+{
+  GumDukCore * core = sc->core;
+
+  _gum_duk_protect (ctx, sc->on_match);
+  if (sc->on_progress != NULL)
+    _gum_duk_protect (ctx, sc->on_progress);
+  if (sc->on_error != NULL)
+    _gum_duk_protect (ctx, sc->on_error);
+  _gum_duk_protect (ctx, sc->on_complete);
 
   _gum_duk_core_pin (core);
   _gum_duk_core_push_job (core,
       (GumScriptJobFunc) gum_memory_scan_context_run,
-      g_slice_dup (GumMemoryScanContext, &sc),
+      g_slice_dup (GumMemoryScanContext, sc),
       (GDestroyNotify) gum_memory_scan_context_free);
-
-  return 0;
 }
 
 static void
@@ -868,6 +969,8 @@ gum_memory_scan_context_free (GumMemoryScanContext * self)
   ctx = _gum_duk_scope_enter (&scope, core);
 
   _gum_duk_unprotect (ctx, self->on_match);
+  if (self->on_progress != NULL)
+    _gum_duk_unprotect (ctx, self->on_progress);
   if (self->on_error != NULL)
     _gum_duk_unprotect (ctx, self->on_error);
   _gum_duk_unprotect (ctx, self->on_complete);
@@ -876,6 +979,7 @@ gum_memory_scan_context_free (GumMemoryScanContext * self)
   _gum_duk_scope_leave (&scope);
 
   gum_match_pattern_free (self->pattern);
+  g_array_free (self->ranges, TRUE);
 
   g_slice_free (GumMemoryScanContext, self);
 }
@@ -884,35 +988,28 @@ static void
 gum_memory_scan_context_run (GumMemoryScanContext * self)
 {
   GumDukCore * core = self->core;
-  GumExceptor * exceptor = core->exceptor;
-  GumExceptorScope exceptor_scope;
   GumDukScope script_scope;
   duk_context * ctx;
+  GError * error = NULL;
 
-  if (gum_exceptor_try (exceptor, &exceptor_scope))
-  {
-    gum_memory_scan (&self->range, self->pattern,
-        (GumMemoryScanMatchFunc) gum_memory_scan_context_emit_match, self);
-  }
+  gum_memory_scan_ranges ((const GumMemoryRange *) self->ranges->data,
+      self->ranges->len, self->pattern,
+      (GumMemoryScanMatchFunc) gum_memory_scan_context_emit_match,
+      (self->on_progress != NULL)
+          ? (GumMemoryScanProgressFunc) gum_memory_scan_context_emit_progress
+          : NULL,
+      self, &error);
 
   ctx = _gum_duk_scope_enter (&script_scope, core);
 
-  if (gum_exceptor_catch (exceptor, &exceptor_scope))
+  if (error != NULL && self->on_error != NULL)
   {
-    if (self->on_error != NULL)
-    {
-      gchar * message;
-
-      duk_push_heapptr (ctx, self->on_error);
-
-      message = gum_exception_details_to_string (&exceptor_scope.exception);
-      duk_push_string (ctx, message);
-      g_free (message);
-
-      _gum_duk_scope_call (&script_scope, 1);
-      duk_pop (ctx);
-    }
+    duk_push_heapptr (ctx, self->on_error);
+    duk_push_string (ctx, error->message);
+    _gum_duk_scope_call (&script_scope, 1);
+    duk_pop (ctx);
   }
+  g_clear_error (&error);
 
   duk_push_heapptr (ctx, self->on_complete);
   _gum_duk_scope_call (&script_scope, 0);
@@ -952,6 +1049,25 @@ gum_memory_scan_context_emit_match (GumAddress address,
   return proceed;
 }
 
+static void
+gum_memory_scan_context_emit_progress (gsize bytes_scanned,
+                                       gsize bytes_total,
+                                       GumMemoryScanContext * self)
+{
+  GumDukScope scope;
+  duk_context * ctx;
+
+  ctx = _gum_duk_scope_enter (&scope, self->core);
+
+  duk_push_heapptr (ctx, self->on_progress);
+  duk_push_number (ctx, (double) bytes_scanned);
+  duk_push_number (ctx, (double) bytes_total);
+  _gum_duk_scope_call (&scope, 2);
+  duk_pop (ctx);
+
+  _gum_duk_scope_leave (&scope);
+}
+
 GUMJS_DEFINE_FUNCTION (gumjs_memory_scan_sync)
 {
   GumDukCore * core = args->core;
@@ -89,6 +89,9 @@ GUMJS_DECLARE_FUNCTION (gumjs_interceptor_replace)
 static void gum_v8_replace_entry_free (GumV8ReplaceEntry * entry);
 GUMJS_DECLARE_FUNCTION (gumjs_interceptor_revert)
 GUMJS_DECLARE_FUNCTION (gumjs_interceptor_flush)
+GUMJS_DECLARE_FUNCTION (gumjs_interceptor_set_profiling_enabled)
+GUMJS_DECLARE_FUNCTION (gumjs_interceptor_get_stats)
+GUMJS_DECLARE_FUNCTION (gumjs_interceptor_reset_stats)
 
 GUMJS_DECLARE_FUNCTION (gumjs_invocation_listener_detach)
 
@@ -170,6 +173,9 @@ static const GumV8Function gumjs_interceptor_functions[] =
   { "_replace", gumjs_interceptor_replace },
   { "revert", gumjs_interceptor_revert },
   { "flush", gumjs_interceptor_flush },
+  { "setProfilingEnabled", gumjs_interceptor_set_profiling_enabled },
+  { "getStats", gumjs_interceptor_get_stats },
+  { "resetStats", gumjs_interceptor_reset_stats },
 
   { NULL, NULL }
 };
@@ -533,6 +539,14 @@ GUMJS_DEFINE_FUNCTION (gumjs_interceptor_attach)
       _gum_v8_throw_ascii_literal (isolate,
           "not permitted by code-signing policy");
       break;
+    case GUM_ATTACH_WRONG_TYPE:
+      _gum_v8_throw_ascii_literal (isolate,
+          "already replaced using the fast path");
+      break;
+    case GUM_ATTACH_BUSY:
+      _gum_v8_throw_ascii_literal (isolate,
+          "another thread is executing the function's prologue");
+      break;
     default:
       g_assert_not_reached ();
   }
@@ -621,6 +635,10 @@ GUMJS_DEFINE_FUNCTION (gumjs_interceptor_replace)
       _gum_v8_throw_ascii_literal (isolate,
           "not permitted by code-signing policy");
       break;
+    case GUM_REPLACE_BUSY:
+      _gum_v8_throw_ascii_literal (isolate,
+          "another thread is executing the function's prologue");
+      break;
     default:
       g_assert_not_reached ();
   }
@@ -673,6 +691,78 @@ GUMJS_DEFINE_FUNCTION (gumjs_interceptor_flush)
   gum_interceptor_begin_transaction (interceptor);
 }
 
+/*
+ * Prototype:
+ * Interceptor.setProfilingEnabled(enabled)
+ *
+ * Docs:
+ * Turns per-hook cost accounting on or off
+ *
+ * Example:
+ * TBW
+ */
+GUMJS_DEFINE_FUNCTION (gumjs_interceptor_set_profiling_enabled)
+{
+  gboolean enabled;
+  if (!_gum_v8_args_parse (args, "t", &enabled))
+    return;
+
+  gum_interceptor_set_profiling_enabled (module->interceptor, enabled);
+}
+
+/*
+ * Prototype:
+ * Interceptor.getStats()
+ *
+ * Docs:
+ * Returns an array of { target, invocations, bypassedInvocations,
+ * listenerTicks, trampolineTicks }, most expensive hook first
+ *
+ * Example:
+ * TBW
+ */
+GUMJS_DEFINE_FUNCTION (gumjs_interceptor_get_stats)
+{
+  auto stats = gum_interceptor_get_stats (module->interceptor);
+
+  auto result = Array::New (isolate, stats->len);
+  for (guint i = 0; i != stats->len; i++)
+  {
+    auto s = &g_array_index (stats, GumInterceptorHookStats, i);
+
+    auto entry = Object::New (isolate);
+    _gum_v8_object_set_pointer (entry, "target", s->function_address, core);
+    _gum_v8_object_set (entry, "invocations",
+        Number::New (isolate, (double) s->invocations), core);
+    _gum_v8_object_set (entry, "bypassedInvocations",
+        Number::New (isolate, (double) s->bypassed_invocations), core);
+    _gum_v8_object_set (entry, "listenerTicks",
+        Number::New (isolate, (double) s->listener_ticks), core);
+    _gum_v8_object_set (entry, "trampolineTicks",
+        Number::New (isolate, (double) s->trampoline_ticks), core);
+    result->Set (i, entry);
+  }
+
+  g_array_free (stats, TRUE);
+
+  info.GetReturnValue ().Set (result);
+}
+
+/*
+ * Prototype:
+ * Interceptor.resetStats()
+ *
+ * Docs:
+ * TBW
+ *
+ * Example:
+ * TBW
+ */
+GUMJS_DEFINE_FUNCTION (gumjs_interceptor_reset_stats)
+{
+  gum_interceptor_reset_stats (module->interceptor);
+}
+
 /*
  * Prototype:
  * InvocationListener.detach()
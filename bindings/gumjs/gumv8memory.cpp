@@ -54,9 +54,10 @@ struct GumMemoryPatchContext
 
 struct GumMemoryScanContext
 {
-  GumMemoryRange range;
+  GArray * ranges;
   GumMatchPattern * pattern;
   GumPersistent<Function>::type * on_match;
+  GumPersistent<Function>::type * on_progress;
   GumPersistent<Function>::type * on_error;
   GumPersistent<Function>::type * on_complete;
 
@@ -133,10 +134,17 @@ GUMJS_DECLARE_FUNCTION (gumjs_memory_alloc_utf8_string)
 GUMJS_DECLARE_FUNCTION (gumjs_memory_alloc_utf16_string)
 
 GUMJS_DECLARE_FUNCTION (gumjs_memory_scan)
+GUMJS_DECLARE_FUNCTION (gumjs_memory_scan_ranges)
+static void gum_memory_scan_context_schedule (GArray * ranges,
+    const gchar * match_str, Local<Function> on_match,
+    Local<Function> on_progress, Local<Function> on_error,
+    Local<Function> on_complete, GumV8Core * core);
 static void gum_memory_scan_context_free (GumMemoryScanContext * self);
 static void gum_memory_scan_context_run (GumMemoryScanContext * self);
 static gboolean gum_memory_scan_context_emit_match (GumAddress address,
     gsize size, GumMemoryScanContext * self);
+static void gum_memory_scan_context_emit_progress (gsize bytes_scanned,
+    gsize bytes_total, GumMemoryScanContext * self);
 GUMJS_DECLARE_FUNCTION (gumjs_memory_scan_sync)
 static gboolean gum_append_match (GumAddress address, gsize size,
     GumMemoryScanSyncContext * ctx);
@@ -184,6 +192,7 @@ static const GumV8Function gumjs_memory_functions[] =
   { "allocUtf16String", gumjs_memory_alloc_utf16_string },
 
   { "scan", gumjs_memory_scan },
+  { "scanRanges", gumjs_memory_scan_ranges },
   { "scanSync", gumjs_memory_scan_sync },
 
   { NULL, NULL }
@@ -920,29 +929,74 @@ GUMJS_DEFINE_FUNCTION (gumjs_memory_scan)
   range.base_address = GUM_ADDRESS (address);
   range.size = size;
 
-  auto pattern = gum_match_pattern_new_from_string (match_str);
+  auto ranges = g_array_sized_new (FALSE, FALSE, sizeof (GumMemoryRange), 1);
+  g_array_append_val (ranges, range);
+
+  gum_memory_scan_context_schedule (ranges, match_str, on_match,
+      Local<Function> (), on_error, on_complete, core);
 
   g_free (match_str);
+}
 
-  if (pattern != NULL)
-  {
-    auto ctx = g_slice_new0 (GumMemoryScanContext);
-    ctx->range = range;
-    ctx->pattern = pattern;
-    ctx->on_match = new GumPersistent<Function>::type (isolate, on_match);
-    if (!on_error.IsEmpty ())
-      ctx->on_error = new GumPersistent<Function>::type (isolate, on_error);
-    ctx->on_complete = new GumPersistent<Function>::type (isolate, on_complete);
-    ctx->core = core;
-
-    _gum_v8_core_pin (core);
-    _gum_v8_core_push_job (core, (GumScriptJobFunc) gum_memory_scan_context_run,
-        ctx, (GDestroyNotify) gum_memory_scan_context_free);
-  }
-  else
+/*
+ * Prototype:
+ * Memory.scanRanges(ranges, match_str, callback)
+ *
+ * Docs:
+ * Scans several memory regions in parallel, reporting matches in address
+ * order
+ *
+ * Example:
+ * TBW
+ */
+GUMJS_DEFINE_FUNCTION (gumjs_memory_scan_ranges)
+{
+  GArray * ranges;
+  gchar * match_str;
+  Local<Function> on_match, on_progress, on_error, on_complete;
+  if (!_gum_v8_args_parse (args, "RsF{onMatch,onProgress?,onError?,onComplete}",
+      &ranges, &match_str, &on_match, &on_progress, &on_error, &on_complete))
+    return;
+
+  gum_memory_scan_context_schedule (ranges, match_str, on_match, on_progress,
+      on_error, on_complete, core);
+
+  g_free (match_str);
+}
+
+static void
+gum_memory_scan_context_schedule (GArray * ranges,
+                                  const gchar * match_str,
+                                  Local<Function> on_match,
+                                  Local<Function> on_progress,
+                                  Local<Function> on_error,
+                                  Local<Function> on_complete,
+                                  GumV8Core * core)
+{
+  auto isolate = core->isolate;
+
+  auto pattern = gum_match_pattern_new_from_string (match_str);
+  if (pattern == NULL)
   {
+    g_array_free (ranges, TRUE);
     _gum_v8_throw_ascii_literal (isolate, "invalid match pattern");
+    return;
   }
+
+  auto ctx = g_slice_new0 (GumMemoryScanContext);
+  ctx->ranges = ranges;
+  ctx->pattern = pattern;
+  ctx->on_match = new GumPersistent<Function>::type (isolate, on_match);
+  if (!on_progress.IsEmpty ())
+    ctx->on_progress = new GumPersistent<Function>::type (isolate, on_progress);
+  if (!on_error.IsEmpty ())
+    ctx->on_error = new GumPersistent<Function>::type (isolate, on_error);
+  ctx->on_complete = new GumPersistent<Function>::type (isolate, on_complete);
+  ctx->core = core;
+
+  _gum_v8_core_pin (core);
+  _gum_v8_core_push_job (core, (GumScriptJobFunc) gum_memory_scan_context_run,
+      ctx, (GDestroyNotify) gum_memory_scan_context_free);
 }
 
 static void
@@ -951,11 +1005,13 @@ gum_memory_scan_context_free (GumMemoryScanContext * self)
   auto core = self->core;
 
   gum_match_pattern_free (self->pattern);
+  g_array_free (self->ranges, TRUE);
 
   {
     ScriptScope script_scope (core->script);
 
     delete self->on_match;
+    delete self->on_progress;
     delete self->on_error;
     delete self->on_complete;
 
@@ -965,37 +1021,30 @@ gum_memory_scan_context_free (GumMemoryScanContext * self)
   g_slice_free (GumMemoryScanContext, self);
 }
 
-#ifdef _MSC_VER
-# pragma warning (push)
-# pragma warning (disable: 4611)
-#endif
-
 static void
 gum_memory_scan_context_run (GumMemoryScanContext * self)
 {
   auto core = self->core;
-  auto exceptor = core->exceptor;
   auto isolate = core->isolate;
-  GumExceptorScope scope;
+  GError * error = NULL;
 
-  if (gum_exceptor_try (exceptor, &scope))
-  {
-    gum_memory_scan (&self->range, self->pattern,
-        (GumMemoryScanMatchFunc) gum_memory_scan_context_emit_match, self);
-  }
+  gum_memory_scan_ranges ((const GumMemoryRange *) self->ranges->data,
+      self->ranges->len, self->pattern,
+      (GumMemoryScanMatchFunc) gum_memory_scan_context_emit_match,
+      (self->on_progress != nullptr)
+          ? (GumMemoryScanProgressFunc) gum_memory_scan_context_emit_progress
+          : NULL,
+      self, &error);
 
-  if (gum_exceptor_catch (exceptor, &scope) && self->on_error != nullptr)
+  if (error != NULL && self->on_error != nullptr)
   {
     ScriptScope script_scope (core->script);
 
-    auto message = gum_exception_details_to_string (&scope.exception);
-
     auto on_error = Local<Function>::New (isolate, *self->on_error);
-    Handle<Value> argv[] = { String::NewFromUtf8 (isolate, message) };
+    Handle<Value> argv[] = { String::NewFromUtf8 (isolate, error->message) };
     on_error->Call (Undefined (isolate), G_N_ELEMENTS (argv), argv);
-
-    g_free (message);
   }
+  g_clear_error (&error);
 
   {
     ScriptScope script_scope (core->script);
@@ -1030,6 +1079,27 @@ gum_memory_scan_context_emit_match (GumAddress address,
   return proceed;
 }
 
+static void
+gum_memory_scan_context_emit_progress (gsize bytes_scanned,
+                                       gsize bytes_total,
+                                       GumMemoryScanContext * self)
+{
+  ScriptScope scope (self->core->script);
+  auto isolate = self->core->isolate;
+
+  auto on_progress = Local<Function>::New (isolate, *self->on_progress);
+  Handle<Value> argv[] = {
+    Number::New (isolate, (double) bytes_scanned),
+    Number::New (isolate, (double) bytes_total)
+  };
+  on_progress->Call (Undefined (isolate), G_N_ELEMENTS (argv), argv);
+}
+
+#ifdef _MSC_VER
+# pragma warning (push)
+# pragma warning (disable: 4611)
+#endif
+
 /*
  * Prototype:
  * Memory.scanSync(address, size, match_str)
@@ -97,6 +97,8 @@ gum_arm_backtracer_generate (GumBacktracer * backtracer,
   guint skips_pending, i;
   gsize * p;
 
+  gum_memory_map_update_if_stale (priv->code);
+
   invocation_stack = gum_interceptor_get_current_stack ();
 
   if (cpu_context != NULL)
@@ -103,6 +103,8 @@ gum_x86_backtracer_generate (GumBacktracer * backtracer,
   guint i;
   gsize * p;
 
+  gum_memory_map_update_if_stale (priv->code);
+
   invocation_stack = gum_interceptor_get_current_stack ();
 
   if (cpu_context != NULL)
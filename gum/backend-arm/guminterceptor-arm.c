@@ -176,6 +176,9 @@ _gum_interceptor_backend_create_trampoline (GumInterceptorBackend * self,
   function_address = _gum_interceptor_backend_get_function_address (ctx);
   is_thumb = FUNCTION_CONTEXT_ADDRESS_IS_THUMB (ctx);
 
+  /* No direct replacement path yet, use regular dispatch instead. */
+  ctx->fast_replacement = FALSE;
+
   if (!gum_interceptor_backend_prepare_trampoline (self, ctx))
     return FALSE;
 
@@ -503,6 +506,38 @@ _gum_interceptor_backend_get_function_address (GumFunctionContext * ctx)
       GPOINTER_TO_SIZE (ctx->function_address) & ~((gsize) 1));
 }
 
+gboolean
+_gum_interceptor_backend_get_unsafe_range (GumFunctionContext * ctx,
+                                           GumMemoryRange * range)
+{
+  GumArmFunctionContextData * data = (GumArmFunctionContextData *)
+      &ctx->backend_data;
+  guint first_insn_size;
+
+  if (FUNCTION_CONTEXT_ADDRESS_IS_THUMB (ctx))
+  {
+    guint16 first_halfword;
+
+    memcpy (&first_halfword, ctx->overwritten_prologue,
+        sizeof (first_halfword));
+    first_insn_size = ((first_halfword & 0xe000) == 0xe000 &&
+        (first_halfword & 0x1800) != 0) ? 4 : 2;
+  }
+  else
+  {
+    first_insn_size = 4;
+  }
+
+  if (data->redirect_code_size <= first_insn_size)
+    return FALSE;
+
+  range->base_address = GUM_ADDRESS (
+      _gum_interceptor_backend_get_function_address (ctx)) + first_insn_size;
+  range->size = data->redirect_code_size - first_insn_size;
+
+  return TRUE;
+}
+
 gpointer
 _gum_interceptor_backend_resolve_redirect (GumInterceptorBackend * self,
                                            gpointer address)
@@ -43,6 +43,11 @@ struct _GumArm64FunctionContextData
 G_STATIC_ASSERT (sizeof (GumArm64FunctionContextData)
     <= sizeof (GumFunctionContextBackendData));
 
+static gboolean gum_interceptor_backend_try_alloc_near_slice (
+    GumInterceptorBackend * self, GumFunctionContext * ctx);
+static void gum_interceptor_backend_write_redirect (guint8 * prologue,
+    const guint8 * code, guint size);
+
 static void gum_interceptor_backend_create_thunks (
     GumInterceptorBackend * self);
 static void gum_interceptor_backend_destroy_thunks (
@@ -89,12 +94,24 @@ gum_interceptor_backend_prepare_trampoline (GumInterceptorBackend * self,
   GumArm64FunctionContextData * data = (GumArm64FunctionContextData *)
       &ctx->backend_data;
   gpointer function_address = ctx->function_address;
+  gboolean can_relocate_fully;
   guint redirect_limit;
 
   *need_deflector = FALSE;
 
-  if (gum_arm64_relocator_can_relocate (function_address, 16,
-      GUM_SCENARIO_ONLINE, &redirect_limit, &data->scratch_reg))
+  can_relocate_fully = gum_arm64_relocator_can_relocate (function_address, 16,
+      GUM_SCENARIO_ONLINE, &redirect_limit, &data->scratch_reg);
+
+  /*
+   * A single B can be swapped in atomically, so we prefer it whenever there
+   * is a slice within reach.
+   */
+  if ((can_relocate_fully || redirect_limit >= 8) &&
+      gum_interceptor_backend_try_alloc_near_slice (self, ctx))
+  {
+    data->redirect_code_size = 4;
+  }
+  else if (can_relocate_fully)
   {
     data->redirect_code_size = 16;
 
@@ -143,6 +160,21 @@ gum_interceptor_backend_prepare_trampoline (GumInterceptorBackend * self,
   return TRUE;
 }
 
+static gboolean
+gum_interceptor_backend_try_alloc_near_slice (GumInterceptorBackend * self,
+                                              GumFunctionContext * ctx)
+{
+  GumAddressSpec spec;
+
+  spec.near_address = ctx->function_address;
+  spec.max_distance = GUM_ARM64_B_MAX_DISTANCE;
+
+  ctx->trampoline_slice = gum_code_allocator_try_alloc_slice_near (
+      self->allocator, &spec, 0);
+
+  return ctx->trampoline_slice != NULL;
+}
+
 gboolean
 _gum_interceptor_backend_create_trampoline (GumInterceptorBackend * self,
                                             GumFunctionContext * ctx)
@@ -189,17 +221,30 @@ _gum_interceptor_backend_create_trampoline (GumInterceptorBackend * self,
     gum_arm64_writer_put_pop_reg_reg (aw, ARM64_REG_X0, ARM64_REG_LR);
   }
 
-  gum_arm64_writer_put_ldr_reg_address (aw, ARM64_REG_X17, GUM_ADDRESS (ctx));
-  gum_arm64_writer_put_ldr_reg_address (aw, ARM64_REG_X16,
-      GUM_ADDRESS (self->enter_thunk->data));
-  gum_arm64_writer_put_br_reg (aw, ARM64_REG_X16);
-
-  ctx->on_leave_trampoline = gum_arm64_writer_cur (aw);
+  if (ctx->fast_replacement)
+  {
+    gum_arm64_writer_put_ldr_reg_address (aw, ARM64_REG_X16,
+        GUM_ADDRESS (ctx->replacement_function));
+    gum_arm64_writer_put_br_reg (aw, ARM64_REG_X16);
 
-  gum_arm64_writer_put_ldr_reg_address (aw, ARM64_REG_X17, GUM_ADDRESS (ctx));
-  gum_arm64_writer_put_ldr_reg_address (aw, ARM64_REG_X16,
-      GUM_ADDRESS (self->leave_thunk->data));
-  gum_arm64_writer_put_br_reg (aw, ARM64_REG_X16);
+    ctx->on_leave_trampoline = NULL;
+  }
+  else
+  {
+    gum_arm64_writer_put_ldr_reg_address (aw, ARM64_REG_X17,
+        GUM_ADDRESS (ctx));
+    gum_arm64_writer_put_ldr_reg_address (aw, ARM64_REG_X16,
+        GUM_ADDRESS (self->enter_thunk->data));
+    gum_arm64_writer_put_br_reg (aw, ARM64_REG_X16);
+
+    ctx->on_leave_trampoline = gum_arm64_writer_cur (aw);
+
+    gum_arm64_writer_put_ldr_reg_address (aw, ARM64_REG_X17,
+        GUM_ADDRESS (ctx));
+    gum_arm64_writer_put_ldr_reg_address (aw, ARM64_REG_X16,
+        GUM_ADDRESS (self->leave_thunk->data));
+    gum_arm64_writer_put_br_reg (aw, ARM64_REG_X16);
+  }
 
   gum_arm64_writer_flush (aw);
   g_assert_cmpuint (gum_arm64_writer_offset (aw),
@@ -318,8 +363,9 @@ _gum_interceptor_backend_activate_trampoline (GumInterceptorBackend * self,
   GumArm64FunctionContextData * data = (GumArm64FunctionContextData *)
       &ctx->backend_data;
   GumAddress on_enter = GUM_ADDRESS (ctx->on_enter_trampoline);
+  guint32 code[4];
 
-  gum_arm64_writer_reset (aw, prologue);
+  gum_arm64_writer_reset (aw, code);
   aw->pc = GUM_ADDRESS (ctx->function_address);
 
   if (ctx->trampoline_deflector != NULL)
@@ -359,6 +405,9 @@ _gum_interceptor_backend_activate_trampoline (GumInterceptorBackend * self,
 
   gum_arm64_writer_flush (aw);
   g_assert_cmpuint (gum_arm64_writer_offset (aw), <=, data->redirect_code_size);
+
+  gum_interceptor_backend_write_redirect (prologue, (guint8 *) code,
+      gum_arm64_writer_offset (aw));
 }
 
 void
@@ -368,7 +417,38 @@ _gum_interceptor_backend_deactivate_trampoline (GumInterceptorBackend * self,
 {
   (void) self;
 
-  memcpy (prologue, ctx->overwritten_prologue, ctx->overwritten_prologue_len);
+  gum_interceptor_backend_write_redirect (prologue, ctx->overwritten_prologue,
+      ctx->overwritten_prologue_len);
+}
+
+/*
+ * Redirects of one instruction, or of two on an 8-byte boundary, are swapped
+ * in with a single store so that a thread entering the function sees either
+ * the old or the new code in its entirety.
+ */
+static void
+gum_interceptor_backend_write_redirect (guint8 * prologue,
+                                        const guint8 * code,
+                                        guint size)
+{
+  if (size == 4)
+  {
+    guint32 value;
+
+    memcpy (&value, code, sizeof (value));
+    *((volatile guint32 *) prologue) = value;
+  }
+  else if (size == 8 && (GPOINTER_TO_SIZE (prologue) & 7) == 0)
+  {
+    guint64 value;
+
+    memcpy (&value, code, sizeof (value));
+    *((volatile guint64 *) prologue) = value;
+  }
+  else
+  {
+    memcpy (prologue, code, size);
+  }
 }
 
 gpointer
@@ -377,6 +457,22 @@ _gum_interceptor_backend_get_function_address (GumFunctionContext * ctx)
   return ctx->function_address;
 }
 
+gboolean
+_gum_interceptor_backend_get_unsafe_range (GumFunctionContext * ctx,
+                                           GumMemoryRange * range)
+{
+  GumArm64FunctionContextData * data = (GumArm64FunctionContextData *)
+      &ctx->backend_data;
+
+  if (data->redirect_code_size <= 4)
+    return FALSE;
+
+  range->base_address = GUM_ADDRESS (ctx->function_address) + 4;
+  range->size = data->redirect_code_size - 4;
+
+  return TRUE;
+}
+
 gpointer
 _gum_interceptor_backend_resolve_redirect (GumInterceptorBackend * self,
                                            gpointer address)
@@ -117,10 +117,6 @@ gum_darwin_backtracer_generate (GumBacktracer * backtracer,
   return_addresses->len = i;
 
   invocation_stack = gum_interceptor_get_current_stack ();
-  for (i = 0; i != return_addresses->len; i++)
-  {
-    return_addresses->items[i] = gum_invocation_stack_translate (
-        invocation_stack, return_addresses->items[i]);
-  }
+  gum_invocation_stack_translate_all (invocation_stack, return_addresses);
 }
 
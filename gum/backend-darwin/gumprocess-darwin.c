@@ -407,7 +407,8 @@ gum_process_modify_thread (GumThreadId thread_id,
 }
 
 void
-_gum_process_enumerate_threads (GumFoundThreadFunc func,
+_gum_process_enumerate_threads (GumThreadFlags flags,
+                                GumFoundThreadFunc func,
                                 gpointer user_data)
 {
   gum_darwin_enumerate_threads (mach_task_self (), func, user_data);
@@ -428,6 +429,18 @@ _gum_process_enumerate_ranges (GumPageProtection prot,
   gum_darwin_enumerate_ranges (mach_task_self (), prot, func, user_data);
 }
 
+gboolean
+_gum_process_query_module_generation (guint64 * generation)
+{
+  return FALSE;
+}
+
+gboolean
+_gum_process_sample_thread_pcs (GArray * pcs)
+{
+  return FALSE;
+}
+
 void
 gum_process_enumerate_malloc_ranges (GumFoundMallocRangeFunc func,
                                      gpointer user_data)
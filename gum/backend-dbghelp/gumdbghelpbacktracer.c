@@ -178,9 +178,5 @@ gum_dbghelp_backtracer_generate (GumBacktracer * backtracer,
   dbghelp->Unlock ();
 
   invocation_stack = gum_interceptor_get_current_stack ();
-  for (i = 0; i != return_addresses->len; i++)
-  {
-    return_addresses->items[i] = gum_invocation_stack_translate (
-        invocation_stack, return_addresses->items[i]);
-  }
+  gum_invocation_stack_translate_all (invocation_stack, return_addresses);
 }
@@ -87,6 +87,33 @@ gum_symbol_details_from_address (gpointer address,
   return (has_sym_info || has_file_info);
 }
 
+guint
+gum_symbol_details_from_addresses (const gpointer * addresses,
+                                   guint count,
+                                   GumDebugSymbolDetails * details)
+{
+  guint resolved, i;
+
+  resolved = 0;
+
+  for (i = 0; i != count; i++)
+  {
+    GumDebugSymbolDetails * d = &details[i];
+
+    if (gum_symbol_details_from_address (addresses[i], d))
+    {
+      resolved++;
+    }
+    else
+    {
+      memset (d, 0, sizeof (GumDebugSymbolDetails));
+      d->address = GUM_ADDRESS (addresses[i]);
+    }
+  }
+
+  return resolved;
+}
+
 gchar *
 gum_symbol_name_from_address (gpointer address)
 {
@@ -7,6 +7,7 @@
 #include "gumelfmodule.h"
 
 #include <fcntl.h>
+#include <string.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <unistd.h>
@@ -49,8 +50,6 @@ struct _GumElfStoreSymtabParamsContext
   guint pending;
   gboolean found_hash;
 
-  gpointer entries;
-  gsize entry_size;
   gsize entry_count;
 
   GumElfModule * module;
@@ -68,12 +67,28 @@ static void gum_elf_module_get_property (GObject * object,
 static void gum_elf_module_set_property (GObject * object,
     guint property_id, const GValue * value, GParamSpec * pspec);
 
+static gboolean gum_elf_module_load_image_headers (GumElfModule * self);
+static void gum_elf_module_read_program_header (GumElfModule * self,
+    GElf_Half index, GElf_Phdr * phdr);
+
 static gboolean gum_emit_each_needed (const GumElfDynamicEntryDetails * details,
     gpointer user_data);
 static gboolean gum_emit_elf_import (const GumElfSymbolDetails * details,
     gpointer user_data);
 static gboolean gum_emit_elf_export (const GumElfSymbolDetails * details,
     gpointer user_data);
+static gboolean gum_elf_symbol_details_to_export (
+    const GumElfSymbolDetails * symbol, GumExportDetails * details);
+static gboolean gum_elf_module_find_export_by_gnu_hash (GumElfModule * self,
+    const gchar * name, GumExportDetails * details);
+static gboolean gum_elf_module_find_export_by_hash (GumElfModule * self,
+    const gchar * name, GumExportDetails * details);
+static gboolean gum_elf_module_try_export (GumElfModule * self,
+    guint32 symbol_index, const gchar * name, GumExportDetails * details);
+static void gum_elf_module_read_dynamic_symbol (GumElfModule * self,
+    gsize symbol_index, GumElfSymbolDetails * details);
+static guint32 gum_elf_gnu_hash (const gchar * name);
+static guint32 gum_elf_sysv_hash (const gchar * name);
 static gboolean gum_store_symtab_params (
     const GumElfDynamicEntryDetails * details, gpointer user_data);
 static void gum_elf_module_enumerate_symbols_in_section (GumElfModule * self,
@@ -83,13 +98,14 @@ static gboolean gum_elf_module_find_dynamic_range (GumElfModule * self,
     GumMemoryRange * range);
 static GumAddress gum_elf_module_compute_preferred_address (
     GumElfModule * self);
+static gsize gum_elf_module_compute_mapped_size (GumElfModule * self);
 static GumElfDynamicAddressState gum_elf_module_detect_dynamic_address_state (
     GumElfModule * self);
 static GumAddress gum_elf_module_resolve_static_virtual_address (
     GumElfModule * self, GumAddress address);
 static GumAddress gum_elf_module_resolve_dynamic_virtual_address (
     GumElfModule * self, GumAddress address);
-static gboolean gum_store_dynamic_string_table (
+static gboolean gum_store_dynamic_tables (
     const GumElfDynamicEntryDetails * details, gpointer user_data);
 
 G_DEFINE_TYPE (GumElfModule, gum_elf_module, G_TYPE_OBJECT)
@@ -125,7 +141,6 @@ static void
 gum_elf_module_constructed (GObject * object)
 {
   GumElfModule * self = GUM_ELF_MODULE (object);
-  int fd;
   GElf_Half type;
 
   if (self->name == NULL)
@@ -133,48 +148,32 @@ gum_elf_module_constructed (GObject * object)
     self->name = g_path_get_basename (self->path);
   }
 
-  fd = open (self->path, O_RDONLY);
-  if (fd == -1)
-    goto error;
-
-  self->file_size = lseek (fd, 0, SEEK_END);
-  lseek (fd, 0, SEEK_SET);
-
-  self->file_data = mmap (NULL, self->file_size, PROT_READ, MAP_PRIVATE, fd, 0);
-
-  close (fd);
-
-  if (self->file_data == MAP_FAILED)
-    goto mmap_failed;
-
-  self->elf = elf_memory (self->file_data, self->file_size);
-  if (self->elf == NULL)
-    goto error;
+  if (!gum_elf_module_load_image_headers (self))
+  {
+    if (!gum_elf_module_ensure_file_loaded (self))
+      goto error;
 
-  self->ehdr = gelf_getehdr (self->elf, &self->ehdr_storage);
-  if (self->ehdr == NULL)
-    goto error;
+    self->ehdr = gelf_getehdr (self->elf, &self->ehdr_storage);
+    if (self->ehdr == NULL)
+      goto error;
+  }
 
   type = self->ehdr->e_type;
   if (type != ET_EXEC && type != ET_DYN)
     goto error;
 
   self->preferred_address = gum_elf_module_compute_preferred_address (self);
+  self->mapped_size = gum_elf_module_compute_mapped_size (self);
 
   self->dynamic_address_state =
       gum_elf_module_detect_dynamic_address_state (self);
 
-  gum_elf_module_enumerate_dynamic_entries (self,
-      gum_store_dynamic_string_table, self);
+  gum_elf_module_enumerate_dynamic_entries (self, gum_store_dynamic_tables,
+      self);
 
   self->valid = TRUE;
   return;
 
-mmap_failed:
-  {
-    self->file_data = NULL;
-    goto error;
-  }
 error:
   {
     self->valid = FALSE;
@@ -268,6 +267,134 @@ gum_elf_module_new_from_memory (const gchar * path,
   return module;
 }
 
+gboolean
+gum_elf_module_ensure_file_loaded (GumElfModule * self)
+{
+  int fd;
+
+  if (self->file_load_attempted)
+    return self->elf != NULL;
+  self->file_load_attempted = TRUE;
+
+  fd = open (self->path, O_RDONLY);
+  if (fd == -1)
+    goto error;
+
+  self->file_size = lseek (fd, 0, SEEK_END);
+  lseek (fd, 0, SEEK_SET);
+
+  self->file_data = mmap (NULL, self->file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+  close (fd);
+
+  if (self->file_data == MAP_FAILED)
+    goto mmap_failed;
+
+  self->elf = elf_memory (self->file_data, self->file_size);
+  if (self->elf == NULL)
+    goto error;
+
+  return TRUE;
+
+mmap_failed:
+  {
+    self->file_data = NULL;
+    goto error;
+  }
+error:
+  {
+    return FALSE;
+  }
+}
+
+static gboolean
+gum_elf_module_load_image_headers (GumElfModule * self)
+{
+  const guint8 * image;
+  GElf_Ehdr * ehdr = &self->ehdr_storage;
+
+  /*
+   * The loader maps the segment at file offset zero at our base address, so
+   * the ELF and program headers are already in memory. Reading them from
+   * there means constructing a module does not have to touch the file.
+   */
+  if (self->base_address == 0)
+    return FALSE;
+
+  image = GSIZE_TO_POINTER (self->base_address);
+  if (memcmp (image, ELFMAG, SELFMAG) != 0)
+    return FALSE;
+
+  if (sizeof (gpointer) == 4)
+  {
+    const Elf32_Ehdr * e = (const Elf32_Ehdr *) image;
+
+    if (e->e_ident[EI_CLASS] != ELFCLASS32 ||
+        e->e_phentsize != sizeof (Elf32_Phdr))
+      return FALSE;
+
+    memcpy (ehdr->e_ident, e->e_ident, EI_NIDENT);
+    ehdr->e_type = e->e_type;
+    ehdr->e_machine = e->e_machine;
+    ehdr->e_version = e->e_version;
+    ehdr->e_entry = e->e_entry;
+    ehdr->e_phoff = e->e_phoff;
+    ehdr->e_shoff = e->e_shoff;
+    ehdr->e_flags = e->e_flags;
+    ehdr->e_ehsize = e->e_ehsize;
+    ehdr->e_phentsize = e->e_phentsize;
+    ehdr->e_phnum = e->e_phnum;
+    ehdr->e_shentsize = e->e_shentsize;
+    ehdr->e_shnum = e->e_shnum;
+    ehdr->e_shstrndx = e->e_shstrndx;
+  }
+  else
+  {
+    const Elf64_Ehdr * e = (const Elf64_Ehdr *) image;
+
+    if (e->e_ident[EI_CLASS] != ELFCLASS64 ||
+        e->e_phentsize != sizeof (Elf64_Phdr))
+      return FALSE;
+
+    *ehdr = *e;
+  }
+
+  self->ehdr = ehdr;
+  self->program_headers = image + ehdr->e_phoff;
+
+  return TRUE;
+}
+
+static void
+gum_elf_module_read_program_header (GumElfModule * self,
+                                    GElf_Half index,
+                                    GElf_Phdr * phdr)
+{
+  if (self->program_headers == NULL)
+  {
+    gelf_getphdr (self->elf, index, phdr);
+    return;
+  }
+
+  if (sizeof (gpointer) == 4)
+  {
+    const Elf32_Phdr * p = (const Elf32_Phdr *) self->program_headers + index;
+
+    phdr->p_type = p->p_type;
+    phdr->p_flags = p->p_flags;
+    phdr->p_offset = p->p_offset;
+    phdr->p_vaddr = p->p_vaddr;
+    phdr->p_paddr = p->p_paddr;
+    phdr->p_filesz = p->p_filesz;
+    phdr->p_memsz = p->p_memsz;
+    phdr->p_align = p->p_align;
+  }
+  else
+  {
+    *phdr = *((const Elf64_Phdr *) self->program_headers + index);
+  }
+}
+
 void
 gum_elf_module_enumerate_dependencies (GumElfModule * self,
                                        GumElfFoundDependencyFunc func,
@@ -387,24 +514,157 @@ gum_emit_elf_export (const GumElfSymbolDetails * details,
                      gpointer user_data)
 {
   GumElfEnumerateExportsContext * ctx = user_data;
+  GumExportDetails d;
+
+  if (!gum_elf_symbol_details_to_export (details, &d))
+    return TRUE;
+
+  return ctx->func (&d, ctx->user_data);
+}
+
+static gboolean
+gum_elf_symbol_details_to_export (const GumElfSymbolDetails * symbol,
+                                  GumExportDetails * details)
+{
+  if (symbol->section_header_index == SHN_UNDEF ||
+      (symbol->type != STT_FUNC && symbol->type != STT_OBJECT) ||
+      (symbol->bind != STB_GLOBAL && symbol->bind != STB_WEAK))
+    return FALSE;
 
-  if (details->section_header_index != SHN_UNDEF &&
-      (details->type == STT_FUNC || details->type == STT_OBJECT) &&
-      (details->bind == STB_GLOBAL || details->bind == STB_WEAK))
+  details->type = (symbol->type == STT_FUNC)
+      ? GUM_EXPORT_FUNCTION
+      : GUM_EXPORT_VARIABLE;
+  details->name = symbol->name;
+  details->address = symbol->address;
+
+  return TRUE;
+}
+
+/*
+ * Looks up a single export through the module's own hash tables, preferring
+ * DT_GNU_HASH over DT_HASH, the same way the dynamic linker does. Works on
+ * the loaded image and neither calls into libelf nor allocates. Symbols
+ * marked as hidden versions are skipped, so the default version wins.
+ */
+gboolean
+gum_elf_module_find_export (GumElfModule * self,
+                            const gchar * name,
+                            GumExportDetails * details)
+{
+  if (self->dynamic_symbols == NULL || self->dynamic_strings == NULL)
+    return FALSE;
+
+  if (self->dynamic_gnu_hash != NULL)
+    return gum_elf_module_find_export_by_gnu_hash (self, name, details);
+
+  if (self->dynamic_hash != NULL)
+    return gum_elf_module_find_export_by_hash (self, name, details);
+
+  return FALSE;
+}
+
+static gboolean
+gum_elf_module_find_export_by_gnu_hash (GumElfModule * self,
+                                        const gchar * name,
+                                        GumExportDetails * details)
+{
+  const guint32 * hash_params = self->dynamic_gnu_hash;
+  const guint word_bits = sizeof (gsize) * 8;
+  guint32 nbuckets, symoffset, bloom_size, bloom_shift;
+  const gsize * bloom;
+  const guint32 * buckets, * chain;
+  guint32 hash, symbol_index;
+  gsize bloom_word, bloom_mask;
+
+  nbuckets = hash_params[0];
+  symoffset = hash_params[1];
+  bloom_size = hash_params[2];
+  bloom_shift = hash_params[3];
+  bloom = (const gsize *) (hash_params + 4);
+  buckets = (const guint32 *) (bloom + bloom_size);
+  chain = buckets + nbuckets;
+
+  if (nbuckets == 0 || bloom_size == 0)
+    return FALSE;
+
+  hash = gum_elf_gnu_hash (name);
+
+  bloom_word = bloom[(hash / word_bits) % bloom_size];
+  bloom_mask = ((gsize) 1 << (hash % word_bits)) |
+      ((gsize) 1 << ((hash >> bloom_shift) % word_bits));
+  if ((bloom_word & bloom_mask) != bloom_mask)
+    return FALSE;
+
+  symbol_index = buckets[hash % nbuckets];
+  if (symbol_index < symoffset)
+    return FALSE;
+
+  while (TRUE)
   {
-    GumExportDetails d;
+    guint32 chain_hash = chain[symbol_index - symoffset];
 
-    d.type = (details->type == STT_FUNC)
-        ? GUM_EXPORT_FUNCTION
-        : GUM_EXPORT_VARIABLE;
-    d.name = details->name;
-    d.address = details->address;
+    if ((chain_hash | 1) == (hash | 1) &&
+        gum_elf_module_try_export (self, symbol_index, name, details))
+    {
+      return TRUE;
+    }
 
-    if (!ctx->func (&d, ctx->user_data))
-      return FALSE;
+    if ((chain_hash & 1) != 0)
+      break;
+
+    symbol_index++;
   }
 
-  return TRUE;
+  return FALSE;
+}
+
+static gboolean
+gum_elf_module_find_export_by_hash (GumElfModule * self,
+                                    const gchar * name,
+                                    GumExportDetails * details)
+{
+  const guint32 * hash_params = self->dynamic_hash;
+  guint32 nbucket, nchain;
+  const guint32 * buckets, * chain;
+  guint32 symbol_index;
+
+  nbucket = hash_params[0];
+  nchain = hash_params[1];
+  buckets = hash_params + 2;
+  chain = buckets + nbucket;
+
+  if (nbucket == 0)
+    return FALSE;
+
+  for (symbol_index = buckets[gum_elf_sysv_hash (name) % nbucket];
+      symbol_index != STN_UNDEF && symbol_index < nchain;
+      symbol_index = chain[symbol_index])
+  {
+    if (gum_elf_module_try_export (self, symbol_index, name, details))
+      return TRUE;
+  }
+
+  return FALSE;
+}
+
+static gboolean
+gum_elf_module_try_export (GumElfModule * self,
+                           guint32 symbol_index,
+                           const gchar * name,
+                           GumExportDetails * details)
+{
+  GumElfSymbolDetails symbol;
+
+  gum_elf_module_read_dynamic_symbol (self, symbol_index, &symbol);
+
+  if (strcmp (symbol.name, name) != 0)
+    return FALSE;
+
+  if (self->dynamic_versions != NULL &&
+      (self->dynamic_versions[symbol_index] & 0x8000) != 0)
+    return FALSE;
+
+  return gum_elf_symbol_details_to_export (&symbol, details);
 }
 
 void
@@ -414,13 +674,10 @@ gum_elf_module_enumerate_dynamic_symbols (GumElfModule * self,
 {
   GumElfStoreSymtabParamsContext ctx;
   gsize entry_index;
-  const gchar * dynamic_strings = self->dynamic_strings;
 
   ctx.pending = 3;
   ctx.found_hash = FALSE;
 
-  ctx.entries = NULL;
-  ctx.entry_size = 0;
   ctx.entry_count = 0;
 
   ctx.module = self;
@@ -432,40 +689,52 @@ gum_elf_module_enumerate_dynamic_symbols (GumElfModule * self,
 
   for (entry_index = 1; entry_index != ctx.entry_count; entry_index++)
   {
-    gpointer entry = ctx.entries + (entry_index * ctx.entry_size);
     GumElfSymbolDetails details;
-    GumAddress raw_address;
 
-    if (sizeof (gpointer) == 4)
-    {
-      Elf32_Sym * sym = entry;
+    gum_elf_module_read_dynamic_symbol (self, entry_index, &details);
 
-      details.name = dynamic_strings + sym->st_name;
-      details.type = GELF_ST_TYPE (sym->st_info);
-      details.bind = GELF_ST_BIND (sym->st_info);
-      details.section_header_index = sym->st_shndx;
+    if (!func (&details, user_data))
+      return;
+  }
+}
 
-      raw_address = sym->st_value;
-    }
-    else
-    {
-      Elf64_Sym * sym = entry;
+static void
+gum_elf_module_read_dynamic_symbol (GumElfModule * self,
+                                    gsize symbol_index,
+                                    GumElfSymbolDetails * details)
+{
+  gconstpointer entry = self->dynamic_symbols +
+      (symbol_index * self->dynamic_symbol_size);
+  GumAddress raw_address;
 
-      details.name = dynamic_strings + sym->st_name;
-      details.type = GELF_ST_TYPE (sym->st_info);
-      details.bind = GELF_ST_BIND (sym->st_info);
-      details.section_header_index = sym->st_shndx;
+  if (sizeof (gpointer) == 4)
+  {
+    const Elf32_Sym * sym = entry;
 
-      raw_address = sym->st_value;
-    }
+    details->name = self->dynamic_strings + sym->st_name;
+    details->type = GELF_ST_TYPE (sym->st_info);
+    details->bind = GELF_ST_BIND (sym->st_info);
+    details->section_header_index = sym->st_shndx;
+    details->size = sym->st_size;
 
-    details.address = (raw_address != 0)
-        ? gum_elf_module_resolve_static_virtual_address (self, raw_address)
-        : 0;
+    raw_address = sym->st_value;
+  }
+  else
+  {
+    const Elf64_Sym * sym = entry;
 
-    if (!func (&details, user_data))
-      return;
+    details->name = self->dynamic_strings + sym->st_name;
+    details->type = GELF_ST_TYPE (sym->st_info);
+    details->bind = GELF_ST_BIND (sym->st_info);
+    details->section_header_index = sym->st_shndx;
+    details->size = sym->st_size;
+
+    raw_address = sym->st_value;
   }
+
+  details->address = (raw_address != 0)
+      ? gum_elf_module_resolve_static_virtual_address (self, raw_address)
+      : 0;
 }
 
 static gboolean
@@ -477,13 +746,7 @@ gum_store_symtab_params (const GumElfDynamicEntryDetails * details,
   switch (details->type)
   {
     case DT_SYMTAB:
-      ctx->entries = GSIZE_TO_POINTER (
-          gum_elf_module_resolve_dynamic_virtual_address (ctx->module,
-              details->value));
-      ctx->pending--;
-      break;
     case DT_SYMENT:
-      ctx->entry_size = details->value;
       ctx->pending--;
       break;
     case DT_HASH:
@@ -608,6 +871,7 @@ gum_elf_module_enumerate_symbols_in_section (GumElfModule * self,
     details.type = GELF_ST_TYPE (sym.st_info);
     details.bind = GELF_ST_BIND (sym.st_info);
     details.section_header_index = sym.st_shndx;
+    details.size = sym.st_size;
 
     carry_on = func (&details, user_data);
   }
@@ -682,7 +946,7 @@ gum_elf_module_find_address_protection (GumElfModule * self,
   {
     GElf_Phdr phdr;
 
-    gelf_getphdr (self->elf, header_index, &phdr);
+    gum_elf_module_read_program_header (self, header_index, &phdr);
 
     if (phdr.p_type == PT_LOAD &&
         address >= phdr.p_vaddr &&
@@ -718,7 +982,7 @@ gum_elf_module_find_dynamic_range (GumElfModule * self,
   {
     GElf_Phdr phdr;
 
-    gelf_getphdr (self->elf, header_index, &phdr);
+    gum_elf_module_read_program_header (self, header_index, &phdr);
 
     if (phdr.p_type == PT_DYNAMIC)
     {
@@ -783,6 +1047,9 @@ gum_elf_module_find_section_header_by_index (GumElfModule * self,
   guint current_index;
   Elf_Scn * current_section;
 
+  if (!gum_elf_module_ensure_file_loaded (self))
+    return FALSE;
+
   current_index = 1;
   current_section = NULL;
 
@@ -810,6 +1077,9 @@ gum_elf_module_find_section_header_by_type (GumElfModule * self,
 {
   Elf_Scn * cur = NULL;
 
+  if (!gum_elf_module_ensure_file_loaded (self))
+    return FALSE;
+
   while ((cur = elf_nextscn (self->elf, cur)) != NULL)
   {
     gelf_getshdr (cur, shdr);
@@ -835,7 +1105,7 @@ gum_elf_module_compute_preferred_address (GumElfModule * self)
   {
     GElf_Phdr phdr;
 
-    gelf_getphdr (self->elf, header_index, &phdr);
+    gum_elf_module_read_program_header (self, header_index, &phdr);
 
     if (phdr.p_type == PT_LOAD && phdr.p_offset == 0)
       return phdr.p_vaddr;
@@ -844,6 +1114,29 @@ gum_elf_module_compute_preferred_address (GumElfModule * self)
   return 0;
 }
 
+static gsize
+gum_elf_module_compute_mapped_size (GumElfModule * self)
+{
+  GumAddress end;
+  GElf_Half header_count, header_index;
+
+  end = self->preferred_address;
+
+  header_count = self->ehdr->e_phnum;
+
+  for (header_index = 0; header_index != header_count; header_index++)
+  {
+    GElf_Phdr phdr;
+
+    gum_elf_module_read_program_header (self, header_index, &phdr);
+
+    if (phdr.p_type == PT_LOAD && phdr.p_vaddr + phdr.p_memsz > end)
+      end = phdr.p_vaddr + phdr.p_memsz;
+  }
+
+  return end - self->preferred_address;
+}
+
 static GumElfDynamicAddressState
 gum_elf_module_detect_dynamic_address_state (GumElfModule * self)
 {
@@ -880,15 +1173,91 @@ gum_elf_module_resolve_dynamic_virtual_address (GumElfModule * self,
 }
 
 static gboolean
-gum_store_dynamic_string_table (const GumElfDynamicEntryDetails * details,
-                                gpointer user_data)
+gum_store_dynamic_tables (const GumElfDynamicEntryDetails * details,
+                          gpointer user_data)
 {
   GumElfModule * self = user_data;
+  gpointer address;
 
-  if (details->type != DT_STRTAB)
-    return TRUE;
+  switch (details->type)
+  {
+    case DT_STRTAB:
+    case DT_SYMTAB:
+    case DT_HASH:
+#ifdef DT_GNU_HASH
+    case DT_GNU_HASH:
+#endif
+#ifdef DT_VERSYM
+    case DT_VERSYM:
+#endif
+      address = GSIZE_TO_POINTER (
+          gum_elf_module_resolve_dynamic_virtual_address (self,
+              details->value));
+      break;
+    default:
+      address = NULL;
+      break;
+  }
 
-  self->dynamic_strings = GSIZE_TO_POINTER (
-      gum_elf_module_resolve_dynamic_virtual_address (self, details->value));
-  return FALSE;
+  switch (details->type)
+  {
+    case DT_STRTAB:
+      self->dynamic_strings = address;
+      break;
+    case DT_SYMTAB:
+      self->dynamic_symbols = address;
+      break;
+    case DT_SYMENT:
+      self->dynamic_symbol_size = details->value;
+      break;
+    case DT_HASH:
+      self->dynamic_hash = address;
+      break;
+#ifdef DT_GNU_HASH
+    case DT_GNU_HASH:
+      self->dynamic_gnu_hash = address;
+      break;
+#endif
+#ifdef DT_VERSYM
+    case DT_VERSYM:
+      self->dynamic_versions = address;
+      break;
+#endif
+    default:
+      break;
+  }
+
+  return TRUE;
+}
+
+static guint32
+gum_elf_gnu_hash (const gchar * name)
+{
+  guint32 hash = 5381;
+  const guint8 * cursor;
+
+  for (cursor = (const guint8 *) name; *cursor != '\0'; cursor++)
+    hash = (hash << 5) + hash + *cursor;
+
+  return hash;
+}
+
+static guint32
+gum_elf_sysv_hash (const gchar * name)
+{
+  guint32 hash = 0;
+  const guint8 * cursor;
+
+  for (cursor = (const guint8 *) name; *cursor != '\0'; cursor++)
+  {
+    guint32 high;
+
+    hash = (hash << 4) + *cursor;
+    high = hash & 0xf0000000;
+    if (high != 0)
+      hash ^= high >> 24;
+    hash &= ~high;
+  }
+
+  return hash;
 }
@@ -47,17 +47,25 @@ struct _GumElfModule
 
   gpointer file_data;
   gsize file_size;
+  gboolean file_load_attempted;
 
   Elf * elf;
 
   GElf_Ehdr * ehdr;
   GElf_Ehdr ehdr_storage;
+  gconstpointer program_headers;
 
   GumAddress base_address;
   GumAddress preferred_address;
+  gsize mapped_size;
   GumElfDynamicAddressState dynamic_address_state;
 
   const gchar * dynamic_strings;
+  gconstpointer dynamic_symbols;
+  gsize dynamic_symbol_size;
+  const guint32 * dynamic_hash;
+  const guint32 * dynamic_gnu_hash;
+  const guint16 * dynamic_versions;
 };
 
 enum _GumElfDynamicAddressState
@@ -75,6 +83,7 @@ struct _GumElfSymbolDetails
 {
   const gchar * name;
   GumAddress address;
+  gsize size;
   GumElfSymbolType type;
   GumElfSymbolBind bind;
   GumElfSectionHeaderIndex section_header_index;
@@ -104,12 +113,16 @@ struct _GumElfSectionDetails
 GumElfModule * gum_elf_module_new_from_memory (const gchar * path,
     GumAddress base_address);
 
+gboolean gum_elf_module_ensure_file_loaded (GumElfModule * self);
+
 void gum_elf_module_enumerate_dependencies (GumElfModule * self,
     GumElfFoundDependencyFunc func, gpointer user_data);
 void gum_elf_module_enumerate_imports (GumElfModule * self,
     GumFoundImportFunc func, gpointer user_data);
 void gum_elf_module_enumerate_exports (GumElfModule * self,
     GumFoundExportFunc func, gpointer user_data);
+gboolean gum_elf_module_find_export (GumElfModule * self, const gchar * name,
+    GumExportDetails * details);
 void gum_elf_module_enumerate_dynamic_symbols (GumElfModule * self,
     GumElfFoundSymbolFunc func, gpointer user_data);
 void gum_elf_module_enumerate_symbols (GumElfModule * self,
@@ -8,6 +8,7 @@
 
 #include "backend-elf/gumelfmodule.h"
 #include "gum-init.h"
+#include "gumprocess-priv.h"
 
 #include <dlfcn.h>
 #include <dwarf.h>
@@ -19,6 +20,7 @@
 #ifdef __clang__
 # pragma clang diagnostic pop
 #endif
+#include <string.h>
 #include <strings.h>
 
 #define GUM_MAX_CACHE_AGE (0.5)
@@ -26,10 +28,14 @@
 typedef struct _GumModuleEntry GumModuleEntry;
 
 typedef struct _GumNearestSymbolDetails GumNearestSymbolDetails;
-typedef struct _GumDwarfSymbolDetails GumDwarfSymbolDetails;
-typedef struct _GumDwarfSourceDetails GumDwarfSourceDetails;
-typedef struct _GumFindCuDieOperation GumFindCuDieOperation;
-typedef struct _GumFindSymbolOperation GumFindSymbolOperation;
+typedef struct _GumSymbolTable GumSymbolTable;
+typedef struct _GumSymbolTableEntry GumSymbolTableEntry;
+typedef struct _GumDwarfIndex GumDwarfIndex;
+typedef struct _GumDwarfAddressRange GumDwarfAddressRange;
+typedef struct _GumDwarfCompilationUnit GumDwarfCompilationUnit;
+typedef struct _GumDwarfSymbol GumDwarfSymbol;
+typedef struct _GumDwarfLine GumDwarfLine;
+typedef struct _GumDwarfCollectUnitContext GumDwarfCollectUnitContext;
 
 typedef struct _GumCuDieDetails GumCuDieDetails;
 typedef struct _GumDieDetails GumDieDetails;
@@ -43,6 +49,10 @@ struct _GumModuleEntry
 {
   GumElfModule * module;
   Dwarf_Debug dbg;
+  GumDwarfIndex * index;
+  gsize index_initialized;
+  GumSymbolTable * symbols;
+  gsize symbols_initialized;
   gboolean collected;
 };
 
@@ -52,30 +62,59 @@ struct _GumNearestSymbolDetails
   gpointer address;
 };
 
-struct _GumDwarfSymbolDetails
+struct _GumSymbolTable
 {
-  gchar * name;
-  guint line_number;
+  GStringChunk * strings;
+  GArray * entries;
+};
+
+struct _GumSymbolTableEntry
+{
+  GumAddress address;
+  gsize size;
+  const gchar * name;
+  GumElfSymbolType type;
+  GumElfSymbolBind bind;
+};
+
+struct _GumDwarfIndex
+{
+  GStringChunk * strings;
+  GArray * ranges;
+  GArray * units;
+};
+
+struct _GumDwarfAddressRange
+{
+  Dwarf_Addr start;
+  Dwarf_Addr end;
+  guint unit_index;
 };
 
-struct _GumDwarfSourceDetails
+struct _GumDwarfCompilationUnit
 {
-  gchar * path;
+  GArray * symbols;
+  GArray * lines;
+};
+
+struct _GumDwarfSymbol
+{
+  Dwarf_Addr address;
+  const gchar * name;
   guint line_number;
 };
 
-struct _GumFindCuDieOperation
+struct _GumDwarfLine
 {
-  Dwarf_Addr needle;
-  gboolean found;
-  Dwarf_Off cu_die_offset;
+  Dwarf_Addr address;
+  guint line_number;
+  const gchar * path;
 };
 
-struct _GumFindSymbolOperation
+struct _GumDwarfCollectUnitContext
 {
-  GumAddress needle;
-  GumDwarfSymbolDetails * symbol;
-  GumAddress closest_address;
+  GumDwarfIndex * index;
+  GumDwarfCompilationUnit * unit;
 };
 
 struct _GumCuDieDetails
@@ -95,33 +134,63 @@ struct _GumDieDetails
 
 static GumModuleEntry * gum_module_entry_from_address (gpointer address,
     GumNearestSymbolDetails * nearest);
+static void gum_nearest_symbol_from_address (gpointer address,
+    GumNearestSymbolDetails * nearest);
 static GumModuleEntry * gum_module_entry_from_path_and_base (const gchar * path,
     GumAddress base_address);
+static gboolean gum_module_entry_contains (GumModuleEntry * self,
+    gpointer address);
+static void gum_module_entry_describe (GumModuleEntry * self, gpointer address,
+    GumNearestSymbolDetails * nearest, GumDebugSymbolDetails * details);
 static Dwarf_Addr gum_module_entry_virtual_address_to_file (
     GumModuleEntry * self, gpointer address);
+static const GumDwarfSymbol * gum_module_entry_find_symbol (
+    GumModuleEntry * self, gpointer address, const GumDwarfLine ** line);
+static void gum_module_entry_find_nearest_symbol (GumModuleEntry * self,
+    gpointer address, GumNearestSymbolDetails * nearest);
+static GumSymbolTable * gum_module_entry_get_symbols (GumModuleEntry * self);
+static GumDwarfIndex * gum_module_entry_get_index (GumModuleEntry * self);
 
 static GHashTable * gum_get_function_addresses (void);
 static gboolean gum_collect_module_functions (const GumModuleDetails * details,
     gpointer user_data);
-static gboolean gum_collect_symbol_if_function (
-    const GumElfSymbolDetails * details, gpointer user_data);
+static void gum_collect_function (const gchar * name, gpointer address);
 
 static void gum_symbol_util_ensure_initialized (void);
 static void gum_symbol_util_deinitialize (void);
 
 static void gum_on_dwarf_error (Dwarf_Error error, Dwarf_Ptr errarg);
 
-static Dwarf_Die gum_find_cu_die_by_virtual_address (Dwarf_Debug dbg,
-    Dwarf_Addr address);
-static gboolean gum_store_cu_die_offset_if_containing_address (
-    const GumCuDieDetails * details, GumFindCuDieOperation * op);
-static gboolean gum_find_symbol_by_virtual_address (Dwarf_Debug dbg,
-    Dwarf_Die cu_die, Dwarf_Addr address, GumDwarfSymbolDetails * details);
-static gboolean gum_collect_die_if_closest_so_far (
-    const GumDieDetails * details, GumFindSymbolOperation * op);
-static gboolean gum_find_line_by_virtual_address (Dwarf_Debug dbg,
-    Dwarf_Die cu_die, Dwarf_Addr address, guint symbol_line_number,
-    GumDwarfSourceDetails * details);
+static GumSymbolTable * gum_symbol_table_new (GumElfModule * module);
+static void gum_symbol_table_free (GumSymbolTable * table);
+static gboolean gum_symbol_table_add (const GumElfSymbolDetails * details,
+    GumSymbolTable * self);
+static const GumSymbolTableEntry * gum_symbol_table_find (
+    GumSymbolTable * self, GumAddress address);
+static gint gum_symbol_table_entry_compare (const GumSymbolTableEntry * lhs,
+    const GumSymbolTableEntry * rhs);
+
+static GumDwarfIndex * gum_dwarf_index_new (Dwarf_Debug dbg);
+static void gum_dwarf_index_free (GumDwarfIndex * index);
+static gboolean gum_dwarf_index_add_unit (const GumCuDieDetails * details,
+    GumDwarfIndex * self);
+static gboolean gum_dwarf_index_collect_symbol (const GumDieDetails * details,
+    GumDwarfCollectUnitContext * ctx);
+static void gum_dwarf_index_collect_lines (GumDwarfIndex * self,
+    GumDwarfCompilationUnit * unit, Dwarf_Debug dbg, Dwarf_Die cu_die);
+static const GumDwarfCompilationUnit * gum_dwarf_index_find_unit (
+    GumDwarfIndex * self, Dwarf_Addr address);
+static const GumDwarfSymbol * gum_dwarf_unit_find_symbol (
+    const GumDwarfCompilationUnit * unit, Dwarf_Addr address);
+static const GumDwarfLine * gum_dwarf_unit_find_line (
+    const GumDwarfCompilationUnit * unit, Dwarf_Addr address,
+    guint symbol_line_number);
+static gint gum_dwarf_address_range_compare (const GumDwarfAddressRange * lhs,
+    const GumDwarfAddressRange * rhs);
+static gint gum_dwarf_symbol_compare (const GumDwarfSymbol * lhs,
+    const GumDwarfSymbol * rhs);
+static gint gum_dwarf_line_compare (const GumDwarfLine * lhs,
+    const GumDwarfLine * rhs);
 
 static void gum_enumerate_cu_dies (Dwarf_Debug dbg, gboolean is_info,
     GumFoundCuDieFunc func, gpointer user_data);
@@ -142,184 +211,138 @@ static gboolean gum_read_attribute_uint (Dwarf_Debug dbg, Dwarf_Die die,
     Dwarf_Half id, Dwarf_Unsigned * value);
 
 static gint gum_compare_pointers (gconstpointer a, gconstpointer b);
+static gint gum_compare_address_indices (gconstpointer a, gconstpointer b,
+    gpointer user_data);
 
 G_LOCK_DEFINE_STATIC (gum_symbol_util);
 static GHashTable * gum_module_entries = NULL;
 static GHashTable * gum_function_addresses = NULL;
 static GTimer * gum_cache_timer = NULL;
+static guint64 gum_cache_generation = 0;
+static gboolean gum_cache_generation_valid = FALSE;
 
 gboolean
 gum_symbol_details_from_address (gpointer address,
                                  GumDebugSymbolDetails * details)
 {
-  gboolean success;
   GumModuleEntry * entry;
   GumNearestSymbolDetails nearest;
-  Dwarf_Addr file_address;
-  Dwarf_Die cu_die;
-  GumDwarfSymbolDetails symbol;
-  GumDwarfSourceDetails source;
-
-  success = FALSE;
 
   G_LOCK (gum_symbol_util);
-
   entry = gum_module_entry_from_address (address, &nearest);
-  if (entry == NULL)
-    goto entry_not_found;
-  if (entry->dbg == NULL)
-    goto no_debug_info;
-
-  file_address = gum_module_entry_virtual_address_to_file (entry, address);
-
-  cu_die = gum_find_cu_die_by_virtual_address (entry->dbg, file_address);
-  if (cu_die == NULL)
-    goto cu_die_not_found;
-
-  if (!gum_find_symbol_by_virtual_address (entry->dbg, cu_die, file_address,
-      &symbol))
-    goto symbol_not_found;
-
-  if (!gum_find_line_by_virtual_address (entry->dbg, cu_die, file_address,
-      symbol.line_number, &source))
-    goto line_not_found;
-
-  details->address = GUM_ADDRESS (address);
+  G_UNLOCK (gum_symbol_util);
 
-  g_strlcpy (details->module_name, entry->module->name,
-      sizeof (details->module_name));
-  g_strlcpy (details->symbol_name, symbol.name, sizeof (details->symbol_name));
+  if (entry == NULL)
+    return FALSE;
 
-  g_strlcpy (details->file_name, source.path, sizeof (details->file_name));
-  details->line_number = source.line_number;
+  gum_module_entry_describe (entry, address, &nearest, details);
 
-  success = TRUE;
+  return TRUE;
+}
 
-  g_free (source.path);
+guint
+gum_symbol_details_from_addresses (const gpointer * addresses,
+                                   guint count,
+                                   GumDebugSymbolDetails * details)
+{
+  guint resolved, i;
+  guint * order;
+  GumModuleEntry ** entries;
+  GumNearestSymbolDetails * nearest;
+  GumModuleEntry * entry;
 
-line_not_found:
-  g_free (symbol.name);
+  order = g_new (guint, count);
+  for (i = 0; i != count; i++)
+    order[i] = i;
+  g_qsort_with_data (order, count, sizeof (guint),
+      gum_compare_address_indices, (gpointer) addresses);
+
+  /*
+   * Sorted addresses arrive grouped by module, so we only need to resolve
+   * and look up an entry when an address falls outside the previous one.
+   * Each address still gets its own dladdr() symbol, which is what the
+   * single lookup falls back to when the ELF symbols come up empty.
+   */
+  entries = g_new (GumModuleEntry *, count);
+  nearest = g_new (GumNearestSymbolDetails, count);
+  entry = NULL;
 
-symbol_not_found:
-  dwarf_dealloc (entry->dbg, cu_die, DW_DLA_DIE);
+  G_LOCK (gum_symbol_util);
+  for (i = 0; i != count; i++)
+  {
+    guint index = order[i];
+    gpointer address = addresses[index];
 
-cu_die_not_found:
-  if (!success)
-    goto no_debug_info;
+    if (entry == NULL || !gum_module_entry_contains (entry, address))
+      entry = gum_module_entry_from_address (address, &nearest[index]);
+    else
+      gum_nearest_symbol_from_address (address, &nearest[index]);
 
-entry_not_found:
+    entries[index] = entry;
+  }
   G_UNLOCK (gum_symbol_util);
 
-  return success;
+  resolved = 0;
 
-no_debug_info:
+  for (i = 0; i != count; i++)
   {
-    gsize offset;
+    GumDebugSymbolDetails * d = &details[i];
 
-    details->address = GUM_ADDRESS (address);
-
-    g_strlcpy (details->module_name, entry->module->name,
-        sizeof (details->module_name));
-    if (nearest.name != NULL)
+    if (entries[i] != NULL)
     {
-      offset = GPOINTER_TO_SIZE (address) - GPOINTER_TO_SIZE (nearest.address);
+      gum_module_entry_describe (entries[i], addresses[i], &nearest[i], d);
 
-      if (offset == 0)
-      {
-        g_strlcpy (details->symbol_name, nearest.name,
-            sizeof (details->symbol_name));
-      }
-      else
-      {
-        g_snprintf (details->symbol_name, sizeof (details->symbol_name),
-            "%s+0x%" G_GSIZE_MODIFIER "x", nearest.name, offset);
-      }
+      resolved++;
     }
     else
     {
-      offset = details->address - entry->module->base_address;
-
-      g_snprintf (details->symbol_name, sizeof (details->symbol_name),
-          "0x%" G_GSIZE_MODIFIER "x", offset);
+      memset (d, 0, sizeof (GumDebugSymbolDetails));
+      d->address = GUM_ADDRESS (addresses[i]);
     }
+  }
 
-    details->file_name[0] = '\0';
-    details->line_number = 0;
-
-    G_UNLOCK (gum_symbol_util);
+  g_free (nearest);
+  g_free (entries);
+  g_free (order);
 
-    return TRUE;
-  }
+  return resolved;
 }
 
 gchar *
 gum_symbol_name_from_address (gpointer address)
 {
-  GumDwarfSymbolDetails symbol;
   GumModuleEntry * entry;
   GumNearestSymbolDetails nearest;
-  Dwarf_Addr file_address;
-  Dwarf_Die cu_die;
-
-  symbol.name = NULL;
+  const GumDwarfSymbol * symbol;
+  gsize offset;
 
   G_LOCK (gum_symbol_util);
-
   entry = gum_module_entry_from_address (address, &nearest);
-  if (entry == NULL)
-    goto entry_not_found;
-  if (entry->dbg == NULL)
-    goto no_debug_info;
-
-  file_address = gum_module_entry_virtual_address_to_file (entry, address);
-
-  cu_die = gum_find_cu_die_by_virtual_address (entry->dbg, file_address);
-  if (cu_die == NULL)
-    goto cu_die_not_found;
-
-  gum_find_symbol_by_virtual_address (entry->dbg, cu_die, file_address,
-      &symbol);
-
-  dwarf_dealloc (entry->dbg, cu_die, DW_DLA_DIE);
+  G_UNLOCK (gum_symbol_util);
 
-cu_die_not_found:
-  if (symbol.name == NULL)
-    goto no_debug_info;
+  if (entry == NULL)
+    return NULL;
 
-entry_not_found:
-  G_UNLOCK (gum_symbol_util);
+  symbol = gum_module_entry_find_symbol (entry, address, NULL);
+  if (symbol != NULL)
+    return g_strdup (symbol->name);
 
-  return symbol.name;
+  gum_module_entry_find_nearest_symbol (entry, address, &nearest);
 
-no_debug_info:
+  if (nearest.name != NULL)
   {
-    gsize offset;
-
-    if (nearest.name != NULL)
-    {
-      offset = GPOINTER_TO_SIZE (address) - GPOINTER_TO_SIZE (nearest.address);
+    offset = GPOINTER_TO_SIZE (address) - GPOINTER_TO_SIZE (nearest.address);
 
-      if (offset == 0)
-      {
-        symbol.name = g_strdup (nearest.name);
-      }
-      else
-      {
-        symbol.name = g_strdup_printf ("%s+0x%" G_GSIZE_MODIFIER "x",
-            nearest.name, offset);
-      }
-    }
-    else
-    {
-      offset = GPOINTER_TO_SIZE (address) - entry->module->base_address;
+    if (offset == 0)
+      return g_strdup (nearest.name);
 
-      symbol.name = g_strdup_printf ("0x%" G_GSIZE_MODIFIER "x", offset);
-    }
+    return g_strdup_printf ("%s+0x%" G_GSIZE_MODIFIER "x", nearest.name,
+        offset);
+  }
 
-    G_UNLOCK (gum_symbol_util);
+  offset = GPOINTER_TO_SIZE (address) - entry->module->base_address;
 
-    return symbol.name;
-  }
+  return g_strdup_printf ("0x%" G_GSIZE_MODIFIER "x", offset);
 }
 
 gpointer
@@ -454,6 +477,23 @@ gum_module_entry_from_address (gpointer address,
   return entry;
 }
 
+static void
+gum_nearest_symbol_from_address (gpointer address,
+                                 GumNearestSymbolDetails * nearest)
+{
+  Dl_info dl_info;
+
+  if (!dladdr (address, &dl_info))
+  {
+    nearest->name = NULL;
+    nearest->address = NULL;
+    return;
+  }
+
+  nearest->name = dl_info.dli_sname;
+  nearest->address = dl_info.dli_saddr;
+}
+
 static GumModuleEntry *
 gum_module_entry_from_path_and_base (const gchar * path,
                                      GumAddress base_address)
@@ -471,6 +511,7 @@ gum_module_entry_from_path_and_base (const gchar * path,
   module = gum_elf_module_new_from_memory (path, base_address);
 
   if (module == NULL ||
+      !gum_elf_module_ensure_file_loaded (module) ||
       dwarf_elf_init_b (module->elf, DW_DLC_READ, DW_GROUPNUMBER_ANY,
       gum_on_dwarf_error, NULL, &dbg, NULL) != DW_DLV_OK)
   {
@@ -480,6 +521,10 @@ gum_module_entry_from_path_and_base (const gchar * path,
   entry = g_slice_new (GumModuleEntry);
   entry->module = module;
   entry->dbg = dbg;
+  entry->index = NULL;
+  entry->index_initialized = FALSE;
+  entry->symbols = NULL;
+  entry->symbols_initialized = FALSE;
   entry->collected = FALSE;
 
   g_hash_table_insert (gum_module_entries, g_strdup (path), entry);
@@ -488,6 +533,72 @@ have_entry:
   return (entry->module != NULL) ? entry : NULL;
 }
 
+static gboolean
+gum_module_entry_contains (GumModuleEntry * self,
+                           gpointer address)
+{
+  GumAddress base_address = self->module->base_address;
+
+  return GUM_ADDRESS (address) >= base_address &&
+      GUM_ADDRESS (address) < base_address + self->module->mapped_size;
+}
+
+static void
+gum_module_entry_describe (GumModuleEntry * self,
+                           gpointer address,
+                           GumNearestSymbolDetails * nearest,
+                           GumDebugSymbolDetails * details)
+{
+  const GumDwarfSymbol * symbol;
+  const GumDwarfLine * line;
+  gsize offset;
+
+  details->address = GUM_ADDRESS (address);
+
+  g_strlcpy (details->module_name, self->module->name,
+      sizeof (details->module_name));
+
+  symbol = gum_module_entry_find_symbol (self, address, &line);
+  if (symbol != NULL && line != NULL)
+  {
+    g_strlcpy (details->symbol_name, symbol->name,
+        sizeof (details->symbol_name));
+
+    g_strlcpy (details->file_name, line->path, sizeof (details->file_name));
+    details->line_number = line->line_number;
+
+    return;
+  }
+
+  gum_module_entry_find_nearest_symbol (self, address, nearest);
+
+  if (nearest->name != NULL)
+  {
+    offset = GPOINTER_TO_SIZE (address) - GPOINTER_TO_SIZE (nearest->address);
+
+    if (offset == 0)
+    {
+      g_strlcpy (details->symbol_name, nearest->name,
+          sizeof (details->symbol_name));
+    }
+    else
+    {
+      g_snprintf (details->symbol_name, sizeof (details->symbol_name),
+          "%s+0x%" G_GSIZE_MODIFIER "x", nearest->name, offset);
+    }
+  }
+  else
+  {
+    offset = details->address - self->module->base_address;
+
+    g_snprintf (details->symbol_name, sizeof (details->symbol_name),
+        "0x%" G_GSIZE_MODIFIER "x", offset);
+  }
+
+  details->file_name[0] = '\0';
+  details->line_number = 0;
+}
+
 static Dwarf_Addr
 gum_module_entry_virtual_address_to_file (GumModuleEntry * self,
                                           gpointer address)
@@ -496,9 +607,97 @@ gum_module_entry_virtual_address_to_file (GumModuleEntry * self,
       (GUM_ADDRESS (address) - self->module->base_address);
 }
 
+static const GumDwarfSymbol *
+gum_module_entry_find_symbol (GumModuleEntry * self,
+                              gpointer address,
+                              const GumDwarfLine ** line)
+{
+  Dwarf_Addr file_address;
+  const GumDwarfCompilationUnit * unit;
+  GumDwarfIndex * index;
+  const GumDwarfSymbol * symbol;
+
+  index = gum_module_entry_get_index (self);
+  if (index == NULL)
+    return NULL;
+
+  file_address = gum_module_entry_virtual_address_to_file (self, address);
+
+  unit = gum_dwarf_index_find_unit (index, file_address);
+  if (unit == NULL)
+    return NULL;
+
+  symbol = gum_dwarf_unit_find_symbol (unit, file_address);
+  if (symbol == NULL)
+    return NULL;
+
+  if (line != NULL)
+  {
+    *line = gum_dwarf_unit_find_line (unit, file_address,
+        symbol->line_number);
+  }
+
+  return symbol;
+}
+
+static void
+gum_module_entry_find_nearest_symbol (GumModuleEntry * self,
+                                      gpointer address,
+                                      GumNearestSymbolDetails * nearest)
+{
+  const GumSymbolTableEntry * symbol;
+
+  symbol = gum_symbol_table_find (gum_module_entry_get_symbols (self),
+      GUM_ADDRESS (address));
+  if (symbol == NULL)
+    return;
+
+  nearest->name = symbol->name;
+  nearest->address = GSIZE_TO_POINTER (symbol->address);
+}
+
+/*
+ * The symbol table and DWARF index are built at most once per entry, without
+ * holding the global lock, and are immutable afterwards. Entries live until
+ * deinitialization, so they may be queried after the lock is dropped.
+ */
+
+static GumSymbolTable *
+gum_module_entry_get_symbols (GumModuleEntry * self)
+{
+  if (g_once_init_enter (&self->symbols_initialized))
+  {
+    self->symbols = gum_symbol_table_new (self->module);
+
+    g_once_init_leave (&self->symbols_initialized, TRUE);
+  }
+
+  return self->symbols;
+}
+
+static GumDwarfIndex *
+gum_module_entry_get_index (GumModuleEntry * self)
+{
+  if (g_once_init_enter (&self->index_initialized))
+  {
+    if (self->dbg != NULL)
+      self->index = gum_dwarf_index_new (self->dbg);
+
+    g_once_init_leave (&self->index_initialized, TRUE);
+  }
+
+  return self->index;
+}
+
 static void
 gum_module_entry_free (GumModuleEntry * entry)
 {
+  if (entry->symbols != NULL)
+    gum_symbol_table_free (entry->symbols);
+
+  if (entry->index != NULL)
+    gum_dwarf_index_free (entry->index);
+
   if (entry->dbg != NULL)
     dwarf_finish (entry->dbg, NULL);
 
@@ -512,10 +711,19 @@ static GHashTable *
 gum_get_function_addresses (void)
 {
   gboolean need_update;
+  guint64 generation;
 
   gum_symbol_util_ensure_initialized ();
 
-  if (gum_cache_timer == NULL)
+  if (_gum_process_query_module_generation (&generation))
+  {
+    need_update = !gum_cache_generation_valid ||
+        generation != gum_cache_generation;
+
+    gum_cache_generation = generation;
+    gum_cache_generation_valid = TRUE;
+  }
+  else if (gum_cache_timer == NULL)
   {
     gum_cache_timer = g_timer_new ();
 
@@ -539,38 +747,36 @@ gum_collect_module_functions (const GumModuleDetails * details,
                               gpointer user_data)
 {
   GumModuleEntry * entry;
+  GArray * entries;
+  guint i;
 
   entry = gum_module_entry_from_path_and_base (details->path,
       details->range->base_address);
   if (entry == NULL || entry->collected)
     return TRUE;
 
-  gum_elf_module_enumerate_dynamic_symbols (entry->module,
-      gum_collect_symbol_if_function, NULL);
+  entries = gum_module_entry_get_symbols (entry)->entries;
+  for (i = 0; i != entries->len; i++)
+  {
+    const GumSymbolTableEntry * symbol =
+        &g_array_index (entries, GumSymbolTableEntry, i);
 
-  gum_elf_module_enumerate_symbols (entry->module,
-      gum_collect_symbol_if_function, NULL);
+    if (symbol->type == STT_FUNC)
+      gum_collect_function (symbol->name, GSIZE_TO_POINTER (symbol->address));
+  }
 
   entry->collected = TRUE;
 
   return TRUE;
 }
 
-static gboolean
-gum_collect_symbol_if_function (const GumElfSymbolDetails * details,
-                                gpointer user_data)
+static void
+gum_collect_function (const gchar * name,
+                      gpointer address)
 {
-  const gchar * name;
-  gpointer address;
   GArray * addresses;
   gboolean already_collected;
 
-  if (details->section_header_index == SHN_UNDEF || details->type != STT_FUNC)
-    return TRUE;
-
-  name = details->name;
-  address = GSIZE_TO_POINTER (details->address);
-
   already_collected = FALSE;
 
   addresses = g_hash_table_lookup (gum_function_addresses, name);
@@ -595,8 +801,6 @@ gum_collect_symbol_if_function (const GumElfSymbolDetails * details,
 
   if (!already_collected)
     g_array_append_val (addresses, address);
-
-  return TRUE;
 }
 
 static void
@@ -623,6 +827,7 @@ static void
 gum_symbol_util_deinitialize (void)
 {
   g_clear_pointer (&gum_cache_timer, g_timer_destroy);
+  gum_cache_generation_valid = FALSE;
 
   g_hash_table_unref (gum_function_addresses);
   gum_function_addresses = NULL;
@@ -637,110 +842,246 @@ gum_on_dwarf_error (Dwarf_Error error,
 {
 }
 
-static Dwarf_Die
-gum_find_cu_die_by_virtual_address (Dwarf_Debug dbg,
-                                    Dwarf_Addr address)
+static GumSymbolTable *
+gum_symbol_table_new (GumElfModule * module)
 {
-  Dwarf_Die result;
-  GumFindCuDieOperation op;
+  GumSymbolTable * table;
 
-  op.needle = address;
-  op.found = FALSE;
-  op.cu_die_offset = 0;
+  table = g_slice_new (GumSymbolTable);
+  table->strings = g_string_chunk_new (4096);
+  table->entries = g_array_new (FALSE, FALSE, sizeof (GumSymbolTableEntry));
 
-  gum_enumerate_cu_dies (dbg, TRUE,
-      (GumFoundCuDieFunc) gum_store_cu_die_offset_if_containing_address, &op);
+  if (module != NULL)
+  {
+    gum_elf_module_enumerate_dynamic_symbols (module,
+        (GumElfFoundSymbolFunc) gum_symbol_table_add, table);
+    gum_elf_module_enumerate_symbols (module,
+        (GumElfFoundSymbolFunc) gum_symbol_table_add, table);
+  }
+
+  g_array_sort (table->entries, (GCompareFunc) gum_symbol_table_entry_compare);
+
+  return table;
+}
+
+static void
+gum_symbol_table_free (GumSymbolTable * table)
+{
+  g_array_free (table->entries, TRUE);
+  g_string_chunk_free (table->strings);
+
+  g_slice_free (GumSymbolTable, table);
+}
+
+static gboolean
+gum_symbol_table_add (const GumElfSymbolDetails * details,
+                      GumSymbolTable * self)
+{
+  GumSymbolTableEntry entry;
 
-  if (!op.found)
+  if (details->section_header_index == SHN_UNDEF || details->address == 0)
+    return TRUE;
+
+  if (details->type != STT_FUNC && details->type != STT_OBJECT)
+    return TRUE;
+
+  entry.address = details->address;
+  entry.size = details->size;
+  entry.name = g_string_chunk_insert_const (self->strings, details->name);
+  entry.type = details->type;
+  entry.bind = details->bind;
+
+  g_array_append_val (self->entries, entry);
+
+  return TRUE;
+}
+
+static const GumSymbolTableEntry *
+gum_symbol_table_find (GumSymbolTable * self,
+                       GumAddress address)
+{
+  guint lower, upper;
+  const GumSymbolTableEntry * symbol;
+
+  lower = 0;
+  upper = self->entries->len;
+
+  while (lower < upper)
+  {
+    guint mid = lower + ((upper - lower) / 2);
+
+    symbol = &g_array_index (self->entries, GumSymbolTableEntry, mid);
+    if (symbol->address <= address)
+      lower = mid + 1;
+    else
+      upper = mid;
+  }
+
+  if (lower == 0)
     return NULL;
 
-  result = NULL;
-  dwarf_offdie (dbg, op.cu_die_offset, &result, NULL);
+  symbol = &g_array_index (self->entries, GumSymbolTableEntry, lower - 1);
 
-  return result;
+  /* Aliases share an address; the sort order puts the preferred one first. */
+  while (symbol != (GumSymbolTableEntry *) self->entries->data &&
+      (symbol - 1)->address == symbol->address)
+  {
+    symbol--;
+  }
+
+  if (symbol->size == 0)
+    return (address == symbol->address) ? symbol : NULL;
+
+  if (address >= symbol->address + symbol->size)
+    return NULL;
+
+  return symbol;
+}
+
+static gint
+gum_symbol_table_entry_compare (const GumSymbolTableEntry * lhs,
+                                const GumSymbolTableEntry * rhs)
+{
+  if (lhs->address != rhs->address)
+    return (lhs->address < rhs->address) ? -1 : 1;
+
+  if (lhs->size != rhs->size)
+    return (lhs->size > rhs->size) ? -1 : 1;
+
+  if (lhs->bind != rhs->bind)
+  {
+    if (lhs->bind == STB_GLOBAL)
+      return -1;
+    if (rhs->bind == STB_GLOBAL)
+      return 1;
+  }
+
+  return strcmp (lhs->name, rhs->name);
+}
+
+static GumDwarfIndex *
+gum_dwarf_index_new (Dwarf_Debug dbg)
+{
+  GumDwarfIndex * index;
+
+  index = g_slice_new (GumDwarfIndex);
+  index->strings = g_string_chunk_new (4096);
+  index->ranges = g_array_new (FALSE, FALSE, sizeof (GumDwarfAddressRange));
+  index->units = g_array_new (FALSE, FALSE, sizeof (GumDwarfCompilationUnit));
+
+  gum_enumerate_cu_dies (dbg, TRUE,
+      (GumFoundCuDieFunc) gum_dwarf_index_add_unit, index);
+
+  g_array_sort (index->ranges, (GCompareFunc) gum_dwarf_address_range_compare);
+
+  return index;
+}
+
+static void
+gum_dwarf_index_free (GumDwarfIndex * index)
+{
+  guint i;
+
+  for (i = 0; i != index->units->len; i++)
+  {
+    GumDwarfCompilationUnit * unit =
+        &g_array_index (index->units, GumDwarfCompilationUnit, i);
+
+    g_array_free (unit->lines, TRUE);
+    g_array_free (unit->symbols, TRUE);
+  }
+  g_array_free (index->units, TRUE);
+
+  g_array_free (index->ranges, TRUE);
+  g_string_chunk_free (index->strings);
+
+  g_slice_free (GumDwarfIndex, index);
 }
 
 static gboolean
-gum_store_cu_die_offset_if_containing_address (const GumCuDieDetails * details,
-                                               GumFindCuDieOperation * op)
+gum_dwarf_index_add_unit (const GumCuDieDetails * details,
+                          GumDwarfIndex * self)
 {
   Dwarf_Debug dbg = details->dbg;
   Dwarf_Die die = details->cu_die;
   Dwarf_Off ranges_offset;
   Dwarf_Ranges * ranges;
   Dwarf_Signed range_count, range_index;
+  guint unit_index, ranges_added;
+  GumDwarfCompilationUnit unit;
+  GumDwarfCollectUnitContext ctx;
 
   if (!gum_read_attribute_offset (dbg, die, DW_AT_ranges, &ranges_offset))
-    goto skip;
+    return TRUE;
 
   if (dwarf_get_ranges_a (dbg, ranges_offset, die, &ranges, &range_count, NULL,
       NULL) != DW_DLV_OK)
-    goto skip;
+    return TRUE;
+
+  unit_index = self->units->len;
+  ranges_added = 0;
 
   for (range_index = 0; range_index < range_count; range_index++)
   {
     Dwarf_Ranges * range = &ranges[range_index];
+    GumDwarfAddressRange r;
 
     if (range->dwr_type != DW_RANGES_ENTRY)
       break;
 
-    if (op->needle >= range->dwr_addr1 && op->needle < range->dwr_addr2)
-    {
-      op->found = TRUE;
-      dwarf_dieoffset (die, &op->cu_die_offset, NULL);
+    if (range->dwr_addr1 >= range->dwr_addr2)
+      continue;
 
-      break;
-    }
+    r.start = range->dwr_addr1;
+    r.end = range->dwr_addr2;
+    r.unit_index = unit_index;
+    g_array_append_val (self->ranges, r);
+
+    ranges_added++;
   }
 
   dwarf_ranges_dealloc (dbg, ranges, range_count);
 
-skip:
-  return !op->found;
-}
+  if (ranges_added == 0)
+    return TRUE;
 
-static gboolean
-gum_find_symbol_by_virtual_address (Dwarf_Debug dbg,
-                                    Dwarf_Die cu_die,
-                                    Dwarf_Addr address,
-                                    GumDwarfSymbolDetails * details)
-{
-  GumFindSymbolOperation op;
+  unit.symbols = g_array_new (FALSE, FALSE, sizeof (GumDwarfSymbol));
+  unit.lines = g_array_new (FALSE, FALSE, sizeof (GumDwarfLine));
 
-  details->name = NULL;
-  details->line_number = 0;
+  ctx.index = self;
+  ctx.unit = &unit;
+  gum_enumerate_dies (dbg, die,
+      (GumFoundDieFunc) gum_dwarf_index_collect_symbol, &ctx);
+
+  gum_dwarf_index_collect_lines (self, &unit, dbg, die);
 
-  op.needle = address;
-  op.symbol = details;
-  op.closest_address = 0;
+  g_array_sort (unit.symbols, (GCompareFunc) gum_dwarf_symbol_compare);
+  g_array_sort (unit.lines, (GCompareFunc) gum_dwarf_line_compare);
 
-  gum_enumerate_dies (dbg, cu_die,
-      (GumFoundDieFunc) gum_collect_die_if_closest_so_far, &op);
+  g_array_append_val (self->units, unit);
 
-  return details->name != NULL;
+  return TRUE;
 }
 
 static gboolean
-gum_collect_die_if_closest_so_far (const GumDieDetails * details,
-                                   GumFindSymbolOperation * op)
+gum_dwarf_index_collect_symbol (const GumDieDetails * details,
+                                GumDwarfCollectUnitContext * ctx)
 {
   Dwarf_Debug dbg = details->dbg;
   Dwarf_Die die = details->die;
-  GumDwarfSymbolDetails * symbol = op->symbol;
-  Dwarf_Half tag;
-  Dwarf_Addr address;
-
-  if (dwarf_tag (die, &tag, NULL) != DW_DLV_OK)
-    return TRUE;
+  GumDwarfSymbol symbol;
+  gchar * name;
+  Dwarf_Unsigned line_number;
 
-  if (tag == DW_TAG_subprogram)
+  if (details->tag == DW_TAG_subprogram)
   {
-    if (!gum_read_attribute_address (dbg, die, DW_AT_low_pc, &address))
+    if (!gum_read_attribute_address (dbg, die, DW_AT_low_pc, &symbol.address))
       return TRUE;
   }
-  else if (tag == DW_TAG_variable)
+  else if (details->tag == DW_TAG_variable)
   {
-    if (!gum_read_attribute_location (dbg, die, DW_AT_location, &address))
+    if (!gum_read_attribute_location (dbg, die, DW_AT_location,
+        &symbol.address))
       return TRUE;
   }
   else
@@ -748,80 +1089,205 @@ gum_collect_die_if_closest_so_far (const GumDieDetails * details,
     return TRUE;
   }
 
-  if (op->needle < address)
+  if (symbol.address == 0)
     return TRUE;
 
-  if (op->closest_address == 0 ||
-      (op->needle - address) < (op->needle - op->closest_address))
+  if (gum_read_die_name (dbg, die, &name))
   {
-    Dwarf_Unsigned line_number;
+    symbol.name = g_string_chunk_insert (ctx->index->strings, name);
+    g_free (name);
+  }
+  else
+  {
+    symbol.name = NULL;
+  }
 
-    op->closest_address = address;
+  if (gum_read_attribute_uint (dbg, die, DW_AT_decl_line, &line_number))
+    symbol.line_number = line_number;
+  else
+    symbol.line_number = 0;
 
-    g_clear_pointer (&symbol->name, g_free);
-    gum_read_die_name (dbg, die, &symbol->name);
-
-    if (gum_read_attribute_uint (dbg, die, DW_AT_decl_line, &line_number))
-    {
-      symbol->line_number = line_number;
-    }
-  }
+  g_array_append_val (ctx->unit->symbols, symbol);
 
   return TRUE;
 }
 
-static gboolean
-gum_find_line_by_virtual_address (Dwarf_Debug dbg,
-                                  Dwarf_Die cu_die,
-                                  Dwarf_Addr address,
-                                  guint symbol_line_number,
-                                  GumDwarfSourceDetails * details)
+static void
+gum_dwarf_index_collect_lines (GumDwarfIndex * self,
+                               GumDwarfCompilationUnit * unit,
+                               Dwarf_Debug dbg,
+                               Dwarf_Die cu_die)
 {
-  gboolean success;
   Dwarf_Line * lines;
   Dwarf_Signed line_count, line_index;
 
   if (dwarf_srclines (cu_die, &lines, &line_count, NULL) != DW_DLV_OK)
-    return FALSE;
-
-  success = FALSE;
+    return;
 
   for (line_index = 0; line_index != line_count; line_index++)
   {
     Dwarf_Line line = lines[line_index];
-    Dwarf_Addr line_address;
+    GumDwarfLine l;
+    Dwarf_Unsigned line_number;
+    char * path;
 
-    if (dwarf_lineaddr (line, &line_address, NULL) != DW_DLV_OK)
+    if (dwarf_lineaddr (line, &l.address, NULL) != DW_DLV_OK)
       continue;
 
-    if (line_address >= address)
-    {
-      Dwarf_Unsigned line_number;
-      char * path;
+    if (dwarf_lineno (line, &line_number, NULL) != DW_DLV_OK)
+      continue;
 
-      if (dwarf_lineno (line, &line_number, NULL) != DW_DLV_OK)
-        continue;
+    if (dwarf_linesrc (line, &path, NULL) != DW_DLV_OK)
+      continue;
 
-      if (line_number < symbol_line_number)
-        continue;
+    l.line_number = line_number;
+    l.path = g_string_chunk_insert_const (self->strings, path);
 
-      if (dwarf_linesrc (line, &path, NULL) != DW_DLV_OK)
-        continue;
+    dwarf_dealloc (dbg, path, DW_DLA_STRING);
 
-      details->path = g_strdup (path);
-      details->line_number = line_number;
+    g_array_append_val (unit->lines, l);
+  }
 
-      success = TRUE;
+  dwarf_srclines_dealloc (dbg, lines, line_count);
+}
 
-      dwarf_dealloc (dbg, path, DW_DLA_STRING);
+static const GumDwarfCompilationUnit *
+gum_dwarf_index_find_unit (GumDwarfIndex * self,
+                           Dwarf_Addr address)
+{
+  guint lower, upper;
+  const GumDwarfAddressRange * range;
 
-      break;
-    }
+  lower = 0;
+  upper = self->ranges->len;
+
+  while (lower < upper)
+  {
+    guint mid = lower + ((upper - lower) / 2);
+
+    range = &g_array_index (self->ranges, GumDwarfAddressRange, mid);
+    if (range->start <= address)
+      lower = mid + 1;
+    else
+      upper = mid;
   }
 
-  dwarf_srclines_dealloc (dbg, lines, line_count);
+  if (lower == 0)
+    return NULL;
 
-  return success;
+  range = &g_array_index (self->ranges, GumDwarfAddressRange, lower - 1);
+  if (address >= range->end)
+    return NULL;
+
+  return &g_array_index (self->units, GumDwarfCompilationUnit,
+      range->unit_index);
+}
+
+static const GumDwarfSymbol *
+gum_dwarf_unit_find_symbol (const GumDwarfCompilationUnit * unit,
+                            Dwarf_Addr address)
+{
+  guint lower, upper;
+  const GumDwarfSymbol * symbol;
+
+  lower = 0;
+  upper = unit->symbols->len;
+
+  while (lower < upper)
+  {
+    guint mid = lower + ((upper - lower) / 2);
+
+    symbol = &g_array_index (unit->symbols, GumDwarfSymbol, mid);
+    if (symbol->address <= address)
+      lower = mid + 1;
+    else
+      upper = mid;
+  }
+
+  if (lower == 0)
+    return NULL;
+
+  symbol = &g_array_index (unit->symbols, GumDwarfSymbol, lower - 1);
+  if (symbol->name == NULL)
+    return NULL;
+
+  return symbol;
+}
+
+static const GumDwarfLine *
+gum_dwarf_unit_find_line (const GumDwarfCompilationUnit * unit,
+                          Dwarf_Addr address,
+                          guint symbol_line_number)
+{
+  guint lower, upper, i;
+
+  lower = 0;
+  upper = unit->lines->len;
+
+  while (lower < upper)
+  {
+    guint mid = lower + ((upper - lower) / 2);
+
+    if (g_array_index (unit->lines, GumDwarfLine, mid).address < address)
+      lower = mid + 1;
+    else
+      upper = mid;
+  }
+
+  for (i = lower; i != unit->lines->len; i++)
+  {
+    const GumDwarfLine * line = &g_array_index (unit->lines, GumDwarfLine, i);
+
+    if (line->line_number >= symbol_line_number)
+      return line;
+  }
+
+  return NULL;
+}
+
+static gint
+gum_dwarf_address_range_compare (const GumDwarfAddressRange * lhs,
+                                 const GumDwarfAddressRange * rhs)
+{
+  if (lhs->start < rhs->start)
+    return -1;
+
+  if (lhs->start > rhs->start)
+    return 1;
+
+  return 0;
+}
+
+static gint
+gum_dwarf_symbol_compare (const GumDwarfSymbol * lhs,
+                          const GumDwarfSymbol * rhs)
+{
+  if (lhs->address < rhs->address)
+    return -1;
+
+  if (lhs->address > rhs->address)
+    return 1;
+
+  return 0;
+}
+
+static gint
+gum_dwarf_line_compare (const GumDwarfLine * lhs,
+                        const GumDwarfLine * rhs)
+{
+  if (lhs->address < rhs->address)
+    return -1;
+
+  if (lhs->address > rhs->address)
+    return 1;
+
+  if (lhs->line_number < rhs->line_number)
+    return -1;
+
+  if (lhs->line_number > rhs->line_number)
+    return 1;
+
+  return 0;
 }
 
 static void
@@ -1082,3 +1548,19 @@ gum_compare_pointers (gconstpointer a,
 {
   return *((gconstpointer *) a) - *((gconstpointer *) b);
 }
+
+static gint
+gum_compare_address_indices (gconstpointer a,
+                             gconstpointer b,
+                             gpointer user_data)
+{
+  const gpointer * addresses = user_data;
+  gpointer lhs = addresses[*((const guint *) a)];
+  gpointer rhs = addresses[*((const guint *) b)];
+
+  if (lhs < rhs)
+    return -1;
+  if (lhs > rhs)
+    return 1;
+  return 0;
+}
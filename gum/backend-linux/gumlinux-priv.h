@@ -0,0 +1,49 @@
+/*
+ * Copyright (C) 2017 Ole André Vadla Ravnås <oleavr@nowsecure.com>
+ *
+ * Licence: wxWindows Library Licence, Version 3.1
+ */
+
+#ifndef __GUM_LINUX_PRIV_H__
+#define __GUM_LINUX_PRIV_H__
+
+#include "gumprocess.h"
+
+#include <sys/types.h>
+
+#define GUM_PROC_MAPS_BUFFER_SIZE (16 * 1024)
+
+G_BEGIN_DECLS
+
+typedef struct _GumProcMapsIter GumProcMapsIter;
+typedef struct _GumProcMapsEntry GumProcMapsEntry;
+
+struct _GumProcMapsIter
+{
+  gint fd;
+  gboolean eof;
+  gchar * read_cursor;
+  gchar * write_cursor;
+  gchar buffer[GUM_PROC_MAPS_BUFFER_SIZE];
+};
+
+struct _GumProcMapsEntry
+{
+  GumMemoryRange range;
+  GumPageProtection prot;
+  gboolean shared;
+  guint64 offset;
+  guint64 inode;
+  const gchar * path;
+};
+
+G_GNUC_INTERNAL void _gum_proc_maps_iter_init_for_self (GumProcMapsIter * iter);
+G_GNUC_INTERNAL void _gum_proc_maps_iter_init_for_pid (GumProcMapsIter * iter,
+    pid_t pid);
+G_GNUC_INTERNAL void _gum_proc_maps_iter_destroy (GumProcMapsIter * iter);
+G_GNUC_INTERNAL gboolean _gum_proc_maps_iter_next (GumProcMapsIter * iter,
+    GumProcMapsEntry * entry);
+
+G_END_DECLS
+
+#endif
@@ -6,10 +6,10 @@
 
 #include "gummemory.h"
 
+#include "gumlinux-priv.h"
 #include "gummemory-priv.h"
 #include "valgrind.h"
 
-#include <stdio.h>
 #include <string.h>
 #include <sys/mman.h>
 #include <unistd.h>
@@ -125,8 +125,8 @@ gum_memory_get_protection (GumAddress address,
                            GumPageProtection * prot)
 {
   gboolean success;
-  FILE * fp;
-  gchar line[1024 + 1];
+  GumProcMapsIter iter;
+  GumProcMapsEntry entry;
 
   if (size == NULL || prot == NULL)
   {
@@ -178,36 +178,25 @@ gum_memory_get_protection (GumAddress address,
   *size = 0;
   *prot = GUM_PAGE_NO_ACCESS;
 
-  fp = fopen ("/proc/self/maps", "r");
-  g_assert (fp != NULL);
+  _gum_proc_maps_iter_init_for_self (&iter);
 
-  while (fgets (line, sizeof (line), fp) != NULL)
+  while (_gum_proc_maps_iter_next (&iter, &entry))
   {
-    gint n_items;
-    gpointer start, end;
-    gchar protection[16];
+    const GumAddress start = entry.range.base_address;
+    const GumAddress end = start + entry.range.size;
 
-    n_items = sscanf (line, "%p-%p %s ", &start, &end, protection);
-    g_assert_cmpint (n_items, ==, 3);
-
-    if (GUM_ADDRESS (start) > address)
+    if (start > address)
       break;
-    else if (address >= GUM_ADDRESS (start) &&
-        address + n - 1 < GUM_ADDRESS (end))
+    else if (address >= start && address + n - 1 < end)
     {
       success = TRUE;
       *size = 1;
-      if (protection[0] == 'r')
-        *prot |= GUM_PAGE_READ;
-      if (protection[1] == 'w')
-        *prot |= GUM_PAGE_WRITE;
-      if (protection[2] == 'x')
-        *prot |= GUM_PAGE_EXECUTE;
+      *prot = entry.prot;
       break;
     }
   }
 
-  fclose (fp);
+  _gum_proc_maps_iter_destroy (&iter);
 
   return success;
 }
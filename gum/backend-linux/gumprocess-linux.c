@@ -7,12 +7,15 @@
 #include "gumprocess-priv.h"
 
 #include "backend-elf/gumelfmodule.h"
+#include "gum-init.h"
 #include "gumlinux.h"
+#include "gumlinux-priv.h"
 #include "gummodulemap.h"
 #include "valgrind.h"
 
 #include <dlfcn.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <link.h>
 #include <sched.h>
 #include <stdio.h>
@@ -36,7 +39,6 @@
 # include <link.h>
 #endif
 
-#define GUM_MAPS_LINE_SIZE (1024 + PATH_MAX)
 #define GUM_PSR_THUMB 0x20
 
 #if defined (HAVE_I386)
@@ -77,6 +79,9 @@
   })
 
 typedef struct _GumModifyThreadContext GumModifyThreadContext;
+typedef struct _GumCollectThreadContextsContext GumCollectThreadContextsContext;
+typedef struct _GumThreadContextRequest GumThreadContextRequest;
+typedef struct _GumHelperThread GumHelperThread;
 typedef guint8 GumModifyThreadAck;
 
 typedef struct _GumEnumerateModulesContext GumEnumerateModulesContext;
@@ -84,9 +89,14 @@ typedef struct _GumEmitExecutableModuleContext GumEmitExecutableModuleContext;
 typedef struct _GumCopyLinkerModuleContext GumCopyLinkerModuleContext;
 typedef struct _GumEnumerateImportsContext GumEnumerateImportsContext;
 typedef struct _GumDependencyExport GumDependencyExport;
+typedef struct _GumModuleExportIndex GumModuleExportIndex;
 typedef struct _GumEnumerateModuleSymbolContext GumEnumerateModuleSymbolContext;
 typedef struct _GumEnumerateModuleRangesContext GumEnumerateModuleRangesContext;
 typedef struct _GumResolveModuleNameContext GumResolveModuleNameContext;
+typedef struct _GumQueryModuleGenerationContext
+    GumQueryModuleGenerationContext;
+typedef struct _GumProcMapsSnapshot GumProcMapsSnapshot;
+typedef struct _GumProcMapsModule GumProcMapsModule;
 
 typedef gint (* GumFoundDlPhdrFunc) (struct dl_phdr_info * info,
     gsize size, gpointer data);
@@ -116,6 +126,27 @@ struct _GumModifyThreadContext
   GumCpuContext cpu_context;
 };
 
+struct _GumCollectThreadContextsContext
+{
+  GumThreadContextRequest * requests;
+  guint n_requests;
+};
+
+struct _GumThreadContextRequest
+{
+  GumThreadId thread_id;
+  gboolean attached;
+  gboolean collected;
+  GumCpuContext cpu_context;
+};
+
+struct _GumHelperThread
+{
+  gssize pid;
+  gpointer stack;
+  gpointer tls;
+};
+
 struct _GumEnumerateModulesContext
 {
   GumFoundModuleFunc func;
@@ -160,6 +191,15 @@ struct _GumDependencyExport
   GumAddress address;
 };
 
+struct _GumModuleExportIndex
+{
+  volatile gint ref_count;
+
+  GArray * exports;
+  GHashTable * exports_by_name;
+  GStringChunk * names;
+};
+
 struct _GumEnumerateModuleSymbolContext
 {
   GumFoundSymbolFunc func;
@@ -182,6 +222,30 @@ struct _GumResolveModuleNameContext
   GumAddress base;
 };
 
+struct _GumQueryModuleGenerationContext
+{
+  guint64 generation;
+  gboolean valid;
+};
+
+struct _GumProcMapsSnapshot
+{
+  volatile gint ref_count;
+
+  guint64 module_generation;
+  guint64 vm_pages;
+
+  GArray * entries;
+  GArray * modules;
+  GStringChunk * paths;
+};
+
+struct _GumProcMapsModule
+{
+  GumMemoryRange range;
+  const gchar * path;
+};
+
 struct _GumUserDesc
 {
   guint entry_number;
@@ -196,12 +260,18 @@ struct _GumUserDesc
 };
 
 static gint gum_do_modify_thread (gpointer data);
+static void gum_process_collect_thread_contexts (GArray * threads);
+static gint gum_do_collect_thread_contexts (gpointer data);
+static gboolean gum_await_thread_stop (pid_t tid);
+static gboolean gum_capture_current_thread_context (
+    GumCpuContext * cpu_context);
+static void gum_helper_thread_start (GumHelperThread * helper,
+    GumCloneFunc func, gpointer data);
+static void gum_helper_thread_join (GumHelperThread * helper);
 static gboolean gum_await_ack (gint fd, GumModifyThreadAck expected_ack);
 static void gum_put_ack (gint fd, GumModifyThreadAck ack);
 
-static void gum_store_cpu_context (GumThreadId thread_id,
-    GumCpuContext * cpu_context, gpointer user_data);
-
+static GumDlIteratePhdrImpl gum_get_dl_iterate_phdr (void);
 static void gum_process_enumerate_modules_by_using_libc (
     GumDlIteratePhdrImpl iterate_phdr, GumFoundModuleFunc func,
     gpointer user_data);
@@ -210,6 +280,8 @@ static gint gum_emit_module_from_phdr (struct dl_phdr_info * info, gsize size,
 static GumAddress gum_resolve_base_address_from_phdr (
     struct dl_phdr_info * info);
 #ifndef HAVE_ANDROID
+static gint gum_store_module_generation_from_phdr (struct dl_phdr_info * info,
+    gsize size, gpointer user_data);
 static gboolean gum_emit_executable_module (const GumModuleDetails * details,
     gpointer user_data);
 #endif
@@ -219,6 +291,22 @@ static void gum_process_enumerate_modules_by_parsing_proc_maps (
 
 static void gum_process_build_named_range_indexes (GHashTable ** names,
     GHashTable ** sizes);
+static GumProcMapsSnapshot * gum_proc_maps_snapshot_obtain (void);
+static GumProcMapsSnapshot * gum_proc_maps_snapshot_new (
+    guint64 module_generation, guint64 vm_pages);
+static void gum_proc_maps_snapshot_collect_modules (
+    GumProcMapsSnapshot * self);
+static void gum_proc_maps_snapshot_unref (GumProcMapsSnapshot * snapshot);
+static void gum_proc_maps_snapshot_do_deinit (void);
+static gboolean gum_query_vm_pages (guint64 * pages);
+static void gum_proc_maps_iter_init_for_path (GumProcMapsIter * iter,
+    const gchar * path);
+static gboolean gum_proc_maps_iter_read_line (GumProcMapsIter * iter,
+    gchar ** line);
+static gboolean gum_proc_maps_parse_line (gchar * line,
+    GumProcMapsEntry * entry);
+static gboolean gum_try_parse_hex (gchar ** cursor, guint64 * value);
+static gboolean gum_try_parse_dec (gchar ** cursor, guint64 * value);
 #ifdef HAVE_ANDROID
 static gboolean gum_copy_linker_module (const GumModuleDetails * details,
     gpointer user_data);
@@ -252,6 +340,17 @@ static gboolean gum_module_path_equals (const gchar * path,
 
 static GumElfModule * gum_open_elf_module (const gchar * name);
 
+static GumModuleExportIndex * gum_module_export_index_obtain (
+    const gchar * module_name);
+static GumModuleExportIndex * gum_module_export_index_new (
+    const gchar * module_name);
+static GumModuleExportIndex * gum_module_export_index_ref (
+    GumModuleExportIndex * index);
+static void gum_module_export_index_unref (GumModuleExportIndex * index);
+static gboolean gum_module_export_index_add (const GumExportDetails * details,
+    gpointer user_data);
+static void gum_module_export_index_do_deinit (void);
+
 #ifdef HAVE_ANDROID
 static gboolean gum_module_name_is_android_linker (const gchar * name);
 #endif
@@ -274,11 +373,17 @@ static gssize gum_libc_read (gint fd, gpointer buf, gsize count);
 static gssize gum_libc_write (gint fd, gconstpointer buf, gsize count);
 static gssize gum_libc_ptrace (gsize request, pid_t pid, gpointer address,
     gpointer data);
+static gssize gum_libc_waitpid (pid_t pid, gint * status, gint options);
 
 #define gum_libc_syscall_3(n, a, b, c) gum_libc_syscall_4 (n, a, b, c, 0)
 static gssize gum_libc_syscall_4 (gsize n, gsize a, gsize b, gsize c, gsize d);
 
 static gboolean gum_is_regset_supported = TRUE;
+static GumProcMapsSnapshot * gum_proc_maps_snapshot = NULL;
+
+static GMutex gum_export_index_lock;
+static GHashTable * gum_export_indexes = NULL;
+static guint64 gum_export_indexes_generation = 0;
 
 gboolean
 gum_process_is_debugger_attached (void)
@@ -339,9 +444,7 @@ gum_process_modify_thread (GumThreadId thread_id,
   {
     GumModifyThreadContext ctx;
     gint res, fd;
-    gssize child;
-    gpointer stack, tls;
-    GumUserDesc * desc;
+    GumHelperThread helper;
 
     res = socketpair (AF_UNIX, SOCK_STREAM, 0, ctx.fd);
     g_assert_cmpint (res, ==, 0);
@@ -349,69 +452,7 @@ gum_process_modify_thread (GumThreadId thread_id,
 
     fd = ctx.fd[0];
 
-    stack = gum_alloc_n_pages (1, GUM_PAGE_RW);
-    tls = gum_alloc_n_pages (1, GUM_PAGE_RW);
-
-#if defined (HAVE_I386) && GLIB_SIZEOF_VOID_P == 4
-    GumUserDesc segment;
-    gint gs;
-
-    asm volatile (
-        "movw %%gs, %w0"
-        : "=q" (gs)
-    );
-
-    segment.entry_number = (gs & 0xffff) >> 3;
-    segment.base_addr = GPOINTER_TO_SIZE (tls);
-    segment.limit = 0xfffff;
-    segment.seg_32bit = 1;
-    segment.contents = 0;
-    segment.read_exec_only = 0;
-    segment.limit_in_pages = 1;
-    segment.seg_not_present = 0;
-    segment.useable = 1;
-
-    desc = &segment;
-#else
-    desc = tls;
-#endif
-
-    /*
-     * It seems like the only reliable way to read/write the registers of
-     * another thread is to use ptrace(). We used to accomplish this by
-     * hi-jacking the target thread by installing a signal handler and sending a
-     * real-time signal directed at the target thread, and thus relying on the
-     * signal handler getting called in that thread. The signal handler would
-     * then provide us with read/write access to its registers. This hack would
-     * however not work if a thread was for example blocking in poll(), as the
-     * signal would then just get queued and we'd end up waiting indefinitely.
-     *
-     * It is however not possible to ptrace() another thread when we're in the
-     * same process group. This used to be supported in old kernels, but it was
-     * buggy and eventually dropped. So in order to use ptrace() we will need to
-     * spawn a new thread in a different process group so that it can ptrace()
-     * the target thread inside our process group. This is also the solution
-     * recommended by Linus:
-     *
-     * https://lkml.org/lkml/2006/9/1/217
-     *
-     * Because libc implementations don't expose an API to do this, and the
-     * thread setup code is private, where the TLS part is crucial for even just
-     * the syscall wrappers - due to them accessing `errno` - we cannot make any
-     * libc calls in this thread. And because the libc's clone() syscall wrapper
-     * typically writes to the child thread's TLS structures, which we cannot
-     * portably set up correctly, we cannot use the libc clone() syscall wrapper
-     * either.
-     */
-    child = gum_libc_clone (
-        gum_do_modify_thread,
-        stack + gum_query_page_size (),
-        CLONE_VM | CLONE_SETTLS,
-        &ctx,
-        NULL,
-        desc,
-        NULL);
-    g_assert_cmpint (child, >, 0);
+    gum_helper_thread_start (&helper, gum_do_modify_thread, &ctx);
 
     if (gum_await_ack (fd, GUM_ACK_ATTACHED))
     {
@@ -435,10 +476,7 @@ gum_process_modify_thread (GumThreadId thread_id,
       }
     }
 
-    waitpid (child, NULL, __WCLONE);
-
-    gum_free_pages (tls);
-    gum_free_pages (stack);
+    gum_helper_thread_join (&helper);
 
     close (ctx.fd[0]);
     close (ctx.fd[1]);
@@ -533,60 +571,298 @@ gum_put_ack (gint fd,
   GUM_TEMP_FAILURE_RETRY (gum_libc_write (fd, &value, sizeof (value)));
 }
 
+static void
+gum_helper_thread_start (GumHelperThread * helper,
+                         GumCloneFunc func,
+                         gpointer data)
+{
+  GumUserDesc * desc;
+
+  helper->stack = gum_alloc_n_pages (1, GUM_PAGE_RW);
+  helper->tls = gum_alloc_n_pages (1, GUM_PAGE_RW);
+
+#if defined (HAVE_I386) && GLIB_SIZEOF_VOID_P == 4
+  GumUserDesc segment;
+  gint gs;
+
+  asm volatile (
+      "movw %%gs, %w0"
+      : "=q" (gs)
+  );
+
+  segment.entry_number = (gs & 0xffff) >> 3;
+  segment.base_addr = GPOINTER_TO_SIZE (helper->tls);
+  segment.limit = 0xfffff;
+  segment.seg_32bit = 1;
+  segment.contents = 0;
+  segment.read_exec_only = 0;
+  segment.limit_in_pages = 1;
+  segment.seg_not_present = 0;
+  segment.useable = 1;
+
+  desc = &segment;
+#else
+  desc = helper->tls;
+#endif
+
+  /*
+   * It seems like the only reliable way to read/write the registers of
+   * another thread is to use ptrace(). We used to accomplish this by
+   * hi-jacking the target thread by installing a signal handler and sending a
+   * real-time signal directed at the target thread, and thus relying on the
+   * signal handler getting called in that thread. The signal handler would
+   * then provide us with read/write access to its registers. This hack would
+   * however not work if a thread was for example blocking in poll(), as the
+   * signal would then just get queued and we'd end up waiting indefinitely.
+   *
+   * It is however not possible to ptrace() another thread when we're in the
+   * same process group. This used to be supported in old kernels, but it was
+   * buggy and eventually dropped. So in order to use ptrace() we will need to
+   * spawn a new thread in a different process group so that it can ptrace()
+   * the target thread inside our process group. This is also the solution
+   * recommended by Linus:
+   *
+   * https://lkml.org/lkml/2006/9/1/217
+   *
+   * Because libc implementations don't expose an API to do this, and the
+   * thread setup code is private, where the TLS part is crucial for even just
+   * the syscall wrappers - due to them accessing `errno` - we cannot make any
+   * libc calls in this thread. And because the libc's clone() syscall wrapper
+   * typically writes to the child thread's TLS structures, which we cannot
+   * portably set up correctly, we cannot use the libc clone() syscall wrapper
+   * either.
+   */
+  helper->pid = gum_libc_clone (
+      func,
+      helper->stack + gum_query_page_size (),
+      CLONE_VM | CLONE_SETTLS,
+      data,
+      NULL,
+      desc,
+      NULL);
+  g_assert_cmpint (helper->pid, >, 0);
+}
+
+static void
+gum_helper_thread_join (GumHelperThread * helper)
+{
+  waitpid (helper->pid, NULL, __WCLONE);
+
+  gum_free_pages (helper->tls);
+  gum_free_pages (helper->stack);
+}
+
 void
-_gum_process_enumerate_threads (GumFoundThreadFunc func,
+_gum_process_enumerate_threads (GumThreadFlags flags,
+                                GumFoundThreadFunc func,
                                 gpointer user_data)
 {
+  GArray * threads;
   GDir * dir;
   const gchar * name;
+  guint i;
   gboolean carry_on = TRUE;
 
+  threads = g_array_new (FALSE, TRUE, sizeof (GumThreadDetails));
+
   dir = g_dir_open ("/proc/self/task", 0, NULL);
   g_assert (dir != NULL);
 
-  while (carry_on && (name = g_dir_read_name (dir)) != NULL)
+  while ((name = g_dir_read_name (dir)) != NULL)
   {
-    GumThreadDetails details;
+    GumThreadDetails * details;
 
-    details.id = atoi (name);
-    if (gum_thread_read_state (details.id, &details.state))
-    {
-      if (gum_process_modify_thread (details.id, gum_store_cpu_context,
-            &details.cpu_context))
-      {
-        carry_on = func (&details, user_data);
-      }
-    }
+    g_array_set_size (threads, threads->len + 1);
+    details = &g_array_index (threads, GumThreadDetails, threads->len - 1);
+
+    details->id = atoi (name);
+    if (!gum_thread_read_state (details->id, &details->state))
+      g_array_set_size (threads, threads->len - 1);
   }
 
   g_dir_close (dir);
+
+  if ((flags & GUM_THREAD_FLAGS_CPU_CONTEXT) != 0)
+    gum_process_collect_thread_contexts (threads);
+
+  for (i = 0; carry_on && i != threads->len; i++)
+    carry_on = func (&g_array_index (threads, GumThreadDetails, i), user_data);
+
+  g_array_free (threads, TRUE);
 }
 
+/*
+ * Captures the CPU context of every thread in a single pass: one helper
+ * attaches to all of them, waits for each to stop, reads their registers and
+ * detaches again, instead of spawning a helper per thread. Threads whose
+ * context could not be read are removed from the array.
+ */
 static void
-gum_store_cpu_context (GumThreadId thread_id,
-                       GumCpuContext * cpu_context,
-                       gpointer user_data)
+gum_process_collect_thread_contexts (GArray * threads)
 {
-  memcpy (user_data, cpu_context, sizeof (GumCpuContext));
+  GumThreadId current_thread_id;
+  GumCollectThreadContextsContext ctx;
+  GumThreadContextRequest * requests;
+  gboolean * collected;
+  guint n, i, j;
+
+  current_thread_id = gum_process_get_current_thread_id ();
+
+  requests = g_new0 (GumThreadContextRequest, threads->len);
+  collected = g_new0 (gboolean, threads->len);
+
+  n = 0;
+  for (i = 0; i != threads->len; i++)
+  {
+    GumThreadDetails * details = &g_array_index (threads, GumThreadDetails, i);
+
+    if (details->id == current_thread_id)
+    {
+      collected[i] =
+          gum_capture_current_thread_context (&details->cpu_context);
+    }
+    else
+    {
+      requests[n++].thread_id = details->id;
+    }
+  }
+
+  if (n != 0)
+  {
+    GumHelperThread helper;
+
+    ctx.requests = requests;
+    ctx.n_requests = n;
+
+    gum_helper_thread_start (&helper, gum_do_collect_thread_contexts, &ctx);
+    gum_helper_thread_join (&helper);
+  }
+
+  j = 0;
+  for (i = 0; i != threads->len; i++)
+  {
+    GumThreadDetails * details = &g_array_index (threads, GumThreadDetails, i);
+
+    if (details->id == current_thread_id)
+      continue;
+
+    if (requests[j].collected)
+    {
+      memcpy (&details->cpu_context, &requests[j].cpu_context,
+          sizeof (GumCpuContext));
+      collected[i] = TRUE;
+    }
+    j++;
+  }
+
+  j = 0;
+  for (i = 0; i != threads->len; i++)
+  {
+    if (!collected[i])
+      continue;
+
+    if (j != i)
+    {
+      g_array_index (threads, GumThreadDetails, j) =
+          g_array_index (threads, GumThreadDetails, i);
+    }
+    j++;
+  }
+  g_array_set_size (threads, j);
+
+  g_free (collected);
+  g_free (requests);
 }
 
-void
-gum_process_enumerate_modules (GumFoundModuleFunc func,
-                               gpointer user_data)
+static gint
+gum_do_collect_thread_contexts (gpointer data)
 {
-  static gsize iterate_phdr_value = 0;
-  GumDlIteratePhdrImpl iterate_phdr;
+  GumCollectThreadContextsContext * ctx = data;
+  guint i;
+  GumRegs regs;
 
-  if (g_once_init_enter (&iterate_phdr_value))
+  for (i = 0; i != ctx->n_requests; i++)
   {
-    gsize impl;
+    GumThreadContextRequest * request = &ctx->requests[i];
 
-    impl = GPOINTER_TO_SIZE (dlsym (RTLD_DEFAULT, "dl_iterate_phdr"));
+    request->attached = gum_libc_ptrace (PTRACE_ATTACH, request->thread_id,
+        NULL, NULL) >= 0;
+  }
 
-    g_once_init_leave (&iterate_phdr_value, impl + 1);
+  for (i = 0; i != ctx->n_requests; i++)
+  {
+    GumThreadContextRequest * request = &ctx->requests[i];
+
+    if (request->attached && !gum_await_thread_stop (request->thread_id))
+      request->attached = FALSE;
+  }
+
+  for (i = 0; i != ctx->n_requests; i++)
+  {
+    GumThreadContextRequest * request = &ctx->requests[i];
+
+    if (!request->attached)
+      continue;
+
+    if (gum_get_regs (request->thread_id, &regs) >= 0)
+    {
+      gum_parse_regs (&regs, &request->cpu_context);
+      request->collected = TRUE;
+    }
+
+    gum_libc_ptrace (PTRACE_DETACH, request->thread_id, NULL, NULL);
+  }
+
+  return 0;
+}
+
+/*
+ * Waits for the stop caused by our PTRACE_ATTACH. Any other signal that
+ * arrives first is handed back to the thread so it is not lost. Returns
+ * FALSE if the thread exited in the meantime.
+ */
+static gboolean
+gum_await_thread_stop (pid_t tid)
+{
+  while (TRUE)
+  {
+    gint status;
+    gssize res;
+
+    res = GUM_TEMP_FAILURE_RETRY (gum_libc_waitpid (tid, &status, __WALL));
+    if (res < 0 || !WIFSTOPPED (status))
+      return FALSE;
+
+    if (WSTOPSIG (status) == SIGSTOP)
+      return TRUE;
+
+    gum_libc_ptrace (PTRACE_CONT, tid, NULL,
+        GSIZE_TO_POINTER (WSTOPSIG (status)));
   }
+}
+
+static gboolean
+gum_capture_current_thread_context (GumCpuContext * cpu_context)
+{
+#ifndef HAVE_ANDROID
+  ucontext_t uc;
+
+  getcontext (&uc);
+  gum_linux_parse_ucontext (&uc, cpu_context);
+
+  return TRUE;
+#else
+  return FALSE;
+#endif
+}
+
+void
+gum_process_enumerate_modules (GumFoundModuleFunc func,
+                               gpointer user_data)
+{
+  GumDlIteratePhdrImpl iterate_phdr;
 
-  iterate_phdr = GSIZE_TO_POINTER (iterate_phdr_value - 1);
+  iterate_phdr = gum_get_dl_iterate_phdr ();
   if (iterate_phdr != NULL)
   {
     gum_process_enumerate_modules_by_using_libc (iterate_phdr, func, user_data);
@@ -597,6 +873,23 @@ gum_process_enumerate_modules (GumFoundModuleFunc func,
   }
 }
 
+static GumDlIteratePhdrImpl
+gum_get_dl_iterate_phdr (void)
+{
+  static gsize iterate_phdr_value = 0;
+
+  if (g_once_init_enter (&iterate_phdr_value))
+  {
+    gsize impl;
+
+    impl = GPOINTER_TO_SIZE (dlsym (RTLD_DEFAULT, "dl_iterate_phdr"));
+
+    g_once_init_leave (&iterate_phdr_value, impl + 1);
+  }
+
+  return GSIZE_TO_POINTER (iterate_phdr_value - 1);
+}
+
 static void
 gum_process_enumerate_modules_by_using_libc (GumDlIteratePhdrImpl iterate_phdr,
                                              GumFoundModuleFunc func,
@@ -776,193 +1069,262 @@ static void
 gum_process_enumerate_modules_by_parsing_proc_maps (GumFoundModuleFunc func,
                                                     gpointer user_data)
 {
-  FILE * fp;
-  const guint line_size = GUM_MAPS_LINE_SIZE;
-  gchar * line, * path, * next_path;
+  GumProcMapsSnapshot * snapshot;
+  guint i;
   gboolean carry_on = TRUE;
-  gboolean got_line = FALSE;
-
-  fp = fopen ("/proc/self/maps", "r");
-  g_assert (fp != NULL);
 
-  line = g_malloc (line_size);
+  snapshot = gum_proc_maps_snapshot_obtain ();
 
-  path = g_malloc (PATH_MAX);
-  next_path = g_malloc (PATH_MAX);
-
-  do
+  for (i = 0; carry_on && i != snapshot->modules->len; i++)
   {
-    const guint8 elf_magic[] = { 0x7f, 'E', 'L', 'F' };
+    GumProcMapsModule * module =
+        &g_array_index (snapshot->modules, GumProcMapsModule, i);
     GumModuleDetails details;
     GumMemoryRange range;
-    GumAddress end;
-    gchar perms[5] = { 0, };
-    gint n;
-    gboolean readable, executable, shared;
     gchar * name;
 
-    if (!got_line)
-    {
-      if (fgets (line, line_size, fp) == NULL)
-        break;
-    }
-    else
-    {
-      got_line = FALSE;
-    }
-
-    n = sscanf (line,
-        "%" G_GINT64_MODIFIER "x-%" G_GINT64_MODIFIER "x "
-        "%4c "
-        "%*x %*s %*d "
-        "%s",
-        &range.base_address, &end,
-        perms,
-        path);
-    if (n == 3)
-      continue;
-    g_assert_cmpint (n, ==, 4);
-
-    readable = perms[0] == 'r';
-    executable = perms[2] == 'x';
-    shared = perms[3] == 's';
-    if (!readable || !executable || shared)
-      continue;
-    else if (path[0] != '/' || g_str_has_prefix (path, "/dev/"))
-      continue;
-    else if (RUNNING_ON_VALGRIND && strstr (path, "/valgrind/") != NULL)
-      continue;
-    else if (memcmp (GSIZE_TO_POINTER (range.base_address), elf_magic,
-        sizeof (elf_magic)) != 0)
-      continue;
-
-    name = g_path_get_basename (path);
-
-    range.size = end - range.base_address;
+    range = module->range;
+    name = g_path_get_basename (module->path);
 
     details.name = name;
     details.range = &range;
-    details.path = path;
-
-    while (fgets (line, line_size, fp) != NULL)
-    {
-      n = sscanf (line,
-          "%*x-%" G_GINT64_MODIFIER "x %*c%*c%*c%*c %*x %*s %*d %s",
-          &end,
-          next_path);
-      if (n == 1 || (n == 2 && next_path[0] == '['))
-      {
-        continue;
-      }
-      else if (n == 2 && strcmp (next_path, path) == 0)
-      {
-        range.size = end - range.base_address;
-      }
-      else
-      {
-        got_line = TRUE;
-        break;
-      }
-    }
+    details.path = module->path;
 
     carry_on = func (&details, user_data);
 
     g_free (name);
   }
-  while (carry_on);
-
-  g_free (path);
-  g_free (next_path);
 
-  g_free (line);
-
-  fclose (fp);
+  gum_proc_maps_snapshot_unref (snapshot);
 }
 
 static void
 gum_process_build_named_range_indexes (GHashTable ** names,
                                        GHashTable ** sizes)
 {
-  FILE * fp;
-  const guint line_size = GUM_MAPS_LINE_SIZE;
-  gchar * line, * name, * next_name;
-  gboolean carry_on = TRUE;
-  gboolean got_line = FALSE;
+  GumProcMapsSnapshot * snapshot;
+  const GumProcMapsEntry * entries;
+  guint n, i;
 
   *names = g_hash_table_new_full (NULL, NULL, NULL, g_free);
   *sizes = g_hash_table_new (NULL, NULL);
 
-  fp = fopen ("/proc/self/maps", "r");
-  g_assert (fp != NULL);
+  snapshot = gum_proc_maps_snapshot_obtain ();
+  entries = (const GumProcMapsEntry *) snapshot->entries->data;
+  n = snapshot->entries->len;
 
-  line = g_malloc (line_size);
-
-  name = g_malloc (PATH_MAX);
-  next_name = g_malloc (PATH_MAX);
-
-  do
+  i = 0;
+  while (i != n)
   {
+    const GumProcMapsEntry * entry = &entries[i++];
     GumMemoryRange range;
-    GumAddress end;
-    gint n;
     gpointer base;
 
-    if (!got_line)
+    if (entry->path == NULL)
+      continue;
+
+    range = entry->range;
+
+    for (; i != n; i++)
     {
-      if (fgets (line, line_size, fp) == NULL)
+      const GumProcMapsEntry * next = &entries[i];
+
+      if (next->path == NULL || next->path[0] == '[')
+        continue;
+      else if (next->path == entry->path)
+        range.size = next->range.base_address + next->range.size -
+            range.base_address;
+      else
         break;
     }
-    else
+
+    base = GSIZE_TO_POINTER (range.base_address);
+    g_hash_table_insert (*names, base, g_strdup (entry->path));
+    g_hash_table_insert (*sizes, base, GSIZE_TO_POINTER (range.size));
+  }
+
+  gum_proc_maps_snapshot_unref (snapshot);
+}
+
+/*
+ * The cached snapshot is only reused while the dl_iterate_phdr() counters
+ * and the VM size both stay the same. Without the counters, e.g. on
+ * Android, the VM size alone would miss an unload followed by a load of
+ * the same size, so we parse afresh every time. Neither key notices an
+ * mprotect() or a remap that bypasses the dynamic linker, which is why the
+ * snapshot never hands out anything that gets dereferenced later: modules
+ * are recognized by their ELF header while the snapshot is being built.
+ */
+static GumProcMapsSnapshot *
+gum_proc_maps_snapshot_obtain (void)
+{
+  static GMutex lock;
+  static gboolean destructor_registered = FALSE;
+  GumProcMapsSnapshot * snapshot;
+  guint64 module_generation, vm_pages;
+
+  if (!_gum_process_query_module_generation (&module_generation) ||
+      !gum_query_vm_pages (&vm_pages))
+    return gum_proc_maps_snapshot_new (0, 0);
+
+  g_mutex_lock (&lock);
+
+  snapshot = gum_proc_maps_snapshot;
+  if (snapshot != NULL && (snapshot->module_generation != module_generation ||
+      snapshot->vm_pages != vm_pages))
+  {
+    gum_proc_maps_snapshot = NULL;
+    gum_proc_maps_snapshot_unref (snapshot);
+    snapshot = NULL;
+  }
+
+  if (snapshot == NULL)
+  {
+    snapshot = gum_proc_maps_snapshot_new (module_generation, vm_pages);
+    gum_proc_maps_snapshot = snapshot;
+
+    if (!destructor_registered)
     {
-      got_line = FALSE;
+      _gum_register_destructor (gum_proc_maps_snapshot_do_deinit);
+      destructor_registered = TRUE;
     }
+  }
+
+  g_atomic_int_inc (&snapshot->ref_count);
+
+  g_mutex_unlock (&lock);
+
+  return snapshot;
+}
+
+static GumProcMapsSnapshot *
+gum_proc_maps_snapshot_new (guint64 module_generation,
+                            guint64 vm_pages)
+{
+  GumProcMapsSnapshot * snapshot;
+  GumProcMapsIter iter;
+  GumProcMapsEntry entry;
+
+  snapshot = g_slice_new (GumProcMapsSnapshot);
+  snapshot->ref_count = 1;
+  snapshot->module_generation = module_generation;
+  snapshot->vm_pages = vm_pages;
+  snapshot->entries = g_array_new (FALSE, FALSE, sizeof (GumProcMapsEntry));
+  snapshot->paths = g_string_chunk_new (4096);
+
+  _gum_proc_maps_iter_init_for_self (&iter);
+
+  while (_gum_proc_maps_iter_next (&iter, &entry))
+  {
+    if (entry.path != NULL)
+      entry.path = g_string_chunk_insert_const (snapshot->paths, entry.path);
+
+    g_array_append_val (snapshot->entries, entry);
+  }
+
+  _gum_proc_maps_iter_destroy (&iter);
+
+  gum_proc_maps_snapshot_collect_modules (snapshot);
+
+  return snapshot;
+}
+
+static void
+gum_proc_maps_snapshot_collect_modules (GumProcMapsSnapshot * self)
+{
+  const GumProcMapsEntry * entries;
+  guint n, i;
+
+  self->modules = g_array_new (FALSE, FALSE, sizeof (GumProcMapsModule));
+
+  entries = (const GumProcMapsEntry *) self->entries->data;
+  n = self->entries->len;
 
-    n = sscanf (line,
-        "%" G_GINT64_MODIFIER "x-%" G_GINT64_MODIFIER "x "
-        "%*4c "
-        "%*x %*s %*d "
-        "%s",
-        &range.base_address, &end,
-        name);
-    if (n == 2)
+  i = 0;
+  while (i != n)
+  {
+    const guint8 elf_magic[] = { 0x7f, 'E', 'L', 'F' };
+    const GumProcMapsEntry * entry = &entries[i++];
+    const gchar * path = entry->path;
+    GumProcMapsModule module;
+
+    if (path == NULL)
+      continue;
+    else if ((entry->prot & GUM_PAGE_RX) != GUM_PAGE_RX || entry->shared)
+      continue;
+    else if (path[0] != '/' || g_str_has_prefix (path, "/dev/"))
+      continue;
+    else if (RUNNING_ON_VALGRIND && strstr (path, "/valgrind/") != NULL)
+      continue;
+    else if (memcmp (GSIZE_TO_POINTER (entry->range.base_address), elf_magic,
+        sizeof (elf_magic)) != 0)
       continue;
-    g_assert_cmpint (n, ==, 3);
 
-    range.size = end - range.base_address;
+    module.range = entry->range;
+    module.path = path;
 
-    while (fgets (line, line_size, fp) != NULL)
+    /* Paths are interned by the snapshot, so comparing pointers suffices. */
+    for (; i != n; i++)
     {
-      n = sscanf (line,
-          "%*x-%" G_GINT64_MODIFIER "x %*c%*c%*c%*c %*x %*s %*d %s",
-          &end,
-          next_name);
-      if (n == 1 || (n == 2 && next_name[0] == '['))
-      {
+      const GumProcMapsEntry * next = &entries[i];
+
+      if (next->path == NULL || next->path[0] == '[')
         continue;
-      }
-      else if (n == 2 && strcmp (next_name, name) == 0)
-      {
-        range.size = end - range.base_address;
-      }
+      else if (next->path == path)
+        module.range.size = next->range.base_address + next->range.size -
+            module.range.base_address;
       else
-      {
-        got_line = TRUE;
         break;
-      }
     }
 
-    base = GSIZE_TO_POINTER (range.base_address);
-    g_hash_table_insert (*names, base, g_strdup (name));
-    g_hash_table_insert (*sizes, base, GSIZE_TO_POINTER (range.size));
+    g_array_append_val (self->modules, module);
+  }
+}
+
+static void
+gum_proc_maps_snapshot_unref (GumProcMapsSnapshot * snapshot)
+{
+  if (!g_atomic_int_dec_and_test (&snapshot->ref_count))
+    return;
+
+  g_string_chunk_free (snapshot->paths);
+  g_array_free (snapshot->modules, TRUE);
+  g_array_free (snapshot->entries, TRUE);
+
+  g_slice_free (GumProcMapsSnapshot, snapshot);
+}
+
+static void
+gum_proc_maps_snapshot_do_deinit (void)
+{
+  if (gum_proc_maps_snapshot != NULL)
+  {
+    gum_proc_maps_snapshot_unref (gum_proc_maps_snapshot);
+    gum_proc_maps_snapshot = NULL;
   }
-  while (carry_on);
+}
+
+static gboolean
+gum_query_vm_pages (guint64 * pages)
+{
+  gint fd;
+  gchar buffer[64];
+  gssize n;
+  gchar * cursor;
 
-  g_free (name);
-  g_free (next_name);
+  fd = open ("/proc/self/statm", O_RDONLY);
+  if (fd == -1)
+    return FALSE;
+  n = read (fd, buffer, sizeof (buffer) - 1);
+  close (fd);
+
+  if (n <= 0)
+    return FALSE;
+  buffer[n] = '\0';
 
-  g_free (line);
+  cursor = buffer;
 
-  fclose (fp);
+  return gum_try_parse_dec (&cursor, pages);
 }
 
 #ifdef HAVE_ANDROID
@@ -1016,77 +1378,332 @@ _gum_process_enumerate_ranges (GumPageProtection prot,
   gum_linux_enumerate_ranges (getpid (), prot, func, user_data);
 }
 
+gboolean
+_gum_process_query_module_generation (guint64 * generation)
+{
+#ifndef HAVE_ANDROID
+  GumDlIteratePhdrImpl iterate_phdr;
+  GumQueryModuleGenerationContext ctx;
+
+  iterate_phdr = gum_get_dl_iterate_phdr ();
+  if (iterate_phdr == NULL)
+    return FALSE;
+
+  ctx.generation = 0;
+  ctx.valid = FALSE;
+
+  iterate_phdr (gum_store_module_generation_from_phdr, &ctx);
+
+  *generation = ctx.generation;
+
+  return ctx.valid;
+#else
+  return FALSE;
+#endif
+}
+
+/*
+ * Reads the PC of every other thread from /proc without stopping any of
+ * them. Only threads that are blocked or preempted have one to report; those
+ * on a CPU right now show up as "running" and are left out.
+ */
+gboolean
+_gum_process_sample_thread_pcs (GArray * pcs)
+{
+  GumThreadId current_thread_id;
+  GDir * dir;
+  const gchar * name;
+
+  current_thread_id = gum_process_get_current_thread_id ();
+
+  dir = g_dir_open ("/proc/self/task", 0, NULL);
+  if (dir == NULL)
+    return FALSE;
+
+  while ((name = g_dir_read_name (dir)) != NULL)
+  {
+    gchar * path, * syscall;
+    const gchar * last_field;
+    gsize pc;
+
+    if ((GumThreadId) atoi (name) == current_thread_id)
+      continue;
+
+    path = g_build_filename ("/proc/self/task", name, "syscall", NULL);
+    if (g_file_get_contents (path, &syscall, NULL, NULL))
+    {
+      g_strchomp (syscall);
+      last_field = strrchr (syscall, ' ');
+      if (last_field != NULL)
+      {
+        pc = (gsize) g_ascii_strtoull (last_field + 1, NULL, 16);
+        g_array_append_val (pcs, pc);
+      }
+
+      g_free (syscall);
+    }
+    g_free (path);
+  }
+
+  g_dir_close (dir);
+
+  return TRUE;
+}
+
+#ifndef HAVE_ANDROID
+
+static gint
+gum_store_module_generation_from_phdr (struct dl_phdr_info * info,
+                                       gsize size,
+                                       gpointer user_data)
+{
+  GumQueryModuleGenerationContext * ctx =
+      (GumQueryModuleGenerationContext *) user_data;
+
+  if (size >= G_STRUCT_OFFSET (struct dl_phdr_info, dlpi_subs) +
+      sizeof (info->dlpi_subs))
+  {
+    ctx->generation = (guint64) info->dlpi_adds + (guint64) info->dlpi_subs;
+    ctx->valid = TRUE;
+  }
+
+  return 1;
+}
+
+#endif
+
 void
 gum_linux_enumerate_ranges (pid_t pid,
                             GumPageProtection prot,
                             GumFoundRangeFunc func,
                             gpointer user_data)
 {
-  gchar * maps_path;
-  FILE * fp;
-  const guint line_size = GUM_MAPS_LINE_SIZE;
-  gchar * line;
+  GumProcMapsIter iter;
+  GumProcMapsEntry entry;
   gboolean carry_on = TRUE;
 
-  maps_path = g_strdup_printf ("/proc/%d/maps", pid);
-
-  fp = fopen (maps_path, "r");
-  g_assert (fp != NULL);
-
-  g_free (maps_path);
-
-  line = g_malloc (line_size);
+  _gum_proc_maps_iter_init_for_pid (&iter, pid);
 
-  while (carry_on && fgets (line, line_size, fp) != NULL)
+  while (carry_on && _gum_proc_maps_iter_next (&iter, &entry))
   {
     GumRangeDetails details;
-    GumMemoryRange range;
     GumFileMapping file;
-    GumAddress end;
-    gchar perms[5] = { 0, };
-    guint64 inode;
-    gint length, n;
-
-    n = sscanf (line,
-        "%" G_GINT64_MODIFIER "x-%" G_GINT64_MODIFIER "x "
-        "%4c "
-        "%" G_GINT64_MODIFIER "x %*s %" G_GINT64_MODIFIER "d"
-        "%n",
-        &range.base_address, &end,
-        perms,
-        &file.offset, &inode,
-        &length);
-    g_assert (n == 5 || n == 6);
-
-    range.size = end - range.base_address;
 
+    details.range = &entry.range;
+    details.prot = entry.prot;
     details.file = NULL;
-    if (inode != 0)
+
+    if (entry.inode != 0 && entry.path != NULL)
     {
-      file.path = strchr (line + length, '/');
+      file.path = strchr (entry.path, '/');
       if (file.path != NULL)
       {
-        *strchr (file.path, '\n') = '\0';
-        details.file = &file;
+        file.offset = entry.offset;
         file.size = 0; /* TODO */
+        details.file = &file;
 
         if (RUNNING_ON_VALGRIND && strstr (file.path, "/valgrind/") != NULL)
           continue;
       }
     }
 
-    details.range = &range;
-    details.prot = gum_page_protection_from_proc_perms_string (perms);
-
     if ((details.prot & prot) == prot)
     {
       carry_on = func (&details, user_data);
     }
   }
 
-  g_free (line);
+  _gum_proc_maps_iter_destroy (&iter);
+}
+
+void
+_gum_proc_maps_iter_init_for_self (GumProcMapsIter * iter)
+{
+  gum_proc_maps_iter_init_for_path (iter, "/proc/self/maps");
+}
+
+void
+_gum_proc_maps_iter_init_for_pid (GumProcMapsIter * iter,
+                                  pid_t pid)
+{
+  gchar path[31 + 1];
+
+  g_snprintf (path, sizeof (path), "/proc/%d/maps", pid);
+
+  gum_proc_maps_iter_init_for_path (iter, path);
+}
+
+static void
+gum_proc_maps_iter_init_for_path (GumProcMapsIter * iter,
+                                  const gchar * path)
+{
+  iter->fd = open (path, O_RDONLY);
+  g_assert (iter->fd != -1);
+
+  iter->eof = FALSE;
+  iter->read_cursor = iter->buffer;
+  iter->write_cursor = iter->buffer;
+}
+
+void
+_gum_proc_maps_iter_destroy (GumProcMapsIter * iter)
+{
+  close (iter->fd);
+}
+
+gboolean
+_gum_proc_maps_iter_next (GumProcMapsIter * iter,
+                          GumProcMapsEntry * entry)
+{
+  gchar * line;
+  gboolean parsed;
+
+  if (!gum_proc_maps_iter_read_line (iter, &line))
+    return FALSE;
+
+  parsed = gum_proc_maps_parse_line (line, entry);
+  g_assert (parsed);
+
+  return TRUE;
+}
+
+static gboolean
+gum_proc_maps_iter_read_line (GumProcMapsIter * iter,
+                              gchar ** line)
+{
+  while (TRUE)
+  {
+    gsize available, capacity;
+    gchar * newline;
+    gssize n;
+
+    available = iter->write_cursor - iter->read_cursor;
+
+    newline = memchr (iter->read_cursor, '\n', available);
+    if (newline != NULL)
+    {
+      *newline = '\0';
+      *line = iter->read_cursor;
+      iter->read_cursor = newline + 1;
+      return TRUE;
+    }
+
+    if (iter->eof)
+    {
+      if (available == 0)
+        return FALSE;
+
+      *iter->write_cursor = '\0';
+      *line = iter->read_cursor;
+      iter->read_cursor = iter->write_cursor;
+      return TRUE;
+    }
+
+    if (iter->read_cursor != iter->buffer)
+    {
+      memmove (iter->buffer, iter->read_cursor, available);
+      iter->read_cursor = iter->buffer;
+      iter->write_cursor = iter->buffer + available;
+    }
+
+    capacity = sizeof (iter->buffer) - available - 1;
+    g_assert (capacity > 0);
+
+    do
+      n = read (iter->fd, iter->write_cursor, capacity);
+    while (n == -1 && errno == EINTR);
+
+    if (n > 0)
+      iter->write_cursor += n;
+    else
+      iter->eof = TRUE;
+  }
+}
+
+static gboolean
+gum_proc_maps_parse_line (gchar * line,
+                          GumProcMapsEntry * entry)
+{
+  gchar * cursor = line;
+  GumAddress end;
+  guint i;
+
+  if (!gum_try_parse_hex (&cursor, &entry->range.base_address) ||
+      *cursor++ != '-')
+    return FALSE;
+  if (!gum_try_parse_hex (&cursor, &end) || *cursor++ != ' ')
+    return FALSE;
+  entry->range.size = end - entry->range.base_address;
+
+  for (i = 0; i != 4; i++)
+  {
+    if (cursor[i] == '\0')
+      return FALSE;
+  }
+  if (cursor[4] != ' ')
+    return FALSE;
+  entry->prot = gum_page_protection_from_proc_perms_string (cursor);
+  entry->shared = cursor[3] == 's';
+  cursor += 5;
+
+  if (!gum_try_parse_hex (&cursor, &entry->offset) || *cursor++ != ' ')
+    return FALSE;
+
+  cursor = strchr (cursor, ' ');
+  if (cursor == NULL)
+    return FALSE;
+  cursor++;
+
+  if (!gum_try_parse_dec (&cursor, &entry->inode))
+    return FALSE;
+
+  while (*cursor == ' ')
+    cursor++;
+  entry->path = (*cursor != '\0') ? cursor : NULL;
+
+  return TRUE;
+}
+
+static gboolean
+gum_try_parse_hex (gchar ** cursor,
+                   guint64 * value)
+{
+  gchar * start = *cursor;
+  gchar * c;
+  guint64 result = 0;
+  gint digit;
+
+  for (c = start; (digit = g_ascii_xdigit_value (*c)) != -1; c++)
+    result = (result << 4) | digit;
+
+  if (c == start)
+    return FALSE;
+
+  *value = result;
+  *cursor = c;
+
+  return TRUE;
+}
+
+static gboolean
+gum_try_parse_dec (gchar ** cursor,
+                   guint64 * value)
+{
+  gchar * start = *cursor;
+  gchar * c;
+  guint64 result = 0;
+  gint digit;
+
+  for (c = start; (digit = g_ascii_digit_value (*c)) != -1; c++)
+    result = (result * 10) + digit;
+
+  if (c == start)
+    return FALSE;
+
+  *value = result;
+  *cursor = c;
 
-  fclose (fp);
+  return TRUE;
 }
 
 void
@@ -1269,8 +1886,25 @@ gum_module_enumerate_exports (const gchar * module_name,
                               GumFoundExportFunc func,
                               gpointer user_data)
 {
+  GumModuleExportIndex * index;
   GumElfModule * module;
 
+  index = gum_module_export_index_obtain (module_name);
+  if (index != NULL)
+  {
+    guint i;
+
+    for (i = 0; i != index->exports->len; i++)
+    {
+      if (!func (&g_array_index (index->exports, GumExportDetails, i),
+          user_data))
+        break;
+    }
+
+    gum_module_export_index_unref (index);
+    return;
+  }
+
   module = gum_open_elf_module (module_name);
   if (module == NULL)
     return;
@@ -1422,8 +2056,23 @@ gum_module_find_export_by_name (const gchar * module_name,
 
   if (module_name != NULL)
   {
+    GumModuleExportIndex * index;
     gchar * name;
 
+    index = gum_module_export_index_obtain (module_name);
+    if (index != NULL)
+    {
+      const GumExportDetails * details;
+
+      details = g_hash_table_lookup (index->exports_by_name, symbol_name);
+      result = (details != NULL) ? details->address : 0;
+
+      gum_module_export_index_unref (index);
+
+      if (result != 0)
+        return result;
+    }
+
     name = gum_resolve_module_name (module_name, NULL);
     if (name == NULL)
       return 0;
@@ -1664,6 +2313,182 @@ gum_open_elf_module (const gchar * name)
   return module;
 }
 
+/*
+ * Export indexes are keyed by the name the caller passed in and are thrown
+ * away whenever the dynamic linker reports that a module was loaded or
+ * unloaded. Without such a generation counter we cannot tell when an index
+ * goes stale, so no index is used at all.
+ */
+static GumModuleExportIndex *
+gum_module_export_index_obtain (const gchar * module_name)
+{
+  static gboolean destructor_registered = FALSE;
+  guint64 generation;
+  GumModuleExportIndex * index;
+
+  if (!_gum_process_query_module_generation (&generation))
+    return NULL;
+
+  g_mutex_lock (&gum_export_index_lock);
+
+  if (gum_export_indexes == NULL)
+  {
+    gum_export_indexes = g_hash_table_new_full (g_str_hash, g_str_equal,
+        g_free, (GDestroyNotify) gum_module_export_index_unref);
+
+    if (!destructor_registered)
+    {
+      _gum_register_destructor (gum_module_export_index_do_deinit);
+      destructor_registered = TRUE;
+    }
+  }
+  else if (generation != gum_export_indexes_generation)
+  {
+    g_hash_table_remove_all (gum_export_indexes);
+  }
+  gum_export_indexes_generation = generation;
+
+  index = g_hash_table_lookup (gum_export_indexes, module_name);
+  if (index != NULL)
+    gum_module_export_index_ref (index);
+
+  g_mutex_unlock (&gum_export_index_lock);
+
+  if (index != NULL)
+    return index;
+
+  /*
+   * Built without holding the lock, as resolving the module enumerates
+   * modules and may in turn look up exports.
+   */
+  index = gum_module_export_index_new (module_name);
+  if (index == NULL)
+    return NULL;
+
+  g_mutex_lock (&gum_export_index_lock);
+
+  if (gum_export_indexes != NULL &&
+      gum_export_indexes_generation == generation &&
+      !g_hash_table_contains (gum_export_indexes, module_name))
+  {
+    g_hash_table_insert (gum_export_indexes, g_strdup (module_name),
+        gum_module_export_index_ref (index));
+  }
+
+  g_mutex_unlock (&gum_export_index_lock);
+
+  return index;
+}
+
+static GumModuleExportIndex *
+gum_module_export_index_new (const gchar * module_name)
+{
+  GumModuleExportIndex * index;
+  GumElfModule * module;
+  guint i;
+
+  module = gum_open_elf_module (module_name);
+  if (module == NULL)
+    return NULL;
+
+  index = g_slice_new (GumModuleExportIndex);
+  index->ref_count = 1;
+  index->exports = g_array_new (FALSE, FALSE, sizeof (GumExportDetails));
+  index->exports_by_name = g_hash_table_new (g_str_hash, g_str_equal);
+  index->names = g_string_chunk_new (4096);
+
+  gum_elf_module_enumerate_exports (module, gum_module_export_index_add,
+      index);
+
+  /*
+   * A name that appears more than once is usually a versioned symbol. Ask
+   * the module's hash tables which one is the default version, and map the
+   * name to NULL if neither matches so lookups fall back to dlsym().
+   */
+  for (i = 0; i != index->exports->len; i++)
+  {
+    GumExportDetails * details =
+        &g_array_index (index->exports, GumExportDetails, i);
+    GumExportDetails * existing, * preferred;
+    GumExportDetails d;
+
+    if (!g_hash_table_lookup_extended (index->exports_by_name, details->name,
+        NULL, (gpointer *) &existing))
+    {
+      g_hash_table_insert (index->exports_by_name, (gpointer) details->name,
+          details);
+      continue;
+    }
+
+    preferred = NULL;
+    if (gum_elf_module_find_export (module, details->name, &d))
+    {
+      if (existing != NULL && existing->address == d.address)
+        preferred = existing;
+      else if (details->address == d.address)
+        preferred = details;
+    }
+
+    g_hash_table_insert (index->exports_by_name, (gpointer) details->name,
+        preferred);
+  }
+
+  g_object_unref (module);
+
+  return index;
+}
+
+static GumModuleExportIndex *
+gum_module_export_index_ref (GumModuleExportIndex * index)
+{
+  g_atomic_int_inc (&index->ref_count);
+
+  return index;
+}
+
+static void
+gum_module_export_index_unref (GumModuleExportIndex * index)
+{
+  if (!g_atomic_int_dec_and_test (&index->ref_count))
+    return;
+
+  g_string_chunk_free (index->names);
+  g_hash_table_unref (index->exports_by_name);
+  g_array_free (index->exports, TRUE);
+
+  g_slice_free (GumModuleExportIndex, index);
+}
+
+static gboolean
+gum_module_export_index_add (const GumExportDetails * details,
+                             gpointer user_data)
+{
+  GumModuleExportIndex * index = user_data;
+  GumExportDetails d;
+
+  d.type = details->type;
+  d.name = g_string_chunk_insert (index->names, details->name);
+  d.address = details->address;
+
+  g_array_append_val (index->exports, d);
+
+  return TRUE;
+}
+
+static void
+gum_module_export_index_do_deinit (void)
+{
+  g_mutex_lock (&gum_export_index_lock);
+
+  if (gum_export_indexes != NULL)
+  {
+    g_hash_table_unref (gum_export_indexes);
+    gum_export_indexes = NULL;
+  }
+
+  g_mutex_unlock (&gum_export_index_lock);
+}
+
 #ifdef HAVE_ANDROID
 
 static gboolean
@@ -2471,6 +3296,15 @@ gum_libc_ptrace (gsize request,
       GPOINTER_TO_SIZE (address), GPOINTER_TO_SIZE (data));
 }
 
+static gssize
+gum_libc_waitpid (pid_t pid,
+                  gint * status,
+                  gint options)
+{
+  return gum_libc_syscall_4 (__NR_wait4, pid, GPOINTER_TO_SIZE (status),
+      options, 0);
+}
+
 static gssize
 gum_libc_syscall_4 (gsize n,
                     gsize a,
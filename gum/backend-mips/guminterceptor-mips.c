@@ -143,6 +143,9 @@ _gum_interceptor_backend_create_trampoline (GumInterceptorBackend * self,
   gboolean need_deflector;
   guint reloc_bytes;
 
+  /* No direct replacement path yet, use regular dispatch instead. */
+  ctx->fast_replacement = FALSE;
+
   if (!gum_interceptor_backend_prepare_trampoline (self, ctx, &need_deflector))
     return FALSE;
 
@@ -274,6 +277,22 @@ _gum_interceptor_backend_get_function_address (GumFunctionContext * ctx)
   return ctx->function_address;
 }
 
+gboolean
+_gum_interceptor_backend_get_unsafe_range (GumFunctionContext * ctx,
+                                           GumMemoryRange * range)
+{
+  GumMipsFunctionContextData * data = (GumMipsFunctionContextData *)
+      &ctx->backend_data;
+
+  if (data->redirect_code_size <= 4)
+    return FALSE;
+
+  range->base_address = GUM_ADDRESS (ctx->function_address) + 4;
+  range->size = data->redirect_code_size - 4;
+
+  return TRUE;
+}
+
 gpointer
 _gum_interceptor_backend_resolve_redirect (GumInterceptorBackend * self,
                                            gpointer address)
@@ -146,7 +146,8 @@ gum_process_modify_thread (GumThreadId thread_id,
 }
 
 void
-_gum_process_enumerate_threads (GumFoundThreadFunc func,
+_gum_process_enumerate_threads (GumThreadFlags flags,
+                                GumFoundThreadFunc func,
                                 gpointer user_data)
 {
   gint fd, res;
@@ -169,11 +170,21 @@ _gum_process_enumerate_threads (GumFoundThreadFunc func,
     details.id = thread.tid;
     details.state = gum_thread_state_from_system_thread_state (thread.state);
 
-    if (thread.state != STATE_DEAD &&
-        gum_process_modify_thread (details.id, gum_store_cpu_context,
-          &details.cpu_context))
+    if (thread.state != STATE_DEAD)
     {
-      carry_on = func (&details, user_data);
+      if ((flags & GUM_THREAD_FLAGS_CPU_CONTEXT) != 0)
+      {
+        if (gum_process_modify_thread (details.id, gum_store_cpu_context,
+            &details.cpu_context))
+        {
+          carry_on = func (&details, user_data);
+        }
+      }
+      else
+      {
+        memset (&details.cpu_context, 0, sizeof (details.cpu_context));
+        carry_on = func (&details, user_data);
+      }
     }
 
     thread.tid++;
@@ -259,6 +270,18 @@ _gum_process_enumerate_ranges (GumPageProtection prot,
   gum_qnx_enumerate_ranges (getpid (), prot, func, user_data);
 }
 
+gboolean
+_gum_process_query_module_generation (guint64 * generation)
+{
+  return FALSE;
+}
+
+gboolean
+_gum_process_sample_thread_pcs (GArray * pcs)
+{
+  return FALSE;
+}
+
 void
 gum_process_enumerate_malloc_ranges (GumFoundMallocRangeFunc func,
                                      gpointer user_data)
@@ -104,7 +104,8 @@ beach:
 }
 
 void
-_gum_process_enumerate_threads (GumFoundThreadFunc func,
+_gum_process_enumerate_threads (GumThreadFlags flags,
+                                GumFoundThreadFunc func,
                                 gpointer user_data)
 {
   DWORD this_process_id;
@@ -307,6 +308,18 @@ _gum_process_enumerate_ranges (GumPageProtection prot,
   }
 }
 
+gboolean
+_gum_process_query_module_generation (guint64 * generation)
+{
+  return FALSE;
+}
+
+gboolean
+_gum_process_sample_thread_pcs (GArray * pcs)
+{
+  return FALSE;
+}
+
 void
 gum_process_enumerate_malloc_ranges (GumFoundMallocRangeFunc func,
                                      gpointer user_data)
@@ -16,6 +16,7 @@
 
 #define GUM_INTERCEPTOR_REDIRECT_CODE_SIZE  5
 #define GUM_X86_JMP_MAX_DISTANCE            (G_MAXINT32 - 16384)
+#define GUM_X86_CACHE_LINE_SIZE             64
 
 #define GUM_FRAME_OFFSET_CPU_CONTEXT 0
 #define GUM_FRAME_OFFSET_CPU_FLAGS \
@@ -25,17 +26,36 @@
 #define GUM_FRAME_OFFSET_TOP \
     (GUM_FRAME_OFFSET_NEXT_HOP + sizeof (gpointer))
 
+typedef struct _GumX86FunctionContextData GumX86FunctionContextData;
+
 struct _GumInterceptorBackend
 {
   GumCodeAllocator * allocator;
 
   GumX86Writer writer;
   GumX86Relocator relocator;
+  guint8 * scratch;
 
   GumCodeSlice * enter_thunk;
   GumCodeSlice * leave_thunk;
 };
 
+struct _GumX86FunctionContextData
+{
+  guint first_insn_size;
+};
+
+G_STATIC_ASSERT (sizeof (GumX86FunctionContextData)
+    <= sizeof (GumFunctionContextBackendData));
+
+static gboolean gum_interceptor_backend_prepare_trampoline (
+    GumInterceptorBackend * self, GumFunctionContext * ctx, gsize size);
+static guint gum_interceptor_backend_emit_trampoline (
+    GumInterceptorBackend * self, GumFunctionContext * ctx,
+    guint8 * slice_start);
+static void gum_interceptor_backend_write_redirect (guint8 * prologue,
+    const guint8 * code, guint size);
+
 static void gum_interceptor_backend_create_thunks (
     GumInterceptorBackend * self);
 static void gum_interceptor_backend_destroy_thunks (
@@ -58,6 +78,7 @@ _gum_interceptor_backend_create (GumCodeAllocator * allocator)
 
   gum_x86_writer_init (&backend->writer, NULL);
   gum_x86_relocator_init (&backend->relocator, NULL, &backend->writer);
+  backend->scratch = g_malloc (2 * allocator->slice_size);
 
   gum_interceptor_backend_create_thunks (backend);
 
@@ -69,6 +90,7 @@ _gum_interceptor_backend_destroy (GumInterceptorBackend * backend)
 {
   gum_interceptor_backend_destroy_thunks (backend);
 
+  g_free (backend->scratch);
   gum_x86_relocator_clear (&backend->relocator);
   gum_x86_writer_clear (&backend->writer);
 
@@ -77,69 +99,134 @@ _gum_interceptor_backend_destroy (GumInterceptorBackend * backend)
 
 static gboolean
 gum_interceptor_backend_prepare_trampoline (GumInterceptorBackend * self,
-                                            GumFunctionContext * ctx)
+                                            GumFunctionContext * ctx,
+                                            gsize size)
 {
 #if GLIB_SIZEOF_VOID_P == 4
-  ctx->trampoline_slice = gum_code_allocator_alloc_slice (self->allocator);
-
-  return TRUE;
+  ctx->trampoline_slice = gum_code_allocator_try_alloc_sized_slice_near (
+      self->allocator, size, NULL, 0);
 #else
   GumAddressSpec spec;
   gsize default_alignment = 0;
 
   spec.near_address = ctx->function_address;
   spec.max_distance = GUM_X86_JMP_MAX_DISTANCE;
-  ctx->trampoline_slice = gum_code_allocator_try_alloc_slice_near (
-      self->allocator, &spec, default_alignment);
+  ctx->trampoline_slice = gum_code_allocator_try_alloc_sized_slice_near (
+      self->allocator, size, &spec, default_alignment);
+#endif
 
   return ctx->trampoline_slice != NULL;
-#endif
 }
 
 gboolean
 _gum_interceptor_backend_create_trampoline (GumInterceptorBackend * self,
                                             GumFunctionContext * ctx)
 {
-  GumX86Writer * cw = &self->writer;
-  GumX86Relocator * rl = &self->relocator;
-  GumAddress function_ctx_ptr;
-  guint reloc_bytes;
+  guint code_size;
+  gsize slice_size;
 
   if (!gum_x86_relocator_can_relocate (ctx->function_address,
       GUM_INTERCEPTOR_REDIRECT_CODE_SIZE, NULL))
     return FALSE;
 
-  if (!gum_interceptor_backend_prepare_trampoline (self, ctx))
+  /*
+   * Measure the trampoline as if it were placed at the function itself. Its
+   * real slice ends up nearby, so the size rarely differs, and if it does we
+   * fall back to a full slice.
+   */
+  code_size = gum_interceptor_backend_emit_trampoline (self, ctx,
+      ctx->function_address);
+  slice_size = gum_code_allocator_round_slice_size (self->allocator,
+      code_size);
+  if (slice_size == 0)
+    slice_size = self->allocator->slice_size;
+
+  if (!gum_interceptor_backend_prepare_trampoline (self, ctx, slice_size))
     return FALSE;
 
-  gum_x86_writer_reset (cw, ctx->trampoline_slice->data);
+  code_size = gum_interceptor_backend_emit_trampoline (self, ctx,
+      ctx->trampoline_slice->data);
+  if (code_size > ctx->trampoline_slice->size)
+  {
+    gum_code_slice_free (ctx->trampoline_slice);
+    ctx->trampoline_slice = NULL;
+
+    if (!gum_interceptor_backend_prepare_trampoline (self, ctx,
+        self->allocator->slice_size))
+      return FALSE;
+
+    code_size = gum_interceptor_backend_emit_trampoline (self, ctx,
+        ctx->trampoline_slice->data);
+    g_assert_cmpuint (code_size, <=, ctx->trampoline_slice->size);
+  }
+
+  memcpy (ctx->trampoline_slice->data, self->scratch, code_size);
+
+  memcpy (ctx->overwritten_prologue, ctx->function_address,
+      ctx->overwritten_prologue_len);
+
+  return TRUE;
+}
+
+/*
+ * Emits the trampoline into the scratch buffer, as if it were located at
+ * slice_start. This lets us measure it before committing to a slice size
+ * class.
+ */
+static guint
+gum_interceptor_backend_emit_trampoline (GumInterceptorBackend * self,
+                                         GumFunctionContext * ctx,
+                                         guint8 * slice_start)
+{
+  GumX86FunctionContextData * data = (GumX86FunctionContextData *)
+      &ctx->backend_data;
+  GumX86Writer * cw = &self->writer;
+  GumX86Relocator * rl = &self->relocator;
+  GumAddress function_ctx_ptr;
+  guint reloc_bytes;
+
+  gum_x86_writer_reset (cw, self->scratch);
+  cw->pc = GUM_ADDRESS (slice_start);
 
-  function_ctx_ptr = GUM_ADDRESS (gum_x86_writer_cur (cw));
+  function_ctx_ptr = cw->pc;
   gum_x86_writer_put_bytes (cw, (guint8 *) &ctx, sizeof (GumFunctionContext *));
 
-  ctx->on_enter_trampoline = gum_x86_writer_cur (cw);
+  ctx->on_enter_trampoline = slice_start + gum_x86_writer_offset (cw);
 
-  gum_x86_writer_put_push_near_ptr (cw, function_ctx_ptr);
-  gum_x86_writer_put_jmp_address (cw, GUM_ADDRESS (self->enter_thunk->data));
+  if (ctx->fast_replacement)
+  {
+    gum_x86_writer_put_jmp_address (cw,
+        GUM_ADDRESS (ctx->replacement_function));
 
-  ctx->on_leave_trampoline = gum_x86_writer_cur (cw);
+    ctx->on_leave_trampoline = NULL;
+  }
+  else
+  {
+    gum_x86_writer_put_push_near_ptr (cw, function_ctx_ptr);
+    gum_x86_writer_put_jmp_address (cw,
+        GUM_ADDRESS (self->enter_thunk->data));
+
+    ctx->on_leave_trampoline = slice_start + gum_x86_writer_offset (cw);
 
-  gum_x86_writer_put_push_near_ptr (cw, function_ctx_ptr);
-  gum_x86_writer_put_jmp_address (cw, GUM_ADDRESS (self->leave_thunk->data));
+    gum_x86_writer_put_push_near_ptr (cw, function_ctx_ptr);
+    gum_x86_writer_put_jmp_address (cw,
+        GUM_ADDRESS (self->leave_thunk->data));
+  }
 
   gum_x86_writer_flush (cw);
-  g_assert_cmpuint (gum_x86_writer_offset (cw),
-      <=, ctx->trampoline_slice->size);
 
-  ctx->on_invoke_trampoline = gum_x86_writer_cur (cw);
+  ctx->on_invoke_trampoline = slice_start + gum_x86_writer_offset (cw);
   gum_x86_relocator_reset (rl, (guint8 *) ctx->function_address, cw);
 
-  do
+  reloc_bytes = gum_x86_relocator_read_one (rl, NULL);
+  g_assert_cmpuint (reloc_bytes, !=, 0);
+  data->first_insn_size = reloc_bytes;
+
+  while (reloc_bytes < GUM_INTERCEPTOR_REDIRECT_CODE_SIZE)
   {
     reloc_bytes = gum_x86_relocator_read_one (rl, NULL);
     g_assert_cmpuint (reloc_bytes, !=, 0);
   }
-  while (reloc_bytes < GUM_INTERCEPTOR_REDIRECT_CODE_SIZE);
   gum_x86_relocator_write_all (rl);
 
   if (!gum_x86_relocator_eoi (rl))
@@ -149,13 +236,10 @@ _gum_interceptor_backend_create_trampoline (GumInterceptorBackend * self,
   }
 
   gum_x86_writer_flush (cw);
-  g_assert_cmpuint (gum_x86_writer_offset (cw),
-      <=, ctx->trampoline_slice->size);
 
   ctx->overwritten_prologue_len = reloc_bytes;
-  memcpy (ctx->overwritten_prologue, ctx->function_address, reloc_bytes);
 
-  return TRUE;
+  return gum_x86_writer_offset (cw);
 }
 
 void
@@ -174,19 +258,17 @@ _gum_interceptor_backend_activate_trampoline (GumInterceptorBackend * self,
                                               gpointer prologue)
 {
   GumX86Writer * cw = &self->writer;
-  guint padding;
+  guint8 code[16];
 
-  gum_x86_writer_reset (cw, prologue);
+  gum_x86_writer_reset (cw, code);
   cw->pc = GPOINTER_TO_SIZE (ctx->function_address);
   gum_x86_writer_put_jmp_address (cw, GUM_ADDRESS (ctx->on_enter_trampoline));
   gum_x86_writer_flush (cw);
   g_assert_cmpint (gum_x86_writer_offset (cw),
-      <=, GUM_INTERCEPTOR_REDIRECT_CODE_SIZE);
+      ==, GUM_INTERCEPTOR_REDIRECT_CODE_SIZE);
 
-  padding = ctx->overwritten_prologue_len - gum_x86_writer_offset (cw);
-  for (; padding != 0; padding--)
-    gum_x86_writer_put_nop (cw);
-  gum_x86_writer_flush (cw);
+  gum_interceptor_backend_write_redirect (prologue, code,
+      GUM_INTERCEPTOR_REDIRECT_CODE_SIZE);
 }
 
 void
@@ -196,7 +278,44 @@ _gum_interceptor_backend_deactivate_trampoline (GumInterceptorBackend * self,
 {
   (void) self;
 
-  memcpy (prologue, ctx->overwritten_prologue, ctx->overwritten_prologue_len);
+  gum_interceptor_backend_write_redirect (prologue, ctx->overwritten_prologue,
+      GUM_INTERCEPTOR_REDIRECT_CODE_SIZE);
+}
+
+/*
+ * Only the bytes covered by the jump are replaced, and whenever they fit in
+ * a cache line we swap them in with a single 8-byte store. A thread about to
+ * enter the function then sees either the old or the new instruction. The
+ * core checks for threads stopped between the first instruction and the end
+ * of the jump before writing.
+ */
+static void
+gum_interceptor_backend_write_redirect (guint8 * prologue,
+                                        const guint8 * code,
+                                        guint size)
+{
+#if GLIB_SIZEOF_VOID_P == 8
+  gsize offset;
+  guint8 * window;
+  guint64 value;
+
+  offset = GPOINTER_TO_SIZE (prologue) & (GUM_X86_CACHE_LINE_SIZE - 1);
+  if (offset + size <= GUM_X86_CACHE_LINE_SIZE)
+  {
+    if (offset + sizeof (value) <= GUM_X86_CACHE_LINE_SIZE)
+      window = prologue;
+    else
+      window = prologue - offset + GUM_X86_CACHE_LINE_SIZE - sizeof (value);
+
+    memcpy (&value, window, sizeof (value));
+    memcpy ((guint8 *) &value + (prologue - window), code, size);
+    *((volatile guint64 *) window) = value;
+
+    return;
+  }
+#endif
+
+  memcpy (prologue, code, size);
 }
 
 gpointer
@@ -205,6 +324,23 @@ _gum_interceptor_backend_get_function_address (GumFunctionContext * ctx)
   return ctx->function_address;
 }
 
+gboolean
+_gum_interceptor_backend_get_unsafe_range (GumFunctionContext * ctx,
+                                           GumMemoryRange * range)
+{
+  GumX86FunctionContextData * data = (GumX86FunctionContextData *)
+      &ctx->backend_data;
+
+  if (data->first_insn_size >= GUM_INTERCEPTOR_REDIRECT_CODE_SIZE)
+    return FALSE;
+
+  range->base_address =
+      GUM_ADDRESS (ctx->function_address) + data->first_insn_size;
+  range->size = GUM_INTERCEPTOR_REDIRECT_CODE_SIZE - data->first_insn_size;
+
+  return TRUE;
+}
+
 gpointer
 _gum_interceptor_backend_resolve_redirect (GumInterceptorBackend * self,
                                            gpointer address)
@@ -24,6 +24,10 @@
     ((GumCodeSliceElement *) (((guint8 *) (s)) - \
         G_STRUCT_OFFSET (GumCodeSliceElement, slice)))
 
+#define GUM_CODE_REGION_SHIFT 27
+#define GUM_CODE_REGION_OF(address) \
+    (GPOINTER_TO_SIZE (address) >> GUM_CODE_REGION_SHIFT)
+
 #if GLIB_SIZEOF_VOID_P == 8
 # define GUM_CODE_DEFLECTOR_CAVE_SIZE 24
 # define GUM_MAX_CODE_DEFLECTOR_THUNK_SIZE 128
@@ -34,6 +38,7 @@
 
 typedef struct _GumCodePages GumCodePages;
 typedef struct _GumCodeSliceElement GumCodeSliceElement;
+typedef struct _GumCodeSliceBucket GumCodeSliceBucket;
 typedef struct _GumCodeDeflectorDispatcher GumCodeDeflectorDispatcher;
 typedef struct _GumCodeDeflectorImpl GumCodeDeflectorImpl;
 typedef struct _GumProbeRangeForCodeCaveContext GumProbeRangeForCodeCaveContext;
@@ -45,6 +50,11 @@ struct _GumCodeSliceElement
   GumCodeSlice slice;
 };
 
+struct _GumCodeSliceBucket
+{
+  GList * slices;
+};
+
 struct _GumCodePages
 {
   gint ref_count;
@@ -54,6 +64,8 @@ struct _GumCodePages
   gsize size;
 
   GumCodeAllocator * allocator;
+  GumCodeSizeClass * size_class;
+  guint n_free;
 
   GumCodeSliceElement elements[1];
 };
@@ -96,10 +108,30 @@ struct _GumInsertDeflectorContext
   GumCodeDeflectorDispatcher * dispatcher;
 };
 
+static GumCodeSizeClass * gum_code_allocator_find_size_class (
+    GumCodeAllocator * self, gsize size);
+static GumCodeSlice * gum_code_allocator_try_take_free_slice (
+    GumCodeAllocator * self, GumCodeSizeClass * size_class,
+    const GumAddressSpec * spec, gsize alignment);
 static GumCodeSlice * gum_code_allocator_try_alloc_batch_near (
-    GumCodeAllocator * self, const GumAddressSpec * spec);
+    GumCodeAllocator * self, GumCodeSizeClass * size_class,
+    const GumAddressSpec * spec);
+static void gum_code_allocator_add_free_slice (GumCodeAllocator * self,
+    GumCodeSliceElement * element);
+static void gum_code_allocator_release_free_slices (GumCodeAllocator * self);
+static void gum_code_allocator_release_empty_pages (GumCodeAllocator * self);
+
+static void gum_code_size_class_init (GumCodeSizeClass * size_class,
+    gsize slice_size, gsize pages_per_batch);
+static void gum_code_size_class_finalize (GumCodeSizeClass * size_class);
+
+static GumCodeSlice * gum_code_slice_bucket_try_take (
+    GumCodeSliceBucket * self, GumCodeAllocator * allocator,
+    const GumAddressSpec * spec, gsize alignment);
+static void gum_code_slice_bucket_free (GumCodeSliceBucket * bucket);
 
 static void gum_code_pages_unref (GumCodePages * self);
+static void gum_code_pages_free (GumCodePages * self);
 
 static gboolean gum_code_slice_is_near (const GumCodeSlice * self,
     const GumAddressSpec * spec);
@@ -127,34 +159,55 @@ void
 gum_code_allocator_init (GumCodeAllocator * allocator,
                          gsize slice_size)
 {
+  guint n, i;
+
   allocator->slice_size = slice_size;
   allocator->pages_per_batch = 7;
-  allocator->slices_per_batch =
-      (allocator->pages_per_batch * gum_query_page_size ()) / slice_size;
-  allocator->pages_metadata_size = sizeof (GumCodePages) +
-      ((allocator->slices_per_batch - 1) * sizeof (GumCodeSliceElement));
+
+  n = 1;
+  while (n != GUM_CODE_ALLOCATOR_MAX_SIZE_CLASSES &&
+      (slice_size >> n) >= GUM_CODE_ALLOCATOR_MIN_SLICE_SIZE &&
+      (slice_size >> n) << n == slice_size)
+  {
+    n++;
+  }
+  for (i = 0; i != n; i++)
+  {
+    gum_code_size_class_init (&allocator->size_classes[i],
+        slice_size >> (n - 1 - i), allocator->pages_per_batch);
+  }
+  allocator->n_size_classes = n;
 
   allocator->uncommitted_pages = NULL;
   allocator->dirty_pages = g_hash_table_new (NULL, NULL);
-  allocator->free_slices = NULL;
+  allocator->empty_pages = g_hash_table_new (NULL, NULL);
 
   allocator->dispatchers = NULL;
+
+  memset (&allocator->stats, 0, sizeof (allocator->stats));
 }
 
 void
 gum_code_allocator_free (GumCodeAllocator * allocator)
 {
+  guint i;
+
   g_slist_foreach (allocator->dispatchers,
       (GFunc) gum_code_deflector_dispatcher_free, NULL);
   g_slist_free (allocator->dispatchers);
   allocator->dispatchers = NULL;
 
-  g_list_foreach (allocator->free_slices, (GFunc) gum_code_pages_unref, NULL);
+  gum_code_allocator_release_free_slices (allocator);
+  for (i = 0; i != allocator->n_size_classes; i++)
+    gum_code_size_class_finalize (&allocator->size_classes[i]);
+  allocator->n_size_classes = 0;
+
+  g_hash_table_unref (allocator->empty_pages);
   g_hash_table_unref (allocator->dirty_pages);
   g_slist_free (allocator->uncommitted_pages);
   allocator->uncommitted_pages = NULL;
   allocator->dirty_pages = NULL;
-  allocator->free_slices = NULL;
+  allocator->empty_pages = NULL;
 }
 
 GumCodeSlice *
@@ -168,27 +221,134 @@ gum_code_allocator_try_alloc_slice_near (GumCodeAllocator * self,
                                          const GumAddressSpec * spec,
                                          gsize alignment)
 {
-  GList * cur;
+  return gum_code_allocator_try_alloc_sized_slice_near (self, self->slice_size,
+      spec, alignment);
+}
+
+GumCodeSlice *
+gum_code_allocator_try_alloc_sized_slice_near (GumCodeAllocator * self,
+                                               gsize size,
+                                               const GumAddressSpec * spec,
+                                               gsize alignment)
+{
+  GumCodeAllocatorStats * stats = &self->stats;
+  GumCodeSizeClass * size_class;
+  GumCodeSlice * slice;
+  gint64 start_time;
+  guint64 elapsed;
+
+  size_class = gum_code_allocator_find_size_class (self, size);
+  if (size_class == NULL)
+    return NULL;
 
-  for (cur = self->free_slices; cur != NULL; cur = cur->next)
+  start_time = g_get_monotonic_time ();
+
+  slice = gum_code_allocator_try_take_free_slice (self, size_class, spec,
+      alignment);
+  if (slice != NULL)
   {
-    GumCodeSliceElement * element = (GumCodeSliceElement *) cur;
-    GumCodeSlice * slice = &element->slice;
+    stats->slices_reused++;
+  }
+  else
+  {
+    slice = gum_code_allocator_try_alloc_batch_near (self, size_class, spec);
+    if (slice != NULL)
+      stats->batches_allocated++;
+    else
+      stats->allocations_failed++;
+  }
 
-    if (gum_code_slice_is_near (slice, spec) &&
-        gum_code_slice_is_aligned (slice, alignment))
-    {
-      GumCodePages * pages = element->parent.data;
+  elapsed = g_get_monotonic_time () - start_time;
+  stats->max_alloc_time = MAX (stats->max_alloc_time, elapsed);
+  stats->total_alloc_time += elapsed;
 
-      self->free_slices = g_list_remove_link (self->free_slices, cur);
+  return slice;
+}
 
-      g_hash_table_add (self->dirty_pages, pages);
+gsize
+gum_code_allocator_round_slice_size (GumCodeAllocator * self,
+                                     gsize size)
+{
+  GumCodeSizeClass * size_class;
 
-      return slice;
+  size_class = gum_code_allocator_find_size_class (self, size);
+  if (size_class == NULL)
+    return 0;
+
+  return size_class->slice_size;
+}
+
+static GumCodeSizeClass *
+gum_code_allocator_find_size_class (GumCodeAllocator * self,
+                                    gsize size)
+{
+  guint i;
+
+  for (i = 0; i != self->n_size_classes; i++)
+  {
+    GumCodeSizeClass * size_class = &self->size_classes[i];
+
+    if (size <= size_class->slice_size)
+      return size_class;
+  }
+
+  return NULL;
+}
+
+static GumCodeSlice *
+gum_code_allocator_try_take_free_slice (GumCodeAllocator * self,
+                                        GumCodeSizeClass * size_class,
+                                        const GumAddressSpec * spec,
+                                        gsize alignment)
+{
+  GHashTable * free_slices = size_class->free_slices;
+  GumCodeSlice * slice;
+  gsize near_address, lowest, highest, first_region, last_region, region;
+  GHashTableIter iter;
+  GumCodeSliceBucket * bucket;
+
+  if (spec != NULL)
+  {
+    near_address = GPOINTER_TO_SIZE (spec->near_address);
+
+    lowest = (near_address > spec->max_distance)
+        ? near_address - spec->max_distance
+        : 0;
+    highest = (G_MAXSIZE - near_address > spec->max_distance)
+        ? near_address + spec->max_distance
+        : G_MAXSIZE;
+
+    first_region = GUM_CODE_REGION_OF (lowest);
+    last_region = GUM_CODE_REGION_OF (highest);
+
+    if (last_region - first_region < g_hash_table_size (free_slices))
+    {
+      for (region = first_region; region <= last_region; region++)
+      {
+        bucket = g_hash_table_lookup (free_slices,
+            GSIZE_TO_POINTER (region));
+        if (bucket == NULL)
+          continue;
+
+        slice = gum_code_slice_bucket_try_take (bucket, self, spec,
+            alignment);
+        if (slice != NULL)
+          return slice;
+      }
+
+      return NULL;
     }
   }
 
-  return gum_code_allocator_try_alloc_batch_near (self, spec);
+  g_hash_table_iter_init (&iter, free_slices);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &bucket))
+  {
+    slice = gum_code_slice_bucket_try_take (bucket, self, spec, alignment);
+    if (slice != NULL)
+      return slice;
+  }
+
+  return NULL;
 }
 
 void
@@ -230,15 +390,15 @@ gum_code_allocator_commit (GumCodeAllocator * self)
   }
   g_hash_table_remove_all (self->dirty_pages);
 
-  if (!rwx_supported)
-  {
-    g_list_foreach (self->free_slices, (GFunc) gum_code_pages_unref, NULL);
-    self->free_slices = NULL;
-  }
+  if (rwx_supported)
+    gum_code_allocator_release_empty_pages (self);
+  else
+    gum_code_allocator_release_free_slices (self);
 }
 
 static GumCodeSlice *
 gum_code_allocator_try_alloc_batch_near (GumCodeAllocator * self,
+                                         GumCodeSizeClass * size_class,
                                          const GumAddressSpec * spec)
 {
   GumCodeSlice * result = NULL;
@@ -286,16 +446,18 @@ gum_code_allocator_try_alloc_batch_near (GumCodeAllocator * self,
     data = gum_code_segment_get_address (segment);
   }
 
-  pages = g_slice_alloc (self->pages_metadata_size);
-  pages->ref_count = self->slices_per_batch;
+  pages = g_slice_alloc (size_class->pages_metadata_size);
+  pages->ref_count = size_class->slices_per_batch;
 
   pages->segment = segment;
   pages->data = data;
   pages->size = size_in_bytes;
 
   pages->allocator = self;
+  pages->size_class = size_class;
+  pages->n_free = 0;
 
-  for (i = self->slices_per_batch; i != 0; i--)
+  for (i = size_class->slices_per_batch; i != 0; i--)
   {
     guint slice_index = i - 1;
     GumCodeSliceElement * element = &pages->elements[slice_index];
@@ -303,8 +465,8 @@ gum_code_allocator_try_alloc_batch_near (GumCodeAllocator * self,
     GumCodeSlice * slice;
 
     slice = &element->slice;
-    slice->data = (guint8 *) data + (slice_index * self->slice_size);
-    slice->size = self->slice_size;
+    slice->data = (guint8 *) data + (slice_index * size_class->slice_size);
+    slice->size = size_class->slice_size;
 
     link = &element->parent;
     link->data = pages;
@@ -316,10 +478,7 @@ gum_code_allocator_try_alloc_batch_near (GumCodeAllocator * self,
     }
     else
     {
-      if (self->free_slices != NULL)
-        self->free_slices->prev = link;
-      link->next = self->free_slices;
-      self->free_slices = link;
+      gum_code_allocator_add_free_slice (self, element);
     }
   }
 
@@ -332,27 +491,172 @@ gum_code_allocator_try_alloc_batch_near (GumCodeAllocator * self,
 }
 
 static void
-gum_code_pages_unref (GumCodePages * self)
+gum_code_allocator_add_free_slice (GumCodeAllocator * self,
+                                   GumCodeSliceElement * element)
 {
-  self->ref_count--;
-  if (self->ref_count == 0)
+  GList * link = &element->parent;
+  GumCodePages * pages = link->data;
+  GumCodeSizeClass * size_class = pages->size_class;
+  gpointer region;
+  GumCodeSliceBucket * bucket;
+
+  region = GSIZE_TO_POINTER (GUM_CODE_REGION_OF (element->slice.data));
+
+  bucket = g_hash_table_lookup (size_class->free_slices, region);
+  if (bucket == NULL)
   {
-    if (self->segment != NULL)
+    bucket = g_slice_new (GumCodeSliceBucket);
+    bucket->slices = NULL;
+    g_hash_table_insert (size_class->free_slices, region, bucket);
+  }
+
+  link->prev = NULL;
+  link->next = bucket->slices;
+  if (bucket->slices != NULL)
+    bucket->slices->prev = link;
+  bucket->slices = link;
+
+  pages->n_free++;
+  if (pages->n_free == size_class->slices_per_batch)
+    g_hash_table_add (self->empty_pages, pages);
+}
+
+static void
+gum_code_allocator_release_free_slices (GumCodeAllocator * self)
+{
+  guint i;
+
+  g_hash_table_remove_all (self->empty_pages);
+
+  for (i = 0; i != self->n_size_classes; i++)
+  {
+    GHashTableIter iter;
+    GumCodeSliceBucket * bucket;
+
+    g_hash_table_iter_init (&iter, self->size_classes[i].free_slices);
+    while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &bucket))
     {
-      gum_code_segment_free (self->segment);
+      g_list_foreach (bucket->slices, (GFunc) gum_code_pages_unref, NULL);
+      bucket->slices = NULL;
     }
-    else
+  }
+}
+
+static void
+gum_code_allocator_release_empty_pages (GumCodeAllocator * self)
+{
+  GHashTableIter iter;
+  GumCodePages * pages;
+
+  g_hash_table_iter_init (&iter, self->empty_pages);
+  while (g_hash_table_iter_next (&iter, (gpointer *) &pages, NULL))
+  {
+    GumCodeSizeClass * size_class = pages->size_class;
+    guint i;
+
+    for (i = 0; i != size_class->slices_per_batch; i++)
     {
-      GumMemoryRange range;
+      GumCodeSliceElement * element = &pages->elements[i];
+      GumCodeSliceBucket * bucket;
+
+      bucket = g_hash_table_lookup (size_class->free_slices,
+          GSIZE_TO_POINTER (GUM_CODE_REGION_OF (element->slice.data)));
+      bucket->slices = g_list_remove_link (bucket->slices, &element->parent);
+    }
+
+    gum_code_pages_free (pages);
+
+    self->stats.batches_released++;
+  }
+  g_hash_table_remove_all (self->empty_pages);
+}
+
+static void
+gum_code_size_class_init (GumCodeSizeClass * size_class,
+                          gsize slice_size,
+                          gsize pages_per_batch)
+{
+  size_class->slice_size = slice_size;
+  size_class->slices_per_batch =
+      (pages_per_batch * gum_query_page_size ()) / slice_size;
+  size_class->pages_metadata_size = sizeof (GumCodePages) +
+      ((size_class->slices_per_batch - 1) * sizeof (GumCodeSliceElement));
+
+  size_class->free_slices = g_hash_table_new_full (NULL, NULL, NULL,
+      (GDestroyNotify) gum_code_slice_bucket_free);
+}
+
+static void
+gum_code_size_class_finalize (GumCodeSizeClass * size_class)
+{
+  g_hash_table_unref (size_class->free_slices);
+  size_class->free_slices = NULL;
+}
 
-      gum_free_pages (self->data);
+static GumCodeSlice *
+gum_code_slice_bucket_try_take (GumCodeSliceBucket * self,
+                                GumCodeAllocator * allocator,
+                                const GumAddressSpec * spec,
+                                gsize alignment)
+{
+  GList * cur;
 
-      gum_query_page_allocation_range (self->data, self->size, &range);
-      gum_cloak_remove_range (&range);
+  for (cur = self->slices; cur != NULL; cur = cur->next)
+  {
+    GumCodeSliceElement * element = (GumCodeSliceElement *) cur;
+    GumCodeSlice * slice = &element->slice;
+
+    if (gum_code_slice_is_near (slice, spec) &&
+        gum_code_slice_is_aligned (slice, alignment))
+    {
+      GumCodePages * pages = element->parent.data;
+
+      self->slices = g_list_remove_link (self->slices, cur);
+
+      if (pages->n_free-- == pages->size_class->slices_per_batch)
+        g_hash_table_remove (allocator->empty_pages, pages);
+
+      g_hash_table_add (allocator->dirty_pages, pages);
+
+      return slice;
     }
+  }
+
+  return NULL;
+}
+
+static void
+gum_code_slice_bucket_free (GumCodeSliceBucket * bucket)
+{
+  g_slice_free (GumCodeSliceBucket, bucket);
+}
 
-    g_slice_free1 (self->allocator->pages_metadata_size, self);
+static void
+gum_code_pages_unref (GumCodePages * self)
+{
+  self->ref_count--;
+  if (self->ref_count == 0)
+    gum_code_pages_free (self);
+}
+
+static void
+gum_code_pages_free (GumCodePages * self)
+{
+  if (self->segment != NULL)
+  {
+    gum_code_segment_free (self->segment);
   }
+  else
+  {
+    GumMemoryRange range;
+
+    gum_free_pages (self->data);
+
+    gum_query_page_allocation_range (self->data, self->size, &range);
+    gum_cloak_remove_range (&range);
+  }
+
+  g_slice_free1 (self->size_class->pages_metadata_size, self);
 }
 
 void
@@ -369,13 +673,7 @@ gum_code_slice_free (GumCodeSlice * slice)
 
   if (gum_query_is_rwx_supported ())
   {
-    GumCodeAllocator * allocator = pages->allocator;
-    GList * link = &element->parent;
-
-    if (allocator->free_slices != NULL)
-      allocator->free_slices->prev = link;
-    link->next = allocator->free_slices;
-    allocator->free_slices = link;
+    gum_code_allocator_add_free_slice (pages->allocator, element);
   }
   else
   {
@@ -9,22 +9,51 @@
 
 #include "gummemory.h"
 
+#define GUM_CODE_ALLOCATOR_MAX_SIZE_CLASSES 4
+#define GUM_CODE_ALLOCATOR_MIN_SLICE_SIZE   64
+
 typedef struct _GumCodeAllocator GumCodeAllocator;
+typedef struct _GumCodeSizeClass GumCodeSizeClass;
+typedef struct _GumCodeAllocatorStats GumCodeAllocatorStats;
 typedef struct _GumCodeSlice GumCodeSlice;
 typedef struct _GumCodeDeflector GumCodeDeflector;
 
-struct _GumCodeAllocator
+struct _GumCodeAllocatorStats
+{
+  guint slices_reused;
+  guint batches_allocated;
+  guint allocations_failed;
+  guint batches_released;
+
+  /* Time spent allocating slices, in microseconds */
+  guint64 max_alloc_time;
+  guint64 total_alloc_time;
+};
+
+struct _GumCodeSizeClass
 {
   gsize slice_size;
-  gsize pages_per_batch;
   gsize slices_per_batch;
   gsize pages_metadata_size;
 
+  GHashTable * free_slices;
+};
+
+struct _GumCodeAllocator
+{
+  gsize slice_size;
+  gsize pages_per_batch;
+
+  GumCodeSizeClass size_classes[GUM_CODE_ALLOCATOR_MAX_SIZE_CLASSES];
+  guint n_size_classes;
+
   GSList * uncommitted_pages;
   GHashTable * dirty_pages;
-  GList * free_slices;
+  GHashTable * empty_pages;
 
   GSList * dispatchers;
+
+  GumCodeAllocatorStats stats;
 };
 
 struct _GumCodeSlice
@@ -46,6 +75,11 @@ void gum_code_allocator_free (GumCodeAllocator * allocator);
 GumCodeSlice * gum_code_allocator_alloc_slice (GumCodeAllocator * self);
 GumCodeSlice * gum_code_allocator_try_alloc_slice_near (GumCodeAllocator * self,
     const GumAddressSpec * spec, gsize alignment);
+GumCodeSlice * gum_code_allocator_try_alloc_sized_slice_near (
+    GumCodeAllocator * self, gsize size, const GumAddressSpec * spec,
+    gsize alignment);
+gsize gum_code_allocator_round_slice_size (GumCodeAllocator * self,
+    gsize size);
 void gum_code_allocator_commit (GumCodeAllocator * self);
 void gum_code_slice_free (GumCodeSlice * slice);
 
@@ -17,19 +17,31 @@
 typedef struct _GumInterceptorBackend GumInterceptorBackend;
 typedef struct _GumFunctionContext GumFunctionContext;
 typedef struct _GumFunctionContextBackendData GumFunctionContextBackendData;
+typedef guint GumFunctionDispatchMode;
 
 struct _GumFunctionContextBackendData
 {
   gpointer data[2];
 };
 
+enum _GumFunctionDispatchMode
+{
+  GUM_FUNCTION_DISPATCH_GENERIC,
+  GUM_FUNCTION_DISPATCH_ENTER_ONLY,
+  GUM_FUNCTION_DISPATCH_PROBE_ONLY,
+  GUM_FUNCTION_DISPATCH_REPLACEMENT_ONLY
+};
+
 struct _GumFunctionContext
 {
   gpointer function_address;
 
   gboolean destroyed;
   gboolean activated;
+  gboolean deferred;
+  gboolean fast_replacement;
   gboolean has_on_leave_listener;
+  volatile gint dispatch_mode;
 
   GumCodeSlice * trampoline_slice;
   GumCodeDeflector * trampoline_deflector;
@@ -44,6 +56,7 @@ struct _GumFunctionContext
   gpointer on_leave_trampoline;
 
   volatile GPtrArray * listener_entries;
+  volatile GArray * probe_entries;
 
   gpointer replacement_function;
   gpointer replacement_function_data;
@@ -78,6 +91,8 @@ G_GNUC_INTERNAL void _gum_interceptor_backend_deactivate_trampoline (
 
 G_GNUC_INTERNAL gpointer _gum_interceptor_backend_get_function_address (
     GumFunctionContext * ctx);
+G_GNUC_INTERNAL gboolean _gum_interceptor_backend_get_unsafe_range (
+    GumFunctionContext * ctx, GumMemoryRange * range);
 G_GNUC_INTERNAL gpointer _gum_interceptor_backend_resolve_redirect (
     GumInterceptorBackend * self, gpointer address);
 G_GNUC_INTERNAL gboolean _gum_interceptor_backend_can_intercept (
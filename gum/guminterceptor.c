@@ -10,12 +10,16 @@
 #include "guminterceptor-priv.h"
 
 #include "gumcodesegment.h"
+#include "gumexceptor.h"
 #include "gumlibc.h"
 #include "gummemory.h"
-#include "gumprocess.h"
+#include "gumprocess-priv.h"
 #include "gumtls.h"
 
 #include <string.h>
+#ifdef _MSC_VER
+# include <intrin.h>
+#endif
 
 #ifdef HAVE_MIPS
 #define GUM_INTERCEPTOR_CODE_SLICE_SIZE 1024
@@ -25,17 +29,45 @@
 
 G_DEFINE_TYPE (GumInterceptor, gum_interceptor, G_TYPE_OBJECT);
 
+#define GUM_INVOCATION_ARENA_BLOCK_SIZE 4096
+#define GUM_INVOCATION_ARENA_ALIGNMENT  16
+#define GUM_INVOCATION_ARENA_BLOCK_HEADER_SIZE \
+    GUM_ALIGN_SIZE (sizeof (InvocationArenaBlock), \
+        GUM_INVOCATION_ARENA_ALIGNMENT)
+
+#define GUM_HOOK_STATS_INITIAL_CAPACITY 64
+
+#define GUM_MAX_DEFERRED_PAGES 256
+
+#define GUM_BUSY_WRITE_MAX_ATTEMPTS 5
+
+#define GUM_INVOCATION_STACK_INDEX_MIN_DEPTH 8
+#define GUM_INVOCATION_STACK_INDEX_MIN_CAPACITY 32
+
 #define GUM_INTERCEPTOR_LOCK()   (g_rec_mutex_lock (&priv->mutex))
 #define GUM_INTERCEPTOR_UNLOCK() (g_rec_mutex_unlock (&priv->mutex))
 
 typedef struct _GumInterceptorTransaction GumInterceptorTransaction;
 typedef struct _GumDestroyTask GumDestroyTask;
 typedef struct _GumPrologueWrite GumPrologueWrite;
+typedef struct _GumDeferredPage GumDeferredPage;
+typedef struct _GumPageProtectionQuery GumPageProtectionQuery;
 typedef struct _ListenerEntry ListenerEntry;
+typedef struct _ListenerThreadFilter ListenerThreadFilter;
+typedef struct _ThreadFilterVerdict ThreadFilterVerdict;
+typedef struct _ProbeEntry ProbeEntry;
 typedef struct _InterceptorThreadContext InterceptorThreadContext;
+typedef struct _InvocationArena InvocationArena;
+typedef struct _InvocationArenaBlock InvocationArenaBlock;
 typedef struct _GumInvocationStackEntry GumInvocationStackEntry;
+typedef struct _InvocationStackIndex InvocationStackIndex;
+typedef struct _InvocationStackIndexSlot InvocationStackIndexSlot;
 typedef struct _ListenerDataSlot ListenerDataSlot;
+typedef struct _ListenerInvocationData ListenerInvocationData;
 typedef struct _ListenerInvocationState ListenerInvocationState;
+typedef struct _HookStatsTable HookStatsTable;
+typedef struct _HookStatsSlot HookStatsSlot;
+typedef struct _HookStatsTimer HookStatsTimer;
 
 typedef void (* GumPrologueWriteFunc) (GumInterceptor * self,
     GumFunctionContext * ctx, gpointer prologue);
@@ -55,13 +87,24 @@ struct _GumInterceptorPrivate
   GRecMutex mutex;
 
   GHashTable * function_by_address;
+  GPtrArray * retired_fast_replacements;
 
   GumInterceptorBackend * backend;
   GumCodeAllocator allocator;
 
   volatile guint selected_thread_id;
 
+  GHashTable * thread_filter_by_listener;
+
+  GHashTable * deferred_pages;
+  GumDeferredPage * deferred_page_slots;
+  volatile gint deferred_page_hits;
+  GumExceptor * exceptor;
+
+  volatile gint profiling_enabled;
+
   GumInterceptorTransaction current_transaction;
+  GumInterceptorTransactionStats transaction_stats;
 };
 
 struct _GumDestroyTask
@@ -77,11 +120,87 @@ struct _GumPrologueWrite
   GumPrologueWriteFunc func;
 };
 
+/*
+ * Armed pages live in a fixed array that our exception handler scans without
+ * locking, as it may be running in signal context. A slot keeps its address
+ * after the page is disarmed, so a thread that faulted just before can still
+ * be resumed, and is only recycled once a new page needs it.
+ */
+struct _GumDeferredPage
+{
+  gpointer volatile address;
+  GumPageProtection prot;
+  volatile gint hit;
+
+  GPtrArray * functions;
+};
+
+struct _GumPageProtectionQuery
+{
+  GumAddress page;
+  GumPageProtection prot;
+  gboolean found;
+};
+
 struct _ListenerEntry
 {
   GumInvocationListenerIface * listener_interface;
   GumInvocationListener * listener_instance;
   gpointer function_data;
+  ListenerThreadFilter * volatile thread_filter;
+};
+
+struct _ListenerThreadFilter
+{
+  gint ref_count;
+
+  guint id;
+  GumInterceptorThreadFilterFunc func;
+  gpointer data;
+  GDestroyNotify data_destroy;
+};
+
+struct _ThreadFilterVerdict
+{
+  guint filter_id;
+  gboolean accepted;
+};
+
+struct _ProbeEntry
+{
+  GumInterceptorProbeFunc func;
+  gpointer user_data;
+};
+
+struct _InvocationArenaBlock
+{
+  InvocationArenaBlock * previous;
+  gsize capacity;
+  gsize offset;
+};
+
+struct _InvocationArena
+{
+  InvocationArenaBlock * head;
+  InvocationArenaBlock * spare;
+};
+
+/*
+ * Maps trampoline return addresses to their depth in the invocation stack,
+ * so backtracers can translate in constant time. Rebuilt on demand when the
+ * stack has changed since it was last built.
+ */
+struct _InvocationStackIndex
+{
+  InvocationStackIndexSlot * slots;
+  guint capacity;
+  guint version;
+};
+
+struct _InvocationStackIndexSlot
+{
+  gpointer trampoline_ret_addr;
+  gint depth;
 };
 
 struct _InterceptorThreadContext
@@ -92,8 +211,47 @@ struct _InterceptorThreadContext
   gint ignore_level;
 
   GumInvocationStack * stack;
+  guint stack_version;
+  InvocationStackIndex stack_index;
+  InvocationArena arena;
 
   GArray * listener_data_slots;
+  GArray * thread_filter_verdicts;
+  guint thread_filter_epoch;
+
+  HookStatsTable * hook_stats;
+};
+
+/*
+ * Per-thread, open-addressed table of hook counters. Only the owning thread
+ * writes to it, so no atomics are needed. Readers copy the slots out while
+ * holding gum_interceptor_thread_context_lock, which the owner also takes
+ * when swapping in a grown slot array, and merge them after releasing it.
+ */
+struct _HookStatsTable
+{
+  HookStatsTable * next;
+
+  HookStatsSlot * slots;
+  guint capacity;
+  guint length;
+};
+
+struct _HookStatsSlot
+{
+  gpointer function_address;
+
+  guint64 invocations;
+  guint64 bypassed_invocations;
+  guint64 listener_ticks;
+  guint64 trampoline_ticks;
+};
+
+struct _HookStatsTimer
+{
+  HookStatsSlot * slot;
+  guint64 start_ticks;
+  guint64 start_listener_ticks;
 };
 
 struct _GumInvocationStackEntry
@@ -101,9 +259,10 @@ struct _GumInvocationStackEntry
   gpointer trampoline_ret_addr;
   gpointer caller_ret_addr;
   GumInvocationContext invocation_context;
-  GumCpuContext cpu_context;
-  guint8 listener_invocation_data[GUM_MAX_LISTENERS_PER_FUNCTION]
-      [GUM_MAX_LISTENER_DATA];
+  GumCpuContext * cpu_context;
+  ListenerInvocationData * listener_invocation_data;
+  InvocationArenaBlock * arena_block;
+  gsize arena_offset;
   gboolean calling_replacement;
   gint original_system_error;
 };
@@ -114,12 +273,20 @@ struct _ListenerDataSlot
   guint8 data[GUM_MAX_LISTENER_DATA];
 };
 
+struct _ListenerInvocationData
+{
+  ListenerInvocationData * next;
+  GumInvocationListener * owner;
+  gsize size;
+  gpointer data;
+};
+
 struct _ListenerInvocationState
 {
   GumPointCut point_cut;
   ListenerEntry * entry;
   InterceptorThreadContext * interceptor_ctx;
-  guint8 * invocation_data;
+  GumInvocationStackEntry * stack_entry;
 };
 
 static void gum_interceptor_dispose (GObject * object);
@@ -128,8 +295,36 @@ static void gum_interceptor_finalize (GObject * object);
 static void the_interceptor_weak_notify (gpointer data,
     GObject * where_the_object_was);
 
+static GumAttachReturn gum_interceptor_try_attach_listener (
+    GumInterceptor * self, gpointer function_address,
+    GumInvocationListener * listener, gpointer listener_function_data,
+    gboolean deferred);
 static GumFunctionContext * gum_interceptor_instrument (GumInterceptor * self,
     gpointer function_address);
+static GumFunctionContext * gum_interceptor_instrument_deferred (
+    GumInterceptor * self, gpointer function_address);
+static gboolean gum_interceptor_activate_deferred_function (
+    GumInterceptor * self, GumFunctionContext * ctx);
+static void gum_interceptor_activate_deferred_page (GumInterceptor * self,
+    gpointer page);
+static void gum_interceptor_activate_hit_deferred_pages (
+    GumInterceptor * self);
+static void gum_interceptor_forget_deferred_function (GumInterceptor * self,
+    GumFunctionContext * ctx);
+static GumDeferredPage * gum_interceptor_arm_deferred_page (
+    GumInterceptor * self, gpointer page);
+static gboolean gum_query_page_protection (gpointer page,
+    GumPageProtection * prot);
+static gboolean gum_store_page_protection_if_containing (
+    const GumRangeDetails * details, gpointer user_data);
+static void gum_interceptor_protect_deferred_pages (GumInterceptor * self,
+    GList * pages, gboolean writable);
+static GumExceptor * gum_interceptor_steal_idle_exceptor (
+    GumInterceptor * self);
+static void gum_interceptor_release_exceptor (GumInterceptor * self,
+    GumExceptor * exceptor);
+static gboolean gum_interceptor_on_exception (GumExceptionDetails * details,
+    gpointer user_data);
 static void gum_interceptor_activate (GumInterceptor * self,
     GumFunctionContext * ctx, gpointer prologue);
 static void gum_interceptor_deactivate (GumInterceptor * self,
@@ -142,6 +337,13 @@ static void gum_interceptor_transaction_destroy (
 static void gum_interceptor_transaction_begin (
     GumInterceptorTransaction * self);
 static void gum_interceptor_transaction_end (GumInterceptorTransaction * self);
+static void gum_interceptor_record_transaction (GumInterceptor * self,
+    guint page_count, guint range_count, gint64 duration);
+static void gum_interceptor_transaction_hold_back_busy_writes (
+    GumInterceptorTransaction * self, GList * addresses,
+    GHashTable * dropped);
+static gboolean gum_thread_pcs_intersect (GArray * pcs,
+    const GumMemoryRange * range);
 static void gum_interceptor_transaction_schedule_destroy (
     GumInterceptorTransaction * self, GumFunctionContext * ctx,
     GDestroyNotify notify, gpointer data);
@@ -155,6 +357,7 @@ static void gum_function_context_finalize (GumFunctionContext * function_ctx);
 static void gum_function_context_destroy (GumFunctionContext * function_ctx);
 static void gum_function_context_perform_destroy (
     GumFunctionContext * function_ctx);
+static void gum_function_context_retire (GumFunctionContext * function_ctx);
 static gboolean gum_function_context_is_empty (
     GumFunctionContext * function_ctx);
 static void gum_function_context_add_listener (
@@ -163,12 +366,48 @@ static void gum_function_context_add_listener (
 static void gum_function_context_remove_listener (
     GumFunctionContext * function_ctx, GumInvocationListener * listener);
 static void listener_entry_free (ListenerEntry * entry);
+static gboolean listener_entry_accepts_thread (ListenerEntry * entry,
+    InterceptorThreadContext * interceptor_ctx);
+static ListenerThreadFilter * listener_thread_filter_new (
+    GumInterceptorThreadFilterFunc func, gpointer data,
+    GDestroyNotify data_destroy);
+static ListenerThreadFilter * listener_thread_filter_ref (
+    ListenerThreadFilter * filter);
+static void listener_thread_filter_unref (ListenerThreadFilter * filter);
+static gboolean gum_thread_id_set_contains (GumThreadId thread_id,
+    GHashTable * thread_ids);
 static gboolean gum_function_context_has_listener (
     GumFunctionContext * function_ctx, GumInvocationListener * listener);
 static ListenerEntry ** gum_function_context_find_listener (
     GumFunctionContext * function_ctx, GumInvocationListener * listener);
 static ListenerEntry ** gum_function_context_find_taken_listener_slot (
     GumFunctionContext * function_ctx);
+static void gum_function_context_add_probe (GumFunctionContext * function_ctx,
+    GumInterceptorProbeFunc func, gpointer user_data);
+static gboolean gum_function_context_remove_probe (
+    GumFunctionContext * function_ctx, GumInterceptorProbeFunc func,
+    gpointer user_data);
+static gboolean gum_function_context_has_probe (
+    GumFunctionContext * function_ctx, GumInterceptorProbeFunc func,
+    gpointer user_data);
+static void gum_function_context_update_dispatch_mode (
+    GumFunctionContext * function_ctx);
+static gboolean gum_function_context_accepts_thread (
+    GumFunctionContext * function_ctx,
+    InterceptorThreadContext * interceptor_ctx);
+static void gum_function_context_invoke_probes (
+    GumFunctionContext * function_ctx, GumCpuContext * cpu_context,
+    HookStatsSlot * stats);
+static gint gum_function_context_invoke_listeners (
+    GumFunctionContext * function_ctx, GumPointCut point_cut,
+    InterceptorThreadContext * interceptor_ctx,
+    GumInvocationStackEntry * stack_entry, gint system_error,
+    HookStatsSlot * stats);
+static void gum_function_context_enter_replacement (
+    GumFunctionContext * function_ctx,
+    InterceptorThreadContext * interceptor_ctx,
+    GumInvocationStackEntry * stack_entry, GumCpuContext * cpu_context,
+    gint system_error, gpointer replacement_function, gpointer * next_hop);
 static void gum_function_context_fixup_cpu_context (
     GumFunctionContext * function_ctx, GumCpuContext * cpu_context);
 
@@ -183,10 +422,56 @@ static gpointer interceptor_thread_context_get_listener_data (
     gsize required_size);
 static void interceptor_thread_context_forget_listener_data (
     InterceptorThreadContext * self, GumInvocationListener * listener);
+static gboolean interceptor_thread_context_check_filter (
+    InterceptorThreadContext * self, ListenerThreadFilter * filter);
+static HookStatsSlot * interceptor_thread_context_get_hook_stats (
+    InterceptorThreadContext * self, gpointer function_address);
+static void gum_interceptor_count_bypass (gpointer function_address);
+static void hook_stats_timer_start (HookStatsTimer * timer,
+    HookStatsSlot * slot);
+static void hook_stats_timer_stop (HookStatsTimer * timer);
+static HookStatsTable * hook_stats_table_new (void);
+static void hook_stats_table_free (HookStatsTable * table);
+static void hook_stats_table_free_all (HookStatsTable * table);
+static HookStatsSlot * hook_stats_table_lookup (HookStatsTable * self,
+    gpointer function_address);
+static HookStatsSlot * hook_stats_table_insert (HookStatsTable * self,
+    gpointer function_address, GumSpinlock * lock);
+static guint hook_stats_hash (gpointer function_address);
+static void hook_stats_table_merge (HookStatsTable * self,
+    HookStatsTable * other);
+static void hook_stats_table_add (HookStatsTable * self,
+    const HookStatsSlot * src);
+static guint hook_stats_table_copy_slots (HookStatsTable * self,
+    HookStatsSlot * slots);
+static guint gum_interceptor_measure_live_hook_stats (void);
+static guint gum_interceptor_snapshot_live_hook_stats (HookStatsSlot * slots);
+static void hook_stats_table_reset (HookStatsTable * self);
+static gint hook_stats_compare_by_cost (const GumInterceptorHookStats * a,
+    const GumInterceptorHookStats * b);
+static guint64 gum_interceptor_read_ticks (void);
+static void invocation_arena_init (InvocationArena * arena);
+static void invocation_arena_destroy (InvocationArena * arena);
+static gpointer invocation_arena_alloc (InvocationArena * arena, gsize size);
+static void invocation_arena_reset (InvocationArena * arena,
+    InvocationArenaBlock * block, gsize offset);
 static GumInvocationStackEntry * gum_invocation_stack_push (
-    GumInvocationStack * stack, GumFunctionContext * function_ctx,
-    gpointer caller_ret_addr);
-static gpointer gum_invocation_stack_pop (GumInvocationStack * stack);
+    InterceptorThreadContext * interceptor_ctx,
+    GumFunctionContext * function_ctx, gpointer caller_ret_addr);
+static gpointer gum_invocation_stack_pop (
+    InterceptorThreadContext * interceptor_ctx);
+static InvocationStackIndex * gum_invocation_stack_get_index (
+    GumInvocationStack * stack);
+static gint gum_invocation_stack_find_first (GumInvocationStack * stack,
+    gpointer return_address);
+static gint gum_invocation_stack_find_below (GumInvocationStack * stack,
+    gpointer return_address, guint end);
+static void invocation_stack_index_init (InvocationStackIndex * index);
+static void invocation_stack_index_destroy (InvocationStackIndex * index);
+static void invocation_stack_index_rebuild (InvocationStackIndex * index,
+    GumInvocationStack * stack);
+static gint invocation_stack_index_lookup (InvocationStackIndex * index,
+    gpointer return_address);
 static GumInvocationStackEntry * gum_invocation_stack_peek_top (
     GumInvocationStack * stack);
 
@@ -197,6 +482,8 @@ static gboolean gum_interceptor_has (GumInterceptor * self,
 
 static gpointer gum_page_address_from_pointer (gpointer ptr);
 static gint gum_page_address_compare (gconstpointer a, gconstpointer b);
+static GArray * gum_page_ranges_from_sorted_pages (GList * pages,
+    guint page_size);
 
 static GMutex _gum_interceptor_lock;
 static GumInterceptor * _the_interceptor = NULL;
@@ -206,6 +493,13 @@ static GHashTable * gum_interceptor_thread_contexts;
 static GPrivate gum_interceptor_context_private =
     G_PRIVATE_INIT ((GDestroyNotify) release_interceptor_thread_context);
 static GumTlsKey gum_interceptor_guard_key;
+static GumTlsKey gum_interceptor_hook_stats_key;
+static HookStatsTable * gum_interceptor_retired_hook_stats = NULL;
+/*
+ * Bumped whenever a thread filter goes away, so that each thread drops its
+ * cached verdicts the next time it consults one.
+ */
+static volatile gint gum_interceptor_thread_filter_epoch = 0;
 
 static GumInvocationStack _gum_interceptor_empty_stack = { NULL, 0 };
 
@@ -228,16 +522,21 @@ _gum_interceptor_init (void)
       (GDestroyNotify) interceptor_thread_context_destroy, NULL);
 
   gum_interceptor_guard_key = gum_tls_key_new ();
+  gum_interceptor_hook_stats_key = gum_tls_key_new ();
 }
 
 void
 _gum_interceptor_deinit (void)
 {
+  gum_tls_key_free (gum_interceptor_hook_stats_key);
   gum_tls_key_free (gum_interceptor_guard_key);
 
   g_hash_table_unref (gum_interceptor_thread_contexts);
   gum_interceptor_thread_contexts = NULL;
 
+  hook_stats_table_free_all (gum_interceptor_retired_hook_stats);
+  gum_interceptor_retired_hook_stats = NULL;
+
   gum_spinlock_free (&gum_interceptor_thread_context_lock);
 }
 
@@ -253,6 +552,11 @@ gum_interceptor_init (GumInterceptor * self)
 
   priv->function_by_address = g_hash_table_new_full (NULL, NULL, NULL,
       (GDestroyNotify) gum_function_context_destroy);
+  priv->retired_fast_replacements = g_ptr_array_new_full (0,
+      (GDestroyNotify) gum_function_context_perform_destroy);
+  priv->thread_filter_by_listener = g_hash_table_new_full (NULL, NULL, NULL,
+      (GDestroyNotify) listener_thread_filter_unref);
+  priv->deferred_pages = g_hash_table_new (NULL, NULL);
 
   gum_code_allocator_init (&priv->allocator, GUM_INTERCEPTOR_CODE_SLICE_SIZE);
   priv->backend = _gum_interceptor_backend_create (&priv->allocator);
@@ -275,6 +579,12 @@ gum_interceptor_dispose (GObject * object)
   gum_interceptor_transaction_end (&priv->current_transaction);
   GUM_INTERCEPTOR_UNLOCK ();
 
+  if (priv->exceptor != NULL)
+  {
+    gum_interceptor_release_exceptor (self, priv->exceptor);
+    priv->exceptor = NULL;
+  }
+
   G_OBJECT_CLASS (gum_interceptor_parent_class)->dispose (object);
 }
 
@@ -286,10 +596,15 @@ gum_interceptor_finalize (GObject * object)
 
   gum_interceptor_transaction_destroy (&priv->current_transaction);
 
+  g_ptr_array_unref (priv->retired_fast_replacements);
+
   _gum_interceptor_backend_destroy (priv->backend);
 
   g_rec_mutex_clear (&priv->mutex);
 
+  g_hash_table_unref (priv->deferred_pages);
+  g_free (priv->deferred_page_slots);
+  g_hash_table_unref (priv->thread_filter_by_listener);
   g_hash_table_unref (priv->function_by_address);
 
   gum_code_allocator_free (&priv->allocator);
@@ -344,11 +659,10 @@ gum_interceptor_attach_listener (GumInterceptor * self,
                                  gpointer listener_function_data)
 {
   GumInterceptorPrivate * priv = self->priv;
-  GumAttachReturn result = GUM_ATTACH_OK;
-  GumFunctionContext * function_ctx;
+  GumAttachReturn result;
 
   if (gum_process_get_code_signing_policy () == GUM_CODE_SIGNING_REQUIRED)
-    goto policy_violation;
+    return GUM_ATTACH_POLICY_VIOLATION;
 
   gum_interceptor_ignore_current_thread (self);
   GUM_INTERCEPTOR_LOCK ();
@@ -357,40 +671,111 @@ gum_interceptor_attach_listener (GumInterceptor * self,
 
   function_address = gum_interceptor_resolve (self, function_address);
 
-  function_ctx = gum_interceptor_instrument (self, function_address);
+  result = gum_interceptor_try_attach_listener (self, function_address,
+      listener, listener_function_data, FALSE);
+
+  gum_interceptor_transaction_end (&priv->current_transaction);
+  if (result == GUM_ATTACH_OK && !gum_interceptor_has (self, function_address))
+    result = GUM_ATTACH_BUSY;
+  GUM_INTERCEPTOR_UNLOCK ();
+  gum_interceptor_unignore_current_thread (self);
+
+  return result;
+}
+
+/*
+ * Deferred attachments register the function right away, but postpone
+ * relocation, trampoline allocation and the prologue write until code on
+ * the function's page is first executed. Until then the page is mapped
+ * without execute permission. Our GumExceptor handler only gives the page
+ * its original protection back and flags it, as it may be running in
+ * signal context, so the code that faulted runs unhooked and the hooks on
+ * that page are installed when the next transaction is committed, e.g. by
+ * gum_interceptor_flush(). This is meant for rarely used libraries, not for
+ * code that the interceptor or the exceptor themselves depend on.
+ */
+GumAttachReturn
+gum_interceptor_attach_listener_deferred (GumInterceptor * self,
+                                          gpointer function_address,
+                                          GumInvocationListener * listener,
+                                          gpointer listener_function_data)
+{
+  GumInterceptorPrivate * priv = self->priv;
+  GumAttachReturn result;
+
+  if (gum_process_get_code_signing_policy () == GUM_CODE_SIGNING_REQUIRED)
+    return GUM_ATTACH_POLICY_VIOLATION;
+
+  gum_interceptor_ignore_current_thread (self);
+  GUM_INTERCEPTOR_LOCK ();
+  gum_interceptor_transaction_begin (&priv->current_transaction);
+  priv->current_transaction.is_dirty = TRUE;
+
+  function_address = gum_interceptor_resolve (self, function_address);
+
+  result = gum_interceptor_try_attach_listener (self, function_address,
+      listener, listener_function_data, TRUE);
+
+  gum_interceptor_transaction_end (&priv->current_transaction);
+  if (result == GUM_ATTACH_OK && !gum_interceptor_has (self, function_address))
+    result = GUM_ATTACH_BUSY;
+  GUM_INTERCEPTOR_UNLOCK ();
+  gum_interceptor_unignore_current_thread (self);
+
+  return result;
+}
+
+void
+gum_interceptor_activate_deferred (GumInterceptor * self)
+{
+  GumInterceptorPrivate * priv = self->priv;
+  GList * pages, * cur;
+  GumExceptor * exceptor;
+
+  gum_interceptor_ignore_current_thread (self);
+  GUM_INTERCEPTOR_LOCK ();
+  gum_interceptor_transaction_begin (&priv->current_transaction);
+  priv->current_transaction.is_dirty = TRUE;
+
+  pages = g_hash_table_get_keys (priv->deferred_pages);
+  for (cur = pages; cur != NULL; cur = cur->next)
+    gum_interceptor_activate_deferred_page (self, cur->data);
+  g_list_free (pages);
+
+  gum_interceptor_transaction_end (&priv->current_transaction);
+  exceptor = gum_interceptor_steal_idle_exceptor (self);
+  GUM_INTERCEPTOR_UNLOCK ();
+  gum_interceptor_unignore_current_thread (self);
+
+  if (exceptor != NULL)
+    gum_interceptor_release_exceptor (self, exceptor);
+}
+
+static GumAttachReturn
+gum_interceptor_try_attach_listener (GumInterceptor * self,
+                                     gpointer function_address,
+                                     GumInvocationListener * listener,
+                                     gpointer listener_function_data,
+                                     gboolean deferred)
+{
+  GumFunctionContext * function_ctx;
+
+  function_ctx = deferred
+      ? gum_interceptor_instrument_deferred (self, function_address)
+      : gum_interceptor_instrument (self, function_address);
   if (function_ctx == NULL)
-    goto wrong_signature;
+    return GUM_ATTACH_WRONG_SIGNATURE;
+
+  if (function_ctx->fast_replacement)
+    return GUM_ATTACH_WRONG_TYPE;
 
   if (gum_function_context_has_listener (function_ctx, listener))
-    goto already_attached;
+    return GUM_ATTACH_ALREADY_ATTACHED;
 
   gum_function_context_add_listener (function_ctx, listener,
       listener_function_data);
 
-  goto beach;
-
-policy_violation:
-  {
-    return GUM_ATTACH_POLICY_VIOLATION;
-  }
-wrong_signature:
-  {
-    result = GUM_ATTACH_WRONG_SIGNATURE;
-    goto beach;
-  }
-already_attached:
-  {
-    result = GUM_ATTACH_ALREADY_ATTACHED;
-    goto beach;
-  }
-beach:
-  {
-    gum_interceptor_transaction_end (&priv->current_transaction);
-    GUM_INTERCEPTOR_UNLOCK ();
-    gum_interceptor_unignore_current_thread (self);
-
-    return result;
-  }
+  return GUM_ATTACH_OK;
 }
 
 void
@@ -401,12 +786,16 @@ gum_interceptor_detach_listener (GumInterceptor * self,
   GHashTableIter iter;
   GumFunctionContext * function_ctx;
   InterceptorThreadContext * thread_ctx;
+  ListenerThreadFilter * filter;
+  GumExceptor * exceptor;
 
   gum_interceptor_ignore_current_thread (self);
   GUM_INTERCEPTOR_LOCK ();
   gum_interceptor_transaction_begin (&priv->current_transaction);
   priv->current_transaction.is_dirty = TRUE;
 
+  filter = g_hash_table_lookup (priv->thread_filter_by_listener, listener);
+
   g_hash_table_iter_init (&iter, priv->function_by_address);
   while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &function_ctx))
   {
@@ -416,6 +805,13 @@ gum_interceptor_detach_listener (GumInterceptor * self,
 
       gum_interceptor_transaction_schedule_destroy (&priv->current_transaction,
           function_ctx, g_object_unref, g_object_ref (listener));
+      if (filter != NULL)
+      {
+        gum_interceptor_transaction_schedule_destroy (
+            &priv->current_transaction, function_ctx,
+            (GDestroyNotify) listener_thread_filter_unref,
+            listener_thread_filter_ref (filter));
+      }
 
       if (gum_function_context_is_empty (function_ctx))
       {
@@ -424,6 +820,10 @@ gum_interceptor_detach_listener (GumInterceptor * self,
     }
   }
 
+  g_hash_table_remove (priv->thread_filter_by_listener, listener);
+  if (filter != NULL)
+    g_atomic_int_inc (&gum_interceptor_thread_filter_epoch);
+
   gum_spinlock_acquire (&gum_interceptor_thread_context_lock);
   g_hash_table_iter_init (&iter, gum_interceptor_thread_contexts);
   while (g_hash_table_iter_next (&iter, (gpointer *) &thread_ctx, NULL))
@@ -431,23 +831,110 @@ gum_interceptor_detach_listener (GumInterceptor * self,
   gum_spinlock_release (&gum_interceptor_thread_context_lock);
 
   gum_interceptor_transaction_end (&priv->current_transaction);
+  exceptor = gum_interceptor_steal_idle_exceptor (self);
   GUM_INTERCEPTOR_UNLOCK ();
   gum_interceptor_unignore_current_thread (self);
+
+  if (exceptor != NULL)
+    gum_interceptor_release_exceptor (self, exceptor);
 }
 
-GumReplaceReturn
-gum_interceptor_replace_function (GumInterceptor * self,
-                                  gpointer function_address,
-                                  gpointer replacement_function,
-                                  gpointer replacement_function_data)
+void
+gum_interceptor_set_listener_thread_filter (
+    GumInterceptor * self,
+    GumInvocationListener * listener,
+    GumInterceptorThreadFilterFunc func,
+    gpointer data,
+    GDestroyNotify data_destroy)
 {
   GumInterceptorPrivate * priv = self->priv;
-  GumReplaceReturn result = GUM_REPLACE_OK;
+  ListenerThreadFilter * filter;
+  GHashTableIter iter;
+  GumFunctionContext * function_ctx;
+
+  filter = (func != NULL)
+      ? listener_thread_filter_new (func, data, data_destroy)
+      : NULL;
+
+  gum_interceptor_ignore_current_thread (self);
+  GUM_INTERCEPTOR_LOCK ();
+  gum_interceptor_transaction_begin (&priv->current_transaction);
+  priv->current_transaction.is_dirty = TRUE;
+
+  g_hash_table_iter_init (&iter, priv->function_by_address);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &function_ctx))
+  {
+    ListenerEntry ** slot;
+    ListenerThreadFilter * old_filter;
+
+    slot = gum_function_context_find_listener (function_ctx, listener);
+    if (slot == NULL)
+      continue;
+
+    old_filter = (*slot)->thread_filter;
+    g_atomic_pointer_set (&(*slot)->thread_filter,
+        (filter != NULL) ? listener_thread_filter_ref (filter) : NULL);
+
+    if (old_filter != NULL)
+    {
+      gum_interceptor_transaction_schedule_destroy (&priv->current_transaction,
+          function_ctx, (GDestroyNotify) listener_thread_filter_unref,
+          old_filter);
+    }
+  }
+
+  if (g_hash_table_contains (priv->thread_filter_by_listener, listener))
+    g_atomic_int_inc (&gum_interceptor_thread_filter_epoch);
+
+  if (filter != NULL)
+    g_hash_table_insert (priv->thread_filter_by_listener, listener, filter);
+  else
+    g_hash_table_remove (priv->thread_filter_by_listener, listener);
+
+  gum_interceptor_transaction_end (&priv->current_transaction);
+  GUM_INTERCEPTOR_UNLOCK ();
+  gum_interceptor_unignore_current_thread (self);
+}
+
+void
+gum_interceptor_set_listener_threads (GumInterceptor * self,
+                                      GumInvocationListener * listener,
+                                      const GumThreadId * thread_ids,
+                                      guint n_thread_ids)
+{
+  GHashTable * set;
+  guint i;
+
+  set = g_hash_table_new (NULL, NULL);
+  for (i = 0; i != n_thread_ids; i++)
+    g_hash_table_add (set, GSIZE_TO_POINTER (thread_ids[i]));
+
+  gum_interceptor_set_listener_thread_filter (self, listener,
+      (GumInterceptorThreadFilterFunc) gum_thread_id_set_contains, set,
+      (GDestroyNotify) g_hash_table_unref);
+}
+
+static gboolean
+gum_thread_id_set_contains (GumThreadId thread_id,
+                            GHashTable * thread_ids)
+{
+  return g_hash_table_contains (thread_ids, GSIZE_TO_POINTER (thread_id));
+}
+
+GumAttachReturn
+gum_interceptor_attach_probe (GumInterceptor * self,
+                              gpointer function_address,
+                              GumInterceptorProbeFunc func,
+                              gpointer user_data)
+{
+  GumInterceptorPrivate * priv = self->priv;
+  GumAttachReturn result = GUM_ATTACH_OK;
   GumFunctionContext * function_ctx;
 
   if (gum_process_get_code_signing_policy () == GUM_CODE_SIGNING_REQUIRED)
     goto policy_violation;
 
+  gum_interceptor_ignore_current_thread (self);
   GUM_INTERCEPTOR_LOCK ();
   gum_interceptor_transaction_begin (&priv->current_transaction);
   priv->current_transaction.is_dirty = TRUE;
@@ -458,71 +945,279 @@ gum_interceptor_replace_function (GumInterceptor * self,
   if (function_ctx == NULL)
     goto wrong_signature;
 
-  if (function_ctx->replacement_function != NULL)
-    goto already_replaced;
+  if (function_ctx->fast_replacement)
+    goto wrong_type;
 
-  function_ctx->replacement_function_data = replacement_function_data;
-  function_ctx->replacement_function = replacement_function;
+  if (gum_function_context_has_probe (function_ctx, func, user_data))
+    goto already_attached;
+
+  gum_function_context_add_probe (function_ctx, func, user_data);
 
   goto beach;
 
 policy_violation:
   {
-    return GUM_REPLACE_POLICY_VIOLATION;
+    return GUM_ATTACH_POLICY_VIOLATION;
   }
 wrong_signature:
   {
-    result = GUM_REPLACE_WRONG_SIGNATURE;
+    result = GUM_ATTACH_WRONG_SIGNATURE;
     goto beach;
   }
-already_replaced:
+wrong_type:
   {
-    result = GUM_REPLACE_ALREADY_REPLACED;
+    result = GUM_ATTACH_WRONG_TYPE;
+    goto beach;
+  }
+already_attached:
+  {
+    result = GUM_ATTACH_ALREADY_ATTACHED;
     goto beach;
   }
 beach:
   {
     gum_interceptor_transaction_end (&priv->current_transaction);
+    if (result == GUM_ATTACH_OK &&
+        !gum_interceptor_has (self, function_address))
+      result = GUM_ATTACH_BUSY;
     GUM_INTERCEPTOR_UNLOCK ();
+    gum_interceptor_unignore_current_thread (self);
 
     return result;
   }
 }
 
 void
-gum_interceptor_revert_function (GumInterceptor * self,
-                                 gpointer function_address)
+gum_interceptor_detach_probe (GumInterceptor * self,
+                              GumInterceptorProbeFunc func,
+                              gpointer user_data)
 {
   GumInterceptorPrivate * priv = self->priv;
+  GHashTableIter iter;
   GumFunctionContext * function_ctx;
 
+  gum_interceptor_ignore_current_thread (self);
   GUM_INTERCEPTOR_LOCK ();
   gum_interceptor_transaction_begin (&priv->current_transaction);
   priv->current_transaction.is_dirty = TRUE;
 
-  function_address = gum_interceptor_resolve (self, function_address);
-
-  function_ctx = (GumFunctionContext *) g_hash_table_lookup (
-      priv->function_by_address, function_address);
-  if (function_ctx == NULL)
-    goto beach;
-
-  function_ctx->replacement_function = NULL;
-  function_ctx->replacement_function_data = NULL;
-
-  if (gum_function_context_is_empty (function_ctx))
+  g_hash_table_iter_init (&iter, priv->function_by_address);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &function_ctx))
   {
-    g_hash_table_remove (priv->function_by_address, function_address);
+    if (gum_function_context_remove_probe (function_ctx, func, user_data) &&
+        gum_function_context_is_empty (function_ctx))
+    {
+      g_hash_table_iter_remove (&iter);
+    }
   }
 
-beach:
   gum_interceptor_transaction_end (&priv->current_transaction);
   GUM_INTERCEPTOR_UNLOCK ();
+  gum_interceptor_unignore_current_thread (self);
 }
 
-void
-gum_interceptor_begin_transaction (GumInterceptor * self)
-{
+GumReplaceReturn
+gum_interceptor_replace_function (GumInterceptor * self,
+                                  gpointer function_address,
+                                  gpointer replacement_function,
+                                  gpointer replacement_function_data)
+{
+  GumInterceptorPrivate * priv = self->priv;
+  GumReplaceReturn result = GUM_REPLACE_OK;
+  GumFunctionContext * function_ctx;
+
+  if (gum_process_get_code_signing_policy () == GUM_CODE_SIGNING_REQUIRED)
+    goto policy_violation;
+
+  GUM_INTERCEPTOR_LOCK ();
+  gum_interceptor_transaction_begin (&priv->current_transaction);
+  priv->current_transaction.is_dirty = TRUE;
+
+  function_address = gum_interceptor_resolve (self, function_address);
+
+  function_ctx = gum_interceptor_instrument (self, function_address);
+  if (function_ctx == NULL)
+    goto wrong_signature;
+
+  if (function_ctx->replacement_function != NULL)
+    goto already_replaced;
+
+  function_ctx->replacement_function_data = replacement_function_data;
+  function_ctx->replacement_function = replacement_function;
+
+  gum_function_context_update_dispatch_mode (function_ctx);
+
+  goto beach;
+
+policy_violation:
+  {
+    return GUM_REPLACE_POLICY_VIOLATION;
+  }
+wrong_signature:
+  {
+    result = GUM_REPLACE_WRONG_SIGNATURE;
+    goto beach;
+  }
+already_replaced:
+  {
+    result = GUM_REPLACE_ALREADY_REPLACED;
+    goto beach;
+  }
+beach:
+  {
+    gum_interceptor_transaction_end (&priv->current_transaction);
+    if (result == GUM_REPLACE_OK &&
+        !gum_interceptor_has (self, function_address))
+      result = GUM_REPLACE_BUSY;
+    GUM_INTERCEPTOR_UNLOCK ();
+
+    return result;
+  }
+}
+
+/*
+ * Redirects the function straight to the replacement, without going through
+ * the interceptor's dispatch code. This means no invocation context:
+ * gum_interceptor_get_current_invocation() returns NULL inside the
+ * replacement, or the context of an enclosing regular hook if there is
+ * one. The original implementation is available through original_function.
+ *
+ * Only functions not otherwise intercepted can be replaced this way, and
+ * listeners and probes cannot be attached later on. Backends that cannot
+ * emit the direct path fall back to regular replacement dispatch. Reverting
+ * keeps the trampoline around, as threads still inside the replacement may
+ * call original_function at any point.
+ */
+GumReplaceReturn
+gum_interceptor_replace_function_fast (GumInterceptor * self,
+                                       gpointer function_address,
+                                       gpointer replacement_function,
+                                       gpointer * original_function)
+{
+  GumInterceptorPrivate * priv = self->priv;
+  GumReplaceReturn result = GUM_REPLACE_OK;
+  GumFunctionContext * function_ctx;
+
+  if (gum_process_get_code_signing_policy () == GUM_CODE_SIGNING_REQUIRED)
+    goto policy_violation;
+
+  GUM_INTERCEPTOR_LOCK ();
+  gum_interceptor_transaction_begin (&priv->current_transaction);
+  priv->current_transaction.is_dirty = TRUE;
+
+  function_address = gum_interceptor_resolve (self, function_address);
+
+  function_ctx = (GumFunctionContext *) g_hash_table_lookup (
+      priv->function_by_address, function_address);
+  if (function_ctx != NULL)
+  {
+    if (function_ctx->replacement_function != NULL)
+      goto already_replaced;
+    goto wrong_type;
+  }
+
+  function_ctx = gum_function_context_new (self, function_address);
+  function_ctx->fast_replacement = TRUE;
+  function_ctx->replacement_function = replacement_function;
+
+  if (!_gum_interceptor_backend_create_trampoline (priv->backend, function_ctx))
+  {
+    gum_function_context_finalize (function_ctx);
+    goto wrong_signature;
+  }
+
+  if (!function_ctx->fast_replacement)
+    gum_function_context_update_dispatch_mode (function_ctx);
+
+  g_hash_table_insert (priv->function_by_address, function_address,
+      function_ctx);
+
+  gum_interceptor_transaction_schedule_prologue_write (
+      &priv->current_transaction, function_ctx, gum_interceptor_activate);
+
+  if (original_function != NULL)
+    *original_function = function_ctx->on_invoke_trampoline;
+
+  goto beach;
+
+policy_violation:
+  {
+    return GUM_REPLACE_POLICY_VIOLATION;
+  }
+wrong_signature:
+  {
+    result = GUM_REPLACE_WRONG_SIGNATURE;
+    goto beach;
+  }
+wrong_type:
+  {
+    result = GUM_REPLACE_WRONG_TYPE;
+    goto beach;
+  }
+already_replaced:
+  {
+    result = GUM_REPLACE_ALREADY_REPLACED;
+    goto beach;
+  }
+beach:
+  {
+    gum_interceptor_transaction_end (&priv->current_transaction);
+    if (result == GUM_REPLACE_OK &&
+        !gum_interceptor_has (self, function_address))
+      result = GUM_REPLACE_BUSY;
+    GUM_INTERCEPTOR_UNLOCK ();
+
+    return result;
+  }
+}
+
+void
+gum_interceptor_revert_function (GumInterceptor * self,
+                                 gpointer function_address)
+{
+  GumInterceptorPrivate * priv = self->priv;
+  GumFunctionContext * function_ctx;
+
+  GUM_INTERCEPTOR_LOCK ();
+  gum_interceptor_transaction_begin (&priv->current_transaction);
+  priv->current_transaction.is_dirty = TRUE;
+
+  function_address = gum_interceptor_resolve (self, function_address);
+
+  function_ctx = (GumFunctionContext *) g_hash_table_lookup (
+      priv->function_by_address, function_address);
+  if (function_ctx == NULL)
+    goto beach;
+
+  g_atomic_int_set (&function_ctx->dispatch_mode,
+      GUM_FUNCTION_DISPATCH_GENERIC);
+
+  function_ctx->replacement_function = NULL;
+  function_ctx->replacement_function_data = NULL;
+
+  gum_function_context_update_dispatch_mode (function_ctx);
+
+  if (gum_function_context_is_empty (function_ctx))
+  {
+    g_hash_table_remove (priv->function_by_address, function_address);
+  }
+
+beach:
+  gum_interceptor_transaction_end (&priv->current_transaction);
+  GUM_INTERCEPTOR_UNLOCK ();
+}
+
+/*
+ * Attaching or replacing many functions is cheapest when wrapped in a
+ * transaction: the prologue writes are then applied, and the code allocator
+ * committed, once when the outermost transaction ends, instead of once per
+ * call. Attach and replace calls made inside it cannot report
+ * GUM_ATTACH_BUSY or GUM_REPLACE_BUSY, as nothing is patched until then;
+ * a hook that cannot be installed safely at that point is dropped.
+ */
+void
+gum_interceptor_begin_transaction (GumInterceptor * self)
+{
   GumInterceptorPrivate * priv = self->priv;
 
   GUM_INTERCEPTOR_LOCK ();
@@ -562,6 +1257,153 @@ gum_interceptor_flush (GumInterceptor * self)
   return flushed;
 }
 
+void
+gum_interceptor_get_transaction_stats (GumInterceptor * self,
+                                       GumInterceptorTransactionStats * stats)
+{
+  GumInterceptorPrivate * priv = self->priv;
+
+  GUM_INTERCEPTOR_LOCK ();
+  *stats = priv->transaction_stats;
+  GUM_INTERCEPTOR_UNLOCK ();
+}
+
+void
+gum_interceptor_set_profiling_enabled (GumInterceptor * self,
+                                       gboolean enabled)
+{
+  g_atomic_int_set (&self->priv->profiling_enabled, enabled);
+}
+
+gboolean
+gum_interceptor_get_profiling_enabled (GumInterceptor * self)
+{
+  return g_atomic_int_get (&self->priv->profiling_enabled);
+}
+
+/*
+ * Merges the per-thread counters into an array of GumInterceptorHookStats,
+ * most expensive hook first, leaving out hooks not hit since the last reset.
+ * Counters are read without synchronizing with the threads updating them, so
+ * the numbers are a close approximation while hooks are being hit.
+ */
+GArray *
+gum_interceptor_get_stats (GumInterceptor * self)
+{
+  GArray * result;
+  HookStatsTable * retired, * merged, * cur;
+  HookStatsSlot * snapshot;
+  guint snapshot_capacity, n, i;
+  gpointer previous_guard;
+
+  /* Anything hooked that we call into below must be passed straight through */
+  previous_guard = gum_tls_key_get_value (gum_interceptor_guard_key);
+  gum_tls_key_set_value (gum_interceptor_guard_key, self);
+
+  gum_spinlock_acquire (&gum_interceptor_thread_context_lock);
+  retired = gum_interceptor_retired_hook_stats;
+  gum_interceptor_retired_hook_stats = NULL;
+  gum_spinlock_release (&gum_interceptor_thread_context_lock);
+
+  if (retired != NULL && retired->next != NULL)
+  {
+    HookStatsTable * compacted;
+
+    compacted = hook_stats_table_new ();
+    for (cur = retired; cur != NULL; cur = cur->next)
+      hook_stats_table_merge (compacted, cur);
+    hook_stats_table_free_all (retired);
+    retired = compacted;
+  }
+
+  merged = hook_stats_table_new ();
+  if (retired != NULL)
+    hook_stats_table_merge (merged, retired);
+
+  /*
+   * Nothing may be allocated while holding the spinlock, as the allocator
+   * could be hooked, so size the snapshot first and retry if the live tables
+   * grew before we got the lock back.
+   */
+  snapshot = NULL;
+  snapshot_capacity = 0;
+  gum_spinlock_acquire (&gum_interceptor_thread_context_lock);
+  while ((n = gum_interceptor_measure_live_hook_stats ()) > snapshot_capacity)
+  {
+    gum_spinlock_release (&gum_interceptor_thread_context_lock);
+
+    g_free (snapshot);
+    snapshot_capacity = n;
+    snapshot = g_new (HookStatsSlot, snapshot_capacity);
+
+    gum_spinlock_acquire (&gum_interceptor_thread_context_lock);
+  }
+  n = gum_interceptor_snapshot_live_hook_stats (snapshot);
+  if (retired != NULL)
+  {
+    retired->next = gum_interceptor_retired_hook_stats;
+    gum_interceptor_retired_hook_stats = retired;
+  }
+  gum_spinlock_release (&gum_interceptor_thread_context_lock);
+
+  for (i = 0; i != n; i++)
+    hook_stats_table_add (merged, &snapshot[i]);
+  g_free (snapshot);
+
+  result = g_array_sized_new (FALSE, FALSE, sizeof (GumInterceptorHookStats),
+      merged->length);
+  for (i = 0; i != merged->capacity; i++)
+  {
+    HookStatsSlot * slot = &merged->slots[i];
+    GumInterceptorHookStats stats;
+
+    if (slot->function_address == NULL || slot->invocations +
+        slot->bypassed_invocations == 0)
+      continue;
+
+    stats.function_address = slot->function_address;
+    stats.invocations = slot->invocations;
+    stats.bypassed_invocations = slot->bypassed_invocations;
+    stats.listener_ticks = slot->listener_ticks;
+    stats.trampoline_ticks = slot->trampoline_ticks;
+    g_array_append_val (result, stats);
+  }
+  g_array_sort (result, (GCompareFunc) hook_stats_compare_by_cost);
+
+  hook_stats_table_free (merged);
+
+  gum_tls_key_set_value (gum_interceptor_guard_key, previous_guard);
+
+  return result;
+}
+
+void
+gum_interceptor_reset_stats (GumInterceptor * self)
+{
+  HookStatsTable * retired;
+  GHashTableIter iter;
+  InterceptorThreadContext * thread_ctx;
+  gpointer previous_guard;
+
+  previous_guard = gum_tls_key_get_value (gum_interceptor_guard_key);
+  gum_tls_key_set_value (gum_interceptor_guard_key, self);
+
+  gum_spinlock_acquire (&gum_interceptor_thread_context_lock);
+  g_hash_table_iter_init (&iter, gum_interceptor_thread_contexts);
+  while (g_hash_table_iter_next (&iter, (gpointer *) &thread_ctx, NULL))
+  {
+    if (thread_ctx->hook_stats != NULL)
+      hook_stats_table_reset (thread_ctx->hook_stats);
+  }
+  retired = gum_interceptor_retired_hook_stats;
+  gum_interceptor_retired_hook_stats = NULL;
+  gum_spinlock_release (&gum_interceptor_thread_context_lock);
+
+  hook_stats_table_free_all (retired);
+
+  gum_tls_key_set_value (gum_interceptor_guard_key, previous_guard);
+}
+
 GumInvocationContext *
 gum_interceptor_get_current_invocation (void)
 {
@@ -630,18 +1472,61 @@ gpointer
 gum_invocation_stack_translate (GumInvocationStack * self,
                                 gpointer return_address)
 {
-  guint i;
+  InvocationStackIndex * index;
+  gint depth;
+
+  if (self->len == 0)
+    return return_address;
+
+  index = gum_invocation_stack_get_index (self);
+  if (index != NULL)
+    depth = invocation_stack_index_lookup (index, return_address);
+  else
+    depth = gum_invocation_stack_find_first (self, return_address);
+  if (depth == -1)
+    return return_address;
+
+  return g_array_index (self, GumInvocationStackEntry, depth).caller_ret_addr;
+}
+
+/*
+ * Translates a whole backtrace, innermost frame first, in one pass. Each
+ * match is expected below the previous one, which also lets recursive
+ * invocations of the same function resolve to their own callers.
+ */
+void
+gum_invocation_stack_translate_all (GumInvocationStack * self,
+                                    GumReturnAddressArray * return_addresses)
+{
+  InvocationStackIndex * index;
+  guint end, i;
 
-  for (i = 0; i != self->len; i++)
+  if (self->len == 0)
+    return;
+
+  index = gum_invocation_stack_get_index (self);
+
+  end = self->len;
+  for (i = 0; i != return_addresses->len; i++)
   {
-    GumInvocationStackEntry * entry;
+    gpointer * item = &return_addresses->items[i];
+    gint depth;
 
-    entry = &g_array_index (self, GumInvocationStackEntry, i);
-    if (entry->trampoline_ret_addr == return_address)
-      return entry->caller_ret_addr;
-  }
+    if (index != NULL && invocation_stack_index_lookup (index, *item) == -1)
+      continue;
 
-  return return_address;
+    depth = gum_invocation_stack_find_below (self, *item, end);
+    if (depth != -1)
+    {
+      *item = g_array_index (self, GumInvocationStackEntry,
+          depth).caller_ret_addr;
+      end = depth;
+    }
+    else
+    {
+      *item = gum_invocation_stack_translate (self, *item);
+    }
+  }
 }
 
 gpointer
@@ -689,7 +1574,12 @@ gum_interceptor_instrument (GumInterceptor * self,
   ctx = (GumFunctionContext *) g_hash_table_lookup (priv->function_by_address,
       function_address);
   if (ctx != NULL)
+  {
+    if (ctx->deferred && !gum_interceptor_activate_deferred_function (self, ctx))
+      return NULL;
+
     return ctx;
+  }
 
   ctx = gum_function_context_new (self, function_address);
   if (ctx == NULL)
@@ -709,13 +1599,340 @@ gum_interceptor_instrument (GumInterceptor * self,
   return ctx;
 }
 
-static void
-gum_interceptor_activate (GumInterceptor * self,
-                          GumFunctionContext * ctx,
-                          gpointer prologue)
+static GumFunctionContext *
+gum_interceptor_instrument_deferred (GumInterceptor * self,
+                                     gpointer function_address)
 {
-  if (ctx->destroyed)
-    return;
+  GumInterceptorPrivate * priv = self->priv;
+  GumFunctionContext * ctx;
+  gpointer page;
+  GumDeferredPage * deferred_page;
+
+  ctx = (GumFunctionContext *) g_hash_table_lookup (priv->function_by_address,
+      function_address);
+  if (ctx != NULL)
+    return ctx;
+
+  if (!gum_query_is_rwx_supported () && gum_code_segment_is_supported ())
+    return gum_interceptor_instrument (self, function_address);
+
+  page = gum_page_address_from_pointer (function_address);
+
+  deferred_page = g_hash_table_lookup (priv->deferred_pages, page);
+  if (deferred_page == NULL)
+  {
+    deferred_page = gum_interceptor_arm_deferred_page (self, page);
+    if (deferred_page == NULL)
+      return gum_interceptor_instrument (self, function_address);
+    g_hash_table_insert (priv->deferred_pages, page, deferred_page);
+  }
+
+  ctx = gum_function_context_new (self, function_address);
+  if (ctx == NULL)
+  {
+    if (deferred_page->functions->len == 0)
+    {
+      g_hash_table_remove (priv->deferred_pages, page);
+      gum_mprotect (page, gum_query_page_size (), deferred_page->prot);
+      g_ptr_array_unref (deferred_page->functions);
+      deferred_page->functions = NULL;
+    }
+
+    return NULL;
+  }
+  ctx->deferred = TRUE;
+
+  g_hash_table_insert (priv->function_by_address, function_address, ctx);
+
+  g_ptr_array_add (deferred_page->functions, ctx);
+
+  return ctx;
+}
+
+static gboolean
+gum_interceptor_activate_deferred_function (GumInterceptor * self,
+                                            GumFunctionContext * ctx)
+{
+  GumInterceptorPrivate * priv = self->priv;
+  gpointer start_page, end_page;
+
+  gum_interceptor_forget_deferred_function (self, ctx);
+
+  if (!_gum_interceptor_backend_create_trampoline (priv->backend, ctx))
+  {
+    g_hash_table_remove (priv->function_by_address, ctx->function_address);
+    return FALSE;
+  }
+
+  gum_interceptor_transaction_schedule_prologue_write (
+      &priv->current_transaction, ctx, gum_interceptor_activate);
+
+  start_page = gum_page_address_from_pointer (ctx->function_address);
+  end_page = gum_page_address_from_pointer ((guint8 *) ctx->function_address +
+      ctx->overwritten_prologue_len - 1);
+  if (end_page != start_page)
+    gum_interceptor_activate_deferred_page (self, end_page);
+
+  return TRUE;
+}
+
+static void
+gum_interceptor_activate_deferred_page (GumInterceptor * self,
+                                        gpointer page)
+{
+  GumDeferredPage * deferred_page;
+  GPtrArray * functions;
+
+  deferred_page = g_hash_table_lookup (self->priv->deferred_pages, page);
+  if (deferred_page == NULL)
+    return;
+
+  functions = g_ptr_array_ref (deferred_page->functions);
+  while (functions->len != 0)
+  {
+    gum_interceptor_activate_deferred_function (self,
+        g_ptr_array_index (functions, functions->len - 1));
+  }
+  g_ptr_array_unref (functions);
+}
+
+static void
+gum_interceptor_forget_deferred_function (GumInterceptor * self,
+                                          GumFunctionContext * ctx)
+{
+  GumInterceptorPrivate * priv = self->priv;
+  gpointer page;
+  GumDeferredPage * deferred_page;
+
+  g_assert (ctx->deferred);
+  ctx->deferred = FALSE;
+
+  page = gum_page_address_from_pointer (ctx->function_address);
+
+  deferred_page = g_hash_table_lookup (priv->deferred_pages, page);
+  g_ptr_array_remove_fast (deferred_page->functions, ctx);
+  if (deferred_page->functions->len == 0)
+  {
+    g_hash_table_remove (priv->deferred_pages, page);
+
+    gum_mprotect (page, gum_query_page_size (), deferred_page->prot);
+
+    g_ptr_array_unref (deferred_page->functions);
+    deferred_page->functions = NULL;
+  }
+}
+
+static void
+gum_interceptor_activate_hit_deferred_pages (GumInterceptor * self)
+{
+  GumInterceptorPrivate * priv = self->priv;
+  guint i;
+
+  if (!g_atomic_int_compare_and_exchange (&priv->deferred_page_hits, TRUE,
+      FALSE))
+    return;
+
+  for (i = 0; i != GUM_MAX_DEFERRED_PAGES; i++)
+  {
+    GumDeferredPage * deferred_page = &priv->deferred_page_slots[i];
+
+    if (deferred_page->functions != NULL &&
+        g_atomic_int_compare_and_exchange (&deferred_page->hit, TRUE, FALSE))
+    {
+      gum_interceptor_activate_deferred_page (self, deferred_page->address);
+    }
+  }
+}
+
+static GumDeferredPage *
+gum_interceptor_arm_deferred_page (GumInterceptor * self,
+                                   gpointer page)
+{
+  GumInterceptorPrivate * priv = self->priv;
+  GumDeferredPage * deferred_page = NULL;
+  GumPageProtection prot;
+  guint i;
+
+  if (!gum_query_page_protection (page, &prot) ||
+      (prot & GUM_PAGE_EXECUTE) == 0)
+    return NULL;
+
+  if (priv->deferred_page_slots == NULL)
+    priv->deferred_page_slots = g_new0 (GumDeferredPage, GUM_MAX_DEFERRED_PAGES);
+
+  for (i = 0; i != GUM_MAX_DEFERRED_PAGES; i++)
+  {
+    GumDeferredPage * candidate = &priv->deferred_page_slots[i];
+
+    if (candidate->address == NULL)
+    {
+      deferred_page = candidate;
+      break;
+    }
+
+    if (deferred_page == NULL && candidate->functions == NULL)
+      deferred_page = candidate;
+  }
+  if (deferred_page == NULL)
+    return NULL;
+
+  g_atomic_pointer_set (&deferred_page->address, NULL);
+  deferred_page->prot = prot;
+  deferred_page->hit = FALSE;
+  deferred_page->functions = g_ptr_array_new ();
+  g_atomic_pointer_set (&deferred_page->address, page);
+
+  if (priv->exceptor == NULL)
+  {
+    priv->exceptor = gum_exceptor_obtain ();
+    gum_exceptor_add (priv->exceptor, gum_interceptor_on_exception, self);
+  }
+
+  gum_mprotect (page, gum_query_page_size (), prot & ~GUM_PAGE_EXECUTE);
+
+  return deferred_page;
+}
+
+static gboolean
+gum_query_page_protection (gpointer page,
+                           GumPageProtection * prot)
+{
+  GumPageProtectionQuery query;
+
+  query.page = GUM_ADDRESS (page);
+  query.prot = GUM_PAGE_NO_ACCESS;
+  query.found = FALSE;
+
+  gum_process_enumerate_ranges (GUM_PAGE_NO_ACCESS,
+      gum_store_page_protection_if_containing, &query);
+
+  *prot = query.prot;
+
+  return query.found;
+}
+
+static gboolean
+gum_store_page_protection_if_containing (const GumRangeDetails * details,
+                                         gpointer user_data)
+{
+  GumPageProtectionQuery * query = user_data;
+
+  if (!GUM_MEMORY_RANGE_INCLUDES (details->range, query->page))
+    return TRUE;
+
+  query->prot = details->prot;
+  query->found = TRUE;
+
+  return FALSE;
+}
+
+static void
+gum_interceptor_protect_deferred_pages (GumInterceptor * self,
+                                        GList * pages,
+                                        gboolean writable)
+{
+  GumInterceptorPrivate * priv = self->priv;
+  GList * cur;
+
+  if (g_hash_table_size (priv->deferred_pages) == 0)
+    return;
+
+  for (cur = pages; cur != NULL; cur = cur->next)
+  {
+    GumDeferredPage * deferred_page;
+    GumPageProtection prot;
+
+    deferred_page = g_hash_table_lookup (priv->deferred_pages, cur->data);
+    if (deferred_page == NULL)
+      continue;
+
+    prot = deferred_page->prot & ~GUM_PAGE_EXECUTE;
+    if (writable)
+      prot |= GUM_PAGE_WRITE;
+
+    gum_mprotect (cur->data, gum_query_page_size (), prot);
+  }
+}
+
+static GumExceptor *
+gum_interceptor_steal_idle_exceptor (GumInterceptor * self)
+{
+  GumInterceptorPrivate * priv = self->priv;
+  GumExceptor * exceptor;
+
+  if (priv->exceptor == NULL ||
+      g_hash_table_size (priv->deferred_pages) != 0)
+    return NULL;
+
+  exceptor = priv->exceptor;
+  priv->exceptor = NULL;
+
+  return exceptor;
+}
+
+static void
+gum_interceptor_release_exceptor (GumInterceptor * self,
+                                  GumExceptor * exceptor)
+{
+  gum_exceptor_remove (exceptor, gum_interceptor_on_exception, self);
+  g_object_unref (exceptor);
+}
+
+/*
+ * May be called in signal context, so this must not lock, allocate or call
+ * into anything that might. It only restores the page's protection so the
+ * thread can resume, and leaves the rest to the next transaction commit.
+ */
+static gboolean
+gum_interceptor_on_exception (GumExceptionDetails * details,
+                              gpointer user_data)
+{
+  GumInterceptor * self = GUM_INTERCEPTOR_CAST (user_data);
+  GumInterceptorPrivate * priv = self->priv;
+  GumDeferredPage * slots;
+  gpointer page;
+  guint i;
+
+  if (details->type != GUM_EXCEPTION_ACCESS_VIOLATION ||
+      details->memory.operation != GUM_MEMOP_EXECUTE)
+    return FALSE;
+
+  slots = g_atomic_pointer_get (&priv->deferred_page_slots);
+  if (slots == NULL)
+    return FALSE;
+
+  page = gum_page_address_from_pointer (details->memory.address);
+
+  for (i = 0; i != GUM_MAX_DEFERRED_PAGES; i++)
+  {
+    GumDeferredPage * deferred_page = &slots[i];
+    GumPageProtection prot;
+
+    if (g_atomic_pointer_get (&deferred_page->address) != page)
+      continue;
+    prot = deferred_page->prot;
+    if (g_atomic_pointer_get (&deferred_page->address) != page)
+      continue;
+
+    if (!gum_try_mprotect (page, gum_query_page_size (), prot))
+      return FALSE;
+
+    g_atomic_int_set (&deferred_page->hit, TRUE);
+    g_atomic_int_set (&priv->deferred_page_hits, TRUE);
+
+    return TRUE;
+  }
+
+  return FALSE;
+}
+
+static void
+gum_interceptor_activate (GumInterceptor * self,
+                          GumFunctionContext * ctx,
+                          gpointer prologue)
+{
+  if (ctx->destroyed)
+    return;
 
   g_assert (!ctx->activated);
   ctx->activated = TRUE;
@@ -779,19 +1996,29 @@ gum_interceptor_transaction_end (GumInterceptorTransaction * self)
   GumInterceptorPrivate * priv = self->interceptor->priv;
   GumInterceptorTransaction transaction_copy;
   GList * addresses, * cur;
-  guint page_size;
+  GArray * ranges;
+  guint page_size, i;
   gboolean rwx_supported, code_segment_supported;
+  gint64 patch_start;
+  GHashTable * dropped;
+  GHashTableIter iter;
+  GumFunctionContext * dropped_ctx;
   GumDestroyTask * task;
 
   self->level--;
   if (self->level > 0)
     return;
 
+  if (g_atomic_int_get (&priv->deferred_page_hits))
+    self->is_dirty = TRUE;
+
   if (!self->is_dirty)
     return;
 
   gum_interceptor_ignore_current_thread (interceptor);
 
+  gum_interceptor_activate_hit_deferred_pages (interceptor);
+
   gum_code_allocator_commit (&priv->allocator);
 
   if (g_queue_is_empty (self->pending_destroy_tasks) &&
@@ -805,11 +2032,18 @@ gum_interceptor_transaction_end (GumInterceptorTransaction * self)
   self = &transaction_copy;
   gum_interceptor_transaction_init (&priv->current_transaction, interceptor);
 
+  patch_start = g_get_monotonic_time ();
+
   addresses = g_hash_table_get_keys (self->pending_prologue_writes);
   addresses = g_list_sort (addresses, gum_page_address_compare);
 
   page_size = gum_query_page_size ();
 
+  ranges = gum_page_ranges_from_sorted_pages (addresses, page_size);
+
+  dropped = g_hash_table_new (NULL, NULL);
+  gum_interceptor_transaction_hold_back_busy_writes (self, addresses, dropped);
+
   rwx_supported = gum_query_is_rwx_supported ();
   code_segment_supported = gum_code_segment_is_supported ();
 
@@ -819,28 +2053,30 @@ gum_interceptor_transaction_end (GumInterceptorTransaction * self)
 
     protection = rwx_supported ? GUM_PAGE_RWX : GUM_PAGE_RW;
 
-    for (cur = addresses; cur != NULL; cur = cur->next)
+    for (i = 0; i != ranges->len; i++)
     {
-      gpointer target_page = cur->data;
+      GumMemoryRange * r = &g_array_index (ranges, GumMemoryRange, i);
 
-      gum_mprotect (target_page, page_size, protection);
+      gum_mprotect (GSIZE_TO_POINTER (r->base_address), r->size, protection);
     }
 
+    gum_interceptor_protect_deferred_pages (interceptor, addresses, TRUE);
+
     for (cur = addresses; cur != NULL; cur = cur->next)
     {
       gpointer target_page = cur->data;
       GArray * pending;
-      guint i;
+      guint j;
 
       pending = g_hash_table_lookup (self->pending_prologue_writes,
           target_page);
       g_assert (pending != NULL);
 
-      for (i = 0; i != pending->len; i++)
+      for (j = 0; j != pending->len; j++)
       {
         GumPrologueWrite * write;
 
-        write = &g_array_index (pending, GumPrologueWrite, i);
+        write = &g_array_index (pending, GumPrologueWrite, j);
 
         write->func (interceptor, write->ctx,
             _gum_interceptor_backend_get_function_address (write->ctx));
@@ -849,86 +2085,122 @@ gum_interceptor_transaction_end (GumInterceptorTransaction * self)
 
     if (!rwx_supported)
     {
-      for (cur = addresses; cur != NULL; cur = cur->next)
+      for (i = 0; i != ranges->len; i++)
       {
-        gpointer target_page = cur->data;
+        GumMemoryRange * r = &g_array_index (ranges, GumMemoryRange, i);
 
-        gum_mprotect (target_page, page_size, GUM_PAGE_RX);
+        gum_mprotect (GSIZE_TO_POINTER (r->base_address), r->size,
+            GUM_PAGE_RX);
       }
     }
 
-    for (cur = addresses; cur != NULL; cur = cur->next)
+    for (i = 0; i != ranges->len; i++)
     {
-      gpointer target_page = cur->data;
+      GumMemoryRange * r = &g_array_index (ranges, GumMemoryRange, i);
 
-      gum_clear_cache (target_page, page_size);
+      gum_clear_cache (GSIZE_TO_POINTER (r->base_address), r->size);
     }
+
+    gum_interceptor_protect_deferred_pages (interceptor, addresses, FALSE);
   }
   else
   {
     guint num_pages;
     GumCodeSegment * segment;
-    guint8 * source_page, * current_page;
+    guint8 * source_base;
     gsize source_offset;
 
     num_pages = g_hash_table_size (self->pending_prologue_writes);
     segment = gum_code_segment_new (num_pages * page_size, NULL);
 
-    source_page = gum_code_segment_get_address (segment);
+    source_base = gum_code_segment_get_address (segment);
 
-    current_page = source_page;
-    for (cur = addresses; cur != NULL; cur = cur->next)
+    source_offset = 0;
+    for (i = 0; i != ranges->len; i++)
     {
-      guint8 * target_page = cur->data;
+      GumMemoryRange * r = &g_array_index (ranges, GumMemoryRange, i);
 
-      memcpy (current_page, target_page, page_size);
+      memcpy (source_base + source_offset, GSIZE_TO_POINTER (r->base_address),
+          r->size);
 
-      current_page += page_size;
+      source_offset += r->size;
     }
 
-    for (cur = addresses; cur != NULL; cur = cur->next)
+    source_offset = 0;
+    cur = addresses;
+    for (i = 0; i != ranges->len; i++)
     {
-      guint8 * target_page = cur->data;
-      GArray * pending;
-      guint i;
-
-      pending = g_hash_table_lookup (self->pending_prologue_writes,
-          target_page);
-      g_assert (pending != NULL);
+      GumMemoryRange * r = &g_array_index (ranges, GumMemoryRange, i);
+      guint8 * range_start = GSIZE_TO_POINTER (r->base_address);
+      guint8 * range_end = range_start + r->size;
 
-      for (i = 0; i != pending->len; i++)
+      for (; cur != NULL && (guint8 *) cur->data < range_end; cur = cur->next)
       {
-        GumPrologueWrite * write;
+        GArray * pending;
+        guint j;
+
+        pending = g_hash_table_lookup (self->pending_prologue_writes,
+            cur->data);
+        g_assert (pending != NULL);
+
+        for (j = 0; j != pending->len; j++)
+        {
+          GumPrologueWrite * write;
 
-        write = &g_array_index (pending, GumPrologueWrite, i);
+          write = &g_array_index (pending, GumPrologueWrite, j);
 
-        write->func (interceptor, write->ctx, source_page +
-            ((guint8 *) _gum_interceptor_backend_get_function_address (
-                write->ctx) - target_page));
+          write->func (interceptor, write->ctx,
+              source_base + source_offset + ((guint8 *)
+                  _gum_interceptor_backend_get_function_address (write->ctx) -
+                  range_start));
+        }
       }
 
-      source_page += page_size;
+      source_offset += r->size;
     }
 
     gum_code_segment_realize (segment);
 
     source_offset = 0;
-    for (cur = addresses; cur != NULL; cur = cur->next)
+    for (i = 0; i != ranges->len; i++)
     {
-      gpointer target_page = cur->data;
+      GumMemoryRange * r = &g_array_index (ranges, GumMemoryRange, i);
+      gpointer range_start = GSIZE_TO_POINTER (r->base_address);
 
-      gum_code_segment_map (segment, source_offset, page_size, target_page);
+      gum_code_segment_map (segment, source_offset, r->size, range_start);
 
-      gum_clear_cache (target_page, page_size);
+      gum_clear_cache (range_start, r->size);
 
-      source_offset += page_size;
+      source_offset += r->size;
     }
 
     gum_code_segment_free (segment);
   }
 
+  gum_interceptor_record_transaction (interceptor,
+      g_hash_table_size (self->pending_prologue_writes), ranges->len,
+      g_get_monotonic_time () - patch_start);
+
+  g_array_free (ranges, TRUE);
   g_list_free (addresses);
 
+  /*
+   * Functions we could not patch safely are unregistered, so that callers
+   * that committed the transaction can tell the hook is not in place.
+   */
+  g_hash_table_iter_init (&iter, dropped);
+  while (g_hash_table_iter_next (&iter, (gpointer *) &dropped_ctx, NULL))
+  {
+    if (g_hash_table_lookup (priv->function_by_address,
+        dropped_ctx->function_address) == dropped_ctx)
+    {
+      g_hash_table_remove (priv->function_by_address,
+          dropped_ctx->function_address);
+      priv->current_transaction.is_dirty = TRUE;
+    }
+  }
+  g_hash_table_unref (dropped);
+
   while ((task = g_queue_pop_head (self->pending_destroy_tasks)) != NULL)
   {
     if (task->ctx->trampoline_usage_counter == 0)
@@ -952,53 +2224,186 @@ no_changes:
   gum_interceptor_unignore_current_thread (interceptor);
 }
 
+/*
+ * A redirect that replaces only the first instruction is swapped in with a
+ * single store, so it is safe to apply while other threads keep running.
+ * Longer ones would break a thread that was preempted right after the first
+ * instruction. The backends tell us which bytes are at risk, and only then
+ * do we sample where the other threads are, without stopping any of them.
+ * Activations that would land on top of a thread are retried a few times,
+ * then given up on and added to `dropped`. Threads on a CPU at the time of
+ * sampling are not seen, and neither are threads entering the range after
+ * the sample; ruling those out would mean stopping every thread. Where the
+ * backend cannot sample without stopping threads, the check is skipped.
+ */
 static void
-gum_interceptor_transaction_schedule_destroy (GumInterceptorTransaction * self,
-                                              GumFunctionContext * ctx,
-                                              GDestroyNotify notify,
-                                              gpointer data)
+gum_interceptor_transaction_hold_back_busy_writes (
+    GumInterceptorTransaction * self,
+    GList * addresses,
+    GHashTable * dropped)
 {
-  GumDestroyTask * task;
+  GArray * held_back, * pcs;
+  GList * cur;
+  guint attempt, i;
 
-  task = g_slice_new (GumDestroyTask);
-  task->ctx = ctx;
-  task->notify = notify;
-  task->data = data;
+  held_back = NULL;
 
-  g_queue_push_tail (self->pending_destroy_tasks, task);
-}
+  for (cur = addresses; cur != NULL; cur = cur->next)
+  {
+    GArray * pending;
 
-static void
-gum_interceptor_transaction_schedule_prologue_write (
-    GumInterceptorTransaction * self,
-    GumFunctionContext * ctx,
-    GumPrologueWriteFunc func)
-{
-  guint8 * function_address;
-  gpointer start_page, end_page;
-  GArray * pending;
-  GumPrologueWrite write;
+    pending = g_hash_table_lookup (self->pending_prologue_writes, cur->data);
 
-  function_address = _gum_interceptor_backend_get_function_address (ctx);
+    i = 0;
+    while (i != pending->len)
+    {
+      GumPrologueWrite * write = &g_array_index (pending, GumPrologueWrite, i);
+      GumMemoryRange range;
 
-  start_page = gum_page_address_from_pointer (function_address);
-  end_page = gum_page_address_from_pointer (function_address +
-      ctx->overwritten_prologue_len - 1);
+      if (write->func != gum_interceptor_activate || write->ctx->destroyed ||
+          !_gum_interceptor_backend_get_unsafe_range (write->ctx, &range))
+      {
+        i++;
+        continue;
+      }
 
-  pending = g_hash_table_lookup (self->pending_prologue_writes, start_page);
-  if (pending == NULL)
-  {
-    pending = g_array_new (FALSE, FALSE, sizeof (GumPrologueWrite));
-    g_hash_table_insert (self->pending_prologue_writes, start_page, pending);
+      if (held_back == NULL)
+        held_back = g_array_new (FALSE, FALSE, sizeof (GumPrologueWrite));
+      g_array_append_val (held_back, *write);
+
+      g_array_remove_index (pending, i);
+    }
   }
 
-  write.ctx = ctx;
-  write.func = func;
-  g_array_append_val (pending, write);
+  if (held_back == NULL)
+    return;
 
-  if (end_page != start_page)
+  pcs = g_array_new (FALSE, FALSE, sizeof (gsize));
+
+  for (attempt = 0; held_back->len != 0; attempt++)
   {
-    pending = g_hash_table_lookup (self->pending_prologue_writes, end_page);
+    gboolean sampled;
+
+    g_array_set_size (pcs, 0);
+    sampled = _gum_process_sample_thread_pcs (pcs);
+
+    i = 0;
+    while (i != held_back->len)
+    {
+      GumPrologueWrite * write;
+      GumMemoryRange range;
+
+      write = &g_array_index (held_back, GumPrologueWrite, i);
+
+      _gum_interceptor_backend_get_unsafe_range (write->ctx, &range);
+
+      if (sampled && gum_thread_pcs_intersect (pcs, &range))
+      {
+        i++;
+        continue;
+      }
+
+      gum_interceptor_transaction_schedule_prologue_write (self, write->ctx,
+          write->func);
+
+      g_array_remove_index_fast (held_back, i);
+    }
+
+    if (held_back->len == 0 || attempt == GUM_BUSY_WRITE_MAX_ATTEMPTS - 1)
+      break;
+
+    g_usleep (G_USEC_PER_SEC / 1000);
+  }
+
+  for (i = 0; i != held_back->len; i++)
+  {
+    g_hash_table_add (dropped,
+        g_array_index (held_back, GumPrologueWrite, i).ctx);
+  }
+
+  g_array_free (pcs, TRUE);
+  g_array_free (held_back, TRUE);
+}
+
+static gboolean
+gum_thread_pcs_intersect (GArray * pcs,
+                          const GumMemoryRange * range)
+{
+  guint i;
+
+  for (i = 0; i != pcs->len; i++)
+  {
+    if (GUM_MEMORY_RANGE_INCLUDES (range, g_array_index (pcs, gsize, i)))
+      return TRUE;
+  }
+
+  return FALSE;
+}
+
+static void
+gum_interceptor_record_transaction (GumInterceptor * self,
+                                    guint page_count,
+                                    guint range_count,
+                                    gint64 duration)
+{
+  GumInterceptorTransactionStats * stats = &self->priv->transaction_stats;
+
+  stats->commit_count++;
+  stats->page_count += page_count;
+  stats->range_count += range_count;
+
+  stats->last_duration = duration;
+  stats->max_duration = MAX (stats->max_duration, stats->last_duration);
+  stats->total_duration += stats->last_duration;
+}
+
+static void
+gum_interceptor_transaction_schedule_destroy (GumInterceptorTransaction * self,
+                                              GumFunctionContext * ctx,
+                                              GDestroyNotify notify,
+                                              gpointer data)
+{
+  GumDestroyTask * task;
+
+  task = g_slice_new (GumDestroyTask);
+  task->ctx = ctx;
+  task->notify = notify;
+  task->data = data;
+
+  g_queue_push_tail (self->pending_destroy_tasks, task);
+}
+
+static void
+gum_interceptor_transaction_schedule_prologue_write (
+    GumInterceptorTransaction * self,
+    GumFunctionContext * ctx,
+    GumPrologueWriteFunc func)
+{
+  guint8 * function_address;
+  gpointer start_page, end_page;
+  GArray * pending;
+  GumPrologueWrite write;
+
+  function_address = _gum_interceptor_backend_get_function_address (ctx);
+
+  start_page = gum_page_address_from_pointer (function_address);
+  end_page = gum_page_address_from_pointer (function_address +
+      ctx->overwritten_prologue_len - 1);
+
+  pending = g_hash_table_lookup (self->pending_prologue_writes, start_page);
+  if (pending == NULL)
+  {
+    pending = g_array_new (FALSE, FALSE, sizeof (GumPrologueWrite));
+    g_hash_table_insert (self->pending_prologue_writes, start_page, pending);
+  }
+
+  write.ctx = ctx;
+  write.func = func;
+  g_array_append_val (pending, write);
+
+  if (end_page != start_page)
+  {
+    pending = g_hash_table_lookup (self->pending_prologue_writes, end_page);
     if (pending == NULL)
     {
       pending = g_array_new (FALSE, FALSE, sizeof (GumPrologueWrite));
@@ -1015,6 +2420,7 @@ gum_function_context_new (GumInterceptor * interceptor,
 
   ctx = g_slice_new0 (GumFunctionContext);
   ctx->function_address = function_address;
+  ctx->dispatch_mode = GUM_FUNCTION_DISPATCH_GENERIC;
 
   ctx->listener_entries =
       g_ptr_array_new_full (1, (GDestroyNotify) listener_entry_free);
@@ -1027,10 +2433,16 @@ gum_function_context_new (GumInterceptor * interceptor,
 static void
 gum_function_context_finalize (GumFunctionContext * function_ctx)
 {
+  GArray * probe_entries;
+
   g_assert (function_ctx->trampoline_slice == NULL);
 
   g_ptr_array_unref (g_atomic_pointer_get (&function_ctx->listener_entries));
 
+  probe_entries = g_atomic_pointer_get (&function_ctx->probe_entries);
+  if (probe_entries != NULL)
+    g_array_unref (probe_entries);
+
   g_slice_free (GumFunctionContext, function_ctx);
 }
 
@@ -1043,6 +2455,12 @@ gum_function_context_destroy (GumFunctionContext * function_ctx)
   g_assert (!function_ctx->destroyed);
   function_ctx->destroyed = TRUE;
 
+  if (function_ctx->deferred)
+  {
+    gum_interceptor_forget_deferred_function (function_ctx->interceptor,
+        function_ctx);
+  }
+
   if (function_ctx->activated)
   {
     gum_interceptor_transaction_schedule_prologue_write (transaction,
@@ -1050,24 +2468,46 @@ gum_function_context_destroy (GumFunctionContext * function_ctx)
   }
 
   gum_interceptor_transaction_schedule_destroy (transaction, function_ctx,
-      (GDestroyNotify) gum_function_context_perform_destroy, function_ctx);
+      function_ctx->fast_replacement
+          ? (GDestroyNotify) gum_function_context_retire
+          : (GDestroyNotify) gum_function_context_perform_destroy,
+      function_ctx);
 }
 
 static void
 gum_function_context_perform_destroy (GumFunctionContext * function_ctx)
 {
-  _gum_interceptor_backend_destroy_trampoline (
-      function_ctx->interceptor->priv->backend, function_ctx);
+  if (function_ctx->trampoline_slice != NULL)
+  {
+    _gum_interceptor_backend_destroy_trampoline (
+        function_ctx->interceptor->priv->backend, function_ctx);
+  }
 
   gum_function_context_finalize (function_ctx);
 }
 
+/*
+ * Fast replacements never enter the thunks, so trampoline_usage_counter
+ * cannot tell us when the last thread is done with original_function. We
+ * keep the trampoline until the interceptor itself goes away.
+ */
+static void
+gum_function_context_retire (GumFunctionContext * function_ctx)
+{
+  g_ptr_array_add (
+      function_ctx->interceptor->priv->retired_fast_replacements,
+      function_ctx);
+}
+
 static gboolean
 gum_function_context_is_empty (GumFunctionContext * function_ctx)
 {
   if (function_ctx->replacement_function != NULL)
     return FALSE;
 
+  if (g_atomic_pointer_get (&function_ctx->probe_entries) != NULL)
+    return FALSE;
+
   return gum_function_context_find_taken_listener_slot (function_ctx) == NULL;
 }
 
@@ -1077,13 +2517,19 @@ gum_function_context_add_listener (GumFunctionContext * function_ctx,
                                    gpointer function_data)
 {
   ListenerEntry * entry;
+  ListenerThreadFilter * filter;
   GPtrArray * old_entries, * new_entries;
   guint i;
 
+  filter = g_hash_table_lookup (
+      function_ctx->interceptor->priv->thread_filter_by_listener, listener);
+
   entry = g_slice_new (ListenerEntry);
   entry->listener_interface = GUM_INVOCATION_LISTENER_GET_INTERFACE (listener);
   entry->listener_instance = listener;
   entry->function_data = function_data;
+  entry->thread_filter =
+      (filter != NULL) ? listener_thread_filter_ref (filter) : NULL;
 
   old_entries = g_atomic_pointer_get (&function_ctx->listener_entries);
   new_entries = g_ptr_array_new_full (old_entries->len + 1,
@@ -1092,7 +2538,12 @@ gum_function_context_add_listener (GumFunctionContext * function_ctx,
   {
     ListenerEntry * old_entry = g_ptr_array_index (old_entries, i);
     if (old_entry != NULL)
-      g_ptr_array_add (new_entries, g_slice_dup (ListenerEntry, old_entry));
+    {
+      ListenerEntry * new_entry = g_slice_dup (ListenerEntry, old_entry);
+      if (new_entry->thread_filter != NULL)
+        listener_thread_filter_ref (new_entry->thread_filter);
+      g_ptr_array_add (new_entries, new_entry);
+    }
   }
   g_ptr_array_add (new_entries, entry);
 
@@ -1105,14 +2556,71 @@ gum_function_context_add_listener (GumFunctionContext * function_ctx,
   {
     function_ctx->has_on_leave_listener = TRUE;
   }
+
+  gum_function_context_update_dispatch_mode (function_ctx);
 }
 
 static void
 listener_entry_free (ListenerEntry * entry)
 {
+  if (entry->thread_filter != NULL)
+    listener_thread_filter_unref (entry->thread_filter);
+
   g_slice_free (ListenerEntry, entry);
 }
 
+static gboolean
+listener_entry_accepts_thread (ListenerEntry * entry,
+                               InterceptorThreadContext * interceptor_ctx)
+{
+  ListenerThreadFilter * filter;
+
+  filter = g_atomic_pointer_get (&entry->thread_filter);
+  if (filter == NULL)
+    return TRUE;
+
+  return interceptor_thread_context_check_filter (interceptor_ctx, filter);
+}
+
+static ListenerThreadFilter *
+listener_thread_filter_new (GumInterceptorThreadFilterFunc func,
+                            gpointer data,
+                            GDestroyNotify data_destroy)
+{
+  static volatile gint last_id = 0;
+  ListenerThreadFilter * filter;
+
+  filter = g_slice_new (ListenerThreadFilter);
+  filter->ref_count = 1;
+
+  filter->id = g_atomic_int_add (&last_id, 1) + 1;
+  filter->func = func;
+  filter->data = data;
+  filter->data_destroy = data_destroy;
+
+  return filter;
+}
+
+static ListenerThreadFilter *
+listener_thread_filter_ref (ListenerThreadFilter * filter)
+{
+  g_atomic_int_inc (&filter->ref_count);
+
+  return filter;
+}
+
+static void
+listener_thread_filter_unref (ListenerThreadFilter * filter)
+{
+  if (!g_atomic_int_dec_and_test (&filter->ref_count))
+    return;
+
+  if (filter->data_destroy != NULL)
+    filter->data_destroy (filter->data);
+
+  g_slice_free (ListenerThreadFilter, filter);
+}
+
 static void
 gum_function_context_remove_listener (GumFunctionContext * function_ctx,
                                       GumInvocationListener * listener)
@@ -1139,6 +2647,8 @@ gum_function_context_remove_listener (GumFunctionContext * function_ctx,
     }
   }
   function_ctx->has_on_leave_listener = has_on_leave_listener;
+
+  gum_function_context_update_dispatch_mode (function_ctx);
 }
 
 static gboolean
@@ -1186,6 +2696,156 @@ gum_function_context_find_taken_listener_slot (
   return NULL;
 }
 
+static void
+gum_function_context_add_probe (GumFunctionContext * function_ctx,
+                                GumInterceptorProbeFunc func,
+                                gpointer user_data)
+{
+  GArray * old_entries, * new_entries;
+  ProbeEntry entry;
+
+  old_entries = g_atomic_pointer_get (&function_ctx->probe_entries);
+
+  new_entries = g_array_sized_new (FALSE, FALSE, sizeof (ProbeEntry),
+      (old_entries != NULL) ? old_entries->len + 1 : 1);
+  if (old_entries != NULL)
+    g_array_append_vals (new_entries, old_entries->data, old_entries->len);
+
+  entry.func = func;
+  entry.user_data = user_data;
+  g_array_append_val (new_entries, entry);
+
+  g_atomic_pointer_set (&function_ctx->probe_entries, new_entries);
+  if (old_entries != NULL)
+  {
+    gum_interceptor_transaction_schedule_destroy (
+        &function_ctx->interceptor->priv->current_transaction, function_ctx,
+        (GDestroyNotify) g_array_unref, old_entries);
+  }
+
+  gum_function_context_update_dispatch_mode (function_ctx);
+}
+
+static gboolean
+gum_function_context_remove_probe (GumFunctionContext * function_ctx,
+                                   GumInterceptorProbeFunc func,
+                                   gpointer user_data)
+{
+  GArray * old_entries, * new_entries;
+  guint i;
+
+  if (!gum_function_context_has_probe (function_ctx, func, user_data))
+    return FALSE;
+
+  old_entries = g_atomic_pointer_get (&function_ctx->probe_entries);
+
+  new_entries = NULL;
+  if (old_entries->len > 1)
+  {
+    new_entries = g_array_sized_new (FALSE, FALSE, sizeof (ProbeEntry),
+        old_entries->len - 1);
+    for (i = 0; i != old_entries->len; i++)
+    {
+      ProbeEntry * entry = &g_array_index (old_entries, ProbeEntry, i);
+
+      if (entry->func != func || entry->user_data != user_data)
+        g_array_append_val (new_entries, *entry);
+    }
+  }
+
+  g_atomic_pointer_set (&function_ctx->probe_entries, new_entries);
+  gum_interceptor_transaction_schedule_destroy (
+      &function_ctx->interceptor->priv->current_transaction, function_ctx,
+      (GDestroyNotify) g_array_unref, old_entries);
+
+  gum_function_context_update_dispatch_mode (function_ctx);
+
+  return TRUE;
+}
+
+static gboolean
+gum_function_context_has_probe (GumFunctionContext * function_ctx,
+                                GumInterceptorProbeFunc func,
+                                gpointer user_data)
+{
+  GArray * probe_entries;
+  guint i;
+
+  probe_entries = g_atomic_pointer_get (&function_ctx->probe_entries);
+  if (probe_entries == NULL)
+    return FALSE;
+
+  for (i = 0; i != probe_entries->len; i++)
+  {
+    ProbeEntry * entry = &g_array_index (probe_entries, ProbeEntry, i);
+
+    if (entry->func == func && entry->user_data == user_data)
+      return TRUE;
+  }
+
+  return FALSE;
+}
+
+/*
+ * Picks the entry path used by _gum_function_context_begin_invocation() based
+ * on what is currently attached, so the common cases of pure replacement,
+ * enter-only listeners and probes don't need to go through the generic path.
+ */
+static void
+gum_function_context_update_dispatch_mode (GumFunctionContext * function_ctx)
+{
+  GumFunctionDispatchMode mode;
+  gboolean has_listeners, has_probes;
+
+  has_listeners =
+      gum_function_context_find_taken_listener_slot (function_ctx) != NULL;
+  has_probes = g_atomic_pointer_get (&function_ctx->probe_entries) != NULL;
+
+  if (function_ctx->replacement_function != NULL)
+  {
+    mode = (has_listeners || has_probes)
+        ? GUM_FUNCTION_DISPATCH_GENERIC
+        : GUM_FUNCTION_DISPATCH_REPLACEMENT_ONLY;
+  }
+  else if (has_listeners && !function_ctx->has_on_leave_listener)
+  {
+    mode = GUM_FUNCTION_DISPATCH_ENTER_ONLY;
+  }
+  else if (has_probes && !has_listeners)
+  {
+    mode = GUM_FUNCTION_DISPATCH_PROBE_ONLY;
+  }
+  else
+  {
+    mode = GUM_FUNCTION_DISPATCH_GENERIC;
+  }
+
+  g_atomic_int_set (&function_ctx->dispatch_mode, mode);
+}
+
+static gboolean
+gum_function_context_accepts_thread (GumFunctionContext * function_ctx,
+                                     InterceptorThreadContext * interceptor_ctx)
+{
+  GPtrArray * listener_entries;
+  guint i;
+
+  if (g_atomic_pointer_get (&function_ctx->probe_entries) != NULL)
+    return TRUE;
+
+  listener_entries = g_atomic_pointer_get (&function_ctx->listener_entries);
+  for (i = 0; i != listener_entries->len; i++)
+  {
+    ListenerEntry * entry = g_ptr_array_index (listener_entries, i);
+
+    if (entry != NULL &&
+        listener_entry_accepts_thread (entry, interceptor_ctx))
+      return TRUE;
+  }
+
+  return FALSE;
+}
+
 void
 _gum_function_context_begin_invocation (GumFunctionContext * function_ctx,
                                         GumCpuContext * cpu_context,
@@ -1197,10 +2857,13 @@ _gum_function_context_begin_invocation (GumFunctionContext * function_ctx,
   InterceptorThreadContext * interceptor_ctx;
   GumInvocationStack * stack;
   GumInvocationStackEntry * stack_entry;
-  GumInvocationContext * invocation_ctx = NULL;
+  GumFunctionDispatchMode dispatch_mode;
+  gpointer replacement_function;
   gint system_error;
   gboolean invoke_listeners = TRUE;
   gboolean will_trap_on_leave;
+  HookStatsSlot * stats = NULL;
+  HookStatsTimer timer;
 
   g_atomic_int_inc (&function_ctx->trampoline_usage_counter);
 
@@ -1213,6 +2876,9 @@ _gum_function_context_begin_invocation (GumFunctionContext * function_ctx,
 
   if (gum_tls_key_get_value (gum_interceptor_guard_key) == interceptor)
   {
+    if (priv->profiling_enabled)
+      gum_interceptor_count_bypass (function_ctx->function_address);
+
     *next_hop = function_ctx->on_invoke_trampoline;
     goto bypass;
   }
@@ -1221,20 +2887,70 @@ _gum_function_context_begin_invocation (GumFunctionContext * function_ctx,
   interceptor_ctx = get_interceptor_thread_context ();
   stack = interceptor_ctx->stack;
 
+  if (priv->profiling_enabled)
+  {
+    stats = interceptor_thread_context_get_hook_stats (interceptor_ctx,
+        function_ctx->function_address);
+  }
+
   stack_entry = gum_invocation_stack_peek_top (stack);
   if (stack_entry != NULL && stack_entry->calling_replacement &&
       stack_entry->invocation_context.function ==
       function_ctx->function_address)
   {
+    if (stats != NULL)
+      stats->bypassed_invocations++;
+
     gum_tls_key_set_value (gum_interceptor_guard_key, NULL);
     *next_hop = function_ctx->on_invoke_trampoline;
     goto bypass;
   }
 
+  if (stats != NULL)
+    stats->invocations++;
+  hook_stats_timer_start (&timer, stats);
+
 #ifndef G_OS_WIN32
   system_error = gum_thread_get_system_error ();
 #endif
 
+  dispatch_mode = g_atomic_int_get (&function_ctx->dispatch_mode);
+
+  /*
+   * A concurrent revert may clear the replacement after we read the mode, so
+   * read it once and fall back to the generic path if it's already gone.
+   */
+  replacement_function =
+      g_atomic_pointer_get (&function_ctx->replacement_function);
+  if (dispatch_mode == GUM_FUNCTION_DISPATCH_REPLACEMENT_ONLY &&
+      replacement_function == NULL)
+  {
+    dispatch_mode = GUM_FUNCTION_DISPATCH_GENERIC;
+  }
+
+  if (dispatch_mode == GUM_FUNCTION_DISPATCH_REPLACEMENT_ONLY)
+  {
+    stack_entry = gum_invocation_stack_push (interceptor_ctx, function_ctx,
+        *caller_ret_addr);
+    stack_entry->invocation_context.system_error = system_error;
+
+    gum_function_context_fixup_cpu_context (function_ctx, cpu_context);
+
+    gum_thread_set_system_error (system_error);
+
+    hook_stats_timer_stop (&timer);
+
+    gum_tls_key_set_value (gum_interceptor_guard_key, NULL);
+
+    *caller_ret_addr = function_ctx->on_leave_trampoline;
+
+    gum_function_context_enter_replacement (function_ctx, interceptor_ctx,
+        stack_entry, cpu_context, system_error, replacement_function,
+        next_hop);
+
+    return;
+  }
+
   if (priv->selected_thread_id != 0)
   {
     invoke_listeners =
@@ -1246,67 +2962,99 @@ _gum_function_context_begin_invocation (GumFunctionContext * function_ctx,
     invoke_listeners = (interceptor_ctx->ignore_level <= 0);
   }
 
-  will_trap_on_leave = function_ctx->replacement_function != NULL ||
-      (invoke_listeners && function_ctx->has_on_leave_listener);
-  if (will_trap_on_leave)
+  if (invoke_listeners && dispatch_mode != GUM_FUNCTION_DISPATCH_PROBE_ONLY)
   {
-    stack_entry = gum_invocation_stack_push (stack, function_ctx,
-        *caller_ret_addr);
-    invocation_ctx = &stack_entry->invocation_context;
+    invoke_listeners =
+        gum_function_context_accepts_thread (function_ctx, interceptor_ctx);
   }
-  else if (invoke_listeners)
+
+  if (dispatch_mode == GUM_FUNCTION_DISPATCH_PROBE_ONLY)
   {
-    stack_entry = gum_invocation_stack_push (stack, function_ctx,
-        function_ctx->function_address);
-    invocation_ctx = &stack_entry->invocation_context;
-  }
+    if (invoke_listeners)
+    {
+      gum_function_context_fixup_cpu_context (function_ctx, cpu_context);
 
-  if (invocation_ctx != NULL)
-    invocation_ctx->system_error = system_error;
+      gum_function_context_invoke_probes (function_ctx, cpu_context, stats);
+    }
 
-  gum_function_context_fixup_cpu_context (function_ctx, cpu_context);
+    gum_thread_set_system_error (system_error);
 
-  if (invoke_listeners)
-  {
-    GPtrArray * listener_entries;
-    guint i;
+    hook_stats_timer_stop (&timer);
+
+    gum_tls_key_set_value (gum_interceptor_guard_key, NULL);
+
+    *next_hop = function_ctx->on_invoke_trampoline;
 
-    invocation_ctx->cpu_context = cpu_context;
-    invocation_ctx->backend = &interceptor_ctx->listener_backend;
+    goto bypass;
+  }
 
-    listener_entries = g_atomic_pointer_get (&function_ctx->listener_entries);
-    for (i = 0; i != listener_entries->len; i++)
+  if (dispatch_mode == GUM_FUNCTION_DISPATCH_ENTER_ONLY)
+  {
+    if (invoke_listeners)
     {
-      ListenerEntry * listener_entry;
-      ListenerInvocationState state;
+      stack_entry = gum_invocation_stack_push (interceptor_ctx, function_ctx,
+          function_ctx->function_address);
+      stack_entry->invocation_context.system_error = system_error;
+      stack_entry->invocation_context.cpu_context = cpu_context;
 
-      listener_entry = g_ptr_array_index (listener_entries, i);
-      if (listener_entry == NULL)
-        continue;
+      gum_function_context_fixup_cpu_context (function_ctx, cpu_context);
 
-      state.point_cut = GUM_POINT_ENTER;
-      state.entry = listener_entry;
-      state.interceptor_ctx = interceptor_ctx;
-      state.invocation_data = stack_entry->listener_invocation_data[i];
-      invocation_ctx->backend->data = &state;
+      gum_function_context_invoke_probes (function_ctx, cpu_context, stats);
 
-      if (listener_entry->listener_interface->on_enter != NULL)
-      {
-        listener_entry->listener_interface->on_enter (
-            listener_entry->listener_instance, invocation_ctx);
-      }
+      system_error = gum_function_context_invoke_listeners (function_ctx,
+          GUM_POINT_ENTER, interceptor_ctx, stack_entry, system_error, stats);
+
+      gum_invocation_stack_pop (interceptor_ctx);
     }
 
-    system_error = invocation_ctx->system_error;
-  }
+    gum_thread_set_system_error (system_error);
+
+    hook_stats_timer_stop (&timer);
+
+    gum_tls_key_set_value (gum_interceptor_guard_key, NULL);
+
+    *next_hop = function_ctx->on_invoke_trampoline;
+
+    goto bypass;
+  }
+
+  will_trap_on_leave = replacement_function != NULL ||
+      (invoke_listeners && function_ctx->has_on_leave_listener);
+  if (will_trap_on_leave)
+  {
+    stack_entry = gum_invocation_stack_push (interceptor_ctx, function_ctx,
+        *caller_ret_addr);
+  }
+  else if (invoke_listeners)
+  {
+    stack_entry = gum_invocation_stack_push (interceptor_ctx, function_ctx,
+        function_ctx->function_address);
+  }
+
+  if (will_trap_on_leave || invoke_listeners)
+    stack_entry->invocation_context.system_error = system_error;
+
+  gum_function_context_fixup_cpu_context (function_ctx, cpu_context);
+
+  if (invoke_listeners)
+  {
+    gum_function_context_invoke_probes (function_ctx, cpu_context, stats);
+
+    stack_entry->invocation_context.cpu_context = cpu_context;
+
+    system_error = gum_function_context_invoke_listeners (function_ctx,
+        GUM_POINT_ENTER, interceptor_ctx, stack_entry, system_error, stats);
+  }
 
   if (!will_trap_on_leave && invoke_listeners)
   {
-    gum_invocation_stack_pop (interceptor_ctx->stack);
+    gum_invocation_stack_pop (interceptor_ctx);
   }
 
   gum_thread_set_system_error (system_error);
 
+  hook_stats_timer_stop (&timer);
+
   gum_tls_key_set_value (gum_interceptor_guard_key, NULL);
 
   if (will_trap_on_leave)
@@ -1314,16 +3062,11 @@ _gum_function_context_begin_invocation (GumFunctionContext * function_ctx,
     *caller_ret_addr = function_ctx->on_leave_trampoline;
   }
 
-  if (function_ctx->replacement_function != NULL)
+  if (replacement_function != NULL)
   {
-    stack_entry->calling_replacement = TRUE;
-    stack_entry->cpu_context = *cpu_context;
-    stack_entry->original_system_error = system_error;
-    invocation_ctx->cpu_context = &stack_entry->cpu_context;
-    invocation_ctx->backend = &interceptor_ctx->replacement_backend;
-    invocation_ctx->backend->data = function_ctx->replacement_function_data;
-
-    *next_hop = function_ctx->replacement_function;
+    gum_function_context_enter_replacement (function_ctx, interceptor_ctx,
+        stack_entry, cpu_context, system_error, replacement_function,
+        next_hop);
   }
   else
   {
@@ -1350,8 +3093,8 @@ _gum_function_context_end_invocation (GumFunctionContext * function_ctx,
   InterceptorThreadContext * interceptor_ctx;
   GumInvocationStackEntry * stack_entry;
   GumInvocationContext * invocation_ctx;
-  GPtrArray * listener_entries;
-  guint i;
+  HookStatsSlot * stats = NULL;
+  HookStatsTimer timer;
 
 #ifdef G_OS_WIN32
   system_error = gum_thread_get_system_error ();
@@ -1365,6 +3108,13 @@ _gum_function_context_end_invocation (GumFunctionContext * function_ctx,
 
   interceptor_ctx = get_interceptor_thread_context ();
 
+  if (function_ctx->interceptor->priv->profiling_enabled)
+  {
+    stats = interceptor_thread_context_get_hook_stats (interceptor_ctx,
+        function_ctx->function_address);
+  }
+  hook_stats_timer_start (&timer, stats);
+
   stack_entry = gum_invocation_stack_peek_top (interceptor_ctx->stack);
   *next_hop = stack_entry->caller_ret_addr;
 
@@ -1375,44 +3125,129 @@ _gum_function_context_end_invocation (GumFunctionContext * function_ctx,
   {
     system_error = invocation_ctx->system_error;
   }
-  else
+
+  gum_function_context_fixup_cpu_context (function_ctx, cpu_context);
+
+  system_error = gum_function_context_invoke_listeners (function_ctx,
+      GUM_POINT_LEAVE, interceptor_ctx, stack_entry, system_error, stats);
+
+  gum_thread_set_system_error (system_error);
+
+  gum_invocation_stack_pop (interceptor_ctx);
+
+  hook_stats_timer_stop (&timer);
+
+  gum_tls_key_set_value (gum_interceptor_guard_key, NULL);
+
+  g_atomic_int_dec_and_test (&function_ctx->trampoline_usage_counter);
+}
+
+static void
+gum_function_context_invoke_probes (GumFunctionContext * function_ctx,
+                                    GumCpuContext * cpu_context,
+                                    HookStatsSlot * stats)
+{
+  GArray * probe_entries;
+  guint64 start_ticks = 0;
+  guint i;
+
+  probe_entries = g_atomic_pointer_get (&function_ctx->probe_entries);
+  if (probe_entries == NULL)
+    return;
+
+  if (stats != NULL)
+    start_ticks = gum_interceptor_read_ticks ();
+
+  for (i = 0; i != probe_entries->len; i++)
   {
-    invocation_ctx->system_error = system_error;
+    ProbeEntry * entry = &g_array_index (probe_entries, ProbeEntry, i);
+
+    entry->func (cpu_context, entry->user_data);
   }
-  invocation_ctx->backend = &interceptor_ctx->listener_backend;
 
-  gum_function_context_fixup_cpu_context (function_ctx, cpu_context);
+  if (stats != NULL)
+    stats->listener_ticks += gum_interceptor_read_ticks () - start_ticks;
+}
+
+static gint
+gum_function_context_invoke_listeners (
+    GumFunctionContext * function_ctx,
+    GumPointCut point_cut,
+    InterceptorThreadContext * interceptor_ctx,
+    GumInvocationStackEntry * stack_entry,
+    gint system_error,
+    HookStatsSlot * stats)
+{
+  GumInvocationContext * invocation_ctx = &stack_entry->invocation_context;
+  GPtrArray * listener_entries;
+  guint64 start_ticks = 0;
+  guint i;
+
+  if (stats != NULL)
+    start_ticks = gum_interceptor_read_ticks ();
+
+  invocation_ctx->system_error = system_error;
+  invocation_ctx->backend = &interceptor_ctx->listener_backend;
 
   listener_entries = g_atomic_pointer_get (&function_ctx->listener_entries);
   for (i = 0; i != listener_entries->len; i++)
   {
     ListenerEntry * listener_entry;
     ListenerInvocationState state;
+    GumInvocationListenerIface * iface;
 
     listener_entry = g_ptr_array_index (listener_entries, i);
-    if (listener_entry == NULL)
+    if (listener_entry == NULL ||
+        !listener_entry_accepts_thread (listener_entry, interceptor_ctx))
       continue;
 
-    state.point_cut = GUM_POINT_LEAVE;
+    state.point_cut = point_cut;
     state.entry = listener_entry;
     state.interceptor_ctx = interceptor_ctx;
-    state.invocation_data = stack_entry->listener_invocation_data[i];
+    state.stack_entry = stack_entry;
     invocation_ctx->backend->data = &state;
 
-    if (listener_entry->listener_interface->on_leave != NULL)
+    iface = listener_entry->listener_interface;
+    if (point_cut == GUM_POINT_ENTER)
     {
-      listener_entry->listener_interface->on_leave (
-          listener_entry->listener_instance, invocation_ctx);
+      if (iface->on_enter != NULL)
+        iface->on_enter (listener_entry->listener_instance, invocation_ctx);
+    }
+    else
+    {
+      if (iface->on_leave != NULL)
+        iface->on_leave (listener_entry->listener_instance, invocation_ctx);
     }
   }
 
-  gum_thread_set_system_error (invocation_ctx->system_error);
-
-  gum_invocation_stack_pop (interceptor_ctx->stack);
+  if (stats != NULL)
+    stats->listener_ticks += gum_interceptor_read_ticks () - start_ticks;
 
-  gum_tls_key_set_value (gum_interceptor_guard_key, NULL);
+  return invocation_ctx->system_error;
+}
 
-  g_atomic_int_dec_and_test (&function_ctx->trampoline_usage_counter);
+static void
+gum_function_context_enter_replacement (
+    GumFunctionContext * function_ctx,
+    InterceptorThreadContext * interceptor_ctx,
+    GumInvocationStackEntry * stack_entry,
+    GumCpuContext * cpu_context,
+    gint system_error,
+    gpointer replacement_function,
+    gpointer * next_hop)
+{
+  GumInvocationContext * invocation_ctx = &stack_entry->invocation_context;
+
+  stack_entry->calling_replacement = TRUE;
+  stack_entry->cpu_context = invocation_arena_alloc (&interceptor_ctx->arena,
+      sizeof (GumCpuContext));
+  *stack_entry->cpu_context = *cpu_context;
+  stack_entry->original_system_error = system_error;
+  invocation_ctx->cpu_context = stack_entry->cpu_context;
+  invocation_ctx->backend = &interceptor_ctx->replacement_backend;
+  invocation_ctx->backend->data = function_ctx->replacement_function_data;
+
+  *next_hop = replacement_function;
 }
 
 static void
@@ -1469,6 +3304,8 @@ release_interceptor_thread_context (InterceptorThreadContext * context)
   if (gum_interceptor_thread_contexts == NULL)
     return;
 
+  gum_tls_key_set_value (gum_interceptor_hook_stats_key, NULL);
+
   gum_spinlock_acquire (&gum_interceptor_thread_context_lock);
   g_hash_table_remove (gum_interceptor_thread_contexts, context);
   gum_spinlock_release (&gum_interceptor_thread_context_lock);
@@ -1533,13 +3370,47 @@ gum_interceptor_invocation_get_listener_function_invocation_data (
     gsize required_size)
 {
   ListenerInvocationState * data;
+  GumInvocationStackEntry * stack_entry;
+  GumInvocationListener * listener;
+  ListenerInvocationData * slot;
+  InvocationArena * arena;
+  gpointer previous_data;
+  gsize previous_size;
 
   data = (ListenerInvocationState *) context->backend->data;
+  stack_entry = data->stack_entry;
+  listener = data->entry->listener_instance;
+  arena = &data->interceptor_ctx->arena;
 
-  if (required_size > GUM_MAX_LISTENER_DATA)
-    return NULL;
+  for (slot = stack_entry->listener_invocation_data;
+      slot != NULL;
+      slot = slot->next)
+  {
+    if (slot->owner == listener)
+      break;
+  }
+
+  if (slot == NULL)
+  {
+    slot = invocation_arena_alloc (arena, sizeof (ListenerInvocationData));
+    slot->owner = listener;
+    slot->next = stack_entry->listener_invocation_data;
+    stack_entry->listener_invocation_data = slot;
+  }
 
-  return data->invocation_data;
+  if (required_size > slot->size)
+  {
+    previous_data = slot->data;
+    previous_size = slot->size;
+
+    slot->data = invocation_arena_alloc (arena, required_size);
+    slot->size = required_size;
+
+    if (previous_data != NULL)
+      gum_memcpy (slot->data, previous_data, previous_size);
+  }
+
+  return slot->data;
 }
 
 static gpointer
@@ -1605,9 +3476,15 @@ interceptor_thread_context_new (void)
 
   context->stack = g_array_sized_new (FALSE, TRUE,
       sizeof (GumInvocationStackEntry), GUM_MAX_CALL_DEPTH);
+  invocation_stack_index_init (&context->stack_index);
+  invocation_arena_init (&context->arena);
 
   context->listener_data_slots = g_array_sized_new (FALSE, TRUE,
       sizeof (ListenerDataSlot), GUM_MAX_LISTENERS_PER_FUNCTION);
+  context->thread_filter_verdicts = g_array_new (FALSE, FALSE,
+      sizeof (ThreadFilterVerdict));
+  context->thread_filter_epoch =
+      g_atomic_int_get (&gum_interceptor_thread_filter_epoch);
 
   return context;
 }
@@ -1615,8 +3492,18 @@ interceptor_thread_context_new (void)
 static void
 interceptor_thread_context_destroy (InterceptorThreadContext * context)
 {
+  /* Keep the counters of threads that have gone away */
+  if (context->hook_stats != NULL)
+  {
+    context->hook_stats->next = gum_interceptor_retired_hook_stats;
+    gum_interceptor_retired_hook_stats = context->hook_stats;
+  }
+
+  g_array_free (context->thread_filter_verdicts, TRUE);
   g_array_free (context->listener_data_slots, TRUE);
 
+  invocation_arena_destroy (&context->arena);
+  invocation_stack_index_destroy (&context->stack_index);
   g_array_free (context->stack, TRUE);
 
   g_slice_free (InterceptorThreadContext, context);
@@ -1661,6 +3548,37 @@ interceptor_thread_context_get_listener_data (InterceptorThreadContext * self,
   return available_slot->data;
 }
 
+static gboolean
+interceptor_thread_context_check_filter (InterceptorThreadContext * self,
+                                         ListenerThreadFilter * filter)
+{
+  GArray * verdicts = self->thread_filter_verdicts;
+  ThreadFilterVerdict verdict;
+  guint epoch, i;
+
+  epoch = g_atomic_int_get (&gum_interceptor_thread_filter_epoch);
+  if (epoch != self->thread_filter_epoch)
+  {
+    g_array_set_size (verdicts, 0);
+    self->thread_filter_epoch = epoch;
+  }
+
+  for (i = 0; i != verdicts->len; i++)
+  {
+    ThreadFilterVerdict * v = &g_array_index (verdicts, ThreadFilterVerdict, i);
+
+    if (v->filter_id == filter->id)
+      return v->accepted;
+  }
+
+  verdict.filter_id = filter->id;
+  verdict.accepted =
+      filter->func (gum_process_get_current_thread_id (), filter->data);
+  g_array_append_val (verdicts, verdict);
+
+  return verdict.accepted;
+}
+
 static void
 interceptor_thread_context_forget_listener_data (
     InterceptorThreadContext * self,
@@ -1681,19 +3599,453 @@ interceptor_thread_context_forget_listener_data (
   }
 }
 
+static HookStatsSlot *
+interceptor_thread_context_get_hook_stats (InterceptorThreadContext * self,
+                                           gpointer function_address)
+{
+  HookStatsSlot * slot;
+
+  if (self->hook_stats == NULL)
+  {
+    self->hook_stats = hook_stats_table_new ();
+    gum_tls_key_set_value (gum_interceptor_hook_stats_key, self->hook_stats);
+  }
+
+  slot = hook_stats_table_lookup (self->hook_stats, function_address);
+  if (slot == NULL)
+  {
+    slot = hook_stats_table_insert (self->hook_stats, function_address,
+        &gum_interceptor_thread_context_lock);
+  }
+
+  return slot;
+}
+
+/*
+ * Called with the guard held by an outer dispatch on this thread, so this
+ * must not call into anything that could be hooked, and cannot allocate.
+ */
+static void
+gum_interceptor_count_bypass (gpointer function_address)
+{
+  HookStatsTable * table;
+  HookStatsSlot * slot;
+
+  table = gum_tls_key_get_value (gum_interceptor_hook_stats_key);
+  if (table == NULL)
+    return;
+
+  slot = hook_stats_table_lookup (table, function_address);
+  if (slot != NULL)
+    slot->bypassed_invocations++;
+}
+
+static void
+hook_stats_timer_start (HookStatsTimer * timer,
+                        HookStatsSlot * slot)
+{
+  timer->slot = slot;
+  if (slot == NULL)
+    return;
+
+  timer->start_ticks = gum_interceptor_read_ticks ();
+  timer->start_listener_ticks = slot->listener_ticks;
+}
+
+static void
+hook_stats_timer_stop (HookStatsTimer * timer)
+{
+  HookStatsSlot * slot = timer->slot;
+  guint64 elapsed;
+
+  if (slot == NULL)
+    return;
+
+  elapsed = gum_interceptor_read_ticks () - timer->start_ticks;
+
+  slot->trampoline_ticks +=
+      elapsed - (slot->listener_ticks - timer->start_listener_ticks);
+}
+
+static HookStatsTable *
+hook_stats_table_new (void)
+{
+  HookStatsTable * table;
+
+  table = g_slice_new (HookStatsTable);
+  table->next = NULL;
+  table->slots = g_new0 (HookStatsSlot, GUM_HOOK_STATS_INITIAL_CAPACITY);
+  table->capacity = GUM_HOOK_STATS_INITIAL_CAPACITY;
+  table->length = 0;
+
+  return table;
+}
+
+static void
+hook_stats_table_free (HookStatsTable * table)
+{
+  g_free (table->slots);
+
+  g_slice_free (HookStatsTable, table);
+}
+
+static void
+hook_stats_table_free_all (HookStatsTable * table)
+{
+  while (table != NULL)
+  {
+    HookStatsTable * next = table->next;
+
+    hook_stats_table_free (table);
+
+    table = next;
+  }
+}
+
+static guint
+hook_stats_hash (gpointer function_address)
+{
+  return (guint) (GPOINTER_TO_SIZE (function_address) >> 2) * 2654435761U;
+}
+
+static HookStatsSlot *
+hook_stats_table_lookup (HookStatsTable * self,
+                         gpointer function_address)
+{
+  HookStatsSlot * slots = self->slots;
+  guint mask = self->capacity - 1;
+  guint i;
+
+  for (i = hook_stats_hash (function_address) & mask; TRUE; i = (i + 1) & mask)
+  {
+    HookStatsSlot * slot = &slots[i];
+
+    if (slot->function_address == function_address)
+      return slot;
+    if (slot->function_address == NULL)
+      return NULL;
+  }
+}
+
+/*
+ * Tables that other threads may be reading need to pass the lock that
+ * protects them, which is held while swapping in the grown slot array.
+ */
+static HookStatsSlot *
+hook_stats_table_insert (HookStatsTable * self,
+                         gpointer function_address,
+                         GumSpinlock * lock)
+{
+  HookStatsSlot * slot;
+  guint mask, i;
+
+  if ((self->length + 1) * 4 > self->capacity * 3)
+  {
+    HookStatsSlot * old_slots, * new_slots;
+    guint old_capacity, new_capacity, j;
+
+    old_slots = self->slots;
+    old_capacity = self->capacity;
+    new_capacity = old_capacity * 2;
+    new_slots = g_new0 (HookStatsSlot, new_capacity);
+
+    mask = new_capacity - 1;
+    for (j = 0; j != old_capacity; j++)
+    {
+      HookStatsSlot * old_slot = &old_slots[j];
+
+      if (old_slot->function_address == NULL)
+        continue;
+
+      for (i = hook_stats_hash (old_slot->function_address) & mask;
+          new_slots[i].function_address != NULL;
+          i = (i + 1) & mask)
+      {
+      }
+      new_slots[i] = *old_slot;
+    }
+
+    if (lock != NULL)
+      gum_spinlock_acquire (lock);
+    self->slots = new_slots;
+    self->capacity = new_capacity;
+    if (lock != NULL)
+      gum_spinlock_release (lock);
+
+    g_free (old_slots);
+  }
+
+  mask = self->capacity - 1;
+  for (i = hook_stats_hash (function_address) & mask;
+      self->slots[i].function_address != NULL;
+      i = (i + 1) & mask)
+  {
+  }
+  slot = &self->slots[i];
+  slot->function_address = function_address;
+  self->length++;
+
+  return slot;
+}
+
+static void
+hook_stats_table_merge (HookStatsTable * self,
+                        HookStatsTable * other)
+{
+  guint i;
+
+  for (i = 0; i != other->capacity; i++)
+  {
+    HookStatsSlot * src = &other->slots[i];
+
+    if (src->function_address == NULL)
+      continue;
+
+    hook_stats_table_add (self, src);
+  }
+}
+
+static void
+hook_stats_table_add (HookStatsTable * self,
+                      const HookStatsSlot * src)
+{
+  HookStatsSlot * dst;
+
+  dst = hook_stats_table_lookup (self, src->function_address);
+  if (dst == NULL)
+    dst = hook_stats_table_insert (self, src->function_address, NULL);
+
+  dst->invocations += src->invocations;
+  dst->bypassed_invocations += src->bypassed_invocations;
+  dst->listener_ticks += src->listener_ticks;
+  dst->trampoline_ticks += src->trampoline_ticks;
+}
+
+static guint
+hook_stats_table_copy_slots (HookStatsTable * self,
+                             HookStatsSlot * slots)
+{
+  guint n, i;
+
+  n = 0;
+  for (i = 0; i != self->capacity; i++)
+  {
+    HookStatsSlot * slot = &self->slots[i];
+
+    if (slot->function_address != NULL)
+      slots[n++] = *slot;
+  }
+
+  return n;
+}
+
+/*
+ * Both of these must be called with gum_interceptor_thread_context_lock held.
+ */
+static guint
+gum_interceptor_measure_live_hook_stats (void)
+{
+  guint n;
+  GHashTableIter iter;
+  InterceptorThreadContext * thread_ctx;
+  HookStatsTable * cur;
+
+  n = 0;
+  g_hash_table_iter_init (&iter, gum_interceptor_thread_contexts);
+  while (g_hash_table_iter_next (&iter, (gpointer *) &thread_ctx, NULL))
+  {
+    if (thread_ctx->hook_stats != NULL)
+      n += thread_ctx->hook_stats->length;
+  }
+  for (cur = gum_interceptor_retired_hook_stats; cur != NULL; cur = cur->next)
+    n += cur->length;
+
+  return n;
+}
+
+static guint
+gum_interceptor_snapshot_live_hook_stats (HookStatsSlot * slots)
+{
+  guint n;
+  GHashTableIter iter;
+  InterceptorThreadContext * thread_ctx;
+  HookStatsTable * cur;
+
+  n = 0;
+  g_hash_table_iter_init (&iter, gum_interceptor_thread_contexts);
+  while (g_hash_table_iter_next (&iter, (gpointer *) &thread_ctx, NULL))
+  {
+    if (thread_ctx->hook_stats != NULL)
+      n += hook_stats_table_copy_slots (thread_ctx->hook_stats, &slots[n]);
+  }
+  for (cur = gum_interceptor_retired_hook_stats; cur != NULL; cur = cur->next)
+    n += hook_stats_table_copy_slots (cur, &slots[n]);
+
+  return n;
+}
+
+static void
+hook_stats_table_reset (HookStatsTable * self)
+{
+  guint i;
+
+  for (i = 0; i != self->capacity; i++)
+  {
+    HookStatsSlot * slot = &self->slots[i];
+
+    slot->invocations = 0;
+    slot->bypassed_invocations = 0;
+    slot->listener_ticks = 0;
+    slot->trampoline_ticks = 0;
+  }
+}
+
+static gint
+hook_stats_compare_by_cost (const GumInterceptorHookStats * a,
+                            const GumInterceptorHookStats * b)
+{
+  guint64 a_cost = a->listener_ticks + a->trampoline_ticks;
+  guint64 b_cost = b->listener_ticks + b->trampoline_ticks;
+
+  if (a_cost > b_cost)
+    return -1;
+  if (a_cost < b_cost)
+    return 1;
+  return 0;
+}
+
+static guint64
+gum_interceptor_read_ticks (void)
+{
+#if defined (HAVE_I386) && defined (_MSC_VER)
+  return __rdtsc ();
+#elif defined (HAVE_I386) && defined (__GNUC__)
+  return __builtin_ia32_rdtsc ();
+#elif defined (HAVE_ARM64) && defined (__GNUC__)
+  guint64 ticks;
+
+  asm volatile ("mrs %0, cntvct_el0" : "=r" (ticks));
+
+  return ticks;
+#else
+  return g_get_monotonic_time ();
+#endif
+}
+
+static void
+invocation_arena_init (InvocationArena * arena)
+{
+  arena->head = NULL;
+  arena->spare = NULL;
+}
+
+static void
+invocation_arena_destroy (InvocationArena * arena)
+{
+  InvocationArenaBlock * block;
+
+  block = arena->head;
+  while (block != NULL)
+  {
+    InvocationArenaBlock * previous = block->previous;
+
+    g_free (block);
+
+    block = previous;
+  }
+  arena->head = NULL;
+
+  g_free (arena->spare);
+  arena->spare = NULL;
+}
+
+static gpointer
+invocation_arena_alloc (InvocationArena * arena,
+                        gsize size)
+{
+  InvocationArenaBlock * block;
+  gpointer result;
+
+  size = GUM_ALIGN_SIZE (size, GUM_INVOCATION_ARENA_ALIGNMENT);
+
+  block = arena->head;
+  if (block == NULL || block->offset + size > block->capacity)
+  {
+    if (arena->spare != NULL && arena->spare->capacity >= size)
+    {
+      block = arena->spare;
+      arena->spare = NULL;
+    }
+    else
+    {
+      gsize capacity;
+
+      capacity = MAX (size, GUM_INVOCATION_ARENA_BLOCK_SIZE -
+          GUM_INVOCATION_ARENA_BLOCK_HEADER_SIZE);
+
+      block = g_malloc (GUM_INVOCATION_ARENA_BLOCK_HEADER_SIZE + capacity);
+      block->capacity = capacity;
+    }
+
+    block->previous = arena->head;
+    block->offset = 0;
+    arena->head = block;
+  }
+
+  result = (guint8 *) block + GUM_INVOCATION_ARENA_BLOCK_HEADER_SIZE +
+      block->offset;
+  block->offset += size;
+
+  gum_memset (result, 0, size);
+
+  return result;
+}
+
+static void
+invocation_arena_reset (InvocationArena * arena,
+                        InvocationArenaBlock * block,
+                        gsize offset)
+{
+  while (arena->head != block)
+  {
+    InvocationArenaBlock * head = arena->head;
+
+    arena->head = head->previous;
+
+    if (arena->spare == NULL || head->capacity > arena->spare->capacity)
+    {
+      g_free (arena->spare);
+      arena->spare = head;
+    }
+    else
+    {
+      g_free (head);
+    }
+  }
+
+  if (block != NULL)
+    block->offset = offset;
+}
+
 static GumInvocationStackEntry *
-gum_invocation_stack_push (GumInvocationStack * stack,
+gum_invocation_stack_push (InterceptorThreadContext * interceptor_ctx,
                            GumFunctionContext * function_ctx,
                            gpointer caller_ret_addr)
 {
+  GumInvocationStack * stack = interceptor_ctx->stack;
+  InvocationArena * arena = &interceptor_ctx->arena;
   GumInvocationStackEntry * entry;
   GumInvocationContext * ctx;
 
+  interceptor_ctx->stack_version++;
+
   g_array_set_size (stack, stack->len + 1);
   entry = (GumInvocationStackEntry *)
       &g_array_index (stack, GumInvocationStackEntry, stack->len - 1);
   entry->trampoline_ret_addr = function_ctx->on_leave_trampoline;
   entry->caller_ret_addr = caller_ret_addr;
+  entry->arena_block = arena->head;
+  entry->arena_offset = (arena->head != NULL) ? arena->head->offset : 0;
 
   ctx = &entry->invocation_context;
   ctx->function =
@@ -1705,14 +4057,19 @@ gum_invocation_stack_push (GumInvocationStack * stack,
 }
 
 static gpointer
-gum_invocation_stack_pop (GumInvocationStack * stack)
+gum_invocation_stack_pop (InterceptorThreadContext * interceptor_ctx)
 {
+  GumInvocationStack * stack = interceptor_ctx->stack;
+  InvocationArena * arena = &interceptor_ctx->arena;
   GumInvocationStackEntry * entry;
   gpointer caller_ret_addr;
 
+  interceptor_ctx->stack_version++;
+
   entry = (GumInvocationStackEntry *)
       &g_array_index (stack, GumInvocationStackEntry, stack->len - 1);
   caller_ret_addr = entry->caller_ret_addr;
+  invocation_arena_reset (arena, entry->arena_block, entry->arena_offset);
   g_array_set_size (stack, stack->len - 1);
 
   return caller_ret_addr;
@@ -1727,6 +4084,140 @@ gum_invocation_stack_peek_top (GumInvocationStack * stack)
   return &g_array_index (stack, GumInvocationStackEntry, stack->len - 1);
 }
 
+static InvocationStackIndex *
+gum_invocation_stack_get_index (GumInvocationStack * stack)
+{
+  InterceptorThreadContext * interceptor_ctx;
+  InvocationStackIndex * index;
+
+  if (stack->len < GUM_INVOCATION_STACK_INDEX_MIN_DEPTH)
+    return NULL;
+
+  interceptor_ctx = g_private_get (&gum_interceptor_context_private);
+  if (interceptor_ctx == NULL || interceptor_ctx->stack != stack)
+    return NULL;
+
+  index = &interceptor_ctx->stack_index;
+  if (index->slots == NULL || index->version != interceptor_ctx->stack_version)
+  {
+    invocation_stack_index_rebuild (index, stack);
+    index->version = interceptor_ctx->stack_version;
+  }
+
+  return index;
+}
+
+static gint
+gum_invocation_stack_find_first (GumInvocationStack * stack,
+                                 gpointer return_address)
+{
+  guint i;
+
+  for (i = 0; i != stack->len; i++)
+  {
+    GumInvocationStackEntry * entry;
+
+    entry = &g_array_index (stack, GumInvocationStackEntry, i);
+    if (entry->trampoline_ret_addr == return_address)
+      return i;
+  }
+
+  return -1;
+}
+
+static gint
+gum_invocation_stack_find_below (GumInvocationStack * stack,
+                                 gpointer return_address,
+                                 guint end)
+{
+  guint i;
+
+  for (i = end; i != 0; i--)
+  {
+    GumInvocationStackEntry * entry;
+
+    entry = &g_array_index (stack, GumInvocationStackEntry, i - 1);
+    if (entry->trampoline_ret_addr == return_address)
+      return i - 1;
+  }
+
+  return -1;
+}
+
+static void
+invocation_stack_index_init (InvocationStackIndex * index)
+{
+  index->slots = NULL;
+  index->capacity = 0;
+  index->version = 0;
+}
+
+static void
+invocation_stack_index_destroy (InvocationStackIndex * index)
+{
+  g_free (index->slots);
+}
+
+static void
+invocation_stack_index_rebuild (InvocationStackIndex * index,
+                                GumInvocationStack * stack)
+{
+  guint capacity, mask, depth;
+
+  capacity = GUM_INVOCATION_STACK_INDEX_MIN_CAPACITY;
+  while (capacity < stack->len * 2)
+    capacity *= 2;
+
+  if (capacity != index->capacity)
+  {
+    g_free (index->slots);
+    index->slots = g_new (InvocationStackIndexSlot, capacity);
+    index->capacity = capacity;
+  }
+  memset (index->slots, 0, capacity * sizeof (InvocationStackIndexSlot));
+
+  /* Keep the outermost entry for each address, like a linear lookup would */
+  mask = capacity - 1;
+  for (depth = 0; depth != stack->len; depth++)
+  {
+    GumInvocationStackEntry * entry;
+    guint i;
+
+    entry = &g_array_index (stack, GumInvocationStackEntry, depth);
+
+    for (i = (GPOINTER_TO_SIZE (entry->trampoline_ret_addr) >> 2) & mask;
+        index->slots[i].trampoline_ret_addr != NULL &&
+        index->slots[i].trampoline_ret_addr != entry->trampoline_ret_addr;
+        i = (i + 1) & mask)
+    {
+    }
+
+    if (index->slots[i].trampoline_ret_addr == NULL)
+    {
+      index->slots[i].trampoline_ret_addr = entry->trampoline_ret_addr;
+      index->slots[i].depth = depth;
+    }
+  }
+}
+
+static gint
+invocation_stack_index_lookup (InvocationStackIndex * index,
+                               gpointer return_address)
+{
+  guint mask, i;
+
+  mask = index->capacity - 1;
+  for (i = (GPOINTER_TO_SIZE (return_address) >> 2) & mask;
+      index->slots[i].trampoline_ret_addr != NULL;
+      i = (i + 1) & mask)
+  {
+    if (index->slots[i].trampoline_ret_addr == return_address)
+      return index->slots[i].depth;
+  }
+
+  return -1;
+}
+
 static gpointer
 gum_interceptor_resolve (GumInterceptor * self,
                          gpointer address)
@@ -1763,5 +4254,46 @@ static gint
 gum_page_address_compare (gconstpointer a,
                           gconstpointer b)
 {
-  return GPOINTER_TO_SIZE (a) - GPOINTER_TO_SIZE (b);
+  gsize address_a = GPOINTER_TO_SIZE (a);
+  gsize address_b = GPOINTER_TO_SIZE (b);
+
+  if (address_a < address_b)
+    return -1;
+  else if (address_a > address_b)
+    return 1;
+  else
+    return 0;
+}
+
+static GArray *
+gum_page_ranges_from_sorted_pages (GList * pages,
+                                   guint page_size)
+{
+  GArray * ranges;
+  GumMemoryRange * current = NULL;
+  GList * cur;
+
+  ranges = g_array_new (FALSE, FALSE, sizeof (GumMemoryRange));
+
+  for (cur = pages; cur != NULL; cur = cur->next)
+  {
+    GumAddress page = GUM_ADDRESS (cur->data);
+
+    if (current != NULL && current->base_address + current->size == page)
+    {
+      current->size += page_size;
+    }
+    else
+    {
+      GumMemoryRange range;
+
+      range.base_address = page;
+      range.size = page_size;
+      g_array_append_val (ranges, range);
+
+      current = &g_array_index (ranges, GumMemoryRange, ranges->len - 1);
+    }
+  }
+
+  return ranges;
 }
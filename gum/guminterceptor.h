@@ -11,6 +11,7 @@
 #include <glib-object.h>
 #include <gum/gumdefs.h>
 #include <gum/guminvocationlistener.h>
+#include <gum/gumreturnaddress.h>
 
 #define GUM_TYPE_INTERCEPTOR (gum_interceptor_get_type ())
 #define GUM_INTERCEPTOR(obj) (G_TYPE_CHECK_INSTANCE_CAST ((obj),\
@@ -28,6 +29,13 @@
 typedef struct _GumInterceptor GumInterceptor;
 typedef struct _GumInterceptorClass GumInterceptorClass;
 typedef GArray GumInvocationStack;
+typedef struct _GumInterceptorTransactionStats GumInterceptorTransactionStats;
+typedef struct _GumInterceptorHookStats GumInterceptorHookStats;
+
+typedef void (* GumInterceptorProbeFunc) (GumCpuContext * cpu_context,
+    gpointer user_data);
+typedef gboolean (* GumInterceptorThreadFilterFunc) (GumThreadId thread_id,
+    gpointer user_data);
 
 typedef struct _GumInterceptorPrivate GumInterceptorPrivate;
 
@@ -36,7 +44,9 @@ typedef enum
   GUM_ATTACH_OK               =  0,
   GUM_ATTACH_WRONG_SIGNATURE  = -1,
   GUM_ATTACH_ALREADY_ATTACHED = -2,
-  GUM_ATTACH_POLICY_VIOLATION = -3
+  GUM_ATTACH_POLICY_VIOLATION = -3,
+  GUM_ATTACH_WRONG_TYPE       = -4,
+  GUM_ATTACH_BUSY             = -5
 } GumAttachReturn;
 
 typedef enum
@@ -44,9 +54,37 @@ typedef enum
   GUM_REPLACE_OK               =  0,
   GUM_REPLACE_WRONG_SIGNATURE  = -1,
   GUM_REPLACE_ALREADY_REPLACED = -2,
-  GUM_REPLACE_POLICY_VIOLATION = -3
+  GUM_REPLACE_POLICY_VIOLATION = -3,
+  GUM_REPLACE_WRONG_TYPE       = -4,
+  GUM_REPLACE_BUSY             = -5
 } GumReplaceReturn;
 
+struct _GumInterceptorTransactionStats
+{
+  guint commit_count;
+  guint page_count;
+  guint range_count;
+
+  /* Time spent patching, in microseconds */
+  guint64 last_duration;
+  guint64 max_duration;
+  guint64 total_duration;
+};
+
+struct _GumInterceptorHookStats
+{
+  gpointer function_address;
+
+  guint64 invocations;
+  /* Calls passed straight through due to re-entrancy or a replacement
+   * calling the original */
+  guint64 bypassed_invocations;
+
+  /* CPU ticks spent in listeners and probes, and in our own dispatch code */
+  guint64 listener_ticks;
+  guint64 trampoline_ticks;
+};
+
 struct _GumInterceptor
 {
   GObject parent;
@@ -68,18 +106,45 @@ GUM_API GumInterceptor * gum_interceptor_obtain (void);
 GUM_API GumAttachReturn gum_interceptor_attach_listener (GumInterceptor * self,
     gpointer function_address, GumInvocationListener * listener,
     gpointer listener_function_data);
+GUM_API GumAttachReturn gum_interceptor_attach_listener_deferred (
+    GumInterceptor * self, gpointer function_address,
+    GumInvocationListener * listener, gpointer listener_function_data);
+GUM_API void gum_interceptor_activate_deferred (GumInterceptor * self);
 GUM_API void gum_interceptor_detach_listener (GumInterceptor * self,
     GumInvocationListener * listener);
+GUM_API void gum_interceptor_set_listener_thread_filter (GumInterceptor * self,
+    GumInvocationListener * listener, GumInterceptorThreadFilterFunc func,
+    gpointer data, GDestroyNotify data_destroy);
+GUM_API void gum_interceptor_set_listener_threads (GumInterceptor * self,
+    GumInvocationListener * listener, const GumThreadId * thread_ids,
+    guint n_thread_ids);
+
+GUM_API GumAttachReturn gum_interceptor_attach_probe (GumInterceptor * self,
+    gpointer function_address, GumInterceptorProbeFunc func,
+    gpointer user_data);
+GUM_API void gum_interceptor_detach_probe (GumInterceptor * self,
+    GumInterceptorProbeFunc func, gpointer user_data);
 
 GUM_API GumReplaceReturn gum_interceptor_replace_function (
     GumInterceptor * self, gpointer function_address,
     gpointer replacement_function, gpointer replacement_function_data);
+GUM_API GumReplaceReturn gum_interceptor_replace_function_fast (
+    GumInterceptor * self, gpointer function_address,
+    gpointer replacement_function, gpointer * original_function);
 GUM_API void gum_interceptor_revert_function (GumInterceptor * self,
     gpointer function_address);
 
 GUM_API void gum_interceptor_begin_transaction (GumInterceptor * self);
 GUM_API void gum_interceptor_end_transaction (GumInterceptor * self);
 GUM_API gboolean gum_interceptor_flush (GumInterceptor * self);
+GUM_API void gum_interceptor_get_transaction_stats (GumInterceptor * self,
+    GumInterceptorTransactionStats * stats);
+
+GUM_API void gum_interceptor_set_profiling_enabled (GumInterceptor * self,
+    gboolean enabled);
+GUM_API gboolean gum_interceptor_get_profiling_enabled (GumInterceptor * self);
+GUM_API GArray * gum_interceptor_get_stats (GumInterceptor * self);
+GUM_API void gum_interceptor_reset_stats (GumInterceptor * self);
 
 GUM_API GumInvocationContext * gum_interceptor_get_current_invocation (void);
 GUM_API GumInvocationStack * gum_interceptor_get_current_stack (void);
@@ -92,6 +157,8 @@ GUM_API void gum_interceptor_unignore_other_threads (GumInterceptor * self);
 
 GUM_API gpointer gum_invocation_stack_translate (GumInvocationStack * self,
     gpointer return_address);
+GUM_API void gum_invocation_stack_translate_all (GumInvocationStack * self,
+    GumReturnAddressArray * return_addresses);
 
 G_END_DECLS
 
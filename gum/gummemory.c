@@ -8,10 +8,32 @@
 
 #include "gumcloak-priv.h"
 #include "gumcodesegment.h"
+#include "gumexceptor.h"
 #include "gumlibc.h"
 #include "gummemory-priv.h"
 
+#include <gio/gio.h>
 #include <string.h>
+#ifdef _MSC_VER
+# include <intrin.h>
+#endif
+
+#if defined (HAVE_I386) && \
+    (GLIB_SIZEOF_VOID_P == 8 || defined (__SSE2__) || _M_IX86_FP >= 2)
+# define GUM_HAVE_SSE2_SCAN 1
+# include <emmintrin.h>
+# if defined (__GNUC__) || defined (_MSC_VER)
+#  define GUM_HAVE_AVX2_SCAN 1
+#  include <immintrin.h>
+# endif
+#endif
+#if defined (HAVE_ARM64) && defined (__ARM_NEON)
+# define GUM_HAVE_NEON_SCAN 1
+# include <arm_neon.h>
+#endif
+
+#define GUM_MULTI_SCAN_BITMAP_SIZE (65536 / 32)
+#define GUM_PARALLEL_SCAN_CHUNK_SIZE (4 * 1024 * 1024)
 
 #ifdef HAVE_IOS
 # include "backend-darwin/gumdarwin.h"
@@ -42,6 +64,111 @@
 # pragma warning (pop)
 #endif
 
+typedef struct _GumScanAnchors GumScanAnchors;
+typedef struct _GumMultiScan GumMultiScan;
+typedef struct _GumMultiScanEntry GumMultiScanEntry;
+typedef struct _GumParallelScan GumParallelScan;
+typedef struct _GumScanChunk GumScanChunk;
+typedef struct _GumScanResync GumScanResync;
+
+typedef const guint8 * (* GumFindCandidateFunc) (const guint8 * cur,
+    const guint8 * end, const GumScanAnchors * anchors);
+
+struct _GumScanAnchors
+{
+  guint8 first_value;
+  guint8 first_mask;
+  guint8 last_value;
+  guint8 last_mask;
+  guint last_offset;
+};
+
+struct _GumMultiScan
+{
+  guint32 * bitmap;
+  GArray * buckets[256];
+  GumMultiScanEntry * entries;
+  guint n_entries;
+};
+
+struct _GumMultiScanEntry
+{
+  const GumMatchPattern * pattern;
+  const GumMatchToken * needle;
+  guint8 second_value;
+  guint8 second_mask;
+  const guint8 * resume_at;
+};
+
+struct _GumParallelScan
+{
+  const GumMatchPattern * pattern;
+  GumExceptor * exceptor;
+  GAsyncQueue * finished_chunks;
+  volatile gint cancelled;
+};
+
+struct _GumScanChunk
+{
+  GumMemoryRange range;
+  GumAddress end;
+  guint range_index;
+  GArray * matches;
+  gboolean finished;
+  gboolean failed;
+  GumExceptionDetails exception;
+};
+
+struct _GumScanResync
+{
+  const GumScanChunk * chunk;
+  GArray * matches;
+  guint next_match;
+  gboolean synced;
+};
+
+static const GumMatchToken * gum_match_pattern_get_needle (
+    const GumMatchPattern * pattern);
+static gboolean gum_match_token_matches (const GumMatchToken * token,
+    const guint8 * bytes);
+static void gum_match_token_get_anchor (const GumMatchToken * token,
+    guint offset, guint8 * value, guint8 * mask);
+
+static GumFindCandidateFunc gum_get_find_candidate_impl (void);
+static const guint8 * gum_find_candidate_scalar (const guint8 * cur,
+    const guint8 * end, const GumScanAnchors * anchors);
+#ifdef GUM_HAVE_SSE2_SCAN
+static const guint8 * gum_find_candidate_sse2 (const guint8 * cur,
+    const guint8 * end, const GumScanAnchors * anchors);
+#endif
+#ifdef GUM_HAVE_AVX2_SCAN
+static gboolean gum_cpu_has_avx2 (void);
+static const guint8 * gum_find_candidate_avx2 (const guint8 * cur,
+    const guint8 * end, const GumScanAnchors * anchors);
+#endif
+#ifdef GUM_HAVE_NEON_SCAN
+static const guint8 * gum_find_candidate_neon (const guint8 * cur,
+    const guint8 * end, const GumScanAnchors * anchors);
+#endif
+static guint gum_find_first_bit (guint64 bits);
+
+static void gum_multi_scan_init (GumMultiScan * self,
+    const GumMatchPattern * const * patterns, guint n_patterns);
+static void gum_multi_scan_destroy (GumMultiScan * self);
+static gboolean gum_multi_scan_try_position (GumMultiScan * self,
+    const GumMemoryRange * range, const guint8 * cur,
+    GumMemoryScanMultiMatchFunc func, gpointer user_data);
+
+static gint gum_memory_range_compare_base (const GumMemoryRange * lhs,
+    const GumMemoryRange * rhs);
+static void gum_scan_chunk_run (GumScanChunk * chunk, GumParallelScan * scan);
+static gboolean gum_scan_chunk_collect_match (GumAddress address, gsize size,
+    GumScanChunk * chunk);
+static guint gum_scan_chunk_resync (GumScanChunk * chunk,
+    GumParallelScan * scan, GumAddress resume_at, GArray * matches);
+static gboolean gum_scan_resync_collect_match (GumAddress address, gsize size,
+    GumScanResync * resync);
+
 static GumMatchPattern * gum_match_pattern_new (void);
 static void gum_match_pattern_update_computed_size (GumMatchPattern * self);
 static GumMatchToken * gum_match_pattern_get_longest_token (
@@ -229,62 +356,754 @@ gum_memory_patch_code (GumAddress address,
   return TRUE;
 }
 
+/*
+ * Candidates are found by comparing two anchor bytes of the needle, the
+ * longest exact token or failing that the longest masked one, a vector at a
+ * time. Only those get the full comparison.
+ */
 void
 gum_memory_scan (const GumMemoryRange * range,
                  const GumMatchPattern * pattern,
                  GumMemoryScanMatchFunc func,
                  gpointer user_data)
 {
-  GumMatchToken * needle;
-  guint8 * needle_data, * mask_data = NULL;
-  guint needle_len;
-  guint8 * cur, * end_address;
+  GumFindCandidateFunc find_candidate;
+  const GumMatchToken * needle;
+  GumScanAnchors anchors;
+  const guint8 * base, * cur, * end_address;
 
-  needle = gum_match_pattern_get_longest_token (pattern, GUM_MATCH_EXACT);
-  if (needle == NULL)
+  if (range->size < pattern->size)
+    return;
+
+  find_candidate = gum_get_find_candidate_impl ();
+
+  needle = gum_match_pattern_get_needle (pattern);
+
+  gum_match_token_get_anchor (needle, 0, &anchors.first_value,
+      &anchors.first_mask);
+  anchors.last_offset = needle->bytes->len - 1;
+  gum_match_token_get_anchor (needle, anchors.last_offset,
+      &anchors.last_value, &anchors.last_mask);
+
+  base = GSIZE_TO_POINTER (range->base_address);
+  cur = base + needle->offset;
+  end_address = base + range->size - (pattern->size - needle->offset) + 1;
+
+  while (cur < end_address &&
+      (cur = find_candidate (cur, end_address, &anchors)) != NULL)
   {
-    needle = gum_match_pattern_get_longest_token (pattern, GUM_MATCH_MASK);
-    mask_data = (guint8 *) needle->masks->data;
+    guint8 * start;
+
+    if (!gum_match_token_matches (needle, cur))
+    {
+      cur++;
+      continue;
+    }
+
+    start = (guint8 *) cur - needle->offset;
+
+    if (gum_match_pattern_try_match_on (pattern, start))
+    {
+      if (!func (GUM_ADDRESS (start), pattern->size, user_data))
+        return;
+
+      cur = start + pattern->size + needle->offset;
+    }
+    else
+    {
+      cur++;
+    }
   }
+}
+
+/*
+ * Scans for several patterns in a single pass. Every pattern contributes the
+ * first two bytes of its needle to a 64 Kbit filter keyed on consecutive
+ * haystack bytes, so most positions cost a single bit test. Matches of the
+ * same pattern do not overlap, just like with gum_memory_scan().
+ */
+void
+gum_memory_scan_multi (const GumMemoryRange * range,
+                       const GumMatchPattern * const * patterns,
+                       guint n_patterns,
+                       GumMemoryScanMultiMatchFunc func,
+                       gpointer user_data)
+{
+  GumMultiScan scan;
+  const guint8 * cur, * last;
 
-  needle_data = (guint8 *) needle->bytes->data;
-  needle_len = needle->bytes->len;
+  if (n_patterns == 0 || range->size == 0)
+    return;
+
+  gum_multi_scan_init (&scan, patterns, n_patterns);
 
   cur = GSIZE_TO_POINTER (range->base_address);
-  end_address = cur + range->size - (pattern->size - needle->offset) + 1;
+  last = cur + range->size - 1;
 
-  for (; cur < end_address; cur++)
+  for (; cur != last; cur++)
   {
-    guint8 * start;
+    guint key = cur[0] | (cur[1] << 8);
+
+    if ((scan.bitmap[key / 32] & (1U << (key % 32))) == 0)
+      continue;
+
+    if (!gum_multi_scan_try_position (&scan, range, cur, func, user_data))
+      goto beach;
+  }
+
+  gum_multi_scan_try_position (&scan, range, last, func, user_data);
+
+beach:
+  gum_multi_scan_destroy (&scan);
+}
+
+/*
+ * Scans the ranges on a pool of worker threads, each taking chunks of a few
+ * MB that overlap their neighbour by the pattern size. Matches and progress
+ * are reported on the calling thread in address order, as chunks complete.
+ * Less than a chunk's worth of memory is scanned on the calling thread.
+ *
+ * Each chunk matches greedily from its own start. When the last match of the
+ * previous chunk spills into the next one, that chunk is rescanned from the
+ * end of the spilled match until it lines up with a match the worker found,
+ * so the result is identical to a serial scan.
+ */
+gboolean
+gum_memory_scan_ranges (const GumMemoryRange * ranges,
+                        guint n_ranges,
+                        const GumMatchPattern * pattern,
+                        GumMemoryScanMatchFunc on_match,
+                        GumMemoryScanProgressFunc on_progress,
+                        gpointer user_data,
+                        GError ** error)
+{
+  gboolean success = TRUE;
+  GArray * sorted_ranges, * chunks;
+  GumParallelScan scan;
+  GThreadPool * pool;
+  gsize bytes_total, bytes_scanned;
+  guint i, next_chunk, remaining;
+  gboolean carry_on;
+  guint last_range_index;
+  GumAddress last_match_end;
+  GArray * resynced_matches;
+
+  sorted_ranges = g_array_sized_new (FALSE, FALSE, sizeof (GumMemoryRange),
+      n_ranges);
+  g_array_append_vals (sorted_ranges, ranges, n_ranges);
+  g_array_sort (sorted_ranges, (GCompareFunc) gum_memory_range_compare_base);
+
+  chunks = g_array_new (FALSE, TRUE, sizeof (GumScanChunk));
+  bytes_total = 0;
+
+  for (i = 0; i != sorted_ranges->len; i++)
+  {
+    GumMemoryRange * r = &g_array_index (sorted_ranges, GumMemoryRange, i);
+    GumAddress range_end, offset;
+
+    if (r->size < pattern->size)
+      continue;
+
+    range_end = r->base_address + r->size;
+
+    for (offset = 0; offset < r->size; offset += GUM_PARALLEL_SCAN_CHUNK_SIZE)
+    {
+      GumScanChunk chunk = { { 0, }, 0, };
+
+      chunk.range.base_address = r->base_address + offset;
+      chunk.end = MIN (chunk.range.base_address + GUM_PARALLEL_SCAN_CHUNK_SIZE,
+          range_end);
+      chunk.range.size = MIN (chunk.end + pattern->size - 1, range_end) -
+          chunk.range.base_address;
+      chunk.range_index = i;
+
+      if (chunk.range.size < pattern->size)
+        break;
+
+      chunk.matches = g_array_new (FALSE, FALSE, sizeof (GumAddress));
+      g_array_append_val (chunks, chunk);
+
+      bytes_total += chunk.end - chunk.range.base_address;
+    }
+  }
+
+  scan.pattern = pattern;
+  scan.exceptor = gum_exceptor_obtain ();
+  scan.finished_chunks = g_async_queue_new ();
+  scan.cancelled = FALSE;
+
+  if (bytes_total > GUM_PARALLEL_SCAN_CHUNK_SIZE)
+  {
+    pool = g_thread_pool_new ((GFunc) gum_scan_chunk_run, &scan,
+        g_get_num_processors (), FALSE, NULL);
+    for (i = 0; i != chunks->len; i++)
+      g_thread_pool_push (pool, &g_array_index (chunks, GumScanChunk, i), NULL);
+  }
+  else
+  {
+    pool = NULL;
+    for (i = 0; i != chunks->len; i++)
+      gum_scan_chunk_run (&g_array_index (chunks, GumScanChunk, i), &scan);
+  }
+
+  bytes_scanned = 0;
+  next_chunk = 0;
+  carry_on = TRUE;
+  last_range_index = G_MAXUINT;
+  last_match_end = 0;
+  resynced_matches = g_array_new (FALSE, FALSE, sizeof (GumAddress));
+
+  for (remaining = chunks->len; remaining != 0; remaining--)
+  {
+    GumScanChunk * chunk;
 
-    if (mask_data == NULL)
+    chunk = g_async_queue_pop (scan.finished_chunks);
+    chunk->finished = TRUE;
+
+    bytes_scanned += chunk->end - chunk->range.base_address;
+    if (carry_on && on_progress != NULL)
+      on_progress (bytes_scanned, bytes_total, user_data);
+
+    while (carry_on && next_chunk != chunks->len)
     {
-      if (cur[0] != needle_data[0] ||
-          memcmp (cur, needle_data, needle_len) != 0)
+      GumScanChunk * c = &g_array_index (chunks, GumScanChunk, next_chunk);
+      guint first_match, j;
+
+      if (!c->finished)
+        break;
+
+      first_match = 0;
+
+      if (c->range_index != last_range_index)
       {
-        continue;
+        last_range_index = c->range_index;
       }
+      else if (last_match_end > c->range.base_address)
+      {
+        first_match = gum_scan_chunk_resync (c, &scan, last_match_end,
+            resynced_matches);
+
+        for (j = 0; carry_on && j != resynced_matches->len; j++)
+        {
+          GumAddress address = g_array_index (resynced_matches, GumAddress, j);
+
+          carry_on = on_match (address, pattern->size, user_data);
+          last_match_end = address + pattern->size;
+        }
+      }
+
+      for (j = first_match; carry_on && j != c->matches->len; j++)
+      {
+        GumAddress address = g_array_index (c->matches, GumAddress, j);
+
+        carry_on = on_match (address, pattern->size, user_data);
+        last_match_end = address + pattern->size;
+      }
+
+      if (carry_on && c->failed)
+      {
+        gchar * message;
+
+        message = gum_exception_details_to_string (&c->exception);
+        g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED, "%s", message);
+        g_free (message);
+
+        success = FALSE;
+        carry_on = FALSE;
+      }
+
+      next_chunk++;
+    }
+
+    if (!carry_on)
+      g_atomic_int_set (&scan.cancelled, TRUE);
+  }
+
+  if (pool != NULL)
+    g_thread_pool_free (pool, FALSE, TRUE);
+  g_async_queue_unref (scan.finished_chunks);
+  g_object_unref (scan.exceptor);
+
+  for (i = 0; i != chunks->len; i++)
+    g_array_free (g_array_index (chunks, GumScanChunk, i).matches, TRUE);
+  g_array_free (chunks, TRUE);
+  g_array_free (resynced_matches, TRUE);
+  g_array_free (sorted_ranges, TRUE);
+
+  return success;
+}
+
+static gint
+gum_memory_range_compare_base (const GumMemoryRange * lhs,
+                               const GumMemoryRange * rhs)
+{
+  if (lhs->base_address < rhs->base_address)
+    return -1;
+  if (lhs->base_address > rhs->base_address)
+    return 1;
+  return 0;
+}
+
+static void
+gum_scan_chunk_run (GumScanChunk * chunk,
+                    GumParallelScan * scan)
+{
+  GumExceptorScope scope;
+
+  if (!g_atomic_int_get (&scan->cancelled))
+  {
+    if (gum_exceptor_try (scan->exceptor, &scope))
+    {
+      gum_memory_scan (&chunk->range, scan->pattern,
+          (GumMemoryScanMatchFunc) gum_scan_chunk_collect_match, chunk);
+    }
+
+    if (gum_exceptor_catch (scan->exceptor, &scope))
+    {
+      chunk->failed = TRUE;
+      chunk->exception = scope.exception;
+    }
+  }
+
+  g_async_queue_push (scan->finished_chunks, chunk);
+}
+
+static gboolean
+gum_scan_chunk_collect_match (GumAddress address,
+                              gsize size,
+                              GumScanChunk * chunk)
+{
+  (void) size;
+
+  if (address >= chunk->end)
+    return FALSE;
+
+  g_array_append_val (chunk->matches, address);
+
+  return TRUE;
+}
+
+/*
+ * Serially rescans the chunk from where the previous chunk's last match
+ * ended. Matches found before lining up with one the worker collected end up
+ * in the given array. Returns the index of the first worker match that is
+ * still valid.
+ */
+static guint
+gum_scan_chunk_resync (GumScanChunk * chunk,
+                       GumParallelScan * scan,
+                       GumAddress resume_at,
+                       GArray * matches)
+{
+  GumScanResync resync;
+  GumMemoryRange range;
+  GumExceptorScope scope;
+
+  g_array_set_size (matches, 0);
+
+  resync.chunk = chunk;
+  resync.matches = matches;
+  resync.next_match = 0;
+  resync.synced = FALSE;
+
+  range.base_address = resume_at;
+  range.size = chunk->range.base_address + chunk->range.size - resume_at;
+
+  if (gum_exceptor_try (scan->exceptor, &scope))
+  {
+    gum_memory_scan (&range, scan->pattern,
+        (GumMemoryScanMatchFunc) gum_scan_resync_collect_match, &resync);
+  }
+
+  if (gum_exceptor_catch (scan->exceptor, &scope))
+  {
+    chunk->failed = TRUE;
+    chunk->exception = scope.exception;
+  }
+
+  return resync.synced ? resync.next_match : chunk->matches->len;
+}
+
+static gboolean
+gum_scan_resync_collect_match (GumAddress address,
+                               gsize size,
+                               GumScanResync * resync)
+{
+  const GArray * worker_matches = resync->chunk->matches;
+
+  (void) size;
+
+  if (address >= resync->chunk->end)
+    return FALSE;
+
+  while (resync->next_match != worker_matches->len &&
+      g_array_index (worker_matches, GumAddress, resync->next_match) < address)
+  {
+    resync->next_match++;
+  }
+
+  if (resync->next_match != worker_matches->len &&
+      g_array_index (worker_matches, GumAddress, resync->next_match) == address)
+  {
+    resync->synced = TRUE;
+    return FALSE;
+  }
+
+  g_array_append_val (resync->matches, address);
+
+  return TRUE;
+}
+
+static void
+gum_multi_scan_init (GumMultiScan * self,
+                     const GumMatchPattern * const * patterns,
+                     guint n_patterns)
+{
+  guint i;
+
+  self->bitmap = g_new0 (guint32, GUM_MULTI_SCAN_BITMAP_SIZE);
+  memset (self->buckets, 0, sizeof (self->buckets));
+  self->entries = g_new (GumMultiScanEntry, n_patterns);
+  self->n_entries = n_patterns;
+
+  for (i = 0; i != n_patterns; i++)
+  {
+    GumMultiScanEntry * entry = &self->entries[i];
+    guint8 first_value, first_mask;
+    guint first, second;
+
+    entry->pattern = patterns[i];
+    entry->needle = gum_match_pattern_get_needle (patterns[i]);
+    entry->resume_at = NULL;
+
+    gum_match_token_get_anchor (entry->needle, 0, &first_value, &first_mask);
+    if (entry->needle->bytes->len >= 2)
+    {
+      gum_match_token_get_anchor (entry->needle, 1, &entry->second_value,
+          &entry->second_mask);
     }
     else
     {
-      if ((cur[0] & mask_data[0]) != (needle_data[0] & mask_data[0]) ||
-          gum_memcmp_mask ((guint8 *) cur, (guint8 *) needle_data,
-              (guint8 *) mask_data, needle_len) != 0)
-      {
+      entry->second_value = 0;
+      entry->second_mask = 0;
+    }
+
+    for (first = 0; first != 256; first++)
+    {
+      if ((first & first_mask) != first_value)
         continue;
+
+      if (self->buckets[first] == NULL)
+        self->buckets[first] = g_array_new (FALSE, FALSE, sizeof (guint));
+      g_array_append_val (self->buckets[first], i);
+
+      for (second = 0; second != 256; second++)
+      {
+        guint key;
+
+        if ((second & entry->second_mask) != entry->second_value)
+          continue;
+
+        key = first | (second << 8);
+        self->bitmap[key / 32] |= 1U << (key % 32);
       }
     }
+  }
+}
 
-    start = cur - needle->offset;
+static void
+gum_multi_scan_destroy (GumMultiScan * self)
+{
+  guint i;
 
-    if (gum_match_pattern_try_match_on (pattern, start))
-    {
-      if (!func (GUM_ADDRESS (start), pattern->size, user_data))
-        return;
+  for (i = 0; i != G_N_ELEMENTS (self->buckets); i++)
+  {
+    if (self->buckets[i] != NULL)
+      g_array_free (self->buckets[i], TRUE);
+  }
+
+  g_free (self->entries);
+  g_free (self->bitmap);
+}
+
+static gboolean
+gum_multi_scan_try_position (GumMultiScan * self,
+                             const GumMemoryRange * range,
+                             const guint8 * cur,
+                             GumMemoryScanMultiMatchFunc func,
+                             gpointer user_data)
+{
+  GArray * bucket;
+  const guint8 * base, * end;
+  guint i;
+
+  bucket = self->buckets[cur[0]];
+  if (bucket == NULL)
+    return TRUE;
+
+  base = GSIZE_TO_POINTER (range->base_address);
+  end = base + range->size;
+
+  for (i = 0; i != bucket->len; i++)
+  {
+    guint index = g_array_index (bucket, guint, i);
+    GumMultiScanEntry * entry = &self->entries[index];
+    const GumMatchPattern * pattern = entry->pattern;
+    guint8 * start;
+
+    if (cur < base + entry->needle->offset)
+      continue;
+    start = (guint8 *) cur - entry->needle->offset;
+    if (start < entry->resume_at || (gsize) (end - start) < pattern->size)
+      continue;
+
+    if (entry->second_mask != 0 &&
+        (cur[1] & entry->second_mask) != entry->second_value)
+      continue;
+
+    if (!gum_match_token_matches (entry->needle, cur) ||
+        !gum_match_pattern_try_match_on (pattern, start))
+      continue;
+
+    if (!func (GUM_ADDRESS (start), pattern->size, index, user_data))
+      return FALSE;
+
+    entry->resume_at = start + pattern->size;
+  }
+
+  return TRUE;
+}
+
+static const GumMatchToken *
+gum_match_pattern_get_needle (const GumMatchPattern * pattern)
+{
+  const GumMatchToken * needle;
+
+  needle = gum_match_pattern_get_longest_token (pattern, GUM_MATCH_EXACT);
+  if (needle == NULL)
+    needle = gum_match_pattern_get_longest_token (pattern, GUM_MATCH_MASK);
+
+  return needle;
+}
 
-      cur = start + pattern->size - 1;
+static gboolean
+gum_match_token_matches (const GumMatchToken * token,
+                         const guint8 * bytes)
+{
+  if (token->type == GUM_MATCH_MASK)
+  {
+    return gum_memcmp_mask (bytes, (guint8 *) token->bytes->data,
+        (guint8 *) token->masks->data, token->bytes->len) == 0;
+  }
+
+  return memcmp (bytes, token->bytes->data, token->bytes->len) == 0;
+}
+
+static void
+gum_match_token_get_anchor (const GumMatchToken * token,
+                            guint offset,
+                            guint8 * value,
+                            guint8 * mask)
+{
+  *mask = (token->type == GUM_MATCH_MASK)
+      ? g_array_index (token->masks, guint8, offset)
+      : 0xff;
+  *value = g_array_index (token->bytes, guint8, offset) & *mask;
+}
+
+static GumFindCandidateFunc
+gum_get_find_candidate_impl (void)
+{
+  static GumFindCandidateFunc impl = NULL;
+
+  if (impl == NULL)
+  {
+#if defined (GUM_HAVE_AVX2_SCAN)
+    impl = gum_cpu_has_avx2 ()
+        ? gum_find_candidate_avx2
+        : gum_find_candidate_sse2;
+#elif defined (GUM_HAVE_SSE2_SCAN)
+    impl = gum_find_candidate_sse2;
+#elif defined (GUM_HAVE_NEON_SCAN)
+    impl = gum_find_candidate_neon;
+#else
+    impl = gum_find_candidate_scalar;
+#endif
+  }
+
+  return impl;
+}
+
+static const guint8 *
+gum_find_candidate_scalar (const guint8 * cur,
+                           const guint8 * end,
+                           const GumScanAnchors * anchors)
+{
+  for (; cur < end; cur++)
+  {
+    if ((cur[0] & anchors->first_mask) == anchors->first_value &&
+        (cur[anchors->last_offset] & anchors->last_mask) ==
+            anchors->last_value)
+    {
+      return cur;
     }
   }
+
+  return NULL;
+}
+
+#ifdef GUM_HAVE_SSE2_SCAN
+
+static const guint8 *
+gum_find_candidate_sse2 (const guint8 * cur,
+                         const guint8 * end,
+                         const GumScanAnchors * anchors)
+{
+  const __m128i first_value = _mm_set1_epi8 ((gchar) anchors->first_value);
+  const __m128i first_mask = _mm_set1_epi8 ((gchar) anchors->first_mask);
+  const __m128i last_value = _mm_set1_epi8 ((gchar) anchors->last_value);
+  const __m128i last_mask = _mm_set1_epi8 ((gchar) anchors->last_mask);
+
+  for (; end - cur >= 16; cur += 16)
+  {
+    __m128i first, last;
+    guint bits;
+
+    first = _mm_and_si128 (_mm_loadu_si128 ((const __m128i *) cur),
+        first_mask);
+    last = _mm_and_si128 (_mm_loadu_si128 (
+        (const __m128i *) (cur + anchors->last_offset)), last_mask);
+
+    bits = _mm_movemask_epi8 (_mm_and_si128 (
+        _mm_cmpeq_epi8 (first, first_value),
+        _mm_cmpeq_epi8 (last, last_value)));
+    if (bits != 0)
+      return cur + gum_find_first_bit (bits);
+  }
+
+  return gum_find_candidate_scalar (cur, end, anchors);
+}
+
+#endif
+
+#ifdef GUM_HAVE_AVX2_SCAN
+
+static gboolean
+gum_cpu_has_avx2 (void)
+{
+#ifdef _MSC_VER
+  gint info[4];
+  guint64 xcr0;
+
+  __cpuid (info, 0);
+  if (info[0] < 7)
+    return FALSE;
+
+  __cpuid (info, 1);
+  if ((info[2] & (1 << 27)) == 0)
+    return FALSE;
+  xcr0 = _xgetbv (0);
+  if ((xcr0 & 6) != 6)
+    return FALSE;
+
+  __cpuidex (info, 7, 0);
+  return (info[1] & (1 << 5)) != 0;
+#else
+  __builtin_cpu_init ();
+  return __builtin_cpu_supports ("avx2") != 0;
+#endif
+}
+
+#ifdef __GNUC__
+__attribute__ ((target ("avx2")))
+#endif
+static const guint8 *
+gum_find_candidate_avx2 (const guint8 * cur,
+                         const guint8 * end,
+                         const GumScanAnchors * anchors)
+{
+  const __m256i first_value = _mm256_set1_epi8 ((gchar) anchors->first_value);
+  const __m256i first_mask = _mm256_set1_epi8 ((gchar) anchors->first_mask);
+  const __m256i last_value = _mm256_set1_epi8 ((gchar) anchors->last_value);
+  const __m256i last_mask = _mm256_set1_epi8 ((gchar) anchors->last_mask);
+
+  for (; end - cur >= 32; cur += 32)
+  {
+    __m256i first, last;
+    guint bits;
+
+    first = _mm256_and_si256 (_mm256_loadu_si256 ((const __m256i *) cur),
+        first_mask);
+    last = _mm256_and_si256 (_mm256_loadu_si256 (
+        (const __m256i *) (cur + anchors->last_offset)), last_mask);
+
+    bits = (guint) _mm256_movemask_epi8 (_mm256_and_si256 (
+        _mm256_cmpeq_epi8 (first, first_value),
+        _mm256_cmpeq_epi8 (last, last_value)));
+    if (bits != 0)
+      return cur + gum_find_first_bit (bits);
+  }
+
+  return gum_find_candidate_sse2 (cur, end, anchors);
+}
+
+#endif
+
+#ifdef GUM_HAVE_NEON_SCAN
+
+static const guint8 *
+gum_find_candidate_neon (const guint8 * cur,
+                         const guint8 * end,
+                         const GumScanAnchors * anchors)
+{
+  const uint8x16_t first_value = vdupq_n_u8 (anchors->first_value);
+  const uint8x16_t first_mask = vdupq_n_u8 (anchors->first_mask);
+  const uint8x16_t last_value = vdupq_n_u8 (anchors->last_value);
+  const uint8x16_t last_mask = vdupq_n_u8 (anchors->last_mask);
+
+  for (; end - cur >= 16; cur += 16)
+  {
+    uint8x16_t first, last, hits;
+    guint64 bits;
+
+    first = vandq_u8 (vld1q_u8 (cur), first_mask);
+    last = vandq_u8 (vld1q_u8 (cur + anchors->last_offset), last_mask);
+
+    hits = vandq_u8 (vceqq_u8 (first, first_value),
+        vceqq_u8 (last, last_value));
+
+    /* Narrow to four bits per byte so the result fits in a scalar. */
+    bits = vget_lane_u64 (vreinterpret_u64_u8 (
+        vshrn_n_u16 (vreinterpretq_u16_u8 (hits), 4)), 0);
+    if (bits != 0)
+      return cur + (gum_find_first_bit (bits) / 4);
+  }
+
+  return gum_find_candidate_scalar (cur, end, anchors);
+}
+
+#endif
+
+static guint
+gum_find_first_bit (guint64 bits)
+{
+#if defined (_MSC_VER) && GLIB_SIZEOF_VOID_P == 8
+  unsigned long index;
+
+  _BitScanForward64 (&index, bits);
+
+  return index;
+#elif defined (_MSC_VER)
+  unsigned long index;
+
+  if (_BitScanForward (&index, (guint32) bits))
+    return index;
+  _BitScanForward (&index, (guint32) (bits >> 32));
+
+  return 32 + index;
+#else
+  return __builtin_ctzll (bits);
+#endif
 }
 
 GumMatchPattern *
@@ -581,7 +1400,7 @@ gum_match_token_free (GumMatchToken * token)
 {
   g_array_free (token->bytes, TRUE);
   if (token->masks != NULL)
-    g_array_free (token->bytes, TRUE);
+    g_array_free (token->masks, TRUE);
   g_slice_free (GumMatchToken, token);
 }
 
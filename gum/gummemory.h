@@ -61,6 +61,10 @@ G_BEGIN_DECLS
 typedef void (* GumMemoryPatchApplyFunc) (gpointer mem, gpointer user_data);
 typedef gboolean (* GumMemoryScanMatchFunc) (GumAddress address, gsize size,
     gpointer user_data);
+typedef gboolean (* GumMemoryScanMultiMatchFunc) (GumAddress address,
+    gsize size, guint pattern_index, gpointer user_data);
+typedef void (* GumMemoryScanProgressFunc) (gsize bytes_scanned,
+    gsize bytes_total, gpointer user_data);
 
 GUM_API void gum_memory_init (void);
 GUM_API void gum_memory_deinit (void);
@@ -78,6 +82,13 @@ GUM_API gboolean gum_memory_patch_code (GumAddress address, gsize size,
 GUM_API void gum_memory_scan (const GumMemoryRange * range,
     const GumMatchPattern * pattern, GumMemoryScanMatchFunc func,
     gpointer user_data);
+GUM_API void gum_memory_scan_multi (const GumMemoryRange * range,
+    const GumMatchPattern * const * patterns, guint n_patterns,
+    GumMemoryScanMultiMatchFunc func, gpointer user_data);
+GUM_API gboolean gum_memory_scan_ranges (const GumMemoryRange * ranges,
+    guint n_ranges, const GumMatchPattern * pattern,
+    GumMemoryScanMatchFunc on_match, GumMemoryScanProgressFunc on_progress,
+    gpointer user_data, GError ** error);
 
 GUM_API GumMatchPattern * gum_match_pattern_new_from_string (
     const gchar * match_combined_str);
@@ -7,27 +7,54 @@
 #include "gummemorymap.h"
 
 #include "gumprocess-priv.h"
+#include "gumspinlock.h"
 
-typedef struct _GumUpdateMemoryRangesContext GumUpdateMemoryRangesContext;
+typedef struct _GumMemoryMapSnapshot GumMemoryMapSnapshot;
 
 struct _GumMemoryMapPrivate
 {
   GumPageProtection prot;
-  GArray * ranges;
-  gsize ranges_min;
-  gsize ranges_max;
+
+  GumMemoryMapSnapshot * snapshot;
+  GumSpinlock snapshot_lock;
+
+  GMutex update_mutex;
+  guint64 generation;
+  gboolean generation_valid;
 };
 
-struct _GumUpdateMemoryRangesContext
+/*
+ * Lookups may race with an update from another thread, e.g. two threads
+ * generating backtraces at once. An update therefore never touches the
+ * ranges in place: it builds a new snapshot and swaps it in, and readers
+ * hold a reference to the snapshot they are searching.
+ */
+struct _GumMemoryMapSnapshot
 {
+  volatile gint ref_count;
+
   GArray * ranges;
-  gint prev_range_index;
+  gsize ranges_min;
+  gsize ranges_max;
 };
 
 static void gum_memory_map_finalize (GObject * object);
 
+static void gum_memory_map_rebuild (GumMemoryMap * self);
+static GumMemoryMapSnapshot * gum_memory_map_get_snapshot (
+    GumMemoryMap * self);
+
+static GumMemoryMapSnapshot * gum_memory_map_snapshot_new (
+    GumPageProtection prot);
+static void gum_memory_map_snapshot_unref (GumMemoryMapSnapshot * snapshot);
+static gboolean gum_memory_map_snapshot_contains (
+    const GumMemoryMapSnapshot * self, const GumMemoryRange * range);
+
 static gboolean gum_memory_map_add_range (const GumRangeDetails * details,
     gpointer user_data);
+static void gum_memory_map_normalize_ranges (GArray * ranges);
+static gint gum_memory_range_compare_base (const GumMemoryRange * lhs,
+    const GumMemoryRange * rhs);
 
 G_DEFINE_TYPE (GumMemoryMap, gum_memory_map, G_TYPE_OBJECT);
 
@@ -44,18 +71,26 @@ gum_memory_map_class_init (GumMemoryMapClass * klass)
 static void
 gum_memory_map_init (GumMemoryMap * self)
 {
-  self->priv = G_TYPE_INSTANCE_GET_PRIVATE (self, GUM_TYPE_MEMORY_MAP,
+  GumMemoryMapPrivate * priv;
+
+  priv = self->priv = G_TYPE_INSTANCE_GET_PRIVATE (self, GUM_TYPE_MEMORY_MAP,
       GumMemoryMapPrivate);
 
-  self->priv->ranges = g_array_new (FALSE, FALSE, sizeof (GumMemoryRange));
+  gum_spinlock_init (&priv->snapshot_lock);
+  g_mutex_init (&priv->update_mutex);
 }
 
 static void
 gum_memory_map_finalize (GObject * object)
 {
   GumMemoryMap * self = GUM_MEMORY_MAP (object);
+  GumMemoryMapPrivate * priv = self->priv;
+
+  if (priv->snapshot != NULL)
+    gum_memory_map_snapshot_unref (priv->snapshot);
 
-  g_array_free (self->priv->ranges, TRUE);
+  g_mutex_clear (&priv->update_mutex);
+  gum_spinlock_free (&priv->snapshot_lock);
 
   G_OBJECT_CLASS (gum_memory_map_parent_class)->finalize (object);
 }
@@ -76,80 +111,223 @@ gum_memory_map_new (GumPageProtection prot)
 gboolean
 gum_memory_map_contains (GumMemoryMap * self,
                          const GumMemoryRange * range)
+{
+  GumMemoryMapSnapshot * snapshot;
+  gboolean result;
+
+  snapshot = gum_memory_map_get_snapshot (self);
+  result = gum_memory_map_snapshot_contains (snapshot, range);
+  gum_memory_map_snapshot_unref (snapshot);
+
+  return result;
+}
+
+void
+gum_memory_map_update (GumMemoryMap * self)
 {
   GumMemoryMapPrivate * priv = self->priv;
-  const GumAddress start = range->base_address;
-  const GumAddress end = range->base_address + range->size;
-  guint i;
 
-  if (start < priv->ranges_min)
-    return FALSE;
-  else if (end > priv->ranges_max)
+  g_mutex_lock (&priv->update_mutex);
+  gum_memory_map_rebuild (self);
+  g_mutex_unlock (&priv->update_mutex);
+}
+
+/*
+ * Re-enumerates the ranges only if a module was loaded or unloaded since the
+ * last update. This is not an incremental update: anonymous mappings created
+ * or changed in between go unnoticed until the next module change, which is
+ * fine for consumers that only care about code, like the backtracers. On
+ * backends without a module generation this never refreshes, as there is
+ * no cheap way to tell whether anything changed.
+ */
+gboolean
+gum_memory_map_update_if_stale (GumMemoryMap * self)
+{
+  GumMemoryMapPrivate * priv = self->priv;
+  guint64 generation;
+  gboolean stale;
+
+  if (!_gum_process_query_module_generation (&generation))
     return FALSE;
 
-  for (i = 0; i < priv->ranges->len; i++)
-  {
-    GumMemoryRange * r = &g_array_index (priv->ranges, GumMemoryRange, i);
-    if (start >= r->base_address && end <= r->base_address + r->size)
-      return TRUE;
-  }
+  g_mutex_lock (&priv->update_mutex);
 
-  return FALSE;
+  stale = !priv->generation_valid || generation != priv->generation;
+  if (stale)
+    gum_memory_map_rebuild (self);
+
+  g_mutex_unlock (&priv->update_mutex);
+
+  return stale;
 }
 
-void
-gum_memory_map_update (GumMemoryMap * self)
+static void
+gum_memory_map_rebuild (GumMemoryMap * self)
 {
   GumMemoryMapPrivate * priv = self->priv;
-  GumUpdateMemoryRangesContext ctx;
+  GumMemoryMapSnapshot * snapshot, * previous;
+
+  priv->generation_valid =
+      _gum_process_query_module_generation (&priv->generation);
 
-  ctx.ranges = priv->ranges;
-  ctx.prev_range_index = -1;
+  snapshot = gum_memory_map_snapshot_new (priv->prot);
 
-  g_array_set_size (priv->ranges, 0);
+  gum_spinlock_acquire (&priv->snapshot_lock);
+  previous = priv->snapshot;
+  priv->snapshot = snapshot;
+  gum_spinlock_release (&priv->snapshot_lock);
+
+  if (previous != NULL)
+    gum_memory_map_snapshot_unref (previous);
+}
+
+static GumMemoryMapSnapshot *
+gum_memory_map_get_snapshot (GumMemoryMap * self)
+{
+  GumMemoryMapPrivate * priv = self->priv;
+  GumMemoryMapSnapshot * snapshot;
 
-  _gum_process_enumerate_ranges (priv->prot, gum_memory_map_add_range, &ctx);
+  gum_spinlock_acquire (&priv->snapshot_lock);
+  snapshot = priv->snapshot;
+  g_atomic_int_inc (&snapshot->ref_count);
+  gum_spinlock_release (&priv->snapshot_lock);
 
-  if (priv->ranges->len > 0)
+  return snapshot;
+}
+
+static GumMemoryMapSnapshot *
+gum_memory_map_snapshot_new (GumPageProtection prot)
+{
+  GumMemoryMapSnapshot * snapshot;
+  GArray * ranges;
+
+  snapshot = g_slice_new (GumMemoryMapSnapshot);
+  snapshot->ref_count = 1;
+
+  ranges = g_array_new (FALSE, FALSE, sizeof (GumMemoryRange));
+  _gum_process_enumerate_ranges (prot, gum_memory_map_add_range, ranges);
+  gum_memory_map_normalize_ranges (ranges);
+  snapshot->ranges = ranges;
+
+  if (ranges->len > 0)
   {
     GumMemoryRange * first_range, * last_range;
 
-    first_range = &g_array_index (priv->ranges, GumMemoryRange, 0);
-    last_range = &g_array_index (priv->ranges, GumMemoryRange,
-        priv->ranges->len - 1);
+    first_range = &g_array_index (ranges, GumMemoryRange, 0);
+    last_range = &g_array_index (ranges, GumMemoryRange, ranges->len - 1);
 
-    priv->ranges_min = first_range->base_address;
-    priv->ranges_max = last_range->base_address + last_range->size;
+    snapshot->ranges_min = first_range->base_address;
+    snapshot->ranges_max = last_range->base_address + last_range->size;
   }
   else
   {
-    priv->ranges_min = 0;
-    priv->ranges_max = 0;
+    snapshot->ranges_min = 0;
+    snapshot->ranges_max = 0;
   }
+
+  return snapshot;
+}
+
+static void
+gum_memory_map_snapshot_unref (GumMemoryMapSnapshot * snapshot)
+{
+  if (!g_atomic_int_dec_and_test (&snapshot->ref_count))
+    return;
+
+  g_array_free (snapshot->ranges, TRUE);
+
+  g_slice_free (GumMemoryMapSnapshot, snapshot);
+}
+
+static gboolean
+gum_memory_map_snapshot_contains (const GumMemoryMapSnapshot * self,
+                                  const GumMemoryRange * range)
+{
+  const GumAddress start = range->base_address;
+  const GumAddress end = range->base_address + range->size;
+  guint lower, upper;
+  const GumMemoryRange * r;
+
+  if (start < self->ranges_min)
+    return FALSE;
+  else if (end > self->ranges_max)
+    return FALSE;
+
+  lower = 0;
+  upper = self->ranges->len;
+  while (lower < upper)
+  {
+    guint mid = lower + ((upper - lower) / 2);
+
+    r = &g_array_index (self->ranges, GumMemoryRange, mid);
+    if (r->base_address <= start)
+      lower = mid + 1;
+    else
+      upper = mid;
+  }
+
+  if (lower == 0)
+    return FALSE;
+
+  r = &g_array_index (self->ranges, GumMemoryRange, lower - 1);
+
+  return end <= r->base_address + r->size;
 }
 
 static gboolean
 gum_memory_map_add_range (const GumRangeDetails * details,
                           gpointer user_data)
 {
-  GumUpdateMemoryRangesContext * ctx =
-      (GumUpdateMemoryRangesContext *) user_data;
-  GArray * ranges = ctx->ranges;
-  const GumMemoryRange * cur = details->range;
-  GumMemoryRange * prev;
+  GArray * ranges = (GArray *) user_data;
 
-  if (ctx->prev_range_index >= 0)
-    prev = &g_array_index (ranges, GumMemoryRange, ctx->prev_range_index);
-  else
-    prev = NULL;
+  g_array_append_val (ranges, *details->range);
 
-  if (prev != NULL && cur->base_address == prev->base_address + prev->size)
-    prev->size += cur->size;
-  else
-    g_array_append_val (ranges, *cur);
+  return TRUE;
+}
+
+static void
+gum_memory_map_normalize_ranges (GArray * ranges)
+{
+  guint n, i;
 
-  ctx->prev_range_index = ranges->len - 1;
+  g_array_sort (ranges, (GCompareFunc) gum_memory_range_compare_base);
 
-  return TRUE;
+  n = 0;
+  for (i = 0; i != ranges->len; i++)
+  {
+    const GumMemoryRange * cur = &g_array_index (ranges, GumMemoryRange, i);
+
+    if (n > 0)
+    {
+      GumMemoryRange * prev = &g_array_index (ranges, GumMemoryRange, n - 1);
+      GumAddress prev_end = prev->base_address + prev->size;
+
+      if (cur->base_address <= prev_end)
+      {
+        GumAddress cur_end = cur->base_address + cur->size;
+
+        if (cur_end > prev_end)
+          prev->size = cur_end - prev->base_address;
+        continue;
+      }
+    }
+
+    if (n != i)
+      g_array_index (ranges, GumMemoryRange, n) = *cur;
+    n++;
+  }
+
+  g_array_set_size (ranges, n);
 }
 
+static gint
+gum_memory_range_compare_base (const GumMemoryRange * lhs,
+                               const GumMemoryRange * rhs)
+{
+  if (lhs->base_address < rhs->base_address)
+    return -1;
+  else if (lhs->base_address > rhs->base_address)
+    return 1;
+  else
+    return 0;
+}
@@ -50,6 +50,7 @@ GUM_API gboolean gum_memory_map_contains (GumMemoryMap * self,
     const GumMemoryRange * range);
 
 GUM_API void gum_memory_map_update (GumMemoryMap * self);
+GUM_API gboolean gum_memory_map_update_if_stale (GumMemoryMap * self);
 
 G_END_DECLS
 
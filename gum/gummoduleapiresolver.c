@@ -9,9 +9,14 @@
 #include "gumprocess.h"
 
 #include <gio/gio.h>
+#include <string.h>
 
 typedef struct _GumModuleMetadata GumModuleMetadata;
+typedef struct _GumFunctionIndex GumFunctionIndex;
 typedef struct _GumFunctionMetadata GumFunctionMetadata;
+typedef struct _GumCollectFunctionsContext GumCollectFunctionsContext;
+typedef struct _GumNamePattern GumNamePattern;
+typedef guint GumNamePatternKind;
 
 struct _GumModuleApiResolver
 {
@@ -20,6 +25,7 @@ struct _GumModuleApiResolver
   GRegex * query_pattern;
 
   GHashTable * module_by_name;
+  GPtrArray * modules;
 };
 
 struct _GumModuleMetadata
@@ -29,15 +35,44 @@ struct _GumModuleMetadata
   gchar * name;
   gchar * path;
 
-  GHashTable * import_by_name;
-  GHashTable * export_by_name;
+  GumFunctionIndex * imports;
+  GumFunctionIndex * exports;
+};
+
+struct _GumFunctionIndex
+{
+  GStringChunk * strings;
+  GArray * functions;
 };
 
 struct _GumFunctionMetadata
 {
-  gchar * name;
+  const gchar * name;
   GumAddress address;
-  gchar * module;
+  const gchar * module;
+};
+
+struct _GumCollectFunctionsContext
+{
+  GumFunctionIndex * index;
+  GHashTable * index_by_name;
+};
+
+enum _GumNamePatternKind
+{
+  GUM_NAME_PATTERN_EXACT,
+  GUM_NAME_PATTERN_PREFIX,
+  GUM_NAME_PATTERN_SUFFIX,
+  GUM_NAME_PATTERN_SUBSTRING,
+  GUM_NAME_PATTERN_GLOB
+};
+
+struct _GumNamePattern
+{
+  GumNamePatternKind kind;
+  gchar * literal;
+  gsize literal_length;
+  GPatternSpec * spec;
 };
 
 static void gum_module_api_resolver_iface_init (gpointer g_iface,
@@ -46,25 +81,44 @@ static void gum_module_api_resolver_finalize (GObject * object);
 static void gum_module_api_resolver_enumerate_matches (
     GumApiResolver * resolver, const gchar * query, GumFoundApiFunc func,
     gpointer user_data, GError ** error);
-
-static GPatternSpec * gum_pattern_spec_from_match_info (GMatchInfo * match_info,
-    gint match_num);
-
-static GHashTable * gum_module_api_resolver_create_snapshot (void);
+static gboolean gum_module_api_resolver_enumerate_functions (
+    GumModuleMetadata * module, GumFunctionIndex * index,
+    const GumNamePattern * pattern, GString * name, GumFoundApiFunc func,
+    gpointer user_data);
+static gboolean gum_emit_function (const GumFunctionMetadata * function,
+    GumModuleMetadata * module, GString * name, GumFoundApiFunc func,
+    gpointer user_data);
+
+static void gum_name_pattern_init_from_match_info (GumNamePattern * pattern,
+    GMatchInfo * match_info, gint match_num);
+static void gum_name_pattern_destroy (GumNamePattern * pattern);
+static gboolean gum_name_pattern_match (const GumNamePattern * pattern,
+    const gchar * name);
+
+static void gum_module_api_resolver_create_snapshot (
+    GumModuleApiResolver * self);
 static gboolean gum_module_api_resolver_collect_module (
     const GumModuleDetails * details, gpointer user_data);
 
 static void gum_module_metadata_unref (GumModuleMetadata * module);
-static GHashTable * gum_module_metadata_get_imports (GumModuleMetadata * self);
-static GHashTable * gum_module_metadata_get_exports (GumModuleMetadata * self);
+static GumFunctionIndex * gum_module_metadata_get_imports (
+    GumModuleMetadata * self);
+static GumFunctionIndex * gum_module_metadata_get_exports (
+    GumModuleMetadata * self);
 static gboolean gum_module_metadata_collect_import (
     const GumImportDetails * details, gpointer user_data);
 static gboolean gum_module_metadata_collect_export (
     const GumExportDetails * details, gpointer user_data);
 
-static GumFunctionMetadata * gum_function_metadata_new (const gchar * name,
-    GumAddress address, const gchar * module);
-static void gum_function_metadata_free (GumFunctionMetadata * function);
+static GumFunctionIndex * gum_function_index_new (void);
+static void gum_function_index_free (GumFunctionIndex * index);
+static void gum_function_index_add (GumCollectFunctionsContext * ctx,
+    const gchar * name, GumAddress address, const gchar * module);
+static void gum_function_index_seal (GumFunctionIndex * self);
+static guint gum_function_index_lower_bound (GumFunctionIndex * self,
+    const gchar * name);
+static gint gum_function_metadata_compare_name (
+    const GumFunctionMetadata * lhs, const GumFunctionMetadata * rhs);
 
 G_DEFINE_TYPE_EXTENDED (GumModuleApiResolver,
                         gum_module_api_resolver,
@@ -97,7 +151,7 @@ gum_module_api_resolver_init (GumModuleApiResolver * self)
 {
   self->query_pattern = g_regex_new ("(imports|exports):(.+)!(.+)", 0, 0, NULL);
 
-  self->module_by_name = gum_module_api_resolver_create_snapshot ();
+  gum_module_api_resolver_create_snapshot (self);
 }
 
 static void
@@ -105,6 +159,7 @@ gum_module_api_resolver_finalize (GObject * object)
 {
   GumModuleApiResolver * self = GUM_MODULE_API_RESOLVER (object);
 
+  g_ptr_array_unref (self->modules);
   g_hash_table_unref (self->module_by_name);
 
   g_regex_unref (self->query_pattern);
@@ -128,125 +183,261 @@ gum_module_api_resolver_enumerate_matches (GumApiResolver * resolver,
   GumModuleApiResolver * self = GUM_MODULE_API_RESOLVER (resolver);
   GMatchInfo * query_info;
   gchar * collection;
-  GPatternSpec * module_spec, * function_spec;
-  GHashTableIter module_iter;
-  GHashTable * seen_modules;
+  GumNamePattern module_pattern, function_pattern;
+  GString * name;
   gboolean carry_on;
-  GumModuleMetadata * module;
+  guint i;
 
   g_regex_match (self->query_pattern, query, 0, &query_info);
   if (!g_match_info_matches (query_info))
     goto invalid_query;
 
   collection = g_match_info_fetch (query_info, 1);
-  module_spec = gum_pattern_spec_from_match_info (query_info, 2);
-  function_spec = gum_pattern_spec_from_match_info (query_info, 3);
+  gum_name_pattern_init_from_match_info (&module_pattern, query_info, 2);
+  gum_name_pattern_init_from_match_info (&function_pattern, query_info, 3);
 
-  g_hash_table_iter_init (&module_iter, self->module_by_name);
-  seen_modules = g_hash_table_new (NULL, NULL);
+  name = g_string_sized_new (128);
   carry_on = TRUE;
 
-  while (carry_on &&
-      g_hash_table_iter_next (&module_iter, NULL, (gpointer *) &module))
+  for (i = 0; carry_on && i != self->modules->len; i++)
   {
-    if (g_hash_table_contains (seen_modules, module))
-      continue;
-    g_hash_table_add (seen_modules, module);
+    GumModuleMetadata * module = g_ptr_array_index (self->modules, i);
 
-    if (g_pattern_match_string (module_spec, module->name) ||
-        g_pattern_match_string (module_spec, module->path))
+    if (gum_name_pattern_match (&module_pattern, module->name) ||
+        gum_name_pattern_match (&module_pattern, module->path))
     {
-      GHashTable * functions;
-      GHashTableIter function_iter;
-      GumFunctionMetadata * function;
-
-      functions = (collection[0] == 'i')
-          ? gum_module_metadata_get_imports (module)
-          : gum_module_metadata_get_exports (module);
-
-      g_hash_table_iter_init (&function_iter, functions);
-      while (carry_on &&
-          g_hash_table_iter_next (&function_iter, NULL, (gpointer *) &function))
-      {
-        if (g_pattern_match_string (function_spec, function->name))
-        {
-          GumApiDetails details;
-
-          details.name = g_strconcat (
-              (function->module != NULL) ? function->module : module->path,
-              "!",
-              function->name,
-              NULL);
-          details.address = function->address;
-
-          carry_on = func (&details, user_data);
-
-          g_free ((gpointer) details.name);
-        }
-      }
+      carry_on = gum_module_api_resolver_enumerate_functions (module,
+          (collection[0] == 'i')
+              ? gum_module_metadata_get_imports (module)
+              : gum_module_metadata_get_exports (module),
+          &function_pattern, name, func, user_data);
     }
   }
 
-  g_hash_table_unref (seen_modules);
+  g_string_free (name, TRUE);
 
-  g_pattern_spec_free (function_spec);
-  g_pattern_spec_free (module_spec);
+  gum_name_pattern_destroy (&function_pattern);
+  gum_name_pattern_destroy (&module_pattern);
   g_free (collection);
 
+  g_match_info_free (query_info);
+
   return;
 
 invalid_query:
   {
+    g_match_info_free (query_info);
+
     g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
         "invalid query; format is: "
         "exports:*!open*, exports:libc.so!* or imports:notepad.exe!*");
   }
 }
 
-static GPatternSpec *
-gum_pattern_spec_from_match_info (GMatchInfo * match_info,
-                                  gint match_num)
+static gboolean
+gum_module_api_resolver_enumerate_functions (GumModuleMetadata * module,
+                                             GumFunctionIndex * index,
+                                             const GumNamePattern * pattern,
+                                             GString * name,
+                                             GumFoundApiFunc func,
+                                             gpointer user_data)
 {
-  gchar * pattern;
-  GPatternSpec * spec;
+  GArray * functions = index->functions;
+  guint i;
+
+  switch (pattern->kind)
+  {
+    case GUM_NAME_PATTERN_EXACT:
+    case GUM_NAME_PATTERN_PREFIX:
+    {
+      /* The index is sorted by name, so all candidates are adjacent. */
+      for (i = gum_function_index_lower_bound (index, pattern->literal);
+          i != functions->len;
+          i++)
+      {
+        const GumFunctionMetadata * function =
+            &g_array_index (functions, GumFunctionMetadata, i);
+
+        if (strncmp (function->name, pattern->literal,
+            pattern->literal_length) != 0)
+          break;
 
-  pattern = g_match_info_fetch (match_info, match_num);
-  spec = g_pattern_spec_new (pattern);
-  g_free (pattern);
+        if (!gum_name_pattern_match (pattern, function->name))
+          continue;
+
+        if (!gum_emit_function (function, module, name, func, user_data))
+          return FALSE;
+      }
 
-  return spec;
+      break;
+    }
+    default:
+    {
+      for (i = 0; i != functions->len; i++)
+      {
+        const GumFunctionMetadata * function =
+            &g_array_index (functions, GumFunctionMetadata, i);
+
+        if (!gum_name_pattern_match (pattern, function->name))
+          continue;
+
+        if (!gum_emit_function (function, module, name, func, user_data))
+          return FALSE;
+      }
+
+      break;
+    }
+  }
+
+  return TRUE;
 }
 
-static GHashTable *
-gum_module_api_resolver_create_snapshot (void)
+static gboolean
+gum_emit_function (const GumFunctionMetadata * function,
+                   GumModuleMetadata * module,
+                   GString * name,
+                   GumFoundApiFunc func,
+                   gpointer user_data)
 {
-  GHashTable * module_by_name;
+  GumApiDetails details;
 
-  module_by_name = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
-      (GDestroyNotify) gum_module_metadata_unref);
+  g_string_assign (name,
+      (function->module != NULL) ? function->module : module->path);
+  g_string_append_c (name, '!');
+  g_string_append (name, function->name);
 
-  gum_process_enumerate_modules (gum_module_api_resolver_collect_module,
-      module_by_name);
+  details.name = name->str;
+  details.address = function->address;
 
-  return module_by_name;
+  return func (&details, user_data);
+}
+
+static void
+gum_name_pattern_init_from_match_info (GumNamePattern * pattern,
+                                       GMatchInfo * match_info,
+                                       gint match_num)
+{
+  gchar * str;
+  gsize length;
+  const gchar * first_star, * last_star;
+
+  str = g_match_info_fetch (match_info, match_num);
+  length = strlen (str);
+  first_star = strchr (str, '*');
+  last_star = strrchr (str, '*');
+
+  pattern->spec = NULL;
+
+  if (strchr (str, '?') != NULL)
+  {
+    pattern->kind = GUM_NAME_PATTERN_GLOB;
+  }
+  else if (first_star == NULL)
+  {
+    pattern->kind = GUM_NAME_PATTERN_EXACT;
+    pattern->literal = g_strdup (str);
+  }
+  else if (first_star == last_star && first_star == str + length - 1)
+  {
+    pattern->kind = GUM_NAME_PATTERN_PREFIX;
+    pattern->literal = g_strndup (str, length - 1);
+  }
+  else if (first_star == last_star && first_star == str)
+  {
+    pattern->kind = GUM_NAME_PATTERN_SUFFIX;
+    pattern->literal = g_strdup (str + 1);
+  }
+  else if (first_star == str && last_star == str + length - 1 &&
+      strchr (first_star + 1, '*') == last_star)
+  {
+    pattern->kind = GUM_NAME_PATTERN_SUBSTRING;
+    pattern->literal = g_strndup (str + 1, length - 2);
+  }
+  else
+  {
+    pattern->kind = GUM_NAME_PATTERN_GLOB;
+  }
+
+  if (pattern->kind == GUM_NAME_PATTERN_GLOB)
+  {
+    pattern->literal = NULL;
+    pattern->literal_length = 0;
+    pattern->spec = g_pattern_spec_new (str);
+  }
+  else
+  {
+    pattern->literal_length = strlen (pattern->literal);
+  }
+
+  g_free (str);
+}
+
+static void
+gum_name_pattern_destroy (GumNamePattern * pattern)
+{
+  if (pattern->spec != NULL)
+    g_pattern_spec_free (pattern->spec);
+  g_free (pattern->literal);
+}
+
+static gboolean
+gum_name_pattern_match (const GumNamePattern * pattern,
+                        const gchar * name)
+{
+  switch (pattern->kind)
+  {
+    case GUM_NAME_PATTERN_EXACT:
+      return strcmp (name, pattern->literal) == 0;
+    case GUM_NAME_PATTERN_PREFIX:
+      return strncmp (name, pattern->literal, pattern->literal_length) == 0;
+    case GUM_NAME_PATTERN_SUFFIX:
+    {
+      gsize length = strlen (name);
+
+      return length >= pattern->literal_length &&
+          memcmp (name + length - pattern->literal_length, pattern->literal,
+              pattern->literal_length) == 0;
+    }
+    case GUM_NAME_PATTERN_SUBSTRING:
+      return strstr (name, pattern->literal) != NULL;
+    case GUM_NAME_PATTERN_GLOB:
+      return g_pattern_match_string (pattern->spec, name);
+    default:
+      g_assert_not_reached ();
+  }
+
+  return FALSE;
+}
+
+static void
+gum_module_api_resolver_create_snapshot (GumModuleApiResolver * self)
+{
+  self->module_by_name = g_hash_table_new_full (g_str_hash, g_str_equal,
+      g_free, (GDestroyNotify) gum_module_metadata_unref);
+  self->modules = g_ptr_array_new ();
+
+  gum_process_enumerate_modules (gum_module_api_resolver_collect_module,
+      self);
 }
 
 static gboolean
 gum_module_api_resolver_collect_module (const GumModuleDetails * details,
                                         gpointer user_data)
 {
-  GHashTable * module_by_name = user_data;
+  GumModuleApiResolver * self = user_data;
   GumModuleMetadata * module;
 
   module = g_slice_new (GumModuleMetadata);
   module->ref_count = 2;
   module->name = g_strdup (details->name);
   module->path = g_strdup (details->path);
-  module->import_by_name = NULL;
-  module->export_by_name = NULL;
+  module->imports = NULL;
+  module->exports = NULL;
+
+  g_hash_table_insert (self->module_by_name, g_strdup (module->name), module);
+  g_hash_table_insert (self->module_by_name, g_strdup (module->path), module);
 
-  g_hash_table_insert (module_by_name, g_strdup (module->name), module);
-  g_hash_table_insert (module_by_name, g_strdup (module->path), module);
+  g_ptr_array_add (self->modules, module);
 
   return TRUE;
 }
@@ -257,11 +448,11 @@ gum_module_metadata_unref (GumModuleMetadata * module)
   module->ref_count--;
   if (module->ref_count == 0)
   {
-    if (module->export_by_name != NULL)
-      g_hash_table_unref (module->export_by_name);
+    if (module->exports != NULL)
+      gum_function_index_free (module->exports);
 
-    if (module->import_by_name != NULL)
-      g_hash_table_unref (module->import_by_name);
+    if (module->imports != NULL)
+      gum_function_index_free (module->imports);
 
     g_free (module->path);
     g_free (module->name);
@@ -270,47 +461,60 @@ gum_module_metadata_unref (GumModuleMetadata * module)
   }
 }
 
-static GHashTable *
+static GumFunctionIndex *
 gum_module_metadata_get_imports (GumModuleMetadata * self)
 {
-  if (self->import_by_name == NULL)
+  if (self->imports == NULL)
   {
-    self->import_by_name = g_hash_table_new_full (g_str_hash, g_str_equal,
-        g_free, (GDestroyNotify) gum_function_metadata_free);
+    GumCollectFunctionsContext ctx;
+
+    ctx.index = gum_function_index_new ();
+    ctx.index_by_name = g_hash_table_new (g_str_hash, g_str_equal);
+
     gum_module_enumerate_imports (self->path,
-        gum_module_metadata_collect_import, self->import_by_name);
+        gum_module_metadata_collect_import, &ctx);
+
+    g_hash_table_unref (ctx.index_by_name);
+    gum_function_index_seal (ctx.index);
+
+    self->imports = ctx.index;
   }
 
-  return self->import_by_name;
+  return self->imports;
 }
 
-static GHashTable *
+static GumFunctionIndex *
 gum_module_metadata_get_exports (GumModuleMetadata * self)
 {
-  if (self->export_by_name == NULL)
+  if (self->exports == NULL)
   {
-    self->export_by_name = g_hash_table_new_full (g_str_hash, g_str_equal,
-        g_free, (GDestroyNotify) gum_function_metadata_free);
+    GumCollectFunctionsContext ctx;
+
+    ctx.index = gum_function_index_new ();
+    ctx.index_by_name = g_hash_table_new (g_str_hash, g_str_equal);
+
     gum_module_enumerate_exports (self->path,
-        gum_module_metadata_collect_export, self->export_by_name);
+        gum_module_metadata_collect_export, &ctx);
+
+    g_hash_table_unref (ctx.index_by_name);
+    gum_function_index_seal (ctx.index);
+
+    self->exports = ctx.index;
   }
 
-  return self->export_by_name;
+  return self->exports;
 }
 
 static gboolean
 gum_module_metadata_collect_import (const GumImportDetails * details,
                                     gpointer user_data)
 {
-  GHashTable * import_by_name = user_data;
+  GumCollectFunctionsContext * ctx = user_data;
 
   if (details->type == GUM_IMPORT_FUNCTION && details->address != 0)
   {
-    GumFunctionMetadata * function;
-
-    function = gum_function_metadata_new (details->name, details->address,
+    gum_function_index_add (ctx, details->name, details->address,
         details->module);
-    g_hash_table_insert (import_by_name, g_strdup (function->name), function);
   }
 
   return TRUE;
@@ -320,40 +524,105 @@ static gboolean
 gum_module_metadata_collect_export (const GumExportDetails * details,
                                     gpointer user_data)
 {
-  GHashTable * export_by_name = user_data;
+  GumCollectFunctionsContext * ctx = user_data;
 
   if (details->type == GUM_EXPORT_FUNCTION)
-  {
-    GumFunctionMetadata * function;
-
-    function = gum_function_metadata_new (details->name, details->address,
-        NULL);
-    g_hash_table_insert (export_by_name, g_strdup (function->name), function);
-  }
+    gum_function_index_add (ctx, details->name, details->address, NULL);
 
   return TRUE;
 }
 
-static GumFunctionMetadata *
-gum_function_metadata_new (const gchar * name,
-                           GumAddress address,
-                           const gchar * module)
+static GumFunctionIndex *
+gum_function_index_new (void)
 {
+  GumFunctionIndex * index;
+
+  index = g_slice_new (GumFunctionIndex);
+  index->strings = g_string_chunk_new (4096);
+  index->functions = g_array_new (FALSE, FALSE, sizeof (GumFunctionMetadata));
+
+  return index;
+}
+
+static void
+gum_function_index_free (GumFunctionIndex * index)
+{
+  g_array_free (index->functions, TRUE);
+  g_string_chunk_free (index->strings);
+
+  g_slice_free (GumFunctionIndex, index);
+}
+
+static void
+gum_function_index_add (GumCollectFunctionsContext * ctx,
+                        const gchar * name,
+                        GumAddress address,
+                        const gchar * module)
+{
+  GumFunctionIndex * index = ctx->index;
+  gpointer existing;
   GumFunctionMetadata * function;
 
-  function = g_slice_new (GumFunctionMetadata);
-  function->name = g_strdup (name);
-  function->address = address;
-  function->module = g_strdup (module);
+  if (g_hash_table_lookup_extended (ctx->index_by_name, name, NULL,
+      &existing))
+  {
+    function = &g_array_index (index->functions, GumFunctionMetadata,
+        GPOINTER_TO_UINT (existing));
+  }
+  else
+  {
+    GumFunctionMetadata entry;
+
+    entry.name = g_string_chunk_insert (index->strings, name);
+    g_array_append_val (index->functions, entry);
 
-  return function;
+    g_hash_table_insert (ctx->index_by_name, (gpointer) entry.name,
+        GUINT_TO_POINTER (index->functions->len - 1));
+
+    function = &g_array_index (index->functions, GumFunctionMetadata,
+        index->functions->len - 1);
+  }
+
+  function->address = address;
+  function->module = (module != NULL)
+      ? g_string_chunk_insert_const (index->strings, module)
+      : NULL;
 }
 
 static void
-gum_function_metadata_free (GumFunctionMetadata * function)
+gum_function_index_seal (GumFunctionIndex * self)
 {
-  g_free (function->module);
-  g_free (function->name);
+  g_array_sort (self->functions,
+      (GCompareFunc) gum_function_metadata_compare_name);
+}
 
-  g_slice_free (GumFunctionMetadata, function);
+static guint
+gum_function_index_lower_bound (GumFunctionIndex * self,
+                                const gchar * name)
+{
+  guint lower, upper;
+
+  lower = 0;
+  upper = self->functions->len;
+
+  while (lower < upper)
+  {
+    guint mid = lower + ((upper - lower) / 2);
+    const GumFunctionMetadata * function =
+        &g_array_index (self->functions, GumFunctionMetadata, mid);
+
+    if (strcmp (function->name, name) < 0)
+      lower = mid + 1;
+    else
+      upper = mid;
+  }
+
+  return lower;
+}
+
+static gint
+gum_function_metadata_compare_name (const GumFunctionMetadata * lhs,
+                                    const GumFunctionMetadata * rhs)
+{
+  return strcmp (lhs->name, rhs->name);
 }
@@ -6,25 +6,40 @@
 
 #include "gummodulemap.h"
 
+#include "gumprocess-priv.h"
+
 #include <stdlib.h>
+#include <string.h>
+
+typedef struct _GumModuleMapUpdateContext GumModuleMapUpdateContext;
 
 struct _GumModuleMap
 {
   GObject parent;
 
   GArray * modules;
+  guint64 generation;
+  gboolean generation_valid;
 
   GumModuleMapFilterFunc filter_func;
   gpointer filter_data;
   GDestroyNotify filter_data_destroy;
 };
 
+struct _GumModuleMapUpdateContext
+{
+  GumModuleMap * self;
+  GArray * previous;
+  gboolean * retained;
+};
+
 static void gum_module_map_dispose (GObject * object);
 static void gum_module_map_finalize (GObject * object);
 
 static void gum_module_map_clear (GumModuleMap * self);
 static gboolean gum_add_module (const GumModuleDetails * details,
     gpointer user_data);
+static void gum_module_details_free_contents (GumModuleDetails * details);
 
 static gint gum_module_details_compare_base (
     const GumModuleDetails * lhs_module, const GumModuleDetails * rhs_module);
@@ -115,9 +130,40 @@ gum_module_map_find (GumModuleMap * self,
 void
 gum_module_map_update (GumModuleMap * self)
 {
-  gum_module_map_clear (self);
-  gum_process_enumerate_modules (gum_add_module, self);
+  guint64 generation;
+  gboolean generation_valid;
+  GumModuleMapUpdateContext ctx;
+  guint i;
+
+  generation_valid = _gum_process_query_module_generation (&generation);
+  if (generation_valid && self->generation_valid &&
+      generation == self->generation)
+  {
+    return;
+  }
+
+  ctx.self = self;
+  ctx.previous = self->modules;
+  ctx.retained = g_new0 (gboolean, ctx.previous->len);
+
+  self->modules = g_array_sized_new (FALSE, FALSE, sizeof (GumModuleDetails),
+      ctx.previous->len);
+  gum_process_enumerate_modules (gum_add_module, &ctx);
   g_array_sort (self->modules, (GCompareFunc) gum_module_details_compare_base);
+
+  for (i = 0; i != ctx.previous->len; i++)
+  {
+    if (!ctx.retained[i])
+    {
+      gum_module_details_free_contents (
+          &g_array_index (ctx.previous, GumModuleDetails, i));
+    }
+  }
+  g_array_free (ctx.previous, TRUE);
+  g_free (ctx.retained);
+
+  self->generation = generation;
+  self->generation_valid = generation_valid;
 }
 
 GArray *
@@ -133,19 +179,22 @@ gum_module_map_clear (GumModuleMap * self)
 
   for (i = 0; i < self->modules->len; i++)
   {
-    GumModuleDetails * d = &g_array_index (self->modules, GumModuleDetails, i);
-    g_free ((gchar *) d->name);
-    g_slice_free (GumMemoryRange, (GumMemoryRange *) d->range);
-    g_free ((gchar *) d->path);
+    gum_module_details_free_contents (
+        &g_array_index (self->modules, GumModuleDetails, i));
   }
   g_array_set_size (self->modules, 0);
+
+  self->generation_valid = FALSE;
 }
 
 static gboolean
 gum_add_module (const GumModuleDetails * details,
                 gpointer user_data)
 {
-  GumModuleMap * self = user_data;
+  GumModuleMapUpdateContext * ctx = user_data;
+  GumModuleMap * self = ctx->self;
+  const GumMemoryRange * range = details->range;
+  const GumModuleDetails * existing;
   GumModuleDetails copy;
 
   if (self->filter_func != NULL)
@@ -154,8 +203,21 @@ gum_add_module (const GumModuleDetails * details,
       return TRUE;
   }
 
+  existing = bsearch (&range->base_address, ctx->previous->data,
+      ctx->previous->len, sizeof (GumModuleDetails),
+      (GCompareFunc) gum_module_details_compare_to_key);
+  if (existing != NULL &&
+      existing->range->base_address == range->base_address &&
+      existing->range->size == range->size &&
+      strcmp (existing->path, details->path) == 0)
+  {
+    ctx->retained[existing - (GumModuleDetails *) ctx->previous->data] = TRUE;
+    g_array_append_val (self->modules, *existing);
+    return TRUE;
+  }
+
   copy.name = g_strdup (details->name);
-  copy.range = g_slice_dup (GumMemoryRange, details->range);
+  copy.range = g_slice_dup (GumMemoryRange, range);
   copy.path = g_strdup (details->path);
 
   g_array_append_val (self->modules, copy);
@@ -163,6 +225,14 @@ gum_add_module (const GumModuleDetails * details,
   return TRUE;
 }
 
+static void
+gum_module_details_free_contents (GumModuleDetails * details)
+{
+  g_free ((gchar *) details->name);
+  g_slice_free (GumMemoryRange, (GumMemoryRange *) details->range);
+  g_free ((gchar *) details->path);
+}
+
 static gint
 gum_module_details_compare_base (const GumModuleDetails * lhs_module,
                                  const GumModuleDetails * rhs_module)
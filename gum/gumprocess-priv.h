@@ -11,10 +11,13 @@
 
 G_BEGIN_DECLS
 
-G_GNUC_INTERNAL void _gum_process_enumerate_threads (GumFoundThreadFunc func,
-    gpointer user_data);
+G_GNUC_INTERNAL void _gum_process_enumerate_threads (GumThreadFlags flags,
+    GumFoundThreadFunc func, gpointer user_data);
 G_GNUC_INTERNAL void _gum_process_enumerate_ranges (GumPageProtection prot,
     GumFoundRangeFunc func, gpointer user_data);
+G_GNUC_INTERNAL gboolean _gum_process_query_module_generation (
+    guint64 * generation);
+G_GNUC_INTERNAL gboolean _gum_process_sample_thread_pcs (GArray * pcs);
 
 G_END_DECLS
 
@@ -65,12 +65,21 @@ gum_process_set_code_signing_policy (GumCodeSigningPolicy policy)
 void
 gum_process_enumerate_threads (GumFoundThreadFunc func,
                                gpointer user_data)
+{
+  gum_process_enumerate_threads_full (GUM_THREAD_FLAGS_CPU_CONTEXT, func,
+      user_data);
+}
+
+void
+gum_process_enumerate_threads_full (GumThreadFlags flags,
+                                    GumFoundThreadFunc func,
+                                    gpointer user_data)
 {
   GumEmitThreadsContext ctx;
 
   ctx.func = func;
   ctx.user_data = user_data;
-  _gum_process_enumerate_threads (gum_emit_thread_if_not_cloaked, &ctx);
+  _gum_process_enumerate_threads (flags, gum_emit_thread_if_not_cloaked, &ctx);
 }
 
 static gboolean
@@ -14,6 +14,7 @@
 typedef guint GumCodeSigningPolicy;
 typedef gsize GumThreadId;
 typedef guint GumThreadState;
+typedef guint GumThreadFlags;
 typedef struct _GumThreadDetails GumThreadDetails;
 typedef struct _GumModuleDetails GumModuleDetails;
 typedef guint GumImportType;
@@ -42,6 +43,12 @@ enum _GumThreadState
   GUM_THREAD_HALTED
 };
 
+enum _GumThreadFlags
+{
+  GUM_THREAD_FLAGS_NONE        = 0,
+  GUM_THREAD_FLAGS_CPU_CONTEXT = (1 << 0)
+};
+
 struct _GumThreadDetails
 {
   GumThreadId id;
@@ -167,6 +174,8 @@ GUM_API gboolean gum_process_modify_thread (GumThreadId thread_id,
     GumModifyThreadFunc func, gpointer user_data);
 GUM_API void gum_process_enumerate_threads (GumFoundThreadFunc func,
     gpointer user_data);
+GUM_API void gum_process_enumerate_threads_full (GumThreadFlags flags,
+    GumFoundThreadFunc func, gpointer user_data);
 GUM_API void gum_process_enumerate_modules (GumFoundModuleFunc func,
     gpointer user_data);
 GUM_API void gum_process_enumerate_ranges (GumPageProtection prot,
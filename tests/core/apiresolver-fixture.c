@@ -19,6 +19,7 @@
 
 typedef struct _TestApiResolverFixture TestApiResolverFixture;
 typedef struct _TestForEachContext TestForEachContext;
+typedef struct _TestGlobContext TestGlobContext;
 
 struct _TestApiResolverFixture
 {
@@ -31,6 +32,12 @@ struct _TestForEachContext
   guint number_of_calls;
 };
 
+struct _TestGlobContext
+{
+  const gchar * pattern;
+  guint number_of_calls;
+};
+
 static void
 test_api_resolver_fixture_setup (TestApiResolverFixture * fixture,
                                  gconstpointer data)
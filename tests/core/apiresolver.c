@@ -8,6 +8,7 @@
 
 TEST_LIST_BEGIN (api_resolver)
   API_RESOLVER_TESTENTRY (module_exports_can_be_resolved)
+  API_RESOLVER_TESTENTRY (module_exports_honor_glob_semantics)
   API_RESOLVER_TESTENTRY (module_imports_can_be_resolved)
   API_RESOLVER_TESTENTRY (objc_methods_can_be_resolved)
 
@@ -16,6 +17,9 @@ TEST_LIST_BEGIN (api_resolver)
 #endif
 TEST_LIST_END ()
 
+static gboolean check_glob_match (const GumApiDetails * details,
+    gpointer user_data);
+
 API_RESOLVER_TESTCASE (module_exports_can_be_resolved)
 {
   TestForEachContext ctx;
@@ -44,6 +48,55 @@ API_RESOLVER_TESTCASE (module_exports_can_be_resolved)
   g_assert_cmpuint (ctx.number_of_calls, ==, 1);
 }
 
+API_RESOLVER_TESTCASE (module_exports_honor_glob_semantics)
+{
+  const gchar * patterns[] = {
+    "malloc",
+    "mall*",
+    "*alloc",
+    "*alloc*",
+    "m?lloc",
+    "*",
+  };
+  guint i;
+
+  fixture->resolver = gum_api_resolver_make ("module");
+  g_assert (fixture->resolver != NULL);
+
+  for (i = 0; i != G_N_ELEMENTS (patterns); i++)
+  {
+    TestGlobContext ctx;
+    gchar * query;
+    GError * error = NULL;
+
+    ctx.pattern = patterns[i];
+    ctx.number_of_calls = 0;
+
+    query = g_strconcat ("exports:*!", patterns[i], NULL);
+    gum_api_resolver_enumerate_matches (fixture->resolver, query,
+        check_glob_match, &ctx, &error);
+    g_assert (error == NULL);
+    g_assert_cmpuint (ctx.number_of_calls, >=, 1);
+    g_free (query);
+  }
+}
+
+static gboolean
+check_glob_match (const GumApiDetails * details,
+                  gpointer user_data)
+{
+  TestGlobContext * ctx = user_data;
+  const gchar * function_name;
+
+  function_name = strrchr (details->name, '!');
+  g_assert (function_name != NULL);
+  g_assert (g_pattern_match_simple (ctx->pattern, function_name + 1));
+
+  ctx->number_of_calls++;
+
+  return TRUE;
+}
+
 API_RESOLVER_TESTCASE (module_imports_can_be_resolved)
 {
 #ifdef HAVE_DARWIN
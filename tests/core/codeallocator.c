@@ -0,0 +1,112 @@
+/*
+ * Copyright (C) 2017 Ole André Vadla Ravnås <oleavr@nowsecure.com>
+ *
+ * Licence: wxWindows Library Licence, Version 3.1
+ */
+
+#include "testutil.h"
+
+#include "gumcodeallocator.h"
+
+#define CODEALLOC_TESTCASE(NAME) \
+    void test_code_allocator_ ## NAME (void)
+#define CODEALLOC_TESTENTRY(NAME) \
+    TEST_ENTRY_SIMPLE ("Core/CodeAllocator", test_code_allocator, NAME)
+
+#define TEST_SLICE_SIZE 256
+
+TEST_LIST_BEGIN (code_allocator)
+  CODEALLOC_TESTENTRY (sized_slice_is_rounded_up_to_size_class)
+  CODEALLOC_TESTENTRY (freed_slice_is_reused_within_its_size_class)
+  CODEALLOC_TESTENTRY (empty_batch_is_released_on_commit)
+TEST_LIST_END ()
+
+CODEALLOC_TESTCASE (sized_slice_is_rounded_up_to_size_class)
+{
+  GumCodeAllocator allocator;
+  GumCodeSlice * slice;
+
+  gum_code_allocator_init (&allocator, TEST_SLICE_SIZE);
+
+  g_assert_cmpuint (gum_code_allocator_round_slice_size (&allocator, 1), ==,
+      GUM_CODE_ALLOCATOR_MIN_SLICE_SIZE);
+  g_assert_cmpuint (gum_code_allocator_round_slice_size (&allocator, 100), ==,
+      128);
+  g_assert_cmpuint (gum_code_allocator_round_slice_size (&allocator,
+      TEST_SLICE_SIZE), ==, TEST_SLICE_SIZE);
+  g_assert_cmpuint (gum_code_allocator_round_slice_size (&allocator,
+      TEST_SLICE_SIZE + 1), ==, 0);
+
+  slice = gum_code_allocator_try_alloc_sized_slice_near (&allocator, 100,
+      NULL, 0);
+  g_assert (slice != NULL);
+  g_assert_cmpuint (slice->size, ==, 128);
+  gum_code_slice_free (slice);
+
+  gum_code_allocator_free (&allocator);
+}
+
+CODEALLOC_TESTCASE (freed_slice_is_reused_within_its_size_class)
+{
+  GumCodeAllocator allocator;
+  GumCodeSlice * small, * large;
+
+  if (!gum_query_is_rwx_supported ())
+  {
+    g_print ("<skipping, slices are only reused with RWX> ");
+    return;
+  }
+
+  gum_code_allocator_init (&allocator, TEST_SLICE_SIZE);
+
+  small = gum_code_allocator_try_alloc_sized_slice_near (&allocator, 64,
+      NULL, 0);
+  gum_code_slice_free (small);
+
+  large = gum_code_allocator_alloc_slice (&allocator);
+  g_assert_cmpuint (allocator.stats.slices_reused, ==, 0);
+  g_assert_cmpuint (allocator.stats.batches_allocated, ==, 2);
+
+  small = gum_code_allocator_try_alloc_sized_slice_near (&allocator, 64,
+      NULL, 0);
+  g_assert_cmpuint (small->size, ==, 64);
+  g_assert_cmpuint (allocator.stats.slices_reused, ==, 1);
+  g_assert_cmpuint (allocator.stats.batches_allocated, ==, 2);
+
+  gum_code_slice_free (small);
+  gum_code_slice_free (large);
+
+  gum_code_allocator_free (&allocator);
+}
+
+CODEALLOC_TESTCASE (empty_batch_is_released_on_commit)
+{
+  GumCodeAllocator allocator;
+  GumCodeSlice * first, * second;
+
+  if (!gum_query_is_rwx_supported ())
+  {
+    g_print ("<skipping, batches are only tracked with RWX> ");
+    return;
+  }
+
+  gum_code_allocator_init (&allocator, TEST_SLICE_SIZE);
+
+  first = gum_code_allocator_alloc_slice (&allocator);
+  second = gum_code_allocator_alloc_slice (&allocator);
+  g_assert_cmpuint (allocator.stats.batches_allocated, ==, 1);
+
+  gum_code_slice_free (first);
+  gum_code_allocator_commit (&allocator);
+  g_assert_cmpuint (allocator.stats.batches_released, ==, 0);
+
+  gum_code_slice_free (second);
+  gum_code_allocator_commit (&allocator);
+  g_assert_cmpuint (allocator.stats.batches_released, ==, 1);
+
+  first = gum_code_allocator_alloc_slice (&allocator);
+  g_assert_cmpuint (allocator.stats.batches_allocated, ==, 2);
+  gum_code_slice_free (first);
+
+  gum_code_allocator_free (&allocator);
+}
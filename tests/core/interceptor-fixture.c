@@ -34,42 +34,6 @@
 # define G_MODULE_SUFFIX "dylib"
 #endif
 
-#if defined (G_OS_WIN32)
-# define GUM_TEST_SHLIB_OS "windows"
-#elif defined (HAVE_MACOS)
-# define GUM_TEST_SHLIB_OS "macos"
-#elif defined (HAVE_LINUX) && !defined (HAVE_ANDROID)
-# define GUM_TEST_SHLIB_OS "linux"
-#elif defined (HAVE_IOS)
-# define GUM_TEST_SHLIB_OS "ios"
-#elif defined (HAVE_ANDROID)
-# define GUM_TEST_SHLIB_OS "android"
-#elif defined (HAVE_QNX)
-# define GUM_TEST_SHLIB_OS "qnx"
-#else
-# error Unknown OS
-#endif
-
-#if defined (HAVE_I386)
-# if GLIB_SIZEOF_VOID_P == 4
-#  define GUM_TEST_SHLIB_ARCH "x86"
-# else
-#  define GUM_TEST_SHLIB_ARCH "x86_64"
-# endif
-#elif defined (HAVE_ARM)
-# define GUM_TEST_SHLIB_ARCH "arm"
-#elif defined (HAVE_ARM64)
-# define GUM_TEST_SHLIB_ARCH "arm64"
-#elif defined (HAVE_MIPS)
-# if G_BYTE_ORDER == G_LITTLE_ENDIAN
-#  define GUM_TEST_SHLIB_ARCH "mipsel"
-# else
-#  define GUM_TEST_SHLIB_ARCH "mips"
-# endif
-#else
-# error Unknown CPU
-#endif
-
 typedef struct _TestInterceptorFixture   TestInterceptorFixture;
 typedef struct _ListenerContext      ListenerContext;
 typedef struct _ListenerContextClass ListenerContextClass;
@@ -98,7 +62,7 @@ struct _TestInterceptorFixture
 {
   GumInterceptor * interceptor;
   GString * result;
-  ListenerContext * listener_context[2];
+  ListenerContext * listener_context[3];
 };
 
 static void listener_context_iface_init (gpointer g_iface,
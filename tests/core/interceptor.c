@@ -24,7 +24,13 @@ TEST_LIST_BEGIN (interceptor)
 
   INTERCEPTOR_TESTENTRY (attach_one)
   INTERCEPTOR_TESTENTRY (attach_two)
+  INTERCEPTOR_TESTENTRY (attach_three)
+  INTERCEPTOR_TESTENTRY (attach_deferred)
+  INTERCEPTOR_TESTENTRY (attach_deferred_activates_after_first_call)
+  INTERCEPTOR_TESTENTRY (transaction_stats)
+  INTERCEPTOR_TESTENTRY (hook_stats)
   INTERCEPTOR_TESTENTRY (attach_to_recursive_function)
+  INTERCEPTOR_TESTENTRY (translate_deep_invocation_stack)
   INTERCEPTOR_TESTENTRY (attach_to_special_function)
 #ifdef G_OS_UNIX
   INTERCEPTOR_TESTENTRY (attach_to_pthread_key_create)
@@ -48,9 +54,13 @@ TEST_LIST_BEGIN (interceptor)
   INTERCEPTOR_TESTENTRY (ignore_current_thread)
   INTERCEPTOR_TESTENTRY (ignore_current_thread_nested)
   INTERCEPTOR_TESTENTRY (ignore_other_threads)
+  INTERCEPTOR_TESTENTRY (listener_thread_set)
+  INTERCEPTOR_TESTENTRY (listener_thread_filter)
   INTERCEPTOR_TESTENTRY (detach)
   INTERCEPTOR_TESTENTRY (listener_ref_count)
   INTERCEPTOR_TESTENTRY (function_data)
+  INTERCEPTOR_TESTENTRY (attach_probe)
+  INTERCEPTOR_TESTENTRY (attach_probe_and_listener)
 
   INTERCEPTOR_TESTENTRY (i_can_has_replaceability)
   INTERCEPTOR_TESTENTRY (already_replaced)
@@ -59,6 +69,10 @@ TEST_LIST_BEGIN (interceptor)
   INTERCEPTOR_TESTENTRY (two_replaced_functions)
 # endif
   INTERCEPTOR_TESTENTRY (replace_function_then_attach_to_it)
+  INTERCEPTOR_TESTENTRY (replace_function_then_attach_and_detach)
+  INTERCEPTOR_TESTENTRY (replace_function_fast)
+  INTERCEPTOR_TESTENTRY (replace_function_fast_has_no_invocation)
+  INTERCEPTOR_TESTENTRY (replace_function_fast_then_revert_while_running)
 
 #ifdef HAVE_QNX
   INTERCEPTOR_TESTENTRY (intercept_malloc_and_create_thread)
@@ -72,8 +86,29 @@ static gpointer thread_calling_pthread_setspecific (gpointer data);
 #ifdef G_OS_WIN32
 static gpointer hit_target_function_repeatedly (gpointer data);
 #endif
+static void count_listener_hits (gpointer user_data,
+    GumInvocationContext * context);
+static gboolean count_thread_filter_calls (GumThreadId thread_id,
+    gpointer user_data);
+static void check_stack_translation (gpointer user_data,
+    GumInvocationContext * context);
+static void count_probe_hits (GumCpuContext * cpu_context,
+    gpointer user_data);
 static gpointer replacement_malloc (gsize size);
 static gpointer replacement_target_function (GString * str);
+static gpointer fast_replacement_target_function (GString * str);
+static gpointer invocation_checking_replacement_target_function (
+    GString * str);
+static gpointer blocking_replacement_target_function (GString * str);
+static gpointer call_target_function (gpointer data);
+
+static gpointer (* target_function_original) (GString * str) = NULL;
+static gboolean fast_replacement_saw_invocation = FALSE;
+
+static GMutex blocking_replacement_mutex;
+static GCond blocking_replacement_cond;
+static gboolean blocking_replacement_entered = FALSE;
+static gboolean blocking_replacement_released = FALSE;
 
 INTERCEPTOR_TESTCASE (attach_one)
 {
@@ -90,6 +125,159 @@ INTERCEPTOR_TESTCASE (attach_two)
   g_assert_cmpstr (fixture->result->str, ==, "ac|bd");
 }
 
+INTERCEPTOR_TESTCASE (attach_three)
+{
+  interceptor_fixture_attach_listener (fixture, 0, target_function, 'a', 'b');
+  interceptor_fixture_attach_listener (fixture, 1, target_function, 'c', 'd');
+  interceptor_fixture_attach_listener (fixture, 2, target_function, 'e', 'f');
+  target_function (fixture->result);
+  g_assert_cmpstr (fixture->result->str, ==, "ace|bdf");
+}
+
+INTERCEPTOR_TESTCASE (attach_deferred)
+{
+  TestCallbackListener * listener;
+  guint hits = 0;
+
+  listener = test_callback_listener_new ();
+  listener->on_enter = count_listener_hits;
+  listener->user_data = &hits;
+
+  g_assert_cmpint (gum_interceptor_attach_listener_deferred (
+      fixture->interceptor, target_nop_function_a,
+      GUM_INVOCATION_LISTENER (listener), NULL), ==, GUM_ATTACH_OK);
+  g_assert_cmpint (gum_interceptor_attach_listener_deferred (
+      fixture->interceptor, target_nop_function_a,
+      GUM_INVOCATION_LISTENER (listener), NULL), ==,
+      GUM_ATTACH_ALREADY_ATTACHED);
+
+  gum_interceptor_activate_deferred (fixture->interceptor);
+  target_nop_function_a (NULL);
+  target_nop_function_b (NULL);
+  g_assert_cmpuint (hits, ==, 1);
+
+  gum_interceptor_detach_listener (fixture->interceptor,
+      GUM_INVOCATION_LISTENER (listener));
+  target_nop_function_a (NULL);
+  g_assert_cmpuint (hits, ==, 1);
+
+  g_assert_cmpint (gum_interceptor_attach_listener_deferred (
+      fixture->interceptor, target_nop_function_b,
+      GUM_INVOCATION_LISTENER (listener), NULL), ==, GUM_ATTACH_OK);
+  gum_interceptor_detach_listener (fixture->interceptor,
+      GUM_INVOCATION_LISTENER (listener));
+  target_nop_function_b (NULL);
+  g_assert_cmpuint (hits, ==, 1);
+
+  g_object_unref (listener);
+}
+
+INTERCEPTOR_TESTCASE (attach_deferred_activates_after_first_call)
+{
+  TestCallbackListener * deferred_listener, * listener;
+  guint deferred_hits = 0, hits = 0;
+
+  deferred_listener = test_callback_listener_new ();
+  deferred_listener->on_enter = count_listener_hits;
+  deferred_listener->user_data = &deferred_hits;
+
+  listener = test_callback_listener_new ();
+  listener->on_enter = count_listener_hits;
+  listener->user_data = &hits;
+
+  g_assert_cmpint (gum_interceptor_attach_listener_deferred (
+      fixture->interceptor, target_nop_function_a,
+      GUM_INVOCATION_LISTENER (deferred_listener), NULL), ==, GUM_ATTACH_OK);
+
+  /* Patches a neighbour, which must not leave the page executable */
+  g_assert_cmpint (gum_interceptor_attach_listener (fixture->interceptor,
+      target_nop_function_b, GUM_INVOCATION_LISTENER (listener), NULL),
+      ==, GUM_ATTACH_OK);
+
+  /* Faults, runs unhooked, and leaves the hook for the next commit */
+  target_nop_function_a (NULL);
+  g_assert_cmpuint (deferred_hits, ==, 0);
+  g_assert (gum_interceptor_flush (fixture->interceptor));
+  target_nop_function_a (NULL);
+  g_assert_cmpuint (deferred_hits, ==, 1);
+
+  target_nop_function_b (NULL);
+  g_assert_cmpuint (hits, ==, 1);
+
+  gum_interceptor_detach_listener (fixture->interceptor,
+      GUM_INVOCATION_LISTENER (listener));
+  gum_interceptor_detach_listener (fixture->interceptor,
+      GUM_INVOCATION_LISTENER (deferred_listener));
+  target_nop_function_a (NULL);
+  g_assert_cmpuint (deferred_hits, ==, 1);
+
+  g_object_unref (listener);
+  g_object_unref (deferred_listener);
+}
+
+INTERCEPTOR_TESTCASE (transaction_stats)
+{
+  GumInterceptorTransactionStats before, after;
+
+  gum_interceptor_get_transaction_stats (fixture->interceptor, &before);
+
+  gum_interceptor_begin_transaction (fixture->interceptor);
+  interceptor_fixture_attach_listener (fixture, 0, target_nop_function_a, 'a',
+      'b');
+  interceptor_fixture_attach_listener (fixture, 1, target_nop_function_b, 'c',
+      'd');
+  gum_interceptor_end_transaction (fixture->interceptor);
+
+  gum_interceptor_get_transaction_stats (fixture->interceptor, &after);
+  g_assert_cmpuint (after.commit_count, ==, before.commit_count + 1);
+  g_assert_cmpuint (after.page_count, >, before.page_count);
+  g_assert_cmpuint (after.range_count - before.range_count, <=,
+      after.page_count - before.page_count);
+  g_assert_cmpuint (after.max_duration, >=, after.last_duration);
+
+  target_nop_function_a (fixture->result);
+  target_nop_function_b (fixture->result);
+  g_assert_cmpstr (fixture->result->str, ==, "abcd");
+}
+
+INTERCEPTOR_TESTCASE (hook_stats)
+{
+  GArray * stats;
+  GumInterceptorHookStats * entry;
+
+  gum_interceptor_reset_stats (fixture->interceptor);
+  gum_interceptor_set_profiling_enabled (fixture->interceptor, TRUE);
+  g_assert (gum_interceptor_get_profiling_enabled (fixture->interceptor));
+
+  interceptor_fixture_attach_listener (fixture, 0, target_nop_function_a, '>',
+      '<');
+  target_nop_function_a (fixture->result);
+  target_nop_function_a (fixture->result);
+  target_nop_function_a (fixture->result);
+  g_assert_cmpstr (fixture->result->str, ==, "><><><");
+
+  stats = gum_interceptor_get_stats (fixture->interceptor);
+  g_assert_cmpuint (stats->len, ==, 1);
+  entry = &g_array_index (stats, GumInterceptorHookStats, 0);
+  g_assert_cmpuint (entry->invocations, ==, 3);
+  g_assert_cmpuint (entry->bypassed_invocations, ==, 0);
+  g_assert_cmpuint (entry->listener_ticks + entry->trampoline_ticks, >, 0);
+  g_array_free (stats, TRUE);
+
+  gum_interceptor_set_profiling_enabled (fixture->interceptor, FALSE);
+  target_nop_function_a (fixture->result);
+
+  stats = gum_interceptor_get_stats (fixture->interceptor);
+  entry = &g_array_index (stats, GumInterceptorHookStats, 0);
+  g_assert_cmpuint (entry->invocations, ==, 3);
+  g_array_free (stats, TRUE);
+
+  gum_interceptor_reset_stats (fixture->interceptor);
+  stats = gum_interceptor_get_stats (fixture->interceptor);
+  g_assert_cmpuint (stats->len, ==, 0);
+  g_array_free (stats, TRUE);
+}
+
 void GUM_NOINLINE
 recursive_function (GString * str,
                     gint count)
@@ -108,6 +296,26 @@ INTERCEPTOR_TESTCASE (attach_to_recursive_function)
   g_assert_cmpstr (fixture->result->str, ==, ">>>>>0<1<2<3<4<");
 }
 
+INTERCEPTOR_TESTCASE (translate_deep_invocation_stack)
+{
+  TestCallbackListener * listener;
+  guint checks = 0;
+
+  listener = test_callback_listener_new ();
+  listener->on_enter = check_stack_translation;
+  listener->user_data = &checks;
+
+  g_assert_cmpint (gum_interceptor_attach_listener (fixture->interceptor,
+      recursive_function, GUM_INVOCATION_LISTENER (listener), NULL), ==,
+      GUM_ATTACH_OK);
+  recursive_function (fixture->result, 11);
+  g_assert_cmpuint (checks, ==, 12);
+
+  gum_interceptor_detach_listener (fixture->interceptor,
+      GUM_INVOCATION_LISTENER (listener));
+  g_object_unref (listener);
+}
+
 INTERCEPTOR_TESTCASE (attach_to_special_function)
 {
   interceptor_fixture_attach_listener (fixture, 0, special_function, '>', '<');
@@ -332,6 +540,50 @@ INTERCEPTOR_TESTCASE (ignore_other_threads)
   g_assert_cmpstr (fixture->result->str, ==, ">|<|>|<");
 }
 
+INTERCEPTOR_TESTCASE (listener_thread_set)
+{
+  GumInvocationListener * listener;
+  GumThreadId other_thread = 0, this_thread;
+
+  interceptor_fixture_attach_listener (fixture, 0, target_function, '>', '<');
+  listener = GUM_INVOCATION_LISTENER (fixture->listener_context[0]);
+
+  gum_interceptor_set_listener_threads (fixture->interceptor, listener,
+      &other_thread, 1);
+  target_function (fixture->result);
+  g_assert_cmpstr (fixture->result->str, ==, "|");
+
+  this_thread = gum_process_get_current_thread_id ();
+  gum_interceptor_set_listener_threads (fixture->interceptor, listener,
+      &this_thread, 1);
+  target_function (fixture->result);
+  g_assert_cmpstr (fixture->result->str, ==, "|>|<");
+
+  gum_interceptor_set_listener_thread_filter (fixture->interceptor, listener,
+      NULL, NULL, NULL);
+  gum_interceptor_set_listener_threads (fixture->interceptor, listener,
+      &other_thread, 1);
+  interceptor_fixture_attach_listener (fixture, 1, target_function, 'a', 'b');
+  target_function (fixture->result);
+  g_assert_cmpstr (fixture->result->str, ==, "|>|<a|b");
+}
+
+INTERCEPTOR_TESTCASE (listener_thread_filter)
+{
+  guint calls = 0;
+
+  interceptor_fixture_attach_listener (fixture, 0, target_function, '>', '<');
+  gum_interceptor_set_listener_thread_filter (fixture->interceptor,
+      GUM_INVOCATION_LISTENER (fixture->listener_context[0]),
+      count_thread_filter_calls, &calls, NULL);
+
+  target_function (fixture->result);
+  target_function (fixture->result);
+  target_function (fixture->result);
+  g_assert_cmpstr (fixture->result->str, ==, ">|<>|<>|<");
+  g_assert_cmpuint (calls, ==, 1);
+}
+
 INTERCEPTOR_TESTCASE (detach)
 {
   interceptor_fixture_attach_listener (fixture, 0, target_function, 'a', 'b');
@@ -434,6 +686,104 @@ INTERCEPTOR_TESTCASE (function_data)
   g_object_unref (fd_listener);
 }
 
+INTERCEPTOR_TESTCASE (attach_probe)
+{
+  guint hits = 0;
+
+  g_assert_cmpint (gum_interceptor_attach_probe (fixture->interceptor,
+      target_function, count_probe_hits, &hits), ==, GUM_ATTACH_OK);
+  g_assert_cmpint (gum_interceptor_attach_probe (fixture->interceptor,
+      target_function, count_probe_hits, &hits), ==,
+      GUM_ATTACH_ALREADY_ATTACHED);
+
+  target_function (fixture->result);
+  target_function (fixture->result);
+  g_assert_cmpuint (hits, ==, 2);
+  g_assert_cmpstr (fixture->result->str, ==, "||");
+
+  gum_interceptor_detach_probe (fixture->interceptor, count_probe_hits, &hits);
+  target_function (fixture->result);
+  g_assert_cmpuint (hits, ==, 2);
+}
+
+INTERCEPTOR_TESTCASE (attach_probe_and_listener)
+{
+  guint hits = 0;
+
+  interceptor_fixture_attach_listener (fixture, 0, target_function, '>', '<');
+  g_assert_cmpint (gum_interceptor_attach_probe (fixture->interceptor,
+      target_function, count_probe_hits, &hits), ==, GUM_ATTACH_OK);
+
+  target_function (fixture->result);
+  g_assert_cmpuint (hits, ==, 1);
+  g_assert_cmpstr (fixture->result->str, ==, ">|<");
+
+  gum_interceptor_detach_probe (fixture->interceptor, count_probe_hits, &hits);
+  target_function (fixture->result);
+  g_assert_cmpuint (hits, ==, 1);
+  g_assert_cmpstr (fixture->result->str, ==, ">|<>|<");
+}
+
+static void
+count_listener_hits (gpointer user_data,
+                     GumInvocationContext * context)
+{
+  guint * hits = user_data;
+
+  (void) context;
+
+  (*hits)++;
+}
+
+static void
+check_stack_translation (gpointer user_data,
+                         GumInvocationContext * context)
+{
+  guint * checks = user_data;
+  GumInvocationStack * stack;
+  gpointer caller;
+  GumReturnAddressArray ret_addrs;
+
+  stack = gum_interceptor_get_current_stack ();
+  caller = gum_invocation_context_get_return_address (context);
+
+  ret_addrs.len = 2;
+  ret_addrs.items[0] = caller;
+  ret_addrs.items[1] = recursive_function;
+  gum_invocation_stack_translate_all (stack, &ret_addrs);
+
+  if (ret_addrs.items[0] == caller &&
+      ret_addrs.items[1] == recursive_function &&
+      gum_invocation_stack_translate (stack, caller) == caller)
+  {
+    (*checks)++;
+  }
+}
+
+static gboolean
+count_thread_filter_calls (GumThreadId thread_id,
+                           gpointer user_data)
+{
+  guint * calls = user_data;
+
+  (void) thread_id;
+
+  (*calls)++;
+
+  return TRUE;
+}
+
+static void
+count_probe_hits (GumCpuContext * cpu_context,
+                  gpointer user_data)
+{
+  guint * hits = user_data;
+
+  (void) cpu_context;
+
+  (*hits)++;
+}
+
 #ifdef HAVE_I386
 
 INTERCEPTOR_TESTCASE (cpu_register_clobber)
@@ -675,6 +1025,24 @@ INTERCEPTOR_TESTCASE (replace_function_then_attach_to_it)
   gum_interceptor_revert_function (fixture->interceptor, target_function);
 }
 
+INTERCEPTOR_TESTCASE (replace_function_then_attach_and_detach)
+{
+  guint target_counter = 0;
+
+  g_assert_cmpint (gum_interceptor_replace_function (fixture->interceptor,
+      target_function, replacement_target_function, &target_counter),
+      ==, GUM_REPLACE_OK);
+  interceptor_fixture_attach_listener (fixture, 0, target_function, '>', '<');
+  interceptor_fixture_detach_listener (fixture, 0);
+  target_function (fixture->result);
+  g_assert_cmpstr (fixture->result->str, ==, "/|\\");
+
+  g_string_truncate (fixture->result, 0);
+  gum_interceptor_revert_function (fixture->interceptor, target_function);
+  target_function (fixture->result);
+  g_assert_cmpstr (fixture->result->str, ==, "|");
+}
+
 static gpointer
 replacement_target_function (GString * str)
 {
@@ -687,6 +1055,138 @@ replacement_target_function (GString * str)
   return result;
 }
 
+INTERCEPTOR_TESTCASE (replace_function_fast)
+{
+  g_assert_cmpint (gum_interceptor_replace_function_fast (fixture->interceptor,
+      target_function, fast_replacement_target_function,
+      (gpointer *) &target_function_original), ==, GUM_REPLACE_OK);
+  g_assert (target_function_original != NULL);
+  g_assert_cmpint (gum_interceptor_replace_function_fast (fixture->interceptor,
+      target_function, fast_replacement_target_function, NULL),
+      ==, GUM_REPLACE_ALREADY_REPLACED);
+
+  target_function (fixture->result);
+  g_assert_cmpstr (fixture->result->str, ==, "/|\\");
+
+  g_assert_cmpint (interceptor_fixture_try_attaching_listener (fixture, 0,
+      target_function, '>', '<'), ==, GUM_ATTACH_WRONG_TYPE);
+
+  g_string_truncate (fixture->result, 0);
+  gum_interceptor_revert_function (fixture->interceptor, target_function);
+  target_function (fixture->result);
+  g_assert_cmpstr (fixture->result->str, ==, "|");
+
+  g_string_truncate (fixture->result, 0);
+  interceptor_fixture_attach_listener (fixture, 0, target_function, '>', '<');
+  g_assert_cmpint (gum_interceptor_replace_function_fast (fixture->interceptor,
+      target_function, fast_replacement_target_function, NULL),
+      ==, GUM_REPLACE_WRONG_TYPE);
+  target_function (fixture->result);
+  g_assert_cmpstr (fixture->result->str, ==, ">|<");
+}
+
+static gpointer
+fast_replacement_target_function (GString * str)
+{
+  gpointer result;
+
+  g_string_append_c (str, '/');
+  result = target_function_original (str);
+  g_string_append_c (str, '\\');
+
+  return result;
+}
+
+INTERCEPTOR_TESTCASE (replace_function_fast_has_no_invocation)
+{
+  g_assert_cmpint (gum_interceptor_replace_function_fast (fixture->interceptor,
+      target_function, invocation_checking_replacement_target_function,
+      (gpointer *) &target_function_original), ==, GUM_REPLACE_OK);
+
+  fast_replacement_saw_invocation = TRUE;
+  target_function (fixture->result);
+  g_assert_cmpstr (fixture->result->str, ==, "|");
+  g_assert (!fast_replacement_saw_invocation);
+
+  gum_interceptor_revert_function (fixture->interceptor, target_function);
+}
+
+static gpointer
+invocation_checking_replacement_target_function (GString * str)
+{
+  fast_replacement_saw_invocation =
+      gum_interceptor_get_current_invocation () != NULL;
+
+  return target_function_original (str);
+}
+
+INTERCEPTOR_TESTCASE (replace_function_fast_then_revert_while_running)
+{
+  GThread * th;
+  GString * str;
+
+  g_assert_cmpint (gum_interceptor_replace_function_fast (fixture->interceptor,
+      target_function, blocking_replacement_target_function,
+      (gpointer *) &target_function_original), ==, GUM_REPLACE_OK);
+
+  blocking_replacement_entered = FALSE;
+  blocking_replacement_released = FALSE;
+
+  str = g_string_new ("");
+  th = g_thread_new ("interceptor-test-fast-revert", call_target_function,
+      str);
+
+  g_mutex_lock (&blocking_replacement_mutex);
+  while (!blocking_replacement_entered)
+    g_cond_wait (&blocking_replacement_cond, &blocking_replacement_mutex);
+  g_mutex_unlock (&blocking_replacement_mutex);
+
+  gum_interceptor_revert_function (fixture->interceptor, target_function);
+
+  /* Give the allocator a chance to reuse the reverted trampoline */
+  interceptor_fixture_attach_listener (fixture, 0, target_function, '>', '<');
+  interceptor_fixture_detach_listener (fixture, 0);
+
+  g_mutex_lock (&blocking_replacement_mutex);
+  blocking_replacement_released = TRUE;
+  g_cond_signal (&blocking_replacement_cond);
+  g_mutex_unlock (&blocking_replacement_mutex);
+
+  g_thread_join (th);
+
+  g_assert_cmpstr (str->str, ==, "/|\\");
+  g_string_free (str, TRUE);
+
+  target_function (fixture->result);
+  g_assert_cmpstr (fixture->result->str, ==, "|");
+}
+
+static gpointer
+blocking_replacement_target_function (GString * str)
+{
+  gpointer result;
+
+  g_string_append_c (str, '/');
+
+  g_mutex_lock (&blocking_replacement_mutex);
+  blocking_replacement_entered = TRUE;
+  g_cond_signal (&blocking_replacement_cond);
+  while (!blocking_replacement_released)
+    g_cond_wait (&blocking_replacement_cond, &blocking_replacement_mutex);
+  g_mutex_unlock (&blocking_replacement_mutex);
+
+  result = target_function_original (str);
+  g_string_append_c (str, '\\');
+
+  return result;
+}
+
+static gpointer
+call_target_function (gpointer data)
+{
+  return target_function ((GString *) data);
+}
+
 INTERCEPTOR_TESTCASE (i_can_has_replaceability)
 {
   UnsupportedFunction * unsupported_functions;
@@ -24,11 +24,18 @@ TEST_LIST_BEGIN (memory)
   MEMORY_TESTENTRY (match_pattern_from_string_does_proper_validation)
   MEMORY_TESTENTRY (scan_range_finds_three_exact_matches)
   MEMORY_TESTENTRY (scan_range_finds_three_wildcarded_matches)
+  MEMORY_TESTENTRY (scan_range_skips_overlaps_with_wildcard_before_needle)
   MEMORY_TESTENTRY (scan_range_finds_three_masked_matches)
+  MEMORY_TESTENTRY (scan_range_finds_matches_spread_across_large_range)
+  MEMORY_TESTENTRY (scan_range_finds_matches_of_multiple_patterns)
+  MEMORY_TESTENTRY (scan_ranges_reports_matches_in_address_order)
+  MEMORY_TESTENTRY (scan_ranges_matches_serial_scan_across_chunk_boundary)
   MEMORY_TESTENTRY (is_memory_readable_handles_mixed_page_protections)
   MEMORY_TESTENTRY (alloc_n_pages_returns_aligned_rw_address)
   MEMORY_TESTENTRY (alloc_n_pages_near_returns_aligned_rw_address_within_range)
   MEMORY_TESTENTRY (mprotect_handles_page_boundaries)
+  MEMORY_TESTENTRY (memory_map_contains_only_ranges_with_protection)
+  MEMORY_TESTENTRY (memory_map_update_if_stale_skips_unchanged_modules)
 TEST_LIST_END ()
 
 typedef struct _TestForEachContext {
@@ -39,8 +46,29 @@ typedef struct _TestForEachContext {
   guint expected_size;
 } TestForEachContext;
 
+typedef struct _TestMultiScanContext {
+  guint number_of_calls;
+  GumAddress addresses[4];
+  guint pattern_indices[4];
+} TestMultiScanContext;
+
+typedef struct _TestScanRangesContext {
+  guint number_of_calls;
+  GumAddress addresses[4];
+  gsize bytes_scanned;
+  gsize bytes_total;
+} TestScanRangesContext;
+
 static gboolean match_found_cb (GumAddress address, gsize size,
     gpointer user_data);
+static gboolean multi_match_found_cb (GumAddress address, gsize size,
+    guint pattern_index, gpointer user_data);
+static gboolean ranges_match_found_cb (GumAddress address, gsize size,
+    gpointer user_data);
+static gboolean collect_match_cb (GumAddress address, gsize size,
+    gpointer user_data);
+static void scan_progress_cb (gsize bytes_scanned, gsize bytes_total,
+    gpointer user_data);
 
 MEMORY_TESTCASE (read_from_valid_address_should_succeed)
 {
@@ -344,6 +372,39 @@ MEMORY_TESTCASE (scan_range_finds_three_wildcarded_matches)
   gum_match_pattern_free (pattern);
 }
 
+MEMORY_TESTCASE (scan_range_skips_overlaps_with_wildcard_before_needle)
+{
+  guint8 buf[] = {
+    0x13, 0x00, 0x13, 0x37,
+    0x13, 0x37, 0x13, 0x37,
+    0x13, 0x37, 0x13, 0x37
+  };
+  GumMemoryRange range;
+  GumMatchPattern * pattern;
+  TestForEachContext ctx;
+
+  range.base_address = GUM_ADDRESS (buf);
+  range.size = sizeof (buf);
+
+  /* The needle is "13 37", two bytes into the pattern */
+  pattern = gum_match_pattern_new_from_string ("13 ?? 13 37");
+  g_assert (pattern != NULL);
+
+  ctx.number_of_calls = 0;
+  ctx.value_to_return = TRUE;
+
+  ctx.expected_address[0] = buf + 0;
+  ctx.expected_address[1] = buf + 4;
+  ctx.expected_address[2] = buf + 8;
+  ctx.expected_size = 4;
+
+  gum_memory_scan (&range, pattern, match_found_cb, &ctx);
+
+  g_assert_cmpuint (ctx.number_of_calls, ==, 3);
+
+  gum_match_pattern_free (pattern);
+}
+
 MEMORY_TESTCASE (scan_range_finds_three_masked_matches)
 {
   guint8 buf[] = {
@@ -377,6 +438,163 @@ MEMORY_TESTCASE (scan_range_finds_three_masked_matches)
   gum_match_pattern_free (pattern);
 }
 
+MEMORY_TESTCASE (scan_range_finds_matches_spread_across_large_range)
+{
+  guint8 buf[300];
+  GumMemoryRange range;
+  GumMatchPattern * pattern;
+  TestForEachContext ctx;
+
+  memset (buf, 0x13, sizeof (buf));
+  buf[37] = 0x37;
+  buf[38] = 0xca;
+  buf[40] = 0xfe;
+  buf[161] = 0x37;
+  buf[162] = 0xca;
+  buf[164] = 0xfe;
+  buf[295] = 0x37;
+  buf[296] = 0xca;
+  buf[298] = 0xfe;
+
+  range.base_address = GUM_ADDRESS (buf);
+  range.size = sizeof (buf);
+
+  pattern = gum_match_pattern_new_from_string ("13 37 ca ?? fe");
+  g_assert (pattern != NULL);
+
+  ctx.expected_address[0] = buf + 36;
+  ctx.expected_address[1] = buf + 160;
+  ctx.expected_address[2] = buf + 294;
+  ctx.expected_size = 5;
+
+  ctx.number_of_calls = 0;
+  ctx.value_to_return = TRUE;
+  gum_memory_scan (&range, pattern, match_found_cb, &ctx);
+  g_assert_cmpuint (ctx.number_of_calls, ==, 3);
+
+  gum_match_pattern_free (pattern);
+}
+
+MEMORY_TESTCASE (scan_range_finds_matches_of_multiple_patterns)
+{
+  guint8 buf[] = {
+    0x12, 0x13, 0x37, 0x00,
+    0xca, 0xfe, 0xba, 0xbe,
+    0x13, 0x37, 0x01, 0x02,
+    0x52, 0x00, 0xba, 0xbe
+  };
+  GumMemoryRange range;
+  GumMatchPattern * patterns[2];
+  TestMultiScanContext ctx;
+
+  range.base_address = GUM_ADDRESS (buf);
+  range.size = sizeof (buf);
+
+  patterns[0] = gum_match_pattern_new_from_string ("13 37");
+  patterns[1] = gum_match_pattern_new_from_string ("12 ?? ba be : 1f 00 ff ff");
+  g_assert (patterns[0] != NULL && patterns[1] != NULL);
+
+  ctx.number_of_calls = 0;
+  gum_memory_scan_multi (&range, (const GumMatchPattern * const *) patterns,
+      G_N_ELEMENTS (patterns), multi_match_found_cb, &ctx);
+
+  g_assert_cmpuint (ctx.number_of_calls, ==, 3);
+  g_assert (ctx.addresses[0] == GUM_ADDRESS (buf + 1));
+  g_assert_cmpuint (ctx.pattern_indices[0], ==, 0);
+  g_assert (ctx.addresses[1] == GUM_ADDRESS (buf + 8));
+  g_assert_cmpuint (ctx.pattern_indices[1], ==, 0);
+  g_assert (ctx.addresses[2] == GUM_ADDRESS (buf + 12));
+  g_assert_cmpuint (ctx.pattern_indices[2], ==, 1);
+
+  gum_match_pattern_free (patterns[1]);
+  gum_match_pattern_free (patterns[0]);
+}
+
+MEMORY_TESTCASE (scan_ranges_reports_matches_in_address_order)
+{
+  const gsize mb = 1024 * 1024;
+  const guint8 needle[] = { 0x13, 0x37, 0xc0 };
+  guint8 * buf;
+  GumMemoryRange ranges[2];
+  GumMatchPattern * pattern;
+  TestScanRangesContext ctx;
+  GError * error = NULL;
+
+  buf = (guint8 *) g_malloc0 (9 * mb);
+  memcpy (buf + 100, needle, sizeof (needle));
+  memcpy (buf + 4 * mb - 2, needle, sizeof (needle));
+  memcpy (buf + 6 * mb, needle, sizeof (needle));
+
+  ranges[0].base_address = GUM_ADDRESS (buf + 5 * mb);
+  ranges[0].size = 4 * mb;
+  ranges[1].base_address = GUM_ADDRESS (buf);
+  ranges[1].size = 5 * mb;
+
+  pattern = gum_match_pattern_new_from_string ("13 37 c0");
+
+  ctx.number_of_calls = 0;
+  ctx.bytes_scanned = 0;
+  ctx.bytes_total = 0;
+  g_assert (gum_memory_scan_ranges (ranges, G_N_ELEMENTS (ranges), pattern,
+      ranges_match_found_cb, scan_progress_cb, &ctx, &error));
+  g_assert_no_error (error);
+
+  g_assert_cmpuint (ctx.number_of_calls, ==, 3);
+  g_assert (ctx.addresses[0] == GUM_ADDRESS (buf + 100));
+  g_assert (ctx.addresses[1] == GUM_ADDRESS (buf + 4 * mb - 2));
+  g_assert (ctx.addresses[2] == GUM_ADDRESS (buf + 6 * mb));
+  g_assert_cmpuint (ctx.bytes_total, !=, 0);
+  g_assert_cmpuint (ctx.bytes_scanned, ==, ctx.bytes_total);
+
+  gum_match_pattern_free (pattern);
+  g_free (buf);
+}
+
+MEMORY_TESTCASE (scan_ranges_matches_serial_scan_across_chunk_boundary)
+{
+  const gsize mb = 1024 * 1024;
+  guint8 * buf, * boundary;
+  GumMemoryRange range;
+  GumMatchPattern * pattern;
+  GArray * serial, * parallel;
+  GError * error = NULL;
+  guint i;
+
+  /* Ranges are split into 4 MB chunks, so the boundary sits right here */
+  buf = (guint8 *) g_malloc0 (8 * mb);
+  boundary = buf + 4 * mb;
+  memset (boundary - 3, 0xaa, 8);
+
+  range.base_address = GUM_ADDRESS (buf);
+  range.size = 8 * mb;
+
+  pattern = gum_match_pattern_new_from_string ("aa aa");
+
+  serial = g_array_new (FALSE, FALSE, sizeof (GumAddress));
+  gum_memory_scan (&range, pattern, collect_match_cb, serial);
+
+  parallel = g_array_new (FALSE, FALSE, sizeof (GumAddress));
+  g_assert (gum_memory_scan_ranges (&range, 1, pattern, collect_match_cb,
+      NULL, parallel, &error));
+  g_assert_no_error (error);
+
+  g_assert_cmpuint (serial->len, ==, 4);
+  g_assert (g_array_index (serial, GumAddress, 2) ==
+      GUM_ADDRESS (boundary + 1));
+
+  g_assert_cmpuint (parallel->len, ==, serial->len);
+  for (i = 0; i != serial->len; i++)
+  {
+    g_assert_cmphex (g_array_index (parallel, GumAddress, i), ==,
+        g_array_index (serial, GumAddress, i));
+  }
+
+  g_array_free (parallel, TRUE);
+  g_array_free (serial, TRUE);
+  gum_match_pattern_free (pattern);
+  g_free (buf);
+}
+
 MEMORY_TESTCASE (is_memory_readable_handles_mixed_page_protections)
 {
   guint8 * pages;
@@ -477,6 +695,64 @@ MEMORY_TESTCASE (mprotect_handles_page_boundaries)
   gum_free_pages (pages);
 }
 
+MEMORY_TESTCASE (memory_map_contains_only_ranges_with_protection)
+{
+  guint8 * pages;
+  guint page_size;
+  GumMemoryMap * map;
+  GumMemoryRange range;
+
+  pages = gum_alloc_n_pages (3, GUM_PAGE_RW);
+  page_size = gum_query_page_size ();
+
+  gum_mprotect (pages + page_size, page_size, GUM_PAGE_NO_ACCESS);
+
+  map = gum_memory_map_new (GUM_PAGE_RW);
+
+  range.base_address = GUM_ADDRESS (pages);
+  range.size = page_size;
+  g_assert (gum_memory_map_contains (map, &range));
+
+  range.base_address = GUM_ADDRESS (pages + page_size);
+  g_assert (!gum_memory_map_contains (map, &range));
+
+  range.base_address = GUM_ADDRESS (pages + (2 * page_size));
+  g_assert (gum_memory_map_contains (map, &range));
+
+  range.base_address = GUM_ADDRESS (pages);
+  range.size = 3 * page_size;
+  g_assert (!gum_memory_map_contains (map, &range));
+
+  gum_mprotect (pages + page_size, page_size, GUM_PAGE_RW);
+  gum_memory_map_update (map);
+  g_assert (gum_memory_map_contains (map, &range));
+
+  g_object_unref (map);
+  gum_free_pages (pages);
+}
+
+MEMORY_TESTCASE (memory_map_update_if_stale_skips_unchanged_modules)
+{
+  GumMemoryMap * map;
+  guint8 * pages;
+  GumMemoryRange range;
+
+  map = gum_memory_map_new (GUM_PAGE_RW);
+
+  pages = gum_alloc_n_pages (1, GUM_PAGE_RW);
+  range.base_address = GUM_ADDRESS (pages);
+  range.size = gum_query_page_size ();
+
+  g_assert (!gum_memory_map_update_if_stale (map));
+  g_assert (!gum_memory_map_contains (map, &range));
+
+  gum_memory_map_update (map);
+  g_assert (gum_memory_map_contains (map, &range));
+
+  g_object_unref (map);
+  gum_free_pages (pages);
+}
+
 static gboolean
 match_found_cb (GumAddress address,
                 gsize size,
@@ -494,3 +770,60 @@ match_found_cb (GumAddress address,
 
   return ctx->value_to_return;
 }
+
+static gboolean
+multi_match_found_cb (GumAddress address,
+                      gsize size,
+                      guint pattern_index,
+                      gpointer user_data)
+{
+  TestMultiScanContext * ctx = (TestMultiScanContext *) user_data;
+
+  g_assert_cmpuint (ctx->number_of_calls, <, G_N_ELEMENTS (ctx->addresses));
+
+  ctx->addresses[ctx->number_of_calls] = address;
+  ctx->pattern_indices[ctx->number_of_calls] = pattern_index;
+  ctx->number_of_calls++;
+
+  return TRUE;
+}
+
+static gboolean
+ranges_match_found_cb (GumAddress address,
+                       gsize size,
+                       gpointer user_data)
+{
+  TestScanRangesContext * ctx = (TestScanRangesContext *) user_data;
+
+  g_assert_cmpuint (ctx->number_of_calls, <, G_N_ELEMENTS (ctx->addresses));
+  g_assert_cmpuint (size, ==, 3);
+
+  ctx->addresses[ctx->number_of_calls++] = address;
+
+  return TRUE;
+}
+
+static gboolean
+collect_match_cb (GumAddress address,
+                  gsize size,
+                  gpointer user_data)
+{
+  GArray * matches = (GArray *) user_data;
+
+  g_array_append_val (matches, address);
+
+  return TRUE;
+}
+
+static void
+scan_progress_cb (gsize bytes_scanned,
+                  gsize bytes_total,
+                  gpointer user_data)
+{
+  TestScanRangesContext * ctx = (TestScanRangesContext *) user_data;
+
+  g_assert_cmpuint (bytes_scanned, >=, ctx->bytes_scanned);
+
+  ctx->bytes_scanned = bytes_scanned;
+  ctx->bytes_total = bytes_total;
+}
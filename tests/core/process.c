@@ -8,6 +8,8 @@
 
 #include "testutil.h"
 
+#include "gumprocess-priv.h"
+
 #include "valgrind.h"
 
 #ifndef G_OS_WIN32
@@ -27,6 +29,7 @@
 TEST_LIST_BEGIN (process)
   PROCESS_TESTENTRY (process_threads)
   PROCESS_TESTENTRY (process_threads_exclude_cloaked)
+  PROCESS_TESTENTRY (process_threads_without_cpu_context)
   PROCESS_TESTENTRY (process_modules)
   PROCESS_TESTENTRY (process_ranges)
   PROCESS_TESTENTRY (process_ranges_exclude_cloaked)
@@ -53,6 +56,9 @@ TEST_LIST_BEGIN (process)
 #endif
 #ifdef HAVE_LINUX
   PROCESS_TESTENTRY (linux_process_modules)
+  PROCESS_TESTENTRY (linux_module_export_matches_default_version)
+  PROCESS_TESTENTRY (linux_module_map_update_tracks_loads_and_unloads)
+  PROCESS_TESTENTRY (linux_thread_pcs_can_be_sampled)
 #endif
 TEST_LIST_END ()
 
@@ -60,6 +66,10 @@ typedef struct _TestForEachContext TestForEachContext;
 typedef struct _TestThreadContext TestThreadContext;
 typedef struct _TestRangeContext TestRangeContext;
 typedef struct _TestThreadSyncData TestThreadSyncData;
+#ifdef HAVE_LINUX
+typedef struct _TestParkedThread TestParkedThread;
+typedef struct _TestThreadLookup TestThreadLookup;
+#endif
 
 struct _TestForEachContext
 {
@@ -88,6 +98,26 @@ struct _TestThreadSyncData
   volatile gboolean * volatile done;
 };
 
+#ifdef HAVE_LINUX
+
+struct _TestParkedThread
+{
+  GMutex mutex;
+  GCond cond;
+  GumThreadId id;
+  gboolean started;
+  gboolean done;
+};
+
+struct _TestThreadLookup
+{
+  GumThreadId needle;
+  gboolean found;
+  GumThreadDetails details;
+};
+
+#endif
+
 #ifndef G_OS_WIN32
 static gboolean store_export_address_if_tricky_module_export (
     const GumExportDetails * details, gpointer user_data);
@@ -102,6 +132,18 @@ static gboolean store_export_address_if_mach_msg (
 
 static GThread * create_sleeping_dummy_thread_sync (volatile gboolean * done);
 static gpointer sleeping_dummy (gpointer data);
+static gboolean thread_count_cb (const GumThreadDetails * details,
+    gpointer user_data);
+#ifdef HAVE_LINUX
+static GThread * create_parked_dummy_thread (TestParkedThread * parked);
+static void release_parked_dummy_thread (TestParkedThread * parked,
+    GThread * thread);
+static gpointer parked_dummy (gpointer data);
+static gboolean thread_lookup_cb (const GumThreadDetails * details,
+    gpointer user_data);
+static void store_cpu_context (GumThreadId thread_id,
+    GumCpuContext * cpu_context, gpointer user_data);
+#endif
 static gboolean thread_found_cb (const GumThreadDetails * details,
     gpointer user_data);
 static gboolean thread_check_cb (const GumThreadDetails * details,
@@ -197,6 +239,69 @@ PROCESS_TESTCASE (process_threads_exclude_cloaked)
   gum_cloak_remove_thread (ctx.needle);
 }
 
+PROCESS_TESTCASE (process_threads_without_cpu_context)
+{
+  TestThreadContext ctx;
+  guint n_without_context, n_with_context;
+#ifdef HAVE_LINUX
+  TestParkedThread parked;
+  GThread * thread;
+  TestThreadLookup lookup;
+  GumCpuContext single;
+#endif
+
+#if defined (HAVE_ANDROID) || defined (HAVE_MIPS)
+  if (!g_test_slow ())
+  {
+    g_print ("<skipping, run in slow mode> ");
+    return;
+  }
+#endif
+
+  if (RUNNING_ON_VALGRIND)
+  {
+    g_print ("<skipping, not compatible with Valgrind> ");
+    return;
+  }
+
+  ctx.needle = gum_process_get_current_thread_id ();
+  ctx.found = FALSE;
+  gum_process_enumerate_threads_full (GUM_THREAD_FLAGS_NONE, thread_check_cb,
+      &ctx);
+  g_assert (ctx.found);
+
+  n_without_context = 0;
+  gum_process_enumerate_threads_full (GUM_THREAD_FLAGS_NONE, thread_count_cb,
+      &n_without_context);
+  n_with_context = 0;
+  gum_process_enumerate_threads_full (GUM_THREAD_FLAGS_CPU_CONTEXT,
+      thread_count_cb, &n_with_context);
+  g_assert_cmpuint (n_with_context, ==, n_without_context);
+
+#ifdef HAVE_LINUX
+  thread = create_parked_dummy_thread (&parked);
+
+  lookup.needle = parked.id;
+  lookup.found = FALSE;
+  gum_process_enumerate_threads_full (GUM_THREAD_FLAGS_CPU_CONTEXT,
+      thread_lookup_cb, &lookup);
+  g_assert (lookup.found);
+
+  g_assert (gum_process_modify_thread (parked.id, store_cpu_context, &single));
+#if defined (HAVE_I386)
+  g_assert_cmphex (GUM_CPU_CONTEXT_XIP (&lookup.details.cpu_context), ==,
+      GUM_CPU_CONTEXT_XIP (&single));
+  g_assert_cmphex (GUM_CPU_CONTEXT_XSP (&lookup.details.cpu_context), ==,
+      GUM_CPU_CONTEXT_XSP (&single));
+#else
+  g_assert_cmphex (lookup.details.cpu_context.pc, ==, single.pc);
+  g_assert_cmphex (lookup.details.cpu_context.sp, ==, single.sp);
+#endif
+
+  release_parked_dummy_thread (&parked, thread);
+#endif
+}
+
 PROCESS_TESTCASE (process_modules)
 {
   TestForEachContext ctx;
@@ -251,6 +356,97 @@ PROCESS_TESTCASE (linux_process_modules)
   dlclose (lib);
 }
 
+PROCESS_TESTCASE (linux_module_export_matches_default_version)
+{
+  const gchar * names[] = { "realpath", "fopen" };
+  guint i;
+
+  for (i = 0; i != G_N_ELEMENTS (names); i++)
+  {
+    const gchar * name = names[i];
+    void * system_address;
+
+    system_address = dlsym (RTLD_DEFAULT, name);
+    if (system_address == NULL)
+      continue;
+
+    g_assert_cmphex (gum_module_find_export_by_name (SYSTEM_MODULE_NAME, name),
+        ==, GPOINTER_TO_SIZE (system_address));
+  }
+}
+
+PROCESS_TESTCASE (linux_module_map_update_tracks_loads_and_unloads)
+{
+  GumModuleMap * map;
+  const GumModuleDetails * details;
+  const gchar * own_path;
+  gchar * testdir, * filename;
+  void * lib;
+  GumAddress own_address, special_function;
+
+  own_address = GUM_ADDRESS (
+      test_process_linux_module_map_update_tracks_loads_and_unloads);
+
+  map = gum_module_map_new ();
+
+  details = gum_module_map_find (map, own_address);
+  g_assert (details != NULL);
+  own_path = details->path;
+
+  testdir = test_util_get_data_dir ();
+  filename = g_build_filename (testdir,
+      "specialfunctions-" GUM_TEST_SHLIB_OS "-" GUM_TEST_SHLIB_ARCH ".so",
+      NULL);
+  lib = dlopen (filename, RTLD_NOW | RTLD_LOCAL);
+  g_assert (lib != NULL);
+  g_free (filename);
+  g_free (testdir);
+
+  special_function = GUM_ADDRESS (dlsym (lib, "gum_test_special_function"));
+  g_assert (special_function != 0);
+  g_assert (gum_module_map_find (map, special_function) == NULL);
+
+  gum_module_map_update (map);
+
+  details = gum_module_map_find (map, special_function);
+  g_assert (details != NULL);
+  g_assert (g_str_has_prefix (details->name, "specialfunctions-"));
+
+  details = gum_module_map_find (map, own_address);
+  g_assert (details != NULL);
+  g_assert (details->path == own_path);
+
+  dlclose (lib);
+
+  gum_module_map_update (map);
+
+  g_assert (gum_module_map_find (map, special_function) == NULL);
+
+  details = gum_module_map_find (map, own_address);
+  g_assert (details != NULL);
+  g_assert (details->path == own_path);
+
+  g_object_unref (map);
+}
+
+PROCESS_TESTCASE (linux_thread_pcs_can_be_sampled)
+{
+  volatile gboolean done = FALSE;
+  GThread * thread;
+  GArray * pcs;
+
+  thread = create_sleeping_dummy_thread_sync (&done);
+
+  pcs = g_array_new (FALSE, FALSE, sizeof (gsize));
+  g_assert (_gum_process_sample_thread_pcs (pcs));
+  g_assert_cmpuint (pcs->len, >=, 1);
+  g_assert_cmphex (g_array_index (pcs, gsize, 0), !=, 0);
+  g_array_free (pcs, TRUE);
+
+  done = TRUE;
+  g_thread_join (thread);
+}
+
 static gboolean
 find_module_bounds (const GumRangeDetails * details,
                     gpointer user_data)
@@ -768,6 +964,118 @@ sleeping_dummy (gpointer data)
   return NULL;
 }
 
+static gboolean
+thread_count_cb (const GumThreadDetails * details,
+                 gpointer user_data)
+{
+  guint * count = user_data;
+
+  (*count)++;
+
+  return TRUE;
+}
+
+#ifdef HAVE_LINUX
+
+/*
+ * Parks a thread in the kernel, so that its program counter and stack
+ * pointer stay put for as long as it is not released.
+ */
+static GThread *
+create_parked_dummy_thread (TestParkedThread * parked)
+{
+  GThread * thread;
+  TestThreadLookup lookup;
+
+  g_mutex_init (&parked->mutex);
+  g_cond_init (&parked->cond);
+  parked->id = 0;
+  parked->started = FALSE;
+  parked->done = FALSE;
+
+  g_mutex_lock (&parked->mutex);
+
+  thread = g_thread_new ("process-test-parked-dummy", parked_dummy, parked);
+
+  while (!parked->started)
+    g_cond_wait (&parked->cond, &parked->mutex);
+
+  g_mutex_unlock (&parked->mutex);
+
+  lookup.needle = parked->id;
+  do
+  {
+    g_thread_yield ();
+
+    lookup.found = FALSE;
+    gum_process_enumerate_threads_full (GUM_THREAD_FLAGS_NONE,
+        thread_lookup_cb, &lookup);
+    g_assert (lookup.found);
+  }
+  while (lookup.details.state != GUM_THREAD_WAITING);
+
+  return thread;
+}
+
+static void
+release_parked_dummy_thread (TestParkedThread * parked,
+                             GThread * thread)
+{
+  g_mutex_lock (&parked->mutex);
+  parked->done = TRUE;
+  g_cond_signal (&parked->cond);
+  g_mutex_unlock (&parked->mutex);
+
+  g_thread_join (thread);
+
+  g_cond_clear (&parked->cond);
+  g_mutex_clear (&parked->mutex);
+}
+
+static gpointer
+parked_dummy (gpointer data)
+{
+  TestParkedThread * parked = data;
+
+  g_mutex_lock (&parked->mutex);
+
+  parked->id = gum_process_get_current_thread_id ();
+  parked->started = TRUE;
+  g_cond_signal (&parked->cond);
+
+  while (!parked->done)
+    g_cond_wait (&parked->cond, &parked->mutex);
+
+  g_mutex_unlock (&parked->mutex);
+
+  return NULL;
+}
+
+static gboolean
+thread_lookup_cb (const GumThreadDetails * details,
+                  gpointer user_data)
+{
+  TestThreadLookup * lookup = user_data;
+
+  if (details->id != lookup->needle)
+    return TRUE;
+
+  lookup->details = *details;
+  lookup->found = TRUE;
+
+  return FALSE;
+}
+
+static void
+store_cpu_context (GumThreadId thread_id,
+                   GumCpuContext * cpu_context,
+                   gpointer user_data)
+{
+  memcpy (user_data, cpu_context, sizeof (GumCpuContext));
+}
+
+#endif
+
 static gboolean
 thread_found_cb (const GumThreadDetails * details,
                  gpointer user_data)
@@ -7,6 +7,12 @@
 
 #include "testutil.h"
 
+#include <stdlib.h>
+#include <string.h>
+#ifdef HAVE_LINUX
+# include <dlfcn.h>
+#endif
+
 #define SYMUTIL_TESTCASE(NAME) \
     void test_symbolutil_ ## NAME (void)
 #define SYMUTIL_TESTENTRY(NAME) \
@@ -14,16 +20,38 @@
 
 TEST_LIST_BEGIN (symbolutil)
   SYMUTIL_TESTENTRY (symbol_details_from_address)
+  SYMUTIL_TESTENTRY (symbol_details_from_addresses)
   SYMUTIL_TESTENTRY (symbol_name_from_address)
   SYMUTIL_TESTENTRY (find_external_public_function)
   SYMUTIL_TESTENTRY (find_local_static_function)
   SYMUTIL_TESTENTRY (find_functions_named)
   SYMUTIL_TESTENTRY (find_functions_matching)
+#ifdef HAVE_LINUX
+  SYMUTIL_TESTENTRY (symbol_details_without_dwarf_use_symbol_table)
+  SYMUTIL_TESTENTRY (symbol_details_of_aliases_are_deterministic)
+#endif
 TEST_LIST_END ()
 
+#ifdef HAVE_LINUX
+
+typedef struct _TestAliasContext TestAliasContext;
+
+struct _TestAliasContext
+{
+  GHashTable * names_by_address;
+  GumAddress address;
+};
+
+#endif
+
 static void GUM_CDECL gum_dummy_function_0 (void);
 static void GUM_STDCALL gum_dummy_function_1 (void);
 
+#ifdef HAVE_LINUX
+static gboolean find_aliased_export (const GumExportDetails * details,
+    gpointer user_data);
+#endif
+
 SYMUTIL_TESTCASE (symbol_details_from_address)
 {
   GumDebugSymbolDetails details;
@@ -39,6 +67,36 @@ SYMUTIL_TESTCASE (symbol_details_from_address)
 #endif
 }
 
+SYMUTIL_TESTCASE (symbol_details_from_addresses)
+{
+  const gpointer addresses[] = {
+    gum_dummy_function_0,
+    gum_dummy_function_1,
+    malloc,
+    gum_dummy_function_0,
+    free,
+  };
+  GumDebugSymbolDetails details[G_N_ELEMENTS (addresses)];
+  guint i;
+
+  g_assert_cmpuint (gum_symbol_details_from_addresses (addresses,
+      G_N_ELEMENTS (addresses), details), ==, G_N_ELEMENTS (addresses));
+
+  for (i = 0; i != G_N_ELEMENTS (addresses); i++)
+  {
+    GumDebugSymbolDetails single;
+
+    g_assert (gum_symbol_details_from_address (addresses[i], &single));
+    g_assert_cmphex (details[i].address, ==, single.address);
+    g_assert_cmpstr (details[i].module_name, ==, single.module_name);
+    g_assert_cmpstr (details[i].symbol_name, ==, single.symbol_name);
+    g_assert_cmpstr (details[i].file_name, ==, single.file_name);
+    g_assert_cmpuint (details[i].line_number, ==, single.line_number);
+  }
+
+  g_assert_cmpstr (details[1].symbol_name, ==, "gum_dummy_function_1");
+}
+
 SYMUTIL_TESTCASE (symbol_name_from_address)
 {
   gchar * symbol_name;
@@ -97,6 +155,102 @@ SYMUTIL_TESTCASE (find_functions_matching)
   g_array_free (functions, TRUE);
 }
 
+#ifdef HAVE_LINUX
+
+SYMUTIL_TESTCASE (symbol_details_without_dwarf_use_symbol_table)
+{
+  gchar * testdir, * filename;
+  void * lib;
+  guint8 * nop_a, * nop_b;
+  gpointer addresses[3];
+  GumDebugSymbolDetails details[G_N_ELEMENTS (addresses)];
+  guint i;
+
+  testdir = test_util_get_data_dir ();
+  filename = g_build_filename (testdir,
+      "targetfunctions-" GUM_TEST_SHLIB_OS "-" GUM_TEST_SHLIB_ARCH ".so",
+      NULL);
+  lib = dlopen (filename, RTLD_NOW | RTLD_GLOBAL);
+  g_assert (lib != NULL);
+  g_free (filename);
+  g_free (testdir);
+
+  nop_a = dlsym (lib, "gum_test_target_nop_function_a");
+  nop_b = dlsym (lib, "gum_test_target_nop_function_b");
+  g_assert (nop_a != NULL && nop_b != NULL);
+
+  addresses[0] = nop_b;
+  addresses[1] = nop_a + 4;
+  addresses[2] = nop_a;
+  g_assert_cmpuint (gum_symbol_details_from_addresses (
+      (const gpointer *) addresses, G_N_ELEMENTS (addresses), details), ==,
+      G_N_ELEMENTS (addresses));
+
+  g_assert_cmpstr (details[0].symbol_name, ==,
+      "gum_test_target_nop_function_b");
+  g_assert_cmpstr (details[1].symbol_name, ==,
+      "gum_test_target_nop_function_a+0x4");
+  g_assert_cmpstr (details[2].symbol_name, ==,
+      "gum_test_target_nop_function_a");
+
+  for (i = 0; i != G_N_ELEMENTS (addresses); i++)
+  {
+    GumDebugSymbolDetails single;
+
+    g_assert (g_str_has_prefix (details[i].module_name, "targetfunctions-"));
+    g_assert_cmpstr (details[i].file_name, ==, "");
+    g_assert_cmpuint (details[i].line_number, ==, 0);
+
+    g_assert (gum_symbol_details_from_address (addresses[i], &single));
+    g_assert_cmpstr (details[i].symbol_name, ==, single.symbol_name);
+  }
+}
+
+SYMUTIL_TESTCASE (symbol_details_of_aliases_are_deterministic)
+{
+  TestAliasContext ctx;
+  GPtrArray * names;
+  GumDebugSymbolDetails single, batch;
+  gpointer address;
+  guint i;
+
+  ctx.names_by_address = g_hash_table_new_full (NULL, NULL, NULL,
+      (GDestroyNotify) g_ptr_array_unref);
+  ctx.address = 0;
+
+  gum_module_enumerate_exports (SYSTEM_MODULE_NAME, find_aliased_export,
+      &ctx);
+  if (ctx.address == 0)
+  {
+    g_hash_table_unref (ctx.names_by_address);
+    g_print ("<skipping, no aliased exports> ");
+    return;
+  }
+
+  address = GSIZE_TO_POINTER (ctx.address);
+  names = g_hash_table_lookup (ctx.names_by_address, address);
+
+  for (i = 0; i != 3; i++)
+  {
+    g_assert (gum_symbol_details_from_address (address, &single));
+    g_assert_cmpuint (gum_symbol_details_from_addresses (
+        (const gpointer *) &address, 1, &batch), ==, 1);
+
+    g_assert_cmpstr (batch.symbol_name, ==, single.symbol_name);
+  }
+
+  for (i = 0; i != names->len; i++)
+  {
+    if (strcmp (g_ptr_array_index (names, i), single.symbol_name) == 0)
+      break;
+  }
+  g_assert_cmpuint (i, !=, names->len);
+
+  g_hash_table_unref (ctx.names_by_address);
+}
+
+#endif
+
 static void GUM_CDECL
 gum_dummy_function_0 (void)
 {
@@ -109,3 +263,34 @@ gum_dummy_function_1 (void)
   g_print ("%s\n", G_STRFUNC);
 }
 
+#ifdef HAVE_LINUX
+
+static gboolean
+find_aliased_export (const GumExportDetails * details,
+                     gpointer user_data)
+{
+  TestAliasContext * ctx = user_data;
+  gpointer key = GSIZE_TO_POINTER (details->address);
+  GPtrArray * names;
+
+  if (details->type != GUM_EXPORT_FUNCTION)
+    return TRUE;
+
+  names = g_hash_table_lookup (ctx->names_by_address, key);
+  if (names == NULL)
+  {
+    names = g_ptr_array_new_with_free_func (g_free);
+    g_hash_table_insert (ctx->names_by_address, key, names);
+  }
+  g_ptr_array_add (names, g_strdup (details->name));
+
+  if (names->len == 2)
+  {
+    ctx->address = details->address;
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+#endif
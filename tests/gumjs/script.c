@@ -55,6 +55,7 @@ TEST_LIST_BEGIN (script)
   SCRIPT_TESTENTRY (function_can_be_replaced)
   SCRIPT_TESTENTRY (function_can_be_replaced_and_called_immediately)
   SCRIPT_TESTENTRY (function_can_be_reverted)
+  SCRIPT_TESTENTRY (interceptor_stats_can_be_queried)
   SCRIPT_TESTENTRY (replaced_function_should_have_invocation_context)
   SCRIPT_TESTENTRY (instructions_can_be_probed)
   SCRIPT_TESTENTRY (interceptor_handles_invalid_arguments)
@@ -121,6 +122,7 @@ TEST_LIST_BEGIN (script)
   SCRIPT_TESTENTRY (memory_can_be_scanned_synchronously)
   SCRIPT_TESTENTRY (memory_scan_should_be_interruptible)
   SCRIPT_TESTENTRY (memory_scan_handles_unreadable_memory)
+  SCRIPT_TESTENTRY (memory_ranges_can_be_scanned)
 #ifdef G_OS_WIN32
   SCRIPT_TESTENTRY (memory_access_can_be_monitored)
 #endif
@@ -3767,6 +3769,36 @@ SCRIPT_TESTCASE (function_can_be_reverted)
   EXPECT_NO_MESSAGES ();
 }
 
+SCRIPT_TESTCASE (interceptor_stats_can_be_queried)
+{
+  COMPILE_AND_LOAD_SCRIPT (
+      "Interceptor.resetStats();"
+      "Interceptor.setProfilingEnabled(true);"
+      "Interceptor.attach(" GUM_PTR_CONST ", {"
+      "  onEnter: function (args) {"
+      "  }"
+      "});"
+      "recv('query', function () {"
+      "  var stats = Interceptor.getStats();"
+      "  Interceptor.setProfilingEnabled(false);"
+      "  send(stats.length);"
+      "  send(stats[0].invocations);"
+      "  send(stats[0].bypassedInvocations);"
+      "  send(stats[0].target instanceof NativePointer);"
+      "});",
+      target_function_int);
+
+  EXPECT_NO_MESSAGES ();
+  target_function_int (7);
+  target_function_int (7);
+  POST_MESSAGE ("{\"type\":\"query\"}");
+  EXPECT_SEND_MESSAGE_WITH ("1");
+  EXPECT_SEND_MESSAGE_WITH ("2");
+  EXPECT_SEND_MESSAGE_WITH ("0");
+  EXPECT_SEND_MESSAGE_WITH ("true");
+  EXPECT_NO_MESSAGES ();
+}
+
 SCRIPT_TESTCASE (replaced_function_should_have_invocation_context)
 {
   COMPILE_AND_LOAD_SCRIPT (
@@ -4027,6 +4059,33 @@ SCRIPT_TESTCASE (memory_scan_handles_unreadable_memory)
   EXPECT_SEND_MESSAGE_WITH ("\"access violation accessing 0x530\"");
 }
 
+SCRIPT_TESTCASE (memory_ranges_can_be_scanned)
+{
+  guint8 haystack[] = {
+    0x01, 0x02, 0x13, 0x37, 0x03, 0x13, 0x37, 0x04,
+    0x05, 0x06, 0x13, 0x37, 0x07, 0x08, 0x09, 0x0a
+  };
+
+  COMPILE_AND_LOAD_SCRIPT (
+      "var haystack = " GUM_PTR_CONST ";"
+      "Memory.scanRanges(["
+        "{ base: haystack.add(8), size: 8 },"
+        "{ base: haystack, size: 8 }"
+      "], '13 37', {"
+        "onMatch: function (address, size) {"
+        "  send('onMatch offset=' + address.sub(haystack).toInt32() +"
+        "      ' size=' + size);"
+        "},"
+        "onComplete: function () {"
+        "  send('onComplete');"
+        "}"
+      "});", haystack);
+  EXPECT_SEND_MESSAGE_WITH ("\"onMatch offset=2 size=2\"");
+  EXPECT_SEND_MESSAGE_WITH ("\"onMatch offset=5 size=2\"");
+  EXPECT_SEND_MESSAGE_WITH ("\"onMatch offset=10 size=2\"");
+  EXPECT_SEND_MESSAGE_WITH ("\"onComplete\"");
+}
+
 #ifdef G_OS_WIN32
 
 SCRIPT_TESTCASE (memory_access_can_be_monitored)
@@ -143,6 +143,7 @@ main (gint argc, gchar * argv[])
   TEST_RUN_LIST (tls);
   TEST_RUN_LIST (cloak);
   TEST_RUN_LIST (memory);
+  TEST_RUN_LIST (code_allocator);
   TEST_RUN_LIST (process);
 #if !defined (HAVE_QNX) && !(defined (HAVE_ANDROID) && defined (HAVE_ARM64))
   TEST_RUN_LIST (symbolutil);
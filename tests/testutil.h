@@ -72,6 +72,42 @@
 # define TRICKY_MODULE_EXPORT SYSTEM_MODULE_EXPORT
 #endif
 
+#if defined (G_OS_WIN32)
+# define GUM_TEST_SHLIB_OS "windows"
+#elif defined (HAVE_MACOS)
+# define GUM_TEST_SHLIB_OS "macos"
+#elif defined (HAVE_LINUX) && !defined (HAVE_ANDROID)
+# define GUM_TEST_SHLIB_OS "linux"
+#elif defined (HAVE_IOS)
+# define GUM_TEST_SHLIB_OS "ios"
+#elif defined (HAVE_ANDROID)
+# define GUM_TEST_SHLIB_OS "android"
+#elif defined (HAVE_QNX)
+# define GUM_TEST_SHLIB_OS "qnx"
+#else
+# error Unknown OS
+#endif
+
+#if defined (HAVE_I386)
+# if GLIB_SIZEOF_VOID_P == 4
+#  define GUM_TEST_SHLIB_ARCH "x86"
+# else
+#  define GUM_TEST_SHLIB_ARCH "x86_64"
+# endif
+#elif defined (HAVE_ARM)
+# define GUM_TEST_SHLIB_ARCH "arm"
+#elif defined (HAVE_ARM64)
+# define GUM_TEST_SHLIB_ARCH "arm64"
+#elif defined (HAVE_MIPS)
+# if G_BYTE_ORDER == G_LITTLE_ENDIAN
+#  define GUM_TEST_SHLIB_ARCH "mipsel"
+# else
+#  define GUM_TEST_SHLIB_ARCH "mips"
+# endif
+#else
+# error Unknown CPU
+#endif
+
 G_BEGIN_DECLS
 
 G_GNUC_INTERNAL void _test_util_init (void);